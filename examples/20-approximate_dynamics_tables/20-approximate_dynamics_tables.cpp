@@ -0,0 +1,98 @@
+/*
+ * Fits approximate dynamics tables for the planar robot of example 11 and the
+ * puma of example 19, and reports their accuracy and the time to update the
+ * model from the tables compared to the exact dynamics.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "Sai2Model.h"
+#include "helper_modules/ApproximateDynamics.h"
+
+using namespace std;
+using namespace Eigen;
+using namespace Sai2Primitives;
+
+const int n_benchmark_iterations = 20000;
+
+// average time of a model update, in microseconds
+template <typename F>
+double timeUpdates(shared_ptr<Sai2Model::Sai2Model> robot,
+				   const MatrixXd& configurations, F update) {
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < n_benchmark_iterations; i++) {
+		robot->setQ(configurations.col(i % configurations.cols()));
+		update();
+	}
+	return chrono::duration<double, micro>(chrono::steady_clock::now() -
+										   start)
+			   .count() /
+		   n_benchmark_iterations;
+}
+
+void fitAndBenchmark(const string& robot_name, const string& robot_file,
+					 const int num_nodes, const int interpolation_order) {
+	auto robot = make_shared<Sai2Model::Sai2Model>(robot_file, false);
+	const string table_file = robot_name + "_dynamics.tbl";
+
+	cout << "\n" << robot_name << " (" << robot->dof() << " dof), "
+		 << num_nodes << " nodes per joint, interpolation order "
+		 << interpolation_order << endl;
+
+	DynamicsTableFitter fitter(robot);
+	fitter.setNumNodes(num_nodes);
+	fitter.setInterpolationOrder(interpolation_order);
+	auto start = chrono::steady_clock::now();
+	DynamicsTableAccuracy accuracy = fitter.fit(table_file);
+	cout << "fitting time: "
+		 << chrono::duration<double>(chrono::steady_clock::now() - start)
+				.count()
+		 << " s" << endl;
+
+	ApproximateDynamicsModel approximate_model(robot, table_file);
+	const DynamicsTable& table = approximate_model.getTable();
+	cout << "mass matrix grid spans " << table.getMassMatrixGrid().num_dims
+		 << " joints, gravity grid spans " << table.getGravityGrid().num_dims
+		 << " joints" << endl;
+	cout << "accuracy on " << accuracy.num_validation_samples
+		 << " random configurations:" << endl;
+	cout << "  mass matrix max error: " << accuracy.mass_matrix_max_error
+		 << " (relative " << accuracy.mass_matrix_max_relative_error << ")"
+		 << endl;
+	cout << "  gravity max error:     " << accuracy.gravity_max_error
+		 << " (relative " << accuracy.gravity_max_relative_error << ")"
+		 << endl;
+
+	// random configurations inside the fitted region
+	const DynamicsTableGrid& grid = table.getGravityGrid();
+	MatrixXd configurations = MatrixXd::Zero(robot->qSize(), 1000);
+	for (int i = 0; i < configurations.cols(); i++) {
+		for (int k = 0; k < grid.num_dims; k++) {
+			const double alpha = 0.5 * (Vector2d::Random()(0) + 1.0);
+			configurations(grid.joint_index[k], i) =
+				grid.lower[k] + alpha * (grid.upper[k] - grid.lower[k]);
+		}
+	}
+
+	const double exact_time = timeUpdates(robot, configurations, [&]() {
+		robot->updateModel();
+		robot->jointGravityVector();
+	});
+	const double table_time = timeUpdates(
+		robot, configurations, [&]() { approximate_model.updateModel(); });
+	cout << "model update with gravity vector: exact " << exact_time
+		 << " us, table " << table_time << " us" << endl;
+}
+
+int main(int argc, char** argv) {
+	Sai2Model::URDF_FOLDERS["EXAMPLE_11_FOLDER"] =
+		string(EXAMPLES_FOLDER) + "/11-planar_robot_controller";
+
+	fitAndBenchmark("rrrrbot", "${EXAMPLE_11_FOLDER}/rrrrbot.urdf", 15, 3);
+	fitAndBenchmark("rrrrbot", "${EXAMPLE_11_FOLDER}/rrrrbot.urdf", 15, 1);
+	fitAndBenchmark("puma", "${SAI2_MODEL_URDF_FOLDER}/puma/puma.urdf", 9, 1);
+
+	return 0;
+}
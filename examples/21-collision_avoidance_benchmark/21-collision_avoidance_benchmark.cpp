@@ -0,0 +1,140 @@
+/*
+ * Times the collision avoidance task on the puma with capsule proxies on its
+ * links and an increasing number of random obstacles around it, while the
+ * robot follows a joint space motion. For comparison, the same distances are
+ * computed by querying all the proxy obstacle pairs without the hierarchy and
+ * without warm start.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "Sai2Model.h"
+#include "tasks/CollisionAvoidanceTask.h"
+
+using namespace std;
+using namespace Eigen;
+using namespace Sai2Primitives;
+
+const string robot_file = "${SAI2_MODEL_URDF_FOLDER}/puma/puma.urdf";
+const int n_cycles = 5000;
+const double control_period = 0.001;
+
+// joint space motion of the robot at a given cycle
+void setRobotState(shared_ptr<Sai2Model::Sai2Model> robot, const int cycle) {
+	const double time = cycle * control_period;
+	VectorXd q = VectorXd::Zero(robot->dof());
+	VectorXd dq = VectorXd::Zero(robot->dof());
+	for (int i = 0; i < robot->dof(); i++) {
+		const double frequency = 0.2 + 0.05 * i;
+		q(i) = 0.8 * sin(2 * M_PI * frequency * time);
+		dq(i) = 0.8 * 2 * M_PI * frequency * cos(2 * M_PI * frequency * time);
+	}
+	robot->setQ(q);
+	robot->setDq(dq);
+	robot->updateModel();
+}
+
+void benchmark(const int num_obstacles) {
+	auto robot = make_shared<Sai2Model::Sai2Model>(robot_file, false);
+	setRobotState(robot, 0);
+
+	auto task = make_shared<CollisionAvoidanceTask>(robot, "collision_avoidance",
+													control_period);
+	const vector<string> proxy_links = {"upper_arm", "lower_arm", "wrist-hand",
+									   "end-effector"};
+	const vector<ConvexShape> proxy_shapes = {
+		ConvexShape::capsule(0.08, 0.2), ConvexShape::capsule(0.06, 0.2),
+		ConvexShape::sphere(0.06),
+		ConvexShape::box(Vector3d(0.03, 0.03, 0.05), 0.01)};
+	const vector<Affine3d> proxy_transforms = {
+		Affine3d(Translation3d(0.2, 0.0, 0.0) *
+				 AngleAxisd(M_PI / 2, Vector3d::UnitY())),
+		Affine3d(Translation3d(0.0, 0.0, 0.2)), Affine3d::Identity(),
+		Affine3d::Identity()};
+	for (int i = 0; i < proxy_links.size(); i++) {
+		task->addLinkProxy(proxy_links[i], proxy_shapes[i],
+						   proxy_transforms[i]);
+	}
+	task->addSelfCollisionPair(0, 3);
+
+	// spheres and boxes around the robot, some of them within its reach
+	mt19937 generator(0);
+	uniform_real_distribution<double> position(-1.5, 1.5);
+	uniform_real_distribution<double> size(0.02, 0.1);
+	vector<ConvexShape> obstacle_shapes;
+	vector<Affine3d> obstacle_poses;
+	while (obstacle_shapes.size() < num_obstacles) {
+		const Vector3d center(position(generator), position(generator),
+							  position(generator));
+		if (center.norm() < 0.5) {
+			continue;
+		}
+		const ConvexShape shape =
+			obstacle_shapes.size() % 2 == 0
+				? ConvexShape::sphere(size(generator))
+				: ConvexShape::box(Vector3d(size(generator), size(generator),
+											size(generator)));
+		const Affine3d pose(Translation3d(center) *
+							AngleAxisd(position(generator), Vector3d::UnitZ()));
+		obstacle_shapes.push_back(shape);
+		obstacle_poses.push_back(pose);
+		task->addObstacle(shape, pose);
+	}
+
+	const MatrixXd N_prec = MatrixXd::Identity(robot->dof(), robot->dof());
+	double total_time = 0;
+	double max_time = 0;
+	double total_queries = 0;
+	int max_active_pairs = 0;
+	for (int cycle = 0; cycle < n_cycles; cycle++) {
+		setRobotState(robot, cycle);
+		auto start = chrono::steady_clock::now();
+		task->updateTaskModel(N_prec);
+		task->computeTorques();
+		const double time =
+			chrono::duration<double, micro>(chrono::steady_clock::now() - start)
+				.count();
+		total_time += time;
+		max_time = max(max_time, time);
+		total_queries += task->getNumDistanceQueries();
+		max_active_pairs =
+			max(max_active_pairs, (int)task->getActivePairs().size());
+	}
+
+	// all the pairs, cold queries
+	double naive_total_time = 0;
+	for (int cycle = 0; cycle < n_cycles; cycle++) {
+		setRobotState(robot, cycle);
+		auto start = chrono::steady_clock::now();
+		for (int j = 0; j < proxy_links.size(); j++) {
+			const Affine3d proxy_pose =
+				robot->transformInWorld(proxy_links[j], proxy_transforms[j]);
+			for (int i = 0; i < num_obstacles; i++) {
+				ConvexDistanceCache cache;
+				computeConvexDistance(proxy_shapes[j], proxy_pose,
+									  obstacle_shapes[i], obstacle_poses[i],
+									  cache);
+			}
+		}
+		naive_total_time +=
+			chrono::duration<double, micro>(chrono::steady_clock::now() - start)
+				.count();
+	}
+
+	cout << num_obstacles << " obstacles: task " << total_time / n_cycles
+		 << " us per cycle (max " << max_time << " us), "
+		 << total_queries / n_cycles << " distance queries per cycle, "
+		 << "up to " << max_active_pairs << " active pairs | all pairs cold "
+		 << naive_total_time / n_cycles << " us per cycle" << endl;
+}
+
+int main(int argc, char** argv) {
+	for (const int num_obstacles : {10, 100, 300, 1000}) {
+		benchmark(num_obstacles);
+	}
+	return 0;
+}
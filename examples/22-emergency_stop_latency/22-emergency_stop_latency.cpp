@@ -0,0 +1,98 @@
+/*
+ * Measures the latency of the emergency stop on the puma: a control thread
+ * runs a robot controller with a cartesian task and a joint task at 1 kHz on
+ * a simple simulation of the robot without gravity (the joint accelerations
+ * produced by the torques are integrated), while another thread triggers
+ * emergency stops at random times and releases them once the robot is at
+ * rest. The latency is
+ * the time between the trigger and the end of the computation of the first
+ * braking torques of all the tasks.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "RobotController.h"
+#include "Sai2Model.h"
+
+using namespace std;
+using namespace Eigen;
+using namespace Sai2Primitives;
+
+const string robot_file = "${SAI2_MODEL_URDF_FOLDER}/puma/puma.urdf";
+const double control_period = 0.001;
+const int n_stops = 50;
+
+int main(int argc, char** argv) {
+	auto robot = make_shared<Sai2Model::Sai2Model>(robot_file, false);
+	robot->updateModel();
+
+	auto motion_force_task = make_shared<MotionForceTask>(
+		robot, "end-effector", Affine3d::Identity(), "cartesian_task",
+		false, control_period);
+	motion_force_task->enableInternalOtgJerkLimited(0.3, 1.0, 5.0, M_PI / 3,
+													M_PI, 3 * M_PI);
+	auto joint_task = make_shared<JointTask>(robot, "joint_task",
+											 control_period);
+	vector<shared_ptr<TemplateTask>> tasks = {motion_force_task, joint_task};
+	auto robot_controller = make_shared<RobotController>(robot, tasks);
+
+	const Vector3d initial_position = motion_force_task->getCurrentPosition();
+	atomic<bool> running(true);
+	atomic<int> num_stops(0);
+
+	// control thread, goals alternating between two points
+	thread control_thread([&]() {
+		auto next_cycle = chrono::steady_clock::now();
+		unsigned long cycle = 0;
+		while (running) {
+			if (cycle % 2000 == 0) {
+				const double side = (cycle / 2000) % 2 == 0 ? 1.0 : -1.0;
+				motion_force_task->setGoalPosition(
+					initial_position + side * Vector3d(0.0, 0.15, 0.1));
+			}
+			robot->updateModel();
+			robot_controller->updateControllerTaskModels();
+			const VectorXd torques = robot_controller->computeControlTorques();
+
+			// integrate the joint accelerations of the commanded torques
+			const VectorXd ddq = robot->MInv() * torques;
+			robot->setDq(robot->dq() + ddq * control_period);
+			robot->setQ(robot->q() + robot->dq() * control_period);
+
+			cycle++;
+			next_cycle += chrono::microseconds(1000);
+			this_thread::sleep_until(next_cycle);
+		}
+	});
+
+	// stop thread
+	mt19937 generator(0);
+	uniform_int_distribution<int> delay_ms(200, 1500);
+	while (num_stops < n_stops) {
+		this_thread::sleep_for(chrono::milliseconds(delay_ms(generator)));
+		robot_controller->triggerEmergencyStop();
+		num_stops++;
+		// let the brake trajectories finish
+		this_thread::sleep_for(chrono::milliseconds(500));
+		robot_controller->releaseEmergencyStop();
+	}
+	running = false;
+	control_thread.join();
+
+	cout << n_stops << " emergency stops, max latency "
+		 << robot_controller->getMaxEmergencyStopLatency() * 1e6
+		 << " us (control period " << control_period * 1e6 << " us), "
+		 << robot_controller->getNumLateEmergencyStops()
+		 << " task stops later than one period" << endl;
+	for (const auto& task : robot_controller->getTasks()) {
+		cout << "  " << task->getTaskName() << ": max latency "
+			 << task->getMaxEmergencyStopLatency() * 1e6 << " us" << endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * Records one minute of 1 kHz telemetry of a robot controller on the puma
+ * (a cartesian task and a joint task, on a simple simulation of the robot
+ * without gravity) in a columnar telemetry file, then exports the same rows as
+ * a CSV file, and compares the size of the two files and the time needed to
+ * load all their columns.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "ColumnarTelemetry.h"
+#include "RobotController.h"
+#include "Sai2Model.h"
+
+using namespace std;
+using namespace Eigen;
+using namespace Sai2Primitives;
+
+const string robot_file = "${SAI2_MODEL_URDF_FOLDER}/puma/puma.urdf";
+const string telemetry_file = "telemetry.sai2tlm";
+const string csv_file = "telemetry.csv";
+const double control_period = 0.001;
+const int n_cycles = 60000;
+
+double fileSize(const string& filename) {
+	ifstream file(filename, ios::binary | ios::ate);
+	return file.tellg() / 1e6;
+}
+
+// writes all the rows of the telemetry file as csv, one value per cell
+void exportCsv(const ColumnarTelemetryReader& reader) {
+	vector<MatrixXd> float64_columns(reader.getNumColumns());
+	vector<Matrix<int64_t, Dynamic, 1>> int64_columns(reader.getNumColumns());
+	vector<Matrix<uint8_t, Dynamic, Dynamic>> dictionary_columns(
+		reader.getNumColumns());
+	vector<vector<string>> dictionaries(reader.getNumColumns());
+	ofstream csv(csv_file);
+	csv << setprecision(17);
+	for (int i = 0; i < reader.getNumColumns(); i++) {
+		switch (reader.getColumnType(i)) {
+			case TELEMETRY_FLOAT64:
+				float64_columns[i] = reader.readFloat64Column(i);
+				break;
+			case TELEMETRY_INT64:
+				int64_columns[i] = reader.readInt64Column(i);
+				break;
+			case TELEMETRY_DICTIONARY:
+				dictionary_columns[i] = reader.readDictionaryColumn(i);
+				dictionaries[i] = reader.getDictionary(i);
+				break;
+		}
+		for (int j = 0; j < reader.getColumnWidth(i); j++) {
+			csv << (i + j == 0 ? "" : ",") << reader.getColumnName(i) << "["
+				<< j << "]";
+		}
+	}
+	csv << "\n";
+	for (uint64_t row = 0; row < reader.getNumRows(); row++) {
+		for (int i = 0; i < reader.getNumColumns(); i++) {
+			for (int j = 0; j < reader.getColumnWidth(i); j++) {
+				csv << (i + j == 0 ? "" : ",");
+				switch (reader.getColumnType(i)) {
+					case TELEMETRY_FLOAT64:
+						csv << float64_columns[i](j, row);
+						break;
+					case TELEMETRY_INT64:
+						csv << int64_columns[i](row);
+						break;
+					case TELEMETRY_DICTIONARY:
+						csv << dictionaries[i][dictionary_columns[i](j, row)];
+						break;
+				}
+			}
+		}
+		csv << "\n";
+	}
+}
+
+int main(int argc, char** argv) {
+	auto robot = make_shared<Sai2Model::Sai2Model>(robot_file, false);
+	robot->updateModel();
+
+	auto motion_force_task = make_shared<MotionForceTask>(
+		robot, "end-effector", Affine3d::Identity(), "cartesian_task",
+		false, control_period);
+	motion_force_task->enableInternalOtgJerkLimited(0.3, 1.0, 5.0, M_PI / 3,
+													M_PI, 3 * M_PI);
+	auto joint_task = make_shared<JointTask>(robot, "joint_task",
+											 control_period);
+	vector<shared_ptr<TemplateTask>> tasks = {motion_force_task, joint_task};
+	auto robot_controller = make_shared<RobotController>(robot, tasks);
+
+	// record, with goals alternating between two points every 2 seconds
+	const Vector3d initial_position = motion_force_task->getCurrentPosition();
+	{
+		ColumnarTelemetryWriter writer(robot_controller, telemetry_file);
+		for (int cycle = 0; cycle < n_cycles; cycle++) {
+			if (cycle % 2000 == 0) {
+				const double side = (cycle / 2000) % 2 == 0 ? 1.0 : -1.0;
+				motion_force_task->setGoalPosition(
+					initial_position + side * Vector3d(0.0, 0.15, 0.1));
+			}
+			robot->updateModel();
+			robot_controller->updateControllerTaskModels();
+			const VectorXd torques = robot_controller->computeControlTorques();
+			writer.capture(torques);
+
+			// integrate the joint accelerations of the commanded torques
+			const VectorXd ddq = robot->MInv() * torques;
+			robot->setDq(robot->dq() + ddq * control_period);
+			robot->setQ(robot->q() + robot->dq() * control_period);
+		}
+		writer.close();
+		cout << n_cycles << " cycles recorded, "
+			 << writer.getNumDroppedCycles() << " dropped" << endl;
+	}
+	{
+		ColumnarTelemetryReader reader(telemetry_file);
+		exportCsv(reader);
+	}
+
+	// load all the columns of the csv file
+	auto start = chrono::steady_clock::now();
+	ifstream csv(csv_file);
+	string line, cell;
+	getline(csv, line);
+	vector<vector<double>> csv_columns(count(line.begin(), line.end(), ',') + 1);
+	while (getline(csv, line)) {
+		stringstream cells(line);
+		for (auto& column : csv_columns) {
+			getline(cells, cell, ',');
+			column.push_back(atof(cell.c_str()));
+		}
+	}
+	const double csv_load_time =
+		chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	// decode all the columns of the telemetry file
+	start = chrono::steady_clock::now();
+	ColumnarTelemetryReader reader(telemetry_file);
+	double checksum = 0;
+	for (int i = 0; i < reader.getNumColumns(); i++) {
+		switch (reader.getColumnType(i)) {
+			case TELEMETRY_FLOAT64:
+				checksum += reader.readFloat64Column(i).sum();
+				break;
+			case TELEMETRY_INT64:
+				checksum += reader.readInt64Column(i).cast<double>().sum();
+				break;
+			case TELEMETRY_DICTIONARY:
+				checksum += reader.readDictionaryColumn(i).cast<double>().sum();
+				break;
+		}
+	}
+	const double columnar_load_time =
+		chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	// reads a single column in place
+	start = chrono::steady_clock::now();
+	const int column = reader.findColumn("cartesian_task/current_position");
+	Vector3d mean_position = Vector3d::Zero();
+	for (uint64_t chunk = 0; chunk < reader.getNumChunks(); chunk++) {
+		const Map<const MatrixXd> positions =
+			reader.mapFloat64Chunk(column, chunk);
+		// a constant chunk holds a single row
+		mean_position += positions.rowwise().sum() *
+						 (positions.cols() == 1
+							  ? reader.getChunk(column, chunk).num_rows
+							  : 1.0);
+	}
+	mean_position /= reader.getNumRows();
+	const double column_read_time =
+		chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << reader.getNumRows() << " rows, " << reader.getNumColumns()
+		 << " columns (" << csv_columns.size() << " values per row)" << endl;
+	cout << "csv: " << fileSize(csv_file) << " MB, all columns loaded in "
+		 << csv_load_time * 1e3 << " ms" << endl;
+	cout << "columnar: " << fileSize(telemetry_file)
+		 << " MB, all columns decoded in " << columnar_load_time * 1e3
+		 << " ms (checksum " << checksum << ")" << endl;
+	cout << "mean end effector position " << mean_position.transpose()
+		 << " read in place in " << column_read_time * 1e3 << " ms" << endl;
+
+	return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Times each dispatched numerical kernel with every instruction set variant
+ * supported by the cpu (selected with NumericalKernels::setInstructionSet),
+ * and the equivalent Eigen expression as a reference, on the sizes used by
+ * the controllers: 7 dof (panda) and 30 dof (humanoid) joint space kernels,
+ * 6x6 operational space inertia, 3d orientation and POPC quantities, and one
+ * block of the batched operational space kernel for 7 dof robots. These
+ * numbers give the sizes up to which the kernels are used without a forced
+ * variant (see NumericalKernels.h).
+ */
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "helper_modules/NumericalKernels.h"
+
+using namespace std;
+using namespace Eigen;
+using namespace Sai2Primitives;
+
+const int n_repetitions = 200000;
+
+// prevents the compiler from optimizing the timed computations away
+volatile double sink = 0;
+
+// average duration of a call in ns
+double timeCall(const function<void()>& call) {
+	for (int i = 0; i < n_repetitions / 10; i++) {
+		call();
+	}
+	const auto start = chrono::steady_clock::now();
+	for (int i = 0; i < n_repetitions; i++) {
+		call();
+	}
+	return chrono::duration<double, nano>(chrono::steady_clock::now() - start)
+			   .count() /
+		   n_repetitions;
+}
+
+struct Benchmark {
+	string name;
+	function<void()> kernel;
+	function<void()> eigen;
+};
+
+// random symmetric positive definite matrix
+MatrixXd randomSpd(const int n) {
+	const MatrixXd A = MatrixXd::Random(n, n);
+	return A * A.transpose() + n * MatrixXd::Identity(n, n);
+}
+
+int main(int argc, char** argv) {
+	vector<Benchmark> benchmarks;
+
+	// joint space kernels
+	for (int dof : {7, 30}) {
+		const string size = " (" + to_string(dof) + " dof)";
+		auto kp = make_shared<VectorXd>(VectorXd::Random(dof));
+		auto kv = make_shared<VectorXd>(VectorXd::Random(dof));
+		auto ki = make_shared<VectorXd>(VectorXd::Random(dof));
+		auto e = make_shared<VectorXd>(VectorXd::Random(dof));
+		auto de = make_shared<VectorXd>(VectorXd::Random(dof));
+		auto ie = make_shared<VectorXd>(VectorXd::Random(dof));
+		auto N = make_shared<MatrixXd>(MatrixXd::Random(dof, dof));
+		auto N_prec = make_shared<MatrixXd>(MatrixXd::Random(dof, dof));
+		auto v = make_shared<VectorXd>(dof);
+		auto m = make_shared<MatrixXd>(dof, dof);
+		benchmarks.push_back(
+			{"applyDiagonalGains" + size,
+			 [=]() {
+				 NumericalKernels::applyDiagonalGains(*kp, *kv, *ki, *e, *de,
+													  *ie, *v);
+				 sink = (*v)(0);
+			 },
+			 [=]() {
+				 v->noalias() = -kp->cwiseProduct(*e) - kv->cwiseProduct(*de) -
+								ki->cwiseProduct(*ie);
+				 sink = (*v)(0);
+			 }});
+		benchmarks.push_back(
+			{"transposedMatrixVectorProduct" + size,
+			 [=]() {
+				 NumericalKernels::transposedMatrixVectorProduct(*N, *e, *v);
+				 sink = (*v)(0);
+			 },
+			 [=]() {
+				 v->noalias() = N->transpose() * *e;
+				 sink = (*v)(0);
+			 }});
+		benchmarks.push_back({"matrixProduct" + size,
+							  [=]() {
+								  NumericalKernels::matrixProduct(*N, *N_prec,
+																  *m);
+								  sink = (*m)(0, 0);
+							  },
+							  [=]() {
+								  m->noalias() = *N * *N_prec;
+								  sink = (*m)(0, 0);
+							  }});
+	}
+
+	// operational space inertia
+	auto lambda_inverse = make_shared<MatrixXd>(randomSpd(6));
+	auto lambda = make_shared<MatrixXd>(6, 6);
+	benchmarks.push_back({"symmetricPositiveDefiniteInverse (6x6)",
+						  [=]() {
+							  NumericalKernels::symmetricPositiveDefiniteInverse(
+								  *lambda_inverse, *lambda);
+							  sink = (*lambda)(0, 0);
+						  },
+						  [=]() {
+							  *lambda = lambda_inverse->inverse();
+							  sink = (*lambda)(0, 0);
+						  }});
+
+	// orientation error
+	const Matrix3d desired_orientation =
+		AngleAxisd(0.3, Vector3d(1, 2, 3).normalized()).toRotationMatrix();
+	const Matrix3d current_orientation =
+		AngleAxisd(-0.2, Vector3d(3, -1, 2).normalized()).toRotationMatrix();
+	benchmarks.push_back(
+		{"orientationError",
+		 [=]() {
+			 sink = NumericalKernels::orientationError(desired_orientation,
+													   current_orientation)(0);
+		 },
+		 [=]() {
+			 Vector3d error = Vector3d::Zero();
+			 for (int i = 0; i < 3; i++) {
+				 error += current_orientation.col(i).cross(
+					 desired_orientation.col(i));
+			 }
+			 sink = -0.5 * error(0);
+		 }});
+
+	// POPC passivity observer power
+	const Vector3d force_error = Vector3d::Random(), vcl = Vector3d::Random(),
+				   command = Vector3d::Random(), vr = Vector3d::Random();
+	benchmarks.push_back(
+		{"passivityObserverPower",
+		 [=]() {
+			 sink = NumericalKernels::passivityObserverPower(force_error, vcl,
+															 command, vr);
+		 },
+		 [=]() { sink = force_error.dot(vcl) - command.dot(vr); }});
+
+	// batched operational space kernel, one block of 7 dof robots (random
+	// well conditioned data)
+	const size_t lanes = NumericalKernels::BATCH_LANES;
+	const size_t dof = 7;
+	vector<vector<double>> batch_data;
+	auto batch = &batch_data;
+	auto addArray = [&](const size_t size) {
+		batch->push_back(vector<double>(size * lanes));
+		VectorXd::Map(batch->back().data(), size * lanes).setRandom();
+		return batch->size() - 1;
+	};
+	const size_t M = addArray(dof * dof), J = addArray(6 * dof),
+				 g = addArray(dof), q = addArray(dof), dq = addArray(dof),
+				 x = addArray(3), R = addArray(9), xd = addArray(3),
+				 Rd = addArray(9), qd = addArray(dof), L = addArray(dof * dof),
+				 X = addArray(dof * 6), LA = addArray(36),
+				 gamma = addArray(dof), tau = addArray(dof);
+	for (size_t l = 0; l < lanes; l++) {
+		const MatrixXd mass_matrix = randomSpd(dof);
+		for (size_t e = 0; e < dof * dof; e++) {
+			(*batch)[M][e * lanes + l] = mass_matrix(e);
+		}
+	}
+	NumericalKernels::BatchedOpSpaceBlock block;
+	block.dof = dof;
+	block.mass_matrix = (*batch)[M].data();
+	block.jacobian = (*batch)[J].data();
+	block.gravity = (*batch)[g].data();
+	block.q = (*batch)[q].data();
+	block.dq = (*batch)[dq].data();
+	block.position = (*batch)[x].data();
+	block.orientation = (*batch)[R].data();
+	block.goal_position = (*batch)[xd].data();
+	block.goal_orientation = (*batch)[Rd].data();
+	block.goal_posture = (*batch)[qd].data();
+	block.mass_matrix_cholesky = (*batch)[L].data();
+	block.mass_inverse_jacobian_t = (*batch)[X].data();
+	block.lambda_inverse_cholesky = (*batch)[LA].data();
+	block.posture_acceleration = (*batch)[gamma].data();
+	block.torques = (*batch)[tau].data();
+	const NumericalKernels::BatchedOpSpaceGains gains = {100, 20, 200,
+														 30,  50, 14};
+	benchmarks.push_back(
+		{"batchedOperationalSpaceTorques (" + to_string(lanes) + " x " +
+			 to_string(dof) + " dof)",
+		 [=]() {
+			 NumericalKernels::batchedOperationalSpaceTorques(block, gains);
+			 sink = block.torques[0];
+		 },
+		 nullptr});
+
+	// table of the average call durations
+	vector<NumericalKernels::InstructionSet> instruction_sets;
+	for (auto instruction_set :
+		 {NumericalKernels::GENERIC, NumericalKernels::AVX2,
+		  NumericalKernels::AVX512}) {
+		try {
+			NumericalKernels::setInstructionSet(instruction_set);
+			instruction_sets.push_back(instruction_set);
+		} catch (const invalid_argument&) {
+			cout << NumericalKernels::instructionSetName(instruction_set)
+				 << " not supported on this cpu" << endl;
+		}
+	}
+	cout << "average duration of a call (ns)" << endl;
+	cout << setw(48) << left << "kernel" << right << setw(10) << "eigen";
+	for (auto instruction_set : instruction_sets) {
+		cout << setw(10)
+			 << NumericalKernels::instructionSetName(instruction_set);
+	}
+	cout << endl << fixed << setprecision(1);
+	for (const auto& benchmark : benchmarks) {
+		cout << setw(48) << left << benchmark.name << right << setw(10);
+		if (benchmark.eigen) {
+			cout << timeCall(benchmark.eigen);
+		} else {
+			cout << "-";
+		}
+		for (auto instruction_set : instruction_sets) {
+			NumericalKernels::setInstructionSet(instruction_set);
+			cout << setw(10) << timeCall(benchmark.kernel);
+		}
+		cout << endl;
+	}
+
+	return 0;
+}
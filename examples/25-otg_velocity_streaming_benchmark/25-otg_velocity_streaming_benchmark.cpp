@@ -0,0 +1,201 @@
+/*
+ * Compares the two ways of streaming velocity goals to the internal trajectory
+ * generators at 1 kHz, for a 7 dof joint space OTG and the 6 dof cartesian
+ * OTG, with jerk limits:
+ * - position streaming: the goal position is rolled forward by the goal
+ * velocity at each cycle and sent with the goal velocity (Ruckig's position
+ * interface, a full profile is solved at each cycle)
+ * - velocity streaming: only the goal velocity is sent (Ruckig's velocity
+ * interface, see enableVelocityStreaming)
+ * Two goal signals are streamed for 20 seconds: a sinusoidal teleoperation
+ * signal, and jogging steps where the goal velocity switches between zero and
+ * a constant velocity every second. For each mode, the cost of update() (mean
+ * and max), the jerk of the output trajectory (max and rms, from the
+ * differences of the output accelerations) and the rms difference between the
+ * output velocity and the goal velocity are reported. The cartesian jerk is
+ * measured along the base frame axes, while the angular limits apply along the
+ * axes of the rotating reference frame of the OTG, so it can exceed the
+ * angular jerk limit by up to sqrt(3). The cartesian goals stay within the
+ * per axis limits in any frame, since the position interface does not scale
+ * them.
+ */
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "helper_modules/OTG_6dof_cartesian.h"
+#include "helper_modules/OTG_joints.h"
+
+using namespace std;
+using namespace Eigen;
+using namespace Sai2Primitives;
+
+const double loop_time = 0.001;
+const int n_cycles = 20000;
+
+struct StreamingStatistics {
+	double mean_update_time;
+	double max_update_time;
+	double max_jerk;
+	double rms_jerk;
+	double rms_velocity_error;
+};
+
+// goal velocity of a signal at time t, with one amplitude per direction
+VectorXd goalVelocity(const string& signal, const VectorXd& amplitude,
+					  const double t) {
+	VectorXd velocity(amplitude.size());
+	for (int i = 0; i < amplitude.size(); i++) {
+		if (signal == "sinusoidal") {
+			velocity(i) = amplitude(i) * sin(2 * M_PI * (0.2 + 0.05 * i) * t);
+		} else {
+			velocity(i) = (int(t) % 2 == 0 ? amplitude(i) : 0.0);
+		}
+	}
+	return velocity;
+}
+
+// streams the goal signal: set_goal is called before each update with the
+// goal velocity, and the output velocity and acceleration are read after it
+StreamingStatistics stream(
+	const string& signal, const VectorXd& amplitude,
+	const function<void(const VectorXd&)>& set_goal,
+	const function<void()>& update, const function<VectorXd()>& velocity,
+	const function<VectorXd()>& acceleration) {
+	StreamingStatistics statistics = {0, 0, 0, 0, 0};
+	VectorXd previous_acceleration = acceleration();
+	for (int cycle = 0; cycle < n_cycles; cycle++) {
+		const VectorXd goal_velocity =
+			goalVelocity(signal, amplitude, cycle * loop_time);
+		const auto start = chrono::steady_clock::now();
+		set_goal(goal_velocity);
+		update();
+		const double update_time =
+			chrono::duration<double, micro>(chrono::steady_clock::now() - start)
+				.count();
+		statistics.mean_update_time += update_time / n_cycles;
+		statistics.max_update_time =
+			max(statistics.max_update_time, update_time);
+
+		const VectorXd next_acceleration = acceleration();
+		const double jerk =
+			((next_acceleration - previous_acceleration) / loop_time)
+				.cwiseAbs()
+				.maxCoeff();
+		previous_acceleration = next_acceleration;
+		statistics.max_jerk = max(statistics.max_jerk, jerk);
+		statistics.rms_jerk += jerk * jerk / n_cycles;
+		statistics.rms_velocity_error +=
+			(velocity() - goal_velocity).squaredNorm() / n_cycles;
+	}
+	statistics.rms_jerk = sqrt(statistics.rms_jerk);
+	statistics.rms_velocity_error = sqrt(statistics.rms_velocity_error);
+	return statistics;
+}
+
+void print(const string& name, const StreamingStatistics& statistics) {
+	cout << setw(44) << left << name << right << fixed << setprecision(2)
+		 << setw(8) << statistics.mean_update_time << setw(9)
+		 << statistics.max_update_time << setprecision(1) << setw(10)
+		 << statistics.max_jerk << setw(10) << statistics.rms_jerk
+		 << setprecision(4) << setw(13) << statistics.rms_velocity_error
+		 << endl;
+}
+
+StreamingStatistics streamJoints(const string& signal,
+								 const bool velocity_streaming) {
+	const int dof = 7;
+	const VectorXd initial_position = VectorXd::Zero(dof);
+	OTG_joints otg(initial_position, loop_time);
+	otg.setMaxVelocity(M_PI / 2);
+	otg.setMaxAcceleration(2 * M_PI);
+	otg.setMaxJerk(20 * M_PI);
+	otg.enableVelocityStreaming(velocity_streaming);
+
+	VectorXd goal_position = initial_position;
+	return stream(
+		signal, VectorXd::Constant(dof, 1.0),
+		[&](const VectorXd& goal_velocity) {
+			if (velocity_streaming) {
+				otg.setGoalVelocity(goal_velocity);
+			} else {
+				goal_position += goal_velocity * loop_time;
+				otg.setGoalPositionAndVelocity(goal_position, goal_velocity);
+			}
+		},
+		[&]() { otg.update(); }, [&]() { return otg.getNextVelocity(); },
+		[&]() { return otg.getNextAcceleration(); });
+}
+
+StreamingStatistics streamCartesian(const string& signal,
+									const bool velocity_streaming) {
+	OTG_6dof_cartesian otg(Vector3d::Zero(), Matrix3d::Identity(), loop_time);
+	otg.setMaxLinearVelocity(0.3);
+	otg.setMaxLinearAcceleration(1.0);
+	otg.setMaxAngularVelocity(M_PI / 3);
+	otg.setMaxAngularAcceleration(M_PI);
+	otg.setMaxJerk(5.0, 3 * M_PI);
+	otg.enableVelocityStreaming(velocity_streaming);
+
+	Vector3d goal_position = Vector3d::Zero();
+	Matrix3d goal_orientation = Matrix3d::Identity();
+	VectorXd amplitude(6);
+	amplitude << 0.2, 0.2, 0.2, 0.5, 0.5, 0.5;
+	return stream(
+		signal, amplitude,
+		[&](const VectorXd& goal_velocity) {
+			const Vector3d linear_velocity = goal_velocity.head<3>();
+			const Vector3d angular_velocity = goal_velocity.tail<3>();
+			if (velocity_streaming) {
+				otg.setGoalLinearVelocity(linear_velocity);
+				otg.setGoalAngularVelocity(angular_velocity);
+			} else {
+				goal_position += linear_velocity * loop_time;
+				if (angular_velocity.norm() > 0) {
+					goal_orientation =
+						AngleAxisd(angular_velocity.norm() * loop_time,
+								   angular_velocity.normalized())
+							.toRotationMatrix() *
+						goal_orientation;
+				}
+				otg.setGoalPositionAndLinearVelocity(goal_position,
+													 linear_velocity);
+				otg.setGoalOrientationAndAngularVelocity(goal_orientation,
+														 angular_velocity);
+			}
+		},
+		[&]() { otg.update(); },
+		[&]() {
+			VectorXd velocity(6);
+			velocity << otg.getNextLinearVelocity(),
+				otg.getNextAngularVelocity();
+			return velocity;
+		},
+		[&]() {
+			VectorXd acceleration(6);
+			acceleration << otg.getNextLinearAcceleration(),
+				otg.getNextAngularAcceleration();
+			return acceleration;
+		});
+}
+
+int main(int argc, char** argv) {
+	cout << n_cycles << " cycles at " << 1 / loop_time << " Hz" << endl;
+	cout << setw(44) << left << "" << right << setw(8) << "mean us" << setw(9)
+		 << "max us" << setw(10) << "max jerk" << setw(10) << "rms jerk"
+		 << setw(13) << "rms vel err" << endl;
+	for (const string signal : {"sinusoidal", "jogging"}) {
+		for (const bool velocity_streaming : {false, true}) {
+			const string mode =
+				velocity_streaming ? "velocity streaming" : "position streaming";
+			print("joints, " + signal + ", " + mode,
+				  streamJoints(signal, velocity_streaming));
+			print("cartesian, " + signal + ", " + mode,
+				  streamCartesian(signal, velocity_streaming));
+		}
+	}
+	return 0;
+}
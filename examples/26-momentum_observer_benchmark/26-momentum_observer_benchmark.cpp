@@ -0,0 +1,168 @@
+/*
+ * Compares the sensorless estimation of the external force with a momentum
+ * observer to a force sensor, on the panda simulated at 1 kHz (the joint
+ * accelerations produced by the torques, the coriolis and gravity torques and
+ * the external torques are integrated). The end effector moves between two
+ * points every second with a motion force task, and an external force of 10 N
+ * pushes it down between 1.5 s and 3 s. The force sensor is ideal but its
+ * readings arrive a few cycles late. For the sensor and for several observer
+ * gains, the cost of the sensing at each cycle (mean and max), the time for
+ * the sensed force to reach 63% of the force step (the time constant of a
+ * first order filter), the rms error of the sensed force and its max error
+ * during the free motion before the force step are reported. The sensed force
+ * does not enter the control torques, so the robot follows the same trajectory
+ * in all runs.
+ */
+
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "RobotController.h"
+#include "Sai2Model.h"
+#include "helper_modules/MomentumObserver.h"
+
+using namespace std;
+using namespace Eigen;
+using namespace Sai2Primitives;
+
+const string robot_file =
+	"${SAI2_MODEL_URDF_FOLDER}/panda/panda_arm_sphere.urdf";
+const string link_name = "end-effector";
+const double loop_time = 0.001;
+const int n_cycles = 4000;
+const int sensor_delay_cycles = 2;
+const double force_on_time = 1.5;
+const double force_off_time = 3.0;
+const Vector3d external_force = Vector3d(0.0, 0.0, -10.0);
+
+struct SensingStatistics {
+	double mean_sensing_time;
+	double max_sensing_time;
+	double rise_time;
+	double rms_error;
+	double max_free_motion_error;
+};
+
+// runs the scenario with the force sensor if observer_gain is zero, and with
+// a momentum observer of that gain otherwise
+SensingStatistics run(const double observer_gain) {
+	auto robot = make_shared<Sai2Model::Sai2Model>(robot_file, false);
+	VectorXd initial_q = VectorXd::Zero(robot->dof());
+	initial_q.head(7) << 0.0, -0.4, 0.0, -2.0, 0.0, 1.6, 0.8;
+	robot->setQ(initial_q);
+	robot->updateModel();
+
+	auto motion_force_task = make_shared<MotionForceTask>(
+		robot, link_name, Affine3d::Identity(), "cartesian_task", false,
+		loop_time);
+	auto joint_task = make_shared<JointTask>(robot, "joint_task", loop_time);
+	vector<shared_ptr<TemplateTask>> tasks = {motion_force_task, joint_task};
+	RobotController robot_controller(robot, tasks);
+	robot_controller.enableGravityCompensation(true);
+
+	MomentumObserver observer(robot, loop_time);
+	if (observer_gain > 0) {
+		observer.setObserverGain(observer_gain);
+	}
+
+	const Vector3d initial_position = motion_force_task->getCurrentPosition();
+	// force applied by the robot on the environment in sensor frame, as
+	// given by the sensor at each cycle
+	deque<Vector3d> sensor_readings(sensor_delay_cycles + 1, Vector3d::Zero());
+	VectorXd torques = VectorXd::Zero(robot->dof());
+
+	SensingStatistics statistics = {0, 0, -1, 0, 0};
+	for (int cycle = 0; cycle < n_cycles; cycle++) {
+		const double time = cycle * loop_time;
+		if (cycle % 1000 == 0) {
+			const double side = (cycle / 1000) % 2 == 0 ? 1.0 : -1.0;
+			motion_force_task->setGoalPosition(initial_position +
+											   side * Vector3d(0.0, 0.1, 0.05));
+		}
+		const bool force_applied =
+			time >= force_on_time && time < force_off_time;
+		const Vector3d force = force_applied ? external_force : Vector3d::Zero();
+
+		robot->updateModel();
+		sensor_readings.push_back(-robot->rotationInWorld(link_name).transpose() *
+								  force);
+		sensor_readings.pop_front();
+
+		// sensing, with the torques applied during the previous cycle for the
+		// observer
+		const auto start = chrono::steady_clock::now();
+		if (observer_gain > 0) {
+			observer.update(torques);
+			motion_force_task->updateSensedForceAndMomentFromObserver(observer);
+		} else {
+			motion_force_task->updateSensedForceAndMoment(
+				sensor_readings.front(), Vector3d::Zero());
+		}
+		const double sensing_time =
+			chrono::duration<double, micro>(chrono::steady_clock::now() - start)
+				.count();
+		statistics.mean_sensing_time += sensing_time / n_cycles;
+		statistics.max_sensing_time =
+			max(statistics.max_sensing_time, sensing_time);
+
+		// the sensed force is the force applied by the robot on the
+		// environment
+		const Vector3d sensed_force =
+			motion_force_task->getSensedForceControlWorldFrame();
+		const double error = (sensed_force + force).norm();
+		statistics.rms_error += error * error / n_cycles;
+		if (time > 0.1 && time < force_on_time) {
+			statistics.max_free_motion_error =
+				max(statistics.max_free_motion_error, error);
+		}
+		if (force_applied && statistics.rise_time < 0 &&
+			-sensed_force.dot(external_force) >=
+				(1.0 - exp(-1.0)) * external_force.squaredNorm()) {
+			statistics.rise_time = time - force_on_time;
+		}
+
+		robot_controller.updateControllerTaskModels();
+		torques = robot_controller.computeControlTorques();
+
+		// simulation step
+		const VectorXd external_torques =
+			robot->JWorldFrame(link_name).topRows(3).transpose() * force;
+		const VectorXd ddq =
+			robot->MInv() * (torques + external_torques -
+							 robot->coriolisForce() -
+							 robot->jointGravityVector());
+		robot->setDq(robot->dq() + ddq * loop_time);
+		robot->setQ(robot->q() + robot->dq() * loop_time);
+	}
+	statistics.rms_error = sqrt(statistics.rms_error);
+	return statistics;
+}
+
+void print(const string& name, const SensingStatistics& statistics) {
+	cout << setw(28) << left << name << right << fixed << setprecision(2)
+		 << setw(8) << statistics.mean_sensing_time << setw(9)
+		 << statistics.max_sensing_time << setprecision(1) << setw(11)
+		 << 1000 * statistics.rise_time << setprecision(3) << setw(12)
+		 << statistics.rms_error << setw(15) << statistics.max_free_motion_error
+		 << endl;
+}
+
+int main(int argc, char** argv) {
+	cout << n_cycles << " cycles at " << 1 / loop_time << " Hz, force step of "
+		 << external_force.norm() << " N" << endl;
+	cout << setw(28) << left << "" << right << setw(8) << "mean us" << setw(9)
+		 << "max us" << setw(11) << "rise ms" << setw(12) << "rms err N"
+		 << setw(15) << "max free err N" << endl;
+	print("sensor, " + to_string(sensor_delay_cycles) + " cycles delay",
+		  run(0.0));
+	for (const double observer_gain : {50.0, 100.0, 200.0, 400.0}) {
+		ostringstream name;
+		name << "observer, " << observer_gain << " rad/s";
+		print(name.str(), run(observer_gain));
+	}
+	return 0;
+}
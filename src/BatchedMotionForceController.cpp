@@ -0,0 +1,275 @@
+#include "BatchedMotionForceController.h"
+
+#include <chrono>
+#include <stdexcept>
+
+using namespace Eigen;
+using namespace std;
+
+namespace Sai2Primitives {
+
+namespace {
+constexpr size_t LANES = NumericalKernels::BATCH_LANES;
+}
+
+BatchedMotionForceController::BatchedMotionForceController(
+	std::shared_ptr<Sai2Model::Sai2Model>& robot, const std::string& link_name,
+	const Affine3d& compliant_frame, const int num_instances)
+	: _robot(robot),
+	  _link_name(link_name),
+	  _compliant_frame(compliant_frame),
+	  _dof(robot->dof()),
+	  _num_instances(num_instances),
+	  _measured_compute_time(0.0),
+	  _measured_robot_steps(0) {
+	if (num_instances <= 0) {
+		throw std::invalid_argument(
+			"number of instances must be strictly positive in "
+			"BatchedMotionForceController::BatchedMotionForceController\n");
+	}
+	if (_dof < 6) {
+		throw std::invalid_argument(
+			"robot must have at least 6 dof in "
+			"BatchedMotionForceController::BatchedMotionForceController\n");
+	}
+	_num_blocks = (_num_instances + LANES - 1) / LANES;
+
+	const size_t n = _dof;
+	size_t offset = 0;
+	auto allocate = [&offset](const size_t size) {
+		const size_t start = offset;
+		offset += size;
+		return start;
+	};
+	_layout.mass_matrix = allocate(n * n);
+	_layout.jacobian = allocate(6 * n);
+	_layout.gravity = allocate(n);
+	_layout.q = allocate(n);
+	_layout.dq = allocate(n);
+	_layout.position = allocate(3);
+	_layout.orientation = allocate(9);
+	_layout.goal_position = allocate(3);
+	_layout.goal_orientation = allocate(9);
+	_layout.goal_posture = allocate(n);
+	_layout.mass_matrix_cholesky = allocate(n * n);
+	_layout.mass_inverse_jacobian_t = allocate(6 * n);
+	_layout.lambda_inverse_cholesky = allocate(36);
+	_layout.posture_acceleration = allocate(n);
+	_layout.torques = allocate(n);
+	_layout.size = offset;
+
+	_data.assign(_num_blocks * _layout.size * LANES, 0.0);
+
+	// every lane, including the padding lanes of the last block, starts with a
+	// well conditioned state so that the kernel never factorizes a singular
+	// matrix
+	const MatrixXd M_init = MatrixXd::Identity(n, n);
+	const MatrixXd J_init = MatrixXd::Identity(6, n);
+	const Matrix3d R_init = Matrix3d::Identity();
+	for (int i = 0; i < _num_blocks * static_cast<int>(LANES); i++) {
+		setElements(i, _layout.mass_matrix, M_init.data(), n * n);
+		setElements(i, _layout.jacobian, J_init.data(), 6 * n);
+		setElements(i, _layout.orientation, R_init.data(), 9);
+		setElements(i, _layout.goal_orientation, R_init.data(), 9);
+	}
+
+	_gains.kp_pos = 100.0;
+	_gains.kv_pos = 20.0;
+	_gains.kp_ori = 100.0;
+	_gains.kv_ori = 20.0;
+	_gains.kp_joint = 50.0;
+	_gains.kv_joint = 14.0;
+}
+
+void BatchedMotionForceController::setInstanceStateFromModel(
+	const int instance, Sai2Model::Sai2Model& model) {
+	if (model.dof() != _dof) {
+		throw std::invalid_argument(
+			"model dof not consistent with the controller in "
+			"BatchedMotionForceController::setInstanceStateFromModel\n");
+	}
+	const MatrixXd J = model.JWorldFrame(_link_name,
+										 _compliant_frame.translation());
+	const Vector3d position =
+		model.positionInWorld(_link_name, _compliant_frame.translation());
+	const Matrix3d orientation =
+		model.rotationInWorld(_link_name, _compliant_frame.linear());
+	setInstanceState(instance, model.M(), model.jointGravityVector(), J,
+					 position, orientation, model.q(), model.dq());
+}
+
+void BatchedMotionForceController::setInstanceState(
+	const int instance, const MatrixXd& M, const VectorXd& gravity,
+	const MatrixXd& J, const Vector3d& position, const Matrix3d& orientation,
+	const VectorXd& q, const VectorXd& dq) {
+	checkInstance(instance, "setInstanceState");
+	if (M.rows() != _dof || M.cols() != _dof || gravity.size() != _dof ||
+		J.rows() != 6 || J.cols() != _dof || q.size() != _dof ||
+		dq.size() != _dof) {
+		throw std::invalid_argument(
+			"state sizes not consistent with the robot dof in "
+			"BatchedMotionForceController::setInstanceState\n");
+	}
+	setElements(instance, _layout.mass_matrix, M.data(), _dof * _dof);
+	setElements(instance, _layout.jacobian, J.data(), 6 * _dof);
+	setElements(instance, _layout.gravity, gravity.data(), _dof);
+	setElements(instance, _layout.q, q.data(), _dof);
+	setElements(instance, _layout.dq, dq.data(), _dof);
+	setElements(instance, _layout.position, position.data(), 3);
+	setElements(instance, _layout.orientation, orientation.data(), 9);
+}
+
+void BatchedMotionForceController::setGoalPosition(
+	const int instance, const Vector3d& goal_position) {
+	checkInstance(instance, "setGoalPosition");
+	setElements(instance, _layout.goal_position, goal_position.data(), 3);
+}
+
+void BatchedMotionForceController::setGoalOrientation(
+	const int instance, const Matrix3d& goal_orientation) {
+	checkInstance(instance, "setGoalOrientation");
+	setElements(instance, _layout.goal_orientation, goal_orientation.data(),
+				9);
+}
+
+void BatchedMotionForceController::setGoalPosture(
+	const int instance, const VectorXd& goal_posture) {
+	checkInstance(instance, "setGoalPosture");
+	if (goal_posture.size() != _dof) {
+		throw std::invalid_argument(
+			"goal posture size not consistent with the robot dof in "
+			"BatchedMotionForceController::setGoalPosture\n");
+	}
+	setElements(instance, _layout.goal_posture, goal_posture.data(), _dof);
+}
+
+void BatchedMotionForceController::setPosControlGains(const double kp_pos,
+													   const double kv_pos) {
+	if (kp_pos < 0 || kv_pos < 0) {
+		throw std::invalid_argument(
+			"gains cannot be negative in "
+			"BatchedMotionForceController::setPosControlGains\n");
+	}
+	_gains.kp_pos = kp_pos;
+	_gains.kv_pos = kv_pos;
+}
+
+void BatchedMotionForceController::setOriControlGains(const double kp_ori,
+													   const double kv_ori) {
+	if (kp_ori < 0 || kv_ori < 0) {
+		throw std::invalid_argument(
+			"gains cannot be negative in "
+			"BatchedMotionForceController::setOriControlGains\n");
+	}
+	_gains.kp_ori = kp_ori;
+	_gains.kv_ori = kv_ori;
+}
+
+void BatchedMotionForceController::setPostureControlGains(
+	const double kp_joint, const double kv_joint) {
+	if (kp_joint < 0 || kv_joint < 0) {
+		throw std::invalid_argument(
+			"gains cannot be negative in "
+			"BatchedMotionForceController::setPostureControlGains\n");
+	}
+	_gains.kp_joint = kp_joint;
+	_gains.kv_joint = kv_joint;
+}
+
+void BatchedMotionForceController::computeTorques() {
+	const auto start = chrono::steady_clock::now();
+
+	NumericalKernels::BatchedOpSpaceBlock block;
+	block.dof = _dof;
+	for (int b = 0; b < _num_blocks; b++) {
+		block.mass_matrix = blockData(b, _layout.mass_matrix);
+		block.jacobian = blockData(b, _layout.jacobian);
+		block.gravity = blockData(b, _layout.gravity);
+		block.q = blockData(b, _layout.q);
+		block.dq = blockData(b, _layout.dq);
+		block.position = blockData(b, _layout.position);
+		block.orientation = blockData(b, _layout.orientation);
+		block.goal_position = blockData(b, _layout.goal_position);
+		block.goal_orientation = blockData(b, _layout.goal_orientation);
+		block.goal_posture = blockData(b, _layout.goal_posture);
+		block.mass_matrix_cholesky = blockData(b, _layout.mass_matrix_cholesky);
+		block.mass_inverse_jacobian_t =
+			blockData(b, _layout.mass_inverse_jacobian_t);
+		block.lambda_inverse_cholesky =
+			blockData(b, _layout.lambda_inverse_cholesky);
+		block.posture_acceleration = blockData(b, _layout.posture_acceleration);
+		block.torques = blockData(b, _layout.torques);
+		NumericalKernels::batchedOperationalSpaceTorques(block, _gains);
+	}
+
+	_measured_compute_time +=
+		chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	_measured_robot_steps += _num_instances;
+}
+
+void BatchedMotionForceController::getTorques(const int instance,
+											  VectorXd& torques) const {
+	checkInstance(instance, "getTorques");
+	torques.resize(_dof);
+	getElements(instance, _layout.torques, torques.data(), _dof);
+}
+
+VectorXd BatchedMotionForceController::getTorques(const int instance) const {
+	VectorXd torques;
+	getTorques(instance, torques);
+	return torques;
+}
+
+double BatchedMotionForceController::getRobotStepsPerSecond() const {
+	if (_measured_compute_time <= 0.0) {
+		return 0.0;
+	}
+	return _measured_robot_steps / _measured_compute_time;
+}
+
+void BatchedMotionForceController::resetThroughputMeasurement() {
+	_measured_compute_time = 0.0;
+	_measured_robot_steps = 0;
+}
+
+void BatchedMotionForceController::checkInstance(
+	const int instance, const std::string& function) const {
+	if (instance < 0 || instance >= _num_instances) {
+		throw std::invalid_argument("instance " + std::to_string(instance) +
+									" out of range in "
+									"BatchedMotionForceController::" +
+									function + "\n");
+	}
+}
+
+double* BatchedMotionForceController::blockData(const int block,
+												const size_t offset) {
+	return _data.data() + (block * _layout.size + offset) * LANES;
+}
+
+const double* BatchedMotionForceController::blockData(
+	const int block, const size_t offset) const {
+	return _data.data() + (block * _layout.size + offset) * LANES;
+}
+
+void BatchedMotionForceController::setElements(const int instance,
+											   const size_t offset,
+											   const double* values,
+											   const size_t size) {
+	double* data = blockData(instance / LANES, offset) + instance % LANES;
+	for (size_t e = 0; e < size; e++) {
+		data[e * LANES] = values[e];
+	}
+}
+
+void BatchedMotionForceController::getElements(const int instance,
+											   const size_t offset,
+											   double* values,
+											   const size_t size) const {
+	const double* data = blockData(instance / LANES, offset) + instance % LANES;
+	for (size_t e = 0; e < size; e++) {
+		values[e] = data[e * LANES];
+	}
+}
+
+} /* namespace Sai2Primitives */
@@ -0,0 +1,165 @@
+/**
+ * BatchedMotionForceController.h
+ *
+ *	A controller that steps many instances of the same control structure on
+ * the same robot model (fleet simulation, reinforcement learning): a 6 dof
+ * motion task at a link with full dynamic decoupling, and a joint posture task
+ * in its dynamically consistent nullspace. The instances are stored in blocks
+ * of NumericalKernels::BATCH_LANES robots (array of structs of arrays), and
+ * each block is evaluated with one kernel call that processes its robots in
+ * SIMD lanes. The singularity handling, force control and trajectory
+ * generation of MotionForceTask are not available in the batched version.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_BATCHED_MOTION_FORCE_CONTROLLER_H_
+#define SAI2_PRIMITIVES_BATCHED_MOTION_FORCE_CONTROLLER_H_
+
+#include <Eigen/Dense>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Sai2Model.h"
+#include "helper_modules/NumericalKernels.h"
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+class BatchedMotionForceController {
+public:
+	/**
+	 * @brief      Constructor. All the instances start with an identity mass
+	 * matrix and a zero state, and their goals are to be set before computing
+	 * torques.
+	 *
+	 * @param      robot             The robot model shared by all the
+	 *                               instances, only used to get the dof and by
+	 *                               setInstanceStateFromModel
+	 * @param[in]  link_name         The link of the motion task
+	 * @param[in]  compliant_frame   The control frame in link frame
+	 * @param[in]  num_instances     The number of instances
+	 */
+	BatchedMotionForceController(
+		std::shared_ptr<Sai2Model::Sai2Model>& robot,
+		const std::string& link_name, const Affine3d& compliant_frame,
+		const int num_instances);
+
+	/**
+	 * @brief      Sets the state of one instance from a robot model whose
+	 * kinematics and dynamics are up to date
+	 *
+	 * @param[in]  instance  The instance index
+	 * @param[in]  model     The model of this instance
+	 */
+	void setInstanceStateFromModel(const int instance,
+								   Sai2Model::Sai2Model& model);
+
+	/**
+	 * @brief      Sets the state of one instance directly
+	 *
+	 * @param[in]  instance     The instance index
+	 * @param[in]  M            The mass matrix
+	 * @param[in]  gravity      The joint gravity vector
+	 * @param[in]  J            The 6 x dof jacobian of the control frame in
+	 *                          world frame, linear part first
+	 * @param[in]  position     The position of the control frame
+	 * @param[in]  orientation  The orientation of the control frame
+	 * @param[in]  q            The joint positions
+	 * @param[in]  dq           The joint velocities
+	 */
+	void setInstanceState(const int instance, const MatrixXd& M,
+						  const VectorXd& gravity, const MatrixXd& J,
+						  const Vector3d& position,
+						  const Matrix3d& orientation, const VectorXd& q,
+						  const VectorXd& dq);
+
+	void setGoalPosition(const int instance, const Vector3d& goal_position);
+	void setGoalOrientation(const int instance,
+							const Matrix3d& goal_orientation);
+	void setGoalPosture(const int instance, const VectorXd& goal_posture);
+
+	void setPosControlGains(const double kp_pos, const double kv_pos);
+	void setOriControlGains(const double kp_ori, const double kv_ori);
+	void setPostureControlGains(const double kp_joint, const double kv_joint);
+
+	/**
+	 * @brief      Computes the control torques of all the instances
+	 */
+	void computeTorques();
+
+	/**
+	 * @brief      Gets the control torques of one instance computed in the last
+	 * call to computeTorques
+	 *
+	 * @param[in]  instance  The instance index
+	 * @param      torques   The torques (resized if needed)
+	 */
+	void getTorques(const int instance, VectorXd& torques) const;
+	VectorXd getTorques(const int instance) const;
+
+	int getNumInstances() const { return _num_instances; }
+	int getDof() const { return _dof; }
+
+	/**
+	 * @brief      Throughput of computeTorques since construction or the last
+	 * call to resetThroughputMeasurement, in robot-steps per second
+	 */
+	double getRobotStepsPerSecond() const;
+	void resetThroughputMeasurement();
+
+private:
+	// offsets (in elements) of the quantities in a block
+	struct BlockLayout {
+		size_t mass_matrix;
+		size_t jacobian;
+		size_t gravity;
+		size_t q;
+		size_t dq;
+		size_t position;
+		size_t orientation;
+		size_t goal_position;
+		size_t goal_orientation;
+		size_t goal_posture;
+		size_t mass_matrix_cholesky;
+		size_t mass_inverse_jacobian_t;
+		size_t lambda_inverse_cholesky;
+		size_t posture_acceleration;
+		size_t torques;
+		size_t size;
+	};
+
+	void checkInstance(const int instance, const std::string& function) const;
+
+	// pointer to the lanes of element 0 of a quantity in a block
+	double* blockData(const int block, const size_t offset);
+	const double* blockData(const int block, const size_t offset) const;
+
+	// scatters/gathers a column major matrix of one instance
+	void setElements(const int instance, const size_t offset,
+					 const double* values, const size_t size);
+	void getElements(const int instance, const size_t offset, double* values,
+					 const size_t size) const;
+
+	std::shared_ptr<Sai2Model::Sai2Model> _robot;
+	std::string _link_name;
+	Affine3d _compliant_frame;
+
+	int _dof;
+	int _num_instances;
+	int _num_blocks;
+
+	BlockLayout _layout;
+	std::vector<double, Eigen::aligned_allocator<double>> _data;
+
+	NumericalKernels::BatchedOpSpaceGains _gains;
+
+	double _measured_compute_time;
+	unsigned long _measured_robot_steps;
+};
+
+} /* namespace Sai2Primitives */
+
+#endif /* SAI2_PRIMITIVES_BATCHED_MOTION_FORCE_CONTROLLER_H_ */
@@ -0,0 +1,835 @@
+#include "ColumnarTelemetry.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace Sai2Primitives {
+
+namespace {
+const char TELEMETRY_FILE_MAGIC[8] = {'S', 'A', 'I', '2', 'T', 'L', 'M', '\0'};
+const char TELEMETRY_CHUNK_MAGIC[8] = {'S', 'A', 'I', '2', 'C', 'H', 'N', 'K'};
+const uint32_t TELEMETRY_FILE_VERSION = 2;
+const uint64_t TELEMETRY_BUFFER_ALIGNMENT = 64;
+const int SINGULARITY_TYPES_WIDTH = 6;
+const std::vector<std::string> SINGULARITY_TYPE_NAMES = {
+	"NO_SINGULARITY", "TYPE_1_SINGULARITY", "TYPE_2_SINGULARITY"};
+
+// whether the num_rows rows of row_size bytes starting at data are all equal
+// (bitwise, so that a constant chunk decodes to the exact recorded values)
+bool rowsAreEqual(const uint8_t* data, const uint64_t num_rows,
+				  const size_t row_size) {
+	for (uint64_t row = 1; row < num_rows; row++) {
+		if (std::memcmp(data, data + row * row_size, row_size) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// next buffer boundary at or after offset
+uint64_t alignedOffset(const uint64_t offset) {
+	return (offset + TELEMETRY_BUFFER_ALIGNMENT - 1) /
+		   TELEMETRY_BUFFER_ALIGNMENT * TELEMETRY_BUFFER_ALIGNMENT;
+}
+
+void appendVarint(uint64_t value, std::vector<uint8_t>& buffer) {
+	while (value >= 0x80) {
+		buffer.push_back(static_cast<uint8_t>(value) | 0x80);
+		value >>= 7;
+	}
+	buffer.push_back(static_cast<uint8_t>(value));
+}
+
+// copies the rows of a PLAIN or CONSTANT buffer
+void copyRows(const TelemetryChunkEntry& entry, const uint8_t* data,
+			  const size_t row_size, uint8_t* output) {
+	if (entry.encoding == TELEMETRY_PLAIN) {
+		std::memcpy(output, data, entry.num_rows * row_size);
+		return;
+	}
+	for (uint64_t row = 0; row < entry.num_rows; row++) {
+		std::memcpy(output + row * row_size, data, row_size);
+	}
+}
+
+// size of a buffer of a column with the given encoding, 0 if the encoding is
+// not valid for the column type (the size of DELTA buffers depends on their
+// content, only the first value is required)
+uint64_t expectedBufferSize(const TelemetryColumnDescriptor& column,
+							const TelemetryChunkEntry& entry) {
+	const uint64_t value_size =
+		column.type == TELEMETRY_DICTIONARY ? sizeof(uint8_t) : sizeof(double);
+	switch (entry.encoding) {
+		case TELEMETRY_PLAIN:
+			return column.type == TELEMETRY_INT64
+					   ? 0
+					   : entry.num_rows * column.width * value_size;
+		case TELEMETRY_CONSTANT:
+			return column.width * value_size;
+		case TELEMETRY_DELTA:
+			return column.type == TELEMETRY_INT64 ? sizeof(int64_t) : 0;
+		default:
+			return 0;
+	}
+}
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+// ColumnarTelemetryWriter
+////////////////////////////////////////////////////////////////////////////////
+
+ColumnarTelemetryWriter::ColumnarTelemetryWriter(
+	std::shared_ptr<RobotController> controller, const std::string& filename,
+	BackgroundExecutor& executor, const int snapshot_capacity,
+	const int chunk_rows)
+	: _controller(controller),
+	  _num_float64_values(0),
+	  _num_int64_values(0),
+	  _num_dictionary_codes(0),
+	  _snapshots(executor,
+				 [this](const CycleSnapshot& snapshot) { appendRow(snapshot); }),
+	  _closed(false),
+	  _cycle(0),
+	  _chunk_rows(chunk_rows),
+	  _num_chunk_rows(0),
+	  _file_offset(0) {
+	if (snapshot_capacity <= 0 || chunk_rows <= 0) {
+		throw std::invalid_argument(
+			"snapshot capacity and chunk rows should be strictly positive in "
+			"ColumnarTelemetryWriter::ColumnarTelemetryWriter\n");
+	}
+
+	addColumn("cycle", TELEMETRY_INT64, 1);
+	addColumn("timestamp_ns", TELEMETRY_INT64, 1);
+	_dof = _controller->getRedundancyCompletionTask()
+			   ->getConstRobotModel()
+			   ->dof();
+	_control_torques = addColumn("control_torques", TELEMETRY_FLOAT64, _dof);
+
+	std::vector<std::shared_ptr<JointTask>> joint_tasks;
+	for (const auto& task : _controller->getTasks()) {
+		switch (task->getTaskType()) {
+			case JOINT_TASK:
+				joint_tasks.push_back(
+					std::dynamic_pointer_cast<JointTask>(task));
+				break;
+			case MOTION_FORCE_TASK: {
+				MotionForceTaskColumns columns;
+				columns.task = std::dynamic_pointer_cast<MotionForceTask>(task);
+				const std::string prefix = task->getTaskName() + "/";
+				columns.desired_position = addColumn(
+					prefix + "desired_position", TELEMETRY_FLOAT64, 3);
+				columns.current_position = addColumn(
+					prefix + "current_position", TELEMETRY_FLOAT64, 3);
+				columns.desired_orientation = addColumn(
+					prefix + "desired_orientation", TELEMETRY_FLOAT64, 4);
+				columns.current_orientation = addColumn(
+					prefix + "current_orientation", TELEMETRY_FLOAT64, 4);
+				columns.desired_linear_velocity = addColumn(
+					prefix + "desired_linear_velocity", TELEMETRY_FLOAT64, 3);
+				columns.current_linear_velocity = addColumn(
+					prefix + "current_linear_velocity", TELEMETRY_FLOAT64, 3);
+				columns.unit_mass_force = addColumn(
+					prefix + "unit_mass_force", TELEMETRY_FLOAT64, 6);
+				columns.sensed_force =
+					addColumn(prefix + "sensed_force", TELEMETRY_FLOAT64, 3);
+				columns.sensed_moment =
+					addColumn(prefix + "sensed_moment", TELEMETRY_FLOAT64, 3);
+				columns.goal_force =
+					addColumn(prefix + "goal_force", TELEMETRY_FLOAT64, 3);
+				columns.goal_moment =
+					addColumn(prefix + "goal_moment", TELEMETRY_FLOAT64, 3);
+				columns.singularity_types = addColumn(
+					prefix + "singularity_types", TELEMETRY_DICTIONARY,
+					SINGULARITY_TYPES_WIDTH, SINGULARITY_TYPE_NAMES);
+				_motion_force_tasks.push_back(columns);
+				break;
+			}
+			default:
+				// not recorded
+				break;
+		}
+	}
+	joint_tasks.push_back(_controller->getRedundancyCompletionTask());
+	for (const auto& task : joint_tasks) {
+		JointTaskColumns columns;
+		columns.task = task;
+		const std::string prefix = task->getTaskName() + "/";
+		const int task_dof = task->getDesiredPosition().size();
+		columns.desired_position =
+			addColumn(prefix + "desired_position", TELEMETRY_FLOAT64, task_dof);
+		columns.current_position =
+			addColumn(prefix + "current_position", TELEMETRY_FLOAT64, task_dof);
+		columns.desired_velocity =
+			addColumn(prefix + "desired_velocity", TELEMETRY_FLOAT64, task_dof);
+		columns.current_velocity =
+			addColumn(prefix + "current_velocity", TELEMETRY_FLOAT64, task_dof);
+		_joint_tasks.push_back(columns);
+	}
+
+	// all the snapshots and chunk buffers are allocated here so that neither
+	// capture nor the drain allocate
+	CycleSnapshot snapshot;
+	snapshot.float64_values = VectorXd::Zero(_num_float64_values);
+	snapshot.int64_values.assign(_num_int64_values, 0);
+	snapshot.dictionary_codes.assign(_num_dictionary_codes, NO_SINGULARITY);
+	_snapshots.allocate(snapshot_capacity, snapshot,
+						_controller->getLoopTimestep());
+
+	_chunk_float64.resize(_columns.size());
+	_chunk_int64.resize(_columns.size());
+	_chunk_dictionary.resize(_columns.size());
+	_encoding_buffers.resize(_columns.size());
+	_chunk_entries.resize(_columns.size());
+	_chunk_buffers.resize(_columns.size());
+	for (int i = 0; i < _columns.size(); i++) {
+		const Column& column = _columns[i];
+		switch (column.type) {
+			case TELEMETRY_FLOAT64:
+				_chunk_float64[i] = VectorXd::Zero(_chunk_rows * column.width);
+				break;
+			case TELEMETRY_INT64:
+				_chunk_int64[i].assign(_chunk_rows, 0);
+				// first value and at most 10 bytes per varint
+				_encoding_buffers[i].reserve(sizeof(int64_t) +
+											 10 * _chunk_rows);
+				break;
+			case TELEMETRY_DICTIONARY:
+				_chunk_dictionary[i].assign(_chunk_rows * column.width, 0);
+				break;
+		}
+	}
+	// column descriptors and dictionaries, written after the header
+	std::vector<TelemetryColumnDescriptor> descriptors;
+	std::vector<TelemetryDictionaryEntry> dictionary;
+	for (const auto& column : _columns) {
+		TelemetryColumnDescriptor descriptor;
+		std::memset(&descriptor, 0, sizeof(descriptor));
+		std::strncpy(descriptor.name, column.name.c_str(),
+					 sizeof(descriptor.name) - 1);
+		descriptor.type = column.type;
+		descriptor.width = column.width;
+		descriptor.dictionary_first = dictionary.size();
+		descriptor.dictionary_size = column.dictionary.size();
+		for (const auto& value : column.dictionary) {
+			TelemetryDictionaryEntry entry;
+			std::memset(&entry, 0, sizeof(entry));
+			std::strncpy(entry.value, value.c_str(), sizeof(entry.value) - 1);
+			dictionary.push_back(entry);
+		}
+		descriptors.push_back(descriptor);
+	}
+
+	std::memset(&_header, 0, sizeof(_header));
+	std::memcpy(_header.magic, TELEMETRY_FILE_MAGIC, sizeof(_header.magic));
+	_header.version = TELEMETRY_FILE_VERSION;
+	_header.num_columns = _columns.size();
+	_header.chunk_rows = _chunk_rows;
+	_header.dictionary_size = dictionary.size();
+	_file_offset = sizeof(_header) +
+				   descriptors.size() * sizeof(TelemetryColumnDescriptor) +
+				   dictionary.size() * sizeof(TelemetryDictionaryEntry);
+	_header.first_chunk_offset = alignedOffset(_file_offset);
+
+	_file.open(filename, std::ios::binary | std::ios::trunc);
+	if (!_file.is_open()) {
+		throw std::invalid_argument(
+			"could not open file " + filename +
+			" in ColumnarTelemetryWriter::ColumnarTelemetryWriter\n");
+	}
+	_file.write(reinterpret_cast<const char*>(&_header), sizeof(_header));
+	_file.write(reinterpret_cast<const char*>(descriptors.data()),
+				descriptors.size() * sizeof(TelemetryColumnDescriptor));
+	_file.write(reinterpret_cast<const char*>(dictionary.data()),
+				dictionary.size() * sizeof(TelemetryDictionaryEntry));
+	writePadding();
+	_file.flush();
+}
+
+ColumnarTelemetryWriter::~ColumnarTelemetryWriter() { close(); }
+
+int ColumnarTelemetryWriter::addColumn(
+	const std::string& name, const TelemetryColumnType type, const int width,
+	const std::vector<std::string>& dictionary) {
+	if (name.size() >= sizeof(TelemetryColumnDescriptor::name)) {
+		throw std::invalid_argument(
+			"column name " + name +
+			" too long in ColumnarTelemetryWriter::ColumnarTelemetryWriter\n");
+	}
+	for (const auto& column : _columns) {
+		if (column.name == name) {
+			throw std::invalid_argument(
+				"duplicate column " + name +
+				" (tasks with the same name) in "
+				"ColumnarTelemetryWriter::ColumnarTelemetryWriter\n");
+		}
+	}
+	Column column;
+	column.name = name;
+	column.type = type;
+	column.width = width;
+	column.dictionary = dictionary;
+	switch (type) {
+		case TELEMETRY_FLOAT64:
+			column.offset = _num_float64_values;
+			_num_float64_values += width;
+			break;
+		case TELEMETRY_INT64:
+			column.offset = _num_int64_values;
+			_num_int64_values += width;
+			break;
+		case TELEMETRY_DICTIONARY:
+			column.offset = _num_dictionary_codes;
+			_num_dictionary_codes += width;
+			break;
+	}
+	_columns.push_back(column);
+	return column.offset;
+}
+
+std::vector<std::string> ColumnarTelemetryWriter::getColumnNames() const {
+	std::vector<std::string> names;
+	for (const auto& column : _columns) {
+		names.push_back(column.name);
+	}
+	return names;
+}
+
+void ColumnarTelemetryWriter::capture(const VectorXd& control_torques) {
+	if (_closed.load(std::memory_order_relaxed)) {
+		return;
+	}
+	if (control_torques.size() != _dof) {
+		throw std::invalid_argument(
+			"control torques size not consistent with the robot dof in "
+			"ColumnarTelemetryWriter::capture\n");
+	}
+	CycleSnapshot* free_snapshot = _snapshots.beginWrite();
+	if (free_snapshot == nullptr) {
+		// the drain fell behind
+		_cycle++;
+		return;
+	}
+
+	CycleSnapshot& snapshot = *free_snapshot;
+	snapshot.int64_values[0] = _cycle++;
+	snapshot.int64_values[1] =
+		std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch())
+			.count();
+	VectorXd& values = snapshot.float64_values;
+	values.segment(_control_torques, control_torques.size()) = control_torques;
+	for (const auto& columns : _joint_tasks) {
+		const auto& task = columns.task;
+		const int task_dof = task->getDesiredPosition().size();
+		values.segment(columns.desired_position, task_dof) =
+			task->getDesiredPosition();
+		values.segment(columns.current_position, task_dof) =
+			task->getCurrentPosition();
+		values.segment(columns.desired_velocity, task_dof) =
+			task->getDesiredVelocity();
+		values.segment(columns.current_velocity, task_dof) =
+			task->getCurrentVelocity();
+	}
+	for (const auto& columns : _motion_force_tasks) {
+		const auto& task = columns.task;
+		values.segment<3>(columns.desired_position) =
+			task->getDesiredPosition();
+		values.segment<3>(columns.current_position) =
+			task->getCurrentPosition();
+		const Quaterniond desired_orientation(task->getDesiredOrientation());
+		values.segment<4>(columns.desired_orientation)
+			<< desired_orientation.w(),
+			desired_orientation.vec();
+		const Quaterniond current_orientation(task->getCurrentOrientation());
+		values.segment<4>(columns.current_orientation)
+			<< current_orientation.w(),
+			current_orientation.vec();
+		values.segment<3>(columns.desired_linear_velocity) =
+			task->getDesiredLinearVelocity();
+		values.segment<3>(columns.current_linear_velocity) =
+			task->getCurrentLinearVelocity();
+		values.segment<6>(columns.unit_mass_force) = task->getUnitMassForce();
+		values.segment<3>(columns.sensed_force) =
+			task->getSensedForceControlWorldFrame();
+		values.segment<3>(columns.sensed_moment) =
+			task->getSensedMomentControlWorldFrame();
+		values.segment<3>(columns.goal_force) = task->getGoalForceSetpoint();
+		values.segment<3>(columns.goal_moment) = task->getGoalMomentSetpoint();
+		const std::vector<SingularityType>& singularity_types =
+			task->getSingularityTypes();
+		for (int i = 0; i < SINGULARITY_TYPES_WIDTH; i++) {
+			snapshot.dictionary_codes[columns.singularity_types + i] =
+				i < singularity_types.size() ? singularity_types[i]
+											 : NO_SINGULARITY;
+		}
+	}
+	_snapshots.commitWrite();
+}
+
+void ColumnarTelemetryWriter::waitForDrain() const {
+	_snapshots.waitForDrain();
+}
+
+void ColumnarTelemetryWriter::close() {
+	_closed = true;
+	waitForDrain();
+	if (!_file.is_open()) {
+		return;
+	}
+	// snapshots left by an executor that refused the last drain
+	_snapshots.drain();
+	writeChunk();
+
+	_header.is_closed = 1;
+	_file.seekp(0);
+	_file.write(reinterpret_cast<const char*>(&_header), sizeof(_header));
+	_file.close();
+}
+
+void ColumnarTelemetryWriter::appendRow(const CycleSnapshot& snapshot) {
+	const uint64_t row = _num_chunk_rows;
+	for (int i = 0; i < _columns.size(); i++) {
+		const Column& column = _columns[i];
+		switch (column.type) {
+			case TELEMETRY_FLOAT64:
+				_chunk_float64[i].segment(row * column.width, column.width) =
+					snapshot.float64_values.segment(column.offset,
+													column.width);
+				break;
+			case TELEMETRY_INT64:
+				_chunk_int64[i][row] = snapshot.int64_values[column.offset];
+				break;
+			case TELEMETRY_DICTIONARY:
+				std::memcpy(
+					_chunk_dictionary[i].data() + row * column.width,
+					snapshot.dictionary_codes.data() + column.offset,
+					column.width);
+				break;
+		}
+	}
+	_num_chunk_rows++;
+	if (_num_chunk_rows == _chunk_rows) {
+		writeChunk();
+	}
+}
+
+void ColumnarTelemetryWriter::writeChunk() {
+	if (_num_chunk_rows == 0) {
+		return;
+	}
+	const uint32_t num_rows = _num_chunk_rows;
+	for (int i = 0; i < _columns.size(); i++) {
+		const Column& column = _columns[i];
+		_chunk_entries[i].num_rows = num_rows;
+		switch (column.type) {
+			case TELEMETRY_FLOAT64: {
+				const uint8_t* data =
+					reinterpret_cast<const uint8_t*>(_chunk_float64[i].data());
+				const size_t row_size = column.width * sizeof(double);
+				if (rowsAreEqual(data, num_rows, row_size)) {
+					setChunkBuffer(i, data, row_size, TELEMETRY_CONSTANT);
+				} else {
+					setChunkBuffer(i, data, num_rows * row_size,
+								   TELEMETRY_PLAIN);
+				}
+				break;
+			}
+			case TELEMETRY_INT64: {
+				const std::vector<int64_t>& values = _chunk_int64[i];
+				if (rowsAreEqual(reinterpret_cast<const uint8_t*>(values.data()),
+								 num_rows, sizeof(int64_t))) {
+					setChunkBuffer(i, values.data(), sizeof(int64_t),
+								   TELEMETRY_CONSTANT);
+					break;
+				}
+				// first value, then the zigzag encoded differences (wrapping
+				// on overflow)
+				std::vector<uint8_t>& encoded = _encoding_buffers[i];
+				encoded.resize(sizeof(int64_t));
+				std::memcpy(encoded.data(), &values[0], sizeof(int64_t));
+				for (uint32_t row = 1; row < num_rows; row++) {
+					const uint64_t delta = static_cast<uint64_t>(values[row]) -
+										   static_cast<uint64_t>(values[row - 1]);
+					appendVarint(
+						(delta << 1) ^
+							static_cast<uint64_t>(static_cast<int64_t>(delta) >>
+												  63),
+						encoded);
+				}
+				setChunkBuffer(i, encoded.data(), encoded.size(),
+							   TELEMETRY_DELTA);
+				break;
+			}
+			case TELEMETRY_DICTIONARY: {
+				const uint8_t* data = _chunk_dictionary[i].data();
+				if (rowsAreEqual(data, num_rows, column.width)) {
+					setChunkBuffer(i, data, column.width, TELEMETRY_CONSTANT);
+				} else {
+					setChunkBuffer(i, data, num_rows * column.width,
+								   TELEMETRY_PLAIN);
+				}
+				break;
+			}
+		}
+	}
+
+	// the buffers follow the chunk header and the entries, each on a buffer
+	// boundary
+	const uint64_t chunk_offset = _file_offset;
+	uint64_t offset =
+		alignedOffset(chunk_offset + sizeof(TelemetryChunkHeader) +
+					  _columns.size() * sizeof(TelemetryChunkEntry));
+	for (auto& entry : _chunk_entries) {
+		entry.offset = offset;
+		offset = alignedOffset(offset + entry.size);
+	}
+
+	TelemetryChunkHeader chunk_header;
+	std::memset(&chunk_header, 0, sizeof(chunk_header));
+	std::memcpy(chunk_header.magic, TELEMETRY_CHUNK_MAGIC,
+				sizeof(chunk_header.magic));
+	chunk_header.chunk_index = _header.num_chunks;
+	chunk_header.size = offset - chunk_offset;
+	chunk_header.num_rows = num_rows;
+	chunk_header.num_columns = _columns.size();
+	_file.write(reinterpret_cast<const char*>(&chunk_header),
+				sizeof(chunk_header));
+	_file.write(reinterpret_cast<const char*>(_chunk_entries.data()),
+				_chunk_entries.size() * sizeof(TelemetryChunkEntry));
+	_file_offset += sizeof(chunk_header) +
+					_chunk_entries.size() * sizeof(TelemetryChunkEntry);
+	for (int i = 0; i < _columns.size(); i++) {
+		writePadding();
+		_file.write(reinterpret_cast<const char*>(_chunk_buffers[i]),
+					_chunk_entries[i].size);
+		_file_offset += _chunk_entries[i].size;
+	}
+	writePadding();
+	// a complete chunk survives a crash of the process
+	_file.flush();
+
+	_header.num_rows += num_rows;
+	_header.num_chunks++;
+	_num_chunk_rows = 0;
+}
+
+void ColumnarTelemetryWriter::setChunkBuffer(const int column,
+											 const void* data,
+											 const size_t size,
+											 const TelemetryEncoding encoding) {
+	_chunk_entries[column].size = size;
+	_chunk_entries[column].encoding = encoding;
+	_chunk_buffers[column] = data;
+}
+
+void ColumnarTelemetryWriter::writePadding() {
+	const uint64_t padding = alignedOffset(_file_offset) - _file_offset;
+	const char zeros[TELEMETRY_BUFFER_ALIGNMENT] = {};
+	_file.write(zeros, padding);
+	_file_offset += padding;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ColumnarTelemetryReader
+////////////////////////////////////////////////////////////////////////////////
+
+ColumnarTelemetryReader::ColumnarTelemetryReader(const std::string& filename)
+	: _fd(-1),
+	  _mapping(MAP_FAILED),
+	  _mapping_size(0),
+	  _num_rows(0),
+	  _is_complete(false) {
+	_fd = ::open(filename.c_str(), O_RDONLY);
+	if (_fd < 0) {
+		throw std::invalid_argument(
+			"could not open file " + filename +
+			" in ColumnarTelemetryReader::ColumnarTelemetryReader\n");
+	}
+	struct stat file_stat;
+	if (fstat(_fd, &file_stat) != 0 ||
+		file_stat.st_size < (off_t)sizeof(TelemetryFileHeader)) {
+		::close(_fd);
+		throw std::invalid_argument(
+			"file " + filename +
+			" is not a telemetry file in "
+			"ColumnarTelemetryReader::ColumnarTelemetryReader\n");
+	}
+	_mapping_size = file_stat.st_size;
+	_mapping = mmap(nullptr, _mapping_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (_mapping == MAP_FAILED) {
+		::close(_fd);
+		throw std::invalid_argument(
+			"could not map file " + filename +
+			" in ColumnarTelemetryReader::ColumnarTelemetryReader\n");
+	}
+	const uint8_t* base = static_cast<const uint8_t*>(_mapping);
+	std::memcpy(&_header, base, sizeof(_header));
+
+	// validates the header, the column descriptors and the chunks once, so
+	// that the accessors can trust them
+	const uint64_t descriptors_size =
+		(uint64_t)_header.num_columns * sizeof(TelemetryColumnDescriptor);
+	const uint64_t dictionary_size =
+		(uint64_t)_header.dictionary_size * sizeof(TelemetryDictionaryEntry);
+	bool valid =
+		std::memcmp(_header.magic, TELEMETRY_FILE_MAGIC,
+					sizeof(_header.magic)) == 0 &&
+		_header.version == TELEMETRY_FILE_VERSION && _header.num_columns > 0 &&
+		_header.chunk_rows > 0 &&
+		_header.first_chunk_offset % TELEMETRY_BUFFER_ALIGNMENT == 0 &&
+		_header.first_chunk_offset <= _mapping_size &&
+		sizeof(_header) + descriptors_size + dictionary_size <=
+			_header.first_chunk_offset;
+	if (valid) {
+		_columns = reinterpret_cast<const TelemetryColumnDescriptor*>(
+			base + sizeof(_header));
+		_dictionary = reinterpret_cast<const TelemetryDictionaryEntry*>(
+			base + sizeof(_header) + descriptors_size);
+		for (int i = 0; valid && i < _header.num_columns; i++) {
+			const TelemetryColumnDescriptor& column = _columns[i];
+			valid = std::memchr(column.name, '\0', sizeof(column.name)) &&
+					column.type <= TELEMETRY_DICTIONARY && column.width > 0 &&
+					(column.type != TELEMETRY_INT64 || column.width == 1) &&
+					(uint64_t)column.dictionary_first + column.dictionary_size <=
+						_header.dictionary_size;
+		}
+	}
+
+	// the chunks follow each other up to the end of the file, or up to a
+	// truncated or partially written chunk if the writer was not closed
+	_num_rows = 0;
+	uint64_t chunk_offset = _header.first_chunk_offset;
+	const uint64_t entries_size =
+		(uint64_t)_header.num_columns * sizeof(TelemetryChunkEntry);
+	while (valid &&
+		   sizeof(TelemetryChunkHeader) + entries_size <=
+			   _mapping_size - chunk_offset) {
+		TelemetryChunkHeader chunk_header;
+		std::memcpy(&chunk_header, base + chunk_offset, sizeof(chunk_header));
+		bool complete =
+			std::memcmp(chunk_header.magic, TELEMETRY_CHUNK_MAGIC,
+						sizeof(chunk_header.magic)) == 0 &&
+			chunk_header.chunk_index == _chunks.size() &&
+			chunk_header.num_columns == _header.num_columns &&
+			chunk_header.num_rows > 0 &&
+			chunk_header.num_rows <= _header.chunk_rows &&
+			chunk_header.size % TELEMETRY_BUFFER_ALIGNMENT == 0 &&
+			chunk_header.size >= sizeof(chunk_header) + entries_size &&
+			chunk_header.size <= _mapping_size - chunk_offset;
+		const TelemetryChunkEntry* entries =
+			reinterpret_cast<const TelemetryChunkEntry*>(
+				base + chunk_offset + sizeof(chunk_header));
+		const uint64_t buffers_offset =
+			chunk_offset + sizeof(chunk_header) + entries_size;
+		const uint64_t chunk_end = chunk_offset + chunk_header.size;
+		for (int i = 0; complete && i < _header.num_columns; i++) {
+			const TelemetryChunkEntry& entry = entries[i];
+			const uint64_t expected_size =
+				expectedBufferSize(_columns[i], entry);
+			complete = entry.num_rows == chunk_header.num_rows &&
+					   expected_size > 0 &&
+					   entry.offset % TELEMETRY_BUFFER_ALIGNMENT == 0 &&
+					   entry.offset >= buffers_offset &&
+					   entry.offset <= chunk_end &&
+					   entry.size <= chunk_end - entry.offset &&
+					   (entry.encoding == TELEMETRY_DELTA
+							? entry.size >= expected_size
+							: entry.size == expected_size);
+		}
+		if (!complete) {
+			break;
+		}
+		_chunks.push_back(entries);
+		_num_rows += chunk_header.num_rows;
+		chunk_offset = chunk_end;
+	}
+	// a closed file ends with its last chunk, otherwise it was truncated
+	_is_complete = _header.is_closed && chunk_offset == _mapping_size &&
+				   _chunks.size() == _header.num_chunks &&
+				   _num_rows == _header.num_rows;
+	if (!valid) {
+		munmap(_mapping, _mapping_size);
+		::close(_fd);
+		throw std::invalid_argument(
+			"file " + filename +
+			" is not a valid telemetry file in "
+			"ColumnarTelemetryReader::ColumnarTelemetryReader\n");
+	}
+}
+
+ColumnarTelemetryReader::~ColumnarTelemetryReader() {
+	munmap(_mapping, _mapping_size);
+	::close(_fd);
+}
+
+int ColumnarTelemetryReader::findColumn(const std::string& name) const {
+	for (int i = 0; i < _header.num_columns; i++) {
+		if (name == _columns[i].name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+std::string ColumnarTelemetryReader::getColumnName(const int column) const {
+	if (column < 0 || column >= _header.num_columns) {
+		throw std::invalid_argument(
+			"column index out of range in "
+			"ColumnarTelemetryReader::getColumnName\n");
+	}
+	return _columns[column].name;
+}
+
+TelemetryColumnType ColumnarTelemetryReader::getColumnType(
+	const int column) const {
+	if (column < 0 || column >= _header.num_columns) {
+		throw std::invalid_argument(
+			"column index out of range in "
+			"ColumnarTelemetryReader::getColumnType\n");
+	}
+	return _columns[column].type;
+}
+
+int ColumnarTelemetryReader::getColumnWidth(const int column) const {
+	if (column < 0 || column >= _header.num_columns) {
+		throw std::invalid_argument(
+			"column index out of range in "
+			"ColumnarTelemetryReader::getColumnWidth\n");
+	}
+	return _columns[column].width;
+}
+
+std::vector<std::string> ColumnarTelemetryReader::getDictionary(
+	const int column) const {
+	const TelemetryColumnDescriptor& column_descriptor =
+		descriptor(column, TELEMETRY_DICTIONARY, "getDictionary");
+	std::vector<std::string> dictionary;
+	for (uint32_t i = 0; i < column_descriptor.dictionary_size; i++) {
+		const TelemetryDictionaryEntry& entry =
+			_dictionary[column_descriptor.dictionary_first + i];
+		dictionary.push_back(
+			std::string(entry.value, strnlen(entry.value, sizeof(entry.value))));
+	}
+	return dictionary;
+}
+
+TelemetryColumnChunk ColumnarTelemetryReader::getChunk(
+	const int column, const uint64_t chunk) const {
+	if (column < 0 || column >= _header.num_columns ||
+		chunk >= _chunks.size()) {
+		throw std::invalid_argument(
+			"column or chunk index out of range in "
+			"ColumnarTelemetryReader::getChunk\n");
+	}
+	const TelemetryChunkEntry& entry =
+		_chunks[chunk][column];
+	TelemetryColumnChunk column_chunk;
+	column_chunk.encoding = entry.encoding;
+	column_chunk.num_rows = entry.num_rows;
+	column_chunk.width = _columns[column].width;
+	column_chunk.data = static_cast<const uint8_t*>(_mapping) + entry.offset;
+	column_chunk.size = entry.size;
+	return column_chunk;
+}
+
+Map<const MatrixXd> ColumnarTelemetryReader::mapFloat64Chunk(
+	const int column, const uint64_t chunk) const {
+	descriptor(column, TELEMETRY_FLOAT64, "mapFloat64Chunk");
+	const TelemetryColumnChunk column_chunk = getChunk(column, chunk);
+	return Map<const MatrixXd>(
+		reinterpret_cast<const double*>(column_chunk.data), column_chunk.width,
+		column_chunk.encoding == TELEMETRY_PLAIN ? column_chunk.num_rows : 1);
+}
+
+MatrixXd ColumnarTelemetryReader::readFloat64Column(const int column) const {
+	const int width =
+		descriptor(column, TELEMETRY_FLOAT64, "readFloat64Column").width;
+	MatrixXd values(width, _num_rows);
+	uint64_t row = 0;
+	for (uint64_t chunk = 0; chunk < _chunks.size(); chunk++) {
+		const TelemetryChunkEntry& entry =
+			_chunks[chunk][column];
+		copyRows(entry, static_cast<const uint8_t*>(_mapping) + entry.offset,
+				 width * sizeof(double),
+				 reinterpret_cast<uint8_t*>(values.col(row).data()));
+		row += entry.num_rows;
+	}
+	return values;
+}
+
+Matrix<int64_t, Dynamic, 1> ColumnarTelemetryReader::readInt64Column(
+	const int column) const {
+	descriptor(column, TELEMETRY_INT64, "readInt64Column");
+	Matrix<int64_t, Dynamic, 1> values(_num_rows);
+	uint64_t row = 0;
+	for (uint64_t chunk = 0; chunk < _chunks.size(); chunk++) {
+		const TelemetryChunkEntry& entry =
+			_chunks[chunk][column];
+		const uint8_t* data =
+			static_cast<const uint8_t*>(_mapping) + entry.offset;
+		if (entry.encoding == TELEMETRY_CONSTANT) {
+			copyRows(entry, data, sizeof(int64_t),
+					 reinterpret_cast<uint8_t*>(values.data() + row));
+			row += entry.num_rows;
+			continue;
+		}
+		const uint8_t* end = data + entry.size;
+		uint64_t value;
+		std::memcpy(&value, data, sizeof(value));
+		data += sizeof(value);
+		values(row++) = static_cast<int64_t>(value);
+		for (uint32_t i = 1; i < entry.num_rows; i++) {
+			uint64_t zigzag = 0;
+			int shift = 0;
+			while (data < end && shift < 64) {
+				const uint8_t byte = *data++;
+				zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+				shift += 7;
+				if ((byte & 0x80) == 0) {
+					break;
+				}
+			}
+			value += (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+			values(row++) = static_cast<int64_t>(value);
+		}
+	}
+	return values;
+}
+
+Matrix<uint8_t, Dynamic, Dynamic> ColumnarTelemetryReader::readDictionaryColumn(
+	const int column) const {
+	const int width =
+		descriptor(column, TELEMETRY_DICTIONARY, "readDictionaryColumn").width;
+	Matrix<uint8_t, Dynamic, Dynamic> codes(width, _num_rows);
+	uint64_t row = 0;
+	for (uint64_t chunk = 0; chunk < _chunks.size(); chunk++) {
+		const TelemetryChunkEntry& entry =
+			_chunks[chunk][column];
+		copyRows(entry, static_cast<const uint8_t*>(_mapping) + entry.offset,
+				 width, codes.col(row).data());
+		row += entry.num_rows;
+	}
+	return codes;
+}
+
+const TelemetryColumnDescriptor& ColumnarTelemetryReader::descriptor(
+	const int column, const TelemetryColumnType type,
+	const char* method) const {
+	if (column < 0 || column >= _header.num_columns ||
+		_columns[column].type != type) {
+		throw std::invalid_argument(
+			std::string("column index out of range or wrong column type in "
+						"ColumnarTelemetryReader::") +
+			method + "\n");
+	}
+	return _columns[column];
+}
+
+}  // namespace Sai2Primitives
@@ -0,0 +1,404 @@
+/**
+ * ColumnarTelemetry.h
+ *
+ *	Columnar binary logs of the per cycle state of a RobotController, for the
+ * offline analysis of long recordings. At each cycle, the control thread copies
+ * the state of the controller and its tasks into a preallocated ring of
+ * snapshots, which is drained on a BackgroundExecutor: the rows are
+ * accumulated in chunks of columns, and each full chunk is encoded and written
+ * to the file, so the control thread never touches the file.
+ *
+ * Recorded columns (one row per captured cycle):
+ * - cycle, timestamp_ns (system clock) and control_torques
+ * - for the joint tasks (including the redundancy completion task):
+ * <task_name>/desired_position, current_position, desired_velocity and
+ * current_velocity
+ * - for the motion force tasks: <task_name>/desired_position,
+ * current_position, desired_orientation and current_orientation (quaternions
+ * [w x y z]), desired_linear_velocity, current_linear_velocity,
+ * unit_mass_force, sensed_force and sensed_moment (control world frame),
+ * goal_force and goal_moment setpoints, and singularity_types (6 dictionary
+ * codes, padded with NO_SINGULARITY)
+ * The other task types are not recorded.
+ *
+ * File layout: a 64 bytes header, the column descriptors and the dictionaries,
+ * then the chunks. Each chunk holds the buffers of all the columns for
+ * chunk_rows consecutive rows (fewer for the last one) and is self-delimiting:
+ * it starts with a chunk header and the entries locating its buffers, so a
+ * file whose writer did not close it (crash, power loss) can be read up to its
+ * last complete chunk. Each buffer starts on a 64 bytes boundary so that the
+ * file can be memory mapped and read in place. A buffer is encoded depending
+ * on its column type and content:
+ * - float64 columns: PLAIN (num_rows * width doubles, row after row, which is
+ * a width x num_rows column major matrix) or CONSTANT (width doubles) when all
+ * the rows of the chunk are equal
+ * - int64 columns: DELTA (the first value, then the zigzag varint differences
+ * between consecutive values) or CONSTANT
+ * - dictionary columns: PLAIN (num_rows * width uint8 codes) or CONSTANT
+ * The numbers of rows and chunks of the file header are written by close(),
+ * the reader recomputes them from the chunk headers and reads a file that was
+ * not closed or was truncated up to its last complete chunk.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_COLUMNAR_TELEMETRY_H
+#define SAI2_PRIMITIVES_COLUMNAR_TELEMETRY_H
+
+#include <Eigen/Dense>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "RobotController.h"
+#include "helper_modules/BackgroundExecutor.h"
+#include "helper_modules/SnapshotRing.h"
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+enum TelemetryColumnType : uint32_t {
+	TELEMETRY_FLOAT64 = 0,
+	TELEMETRY_INT64 = 1,
+	TELEMETRY_DICTIONARY = 2,
+};
+
+enum TelemetryEncoding : uint32_t {
+	TELEMETRY_PLAIN = 0,
+	TELEMETRY_CONSTANT = 1,
+	TELEMETRY_DELTA = 2,
+};
+
+/**
+ * @brief      Header of a telemetry file. It is followed by the num_columns
+ * column descriptors and the dictionary_size dictionary entries, and the
+ * first chunk starts at first_chunk_offset. num_rows and num_chunks are only
+ * set once the file is closed.
+ */
+struct TelemetryFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_columns;
+	uint64_t num_rows;
+	uint64_t num_chunks;
+	uint64_t chunk_rows;
+	uint64_t first_chunk_offset;
+	uint32_t dictionary_size;
+	uint32_t is_closed;
+	uint8_t reserved[8];
+};
+static_assert(sizeof(TelemetryFileHeader) == 64,
+			  "unexpected telemetry file header size");
+
+/**
+ * @brief      Descriptor of a column. The dictionary entries of the column are dictionary_size consecutive entries of the dictionary table,
+ * starting at dictionary_first.
+ */
+struct TelemetryColumnDescriptor {
+	char name[112];
+	TelemetryColumnType type;
+	uint32_t width;
+	uint32_t dictionary_first;
+	uint32_t dictionary_size;
+};
+static_assert(sizeof(TelemetryColumnDescriptor) == 128,
+			  "unexpected telemetry column descriptor size");
+
+/**
+ * @brief      Header of a chunk, followed by the num_columns entries locating
+ * the buffers of the chunk. size is the size of the whole chunk, from the
+ * start of its header to the start of the next chunk.
+ */
+struct TelemetryChunkHeader {
+	char magic[8];
+	uint64_t chunk_index;
+	uint64_t size;
+	uint32_t num_rows;
+	uint32_t num_columns;
+	uint8_t reserved[32];
+};
+static_assert(sizeof(TelemetryChunkHeader) == 64,
+			  "unexpected telemetry chunk header size");
+
+/**
+ * @brief      Location of the buffer of a column in a chunk, after the chunk
+ * header
+ */
+struct TelemetryChunkEntry {
+	uint64_t offset;
+	uint64_t size;
+	TelemetryEncoding encoding;
+	uint32_t num_rows;
+};
+static_assert(sizeof(TelemetryChunkEntry) == 24,
+			  "unexpected telemetry chunk entry size");
+
+/**
+ * @brief      Entry of the dictionary table
+ */
+struct TelemetryDictionaryEntry {
+	char value[32];
+};
+
+class ColumnarTelemetryWriter {
+public:
+	/**
+	 * @brief      Creates the telemetry file and the columns for the tasks of
+	 * the controller. To be called outside of the control loop, after the
+	 * tasks are added to the controller.
+	 *
+	 * @param[in]  controller         The recorded controller
+	 * @param[in]  filename           The output file
+	 * @param[in]  executor           The executor where the snapshots are
+	 *                                drained and the file is written
+	 * @param[in]  snapshot_capacity  The number of cycles that can wait to be
+	 *                                drained before cycles are dropped
+	 * @param[in]  chunk_rows         The number of rows per chunk
+	 */
+	ColumnarTelemetryWriter(
+		std::shared_ptr<RobotController> controller,
+		const std::string& filename,
+		BackgroundExecutor& executor = BackgroundExecutor::instance(),
+		const int snapshot_capacity = 1024, const int chunk_rows = 4096);
+
+	/**
+	 * @brief      Closes the file if needed
+	 */
+	~ColumnarTelemetryWriter();
+
+	// disallow copy and asssign constructors
+	ColumnarTelemetryWriter(ColumnarTelemetryWriter const&) = delete;
+	ColumnarTelemetryWriter& operator=(ColumnarTelemetryWriter const&) =
+		delete;
+
+	/**
+	 * @brief      Copies the state of the current cycle and schedules its
+	 * draining. To be called from the control thread after
+	 * computeControlTorques. Does not allocate and does not block. Does
+	 * nothing once the writer is closed.
+	 *
+	 * @param[in]  control_torques  The torques computed by the controller at
+	 *                              this cycle
+	 */
+	void capture(const VectorXd& control_torques);
+
+	/**
+	 * @brief      Blocks until the captured snapshots are drained. Not to be
+	 * called from the control thread.
+	 */
+	void waitForDrain() const;
+
+	/**
+	 * @brief      Drains the captured snapshots, writes the last chunk and the
+	 * final header, and closes the file. Called by the destructor if
+	 * needed. Not to be called from the control thread, and capture should not
+	 * be called concurrently.
+	 */
+	void close();
+
+	/**
+	 * @brief      Names of the recorded columns
+	 */
+	std::vector<std::string> getColumnNames() const;
+
+	unsigned long getNumCapturedCycles() const {
+		return _snapshots.getNumCapturedCycles();
+	}
+
+	/**
+	 * @brief      Number of cycles not recorded because the snapshot ring was
+	 * full (the gaps are visible in the cycle column)
+	 */
+	unsigned long getNumDroppedCycles() const {
+		return _snapshots.getNumDroppedCycles();
+	}
+
+private:
+	struct Column {
+		std::string name;
+		TelemetryColumnType type;
+		int width;
+		// offset of the column in the values of its type in a snapshot
+		int offset;
+		std::vector<std::string> dictionary;
+	};
+
+	struct JointTaskColumns {
+		std::shared_ptr<JointTask> task;
+		int desired_position;
+		int current_position;
+		int desired_velocity;
+		int current_velocity;
+	};
+
+	struct MotionForceTaskColumns {
+		std::shared_ptr<MotionForceTask> task;
+		int desired_position;
+		int current_position;
+		int desired_orientation;
+		int current_orientation;
+		int desired_linear_velocity;
+		int current_linear_velocity;
+		int unit_mass_force;
+		int sensed_force;
+		int sensed_moment;
+		int goal_force;
+		int goal_moment;
+		int singularity_types;
+	};
+
+	struct CycleSnapshot {
+		VectorXd float64_values;
+		std::vector<int64_t> int64_values;
+		std::vector<uint8_t> dictionary_codes;
+	};
+
+	// adds a column and returns its offset in the snapshots
+	int addColumn(const std::string& name, const TelemetryColumnType type,
+				  const int width,
+				  const std::vector<std::string>& dictionary = {});
+
+	// background side
+	void appendRow(const CycleSnapshot& snapshot);
+	void writeChunk();
+	void setChunkBuffer(const int column, const void* data, const size_t size,
+						const TelemetryEncoding encoding);
+	// writes zeros up to the next buffer boundary
+	void writePadding();
+
+	std::shared_ptr<RobotController> _controller;
+	std::vector<Column> _columns;
+	int _dof;
+	int _control_torques;
+	std::vector<JointTaskColumns> _joint_tasks;
+	std::vector<MotionForceTaskColumns> _motion_force_tasks;
+	int _num_float64_values;
+	int _num_int64_values;
+	int _num_dictionary_codes;
+
+	// snapshots of the control thread, drained on the executor
+	SnapshotRing<CycleSnapshot> _snapshots;
+	std::atomic<bool> _closed;
+
+	// control thread side
+	int64_t _cycle;
+
+	// background side, the rows of the current chunk, row after row for each
+	// column
+	std::vector<VectorXd> _chunk_float64;
+	std::vector<std::vector<int64_t>> _chunk_int64;
+	std::vector<std::vector<uint8_t>> _chunk_dictionary;
+	uint64_t _chunk_rows;
+	uint64_t _num_chunk_rows;
+	// encoded DELTA buffers of the int64 columns
+	std::vector<std::vector<uint8_t>> _encoding_buffers;
+	// entries and buffers of the chunk being written
+	std::vector<TelemetryChunkEntry> _chunk_entries;
+	std::vector<const void*> _chunk_buffers;
+
+	std::ofstream _file;
+	uint64_t _file_offset;
+	TelemetryFileHeader _header;
+};
+
+/**
+ * @brief      Buffer of a column in a chunk, pointing inside the mapped file
+ */
+struct TelemetryColumnChunk {
+	TelemetryEncoding encoding;
+	uint64_t num_rows;
+	int width;
+	const uint8_t* data;
+	uint64_t size;
+};
+
+class ColumnarTelemetryReader {
+public:
+	/**
+	 * @brief      Maps a telemetry file. Throws if the file cannot be mapped
+	 * or is not a valid telemetry file. A file that was not closed by its
+	 * writer or was truncated is read up to its last complete chunk (see
+	 * isComplete).
+	 *
+	 * @param[in]  filename  The file name
+	 */
+	ColumnarTelemetryReader(const std::string& filename);
+	~ColumnarTelemetryReader();
+
+	// disallow copy and asssign constructors
+	ColumnarTelemetryReader(ColumnarTelemetryReader const&) = delete;
+	ColumnarTelemetryReader& operator=(ColumnarTelemetryReader const&) =
+		delete;
+
+	uint64_t getNumRows() const { return _num_rows; }
+	uint64_t getNumChunks() const { return _chunks.size(); }
+	int getNumColumns() const { return _header.num_columns; }
+
+	/**
+	 * @brief      Whether the file was closed by its writer and is complete.
+	 * When false (writer still running or crashed, truncated copy), the rows
+	 * after the last complete chunk are not available.
+	 */
+	bool isComplete() const { return _is_complete; }
+
+	/**
+	 * @brief      Index of a column from its name, -1 if there is no such
+	 * column
+	 */
+	int findColumn(const std::string& name) const;
+
+	std::string getColumnName(const int column) const;
+	TelemetryColumnType getColumnType(const int column) const;
+	int getColumnWidth(const int column) const;
+
+	/**
+	 * @brief      Values of the codes of a dictionary column
+	 */
+	std::vector<std::string> getDictionary(const int column) const;
+
+	/**
+	 * @brief      Buffer of a column in a chunk, without copy
+	 */
+	TelemetryColumnChunk getChunk(const int column, const uint64_t chunk) const;
+
+	/**
+	 * @brief      Maps the values of a float64 column in a chunk without copy:
+	 * width x num_rows matrix for a PLAIN chunk, width x 1 matrix for a
+	 * CONSTANT chunk
+	 */
+	Map<const MatrixXd> mapFloat64Chunk(const int column,
+										const uint64_t chunk) const;
+
+	/**
+	 * @brief      Decodes all the rows of a column: width x num_rows matrix
+	 * for float64 and dictionary columns, num_rows vector for int64 columns
+	 */
+	MatrixXd readFloat64Column(const int column) const;
+	Matrix<int64_t, Dynamic, 1> readInt64Column(const int column) const;
+	Matrix<uint8_t, Dynamic, Dynamic> readDictionaryColumn(
+		const int column) const;
+
+private:
+	const TelemetryColumnDescriptor& descriptor(const int column,
+												const TelemetryColumnType type,
+												const char* method) const;
+
+	int _fd;
+	void* _mapping;
+	size_t _mapping_size;
+	TelemetryFileHeader _header;
+	const TelemetryColumnDescriptor* _columns;
+	const TelemetryDictionaryEntry* _dictionary;
+	// entries of the buffers of each chunk
+	std::vector<const TelemetryChunkEntry*> _chunks;
+	uint64_t _num_rows;
+	bool _is_complete;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_COLUMNAR_TELEMETRY_H
@@ -127,6 +127,9 @@ HapticDeviceController::HapticDeviceController(
 	// Device workspace virtual limits
 	_device_workspace_virtual_limits_enabled = false;
 
+	// Model-mediated force feedback
+	_model_mediated_force_feedback_enabled = false;
+
 	// Initialize haptic guidance parameters
 	_plane_guidance_enabled = false;
 	_line_guidance_enabled = false;
@@ -152,6 +155,7 @@ HapticDeviceController::HapticDeviceController(
 
 HapticControllerOtuput HapticDeviceController::computeHapticControl(
 	const HapticControllerInput& input, const bool verbose) {
+	SAI2_TRACE_SCOPE("computeHapticControl", "HapticDeviceController");
 	HapticControllerOtuput output;
 	_latest_input = input;
 	switch (_haptic_control_type) {
@@ -329,9 +333,23 @@ void HapticDeviceController::motionMotionControlPosition(
 				line_direction_robot_frame);
 	}
 
-	// Compute the force feedback in robot frame
+	// Compute the force feedback in robot frame, either from the sensed force
+	// or from the local contact model at the robot goal position
 	Vector3d haptic_forces_robot_space_direct_feedback =
 		-input.robot_sensed_force;
+	if (_model_mediated_force_feedback_enabled) {
+		haptic_forces_robot_space_direct_feedback =
+			_local_contact_model.computeContactForce(
+				output.robot_goal_position);
+		// the stiffness felt on the device is the model stiffness times the
+		// force reduction factor, and should not exceed the device limits
+		const double rendered_stiffness =
+			_reduction_factor_force * _local_contact_model.stiffness;
+		if (rendered_stiffness > _device_limits.max_linear_stiffness) {
+			haptic_forces_robot_space_direct_feedback *=
+				_device_limits.max_linear_stiffness / rendered_stiffness;
+		}
+	}
 
 	// scale and rotate to device frame
 	Vector3d haptic_force_direct_feedback =
@@ -18,6 +18,8 @@
 #include <string>
 
 #include "Sai2Model.h"
+#include "helper_modules/LocalContactModel.h"
+#include "helper_modules/TraceRecorder.h"
 
 namespace Sai2Primitives {
 
@@ -624,6 +626,39 @@ public:
 	 */
 	void setMomentDeadbandForceMotionController(const double force_deadband);
 
+	/**
+	 * @brief Enables the model-mediated force feedback (used in motion-motion
+	 * control only). Instead of the robot sensed force, the direct force
+	 * feedback is computed from a local contact model of the environment,
+	 * evaluated at the robot goal position given by the current device
+	 * position. The model parameters are estimated on the robot side (see
+	 * LocalContactModelEstimator) and given with setLocalContactModel whenever
+	 * new parameters are received, so the rendering does not depend on the
+	 * communication latency. The moment feedback is not affected.
+	 */
+	void enableModelMediatedForceFeedback() {
+		_model_mediated_force_feedback_enabled = true;
+	}
+	void disableModelMediatedForceFeedback() {
+		_model_mediated_force_feedback_enabled = false;
+	}
+	bool getModelMediatedForceFeedbackEnabled() const {
+		return _model_mediated_force_feedback_enabled;
+	}
+
+	/**
+	 * @brief Sets the local contact model used by the model-mediated force
+	 * feedback
+	 *
+	 * @param local_contact_model contact model in robot world frame
+	 */
+	void setLocalContactModel(const LocalContactModel& local_contact_model) {
+		_local_contact_model = local_contact_model;
+	}
+	const LocalContactModel& getLocalContactModel() const {
+		return _local_contact_model;
+	}
+
 private:
 	// controller states
 	bool _orientation_teleop_enabled;
@@ -705,6 +740,10 @@ private:
 	// Device workspace virtual limits
 	double _device_workspace_radius_limit;
 	double _device_workspace_angle_limit;
+
+	// model-mediated force feedback
+	bool _model_mediated_force_feedback_enabled;
+	LocalContactModel _local_contact_model;
 };
 
 } /* namespace Sai2Primitives */
@@ -1,17 +1,39 @@
 #include "RobotController.h"
 
+#include <chrono>
+
 using namespace Eigen;
 using namespace std;
 
 namespace {
 const std::string REDUNDANCY_COMPLETION_TASK_NAME =
 	"redundancy_completion_task";
+// relative tolerance on the task loop timesteps being integer multiples of the
+// controller loop timestep
+const double LOOP_TIMESTEP_TOLERANCE = 1e-6;
+// default damping of the pseudo inverses in the kinematic resolution
+const double DEFAULT_KINEMATIC_DAMPING = 1e-2;
+
+double elapsedSeconds(const chrono::steady_clock::time_point& start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start)
+		.count();
+}
+
+// a task running at a divided rate is updated at the cycle where its
+// emergency stop is engaged or released
+bool hasPendingEmergencyStopTransition(
+	const Sai2Primitives::TemplateTask& task) {
+	return task.isEmergencyStopRequested() != task.isEmergencyStopEngaged();
+}
 }
 namespace Sai2Primitives {
 
 RobotController::RobotController(std::shared_ptr<Sai2Model::Sai2Model>& robot,
 								 vector<shared_ptr<TemplateTask>>& tasks)
-	: _robot(robot), _tasks(tasks), _enable_gravity_compensation(false) {
+	: _robot(robot),
+	  _tasks(tasks),
+	  _enable_gravity_compensation(false),
+	  _use_nullspace_basis(false) {
 	if (_tasks.size() == 0) {
 		throw std::invalid_argument(
 			"RobotController must have at least one task");
@@ -21,62 +43,442 @@ RobotController::RobotController(std::shared_ptr<Sai2Model::Sai2Model>& robot,
 			throw std::invalid_argument(
 				"All tasks must have the same robot model in RobotController");
 		}
-		if (task->getLoopTimestep() != _tasks[0]->getLoopTimestep()) {
-			throw std::invalid_argument(
-				"All tasks must have the same loop timestep in "
-				"RobotController");
-		}
 		if (std::find(_task_names.begin(), _task_names.end(),
 					  task->getTaskName()) != _task_names.end()) {
 			throw std::invalid_argument(
 				"Tasks in RobotController must have unique names");
 		}
 		_task_names.push_back(task->getTaskName());
+		_task_trace_names.push_back(
+			TraceRecorder::internName(task->getTaskName()));
+	}
+
+	// the controller runs at the rate of the fastest task, and the other tasks
+	// are updated every rate_divider cycles
+	_loop_timestep = _tasks[0]->getLoopTimestep();
+	for (auto& task : _tasks) {
+		_loop_timestep = std::min(_loop_timestep, task->getLoopTimestep());
+	}
+	const int dof = _robot->dof();
+	for (auto& task : _tasks) {
+		const double ratio = task->getLoopTimestep() / _loop_timestep;
+		TaskRateState state;
+		state.rate_divider = std::round(ratio);
+		if (std::abs(ratio - state.rate_divider) >
+			LOOP_TIMESTEP_TOLERANCE * ratio) {
+			throw std::invalid_argument(
+				"All tasks must have a loop timestep that is an integer "
+				"multiple of the smallest one in RobotController");
+		}
+		state.hold_mode = HOLD_TORQUES;
+		state.cycles_since_update = state.rate_divider;
+		state.model_updated = true;
+		state.torques = VectorXd::Zero(dof);
+		state.previous_torques = VectorXd::Zero(dof);
+		state.held_torques = VectorXd::Zero(dof);
+		state.held_torques_coordinates = VectorXd::Zero(dof);
+		state.N_prec = MatrixXd::Identity(dof, dof);
+		state.held_nullspace = MatrixXd::Identity(dof, dof);
+		state.has_torques = false;
+		_task_rate_states.push_back(state);
 	}
+	resetTaskRateStatistics();
+
+	_kinematic_commands_initialized = false;
+	_kinematic_joint_positions = _robot->q();
+	_kinematic_joint_velocities = VectorXd::Zero(dof);
+	_kinematic_inverse_joint_weights = VectorXd::Ones(dof);
+	_kinematic_damping = DEFAULT_KINEMATIC_DAMPING;
+
 	_redundancy_completion_task = std::make_shared<JointTask>(
-		_robot, REDUNDANCY_COMPLETION_TASK_NAME, _tasks[0]->getLoopTimestep());
+		_robot, REDUNDANCY_COMPLETION_TASK_NAME, _loop_timestep);
 	_redundancy_completion_task->disableInternalOtg();
 	_redundancy_completion_task->disableVelocitySaturation();
 	_task_names.push_back(REDUNDANCY_COMPLETION_TASK_NAME);
 }
 
+RobotController::RobotController(std::shared_ptr<Sai2Model::Sai2Model>& robot,
+								 const RobotController& prototype)
+	: _robot(robot),
+	  _task_names(prototype._task_names),
+	  _task_trace_names(prototype._task_trace_names),
+	  _enable_gravity_compensation(prototype._enable_gravity_compensation),
+	  _use_nullspace_basis(prototype._use_nullspace_basis),
+	  _loop_timestep(prototype._loop_timestep) {
+	for (const auto& task : prototype._tasks) {
+		_tasks.push_back(task->cloneTask(_robot));
+	}
+	_redundancy_completion_task =
+		prototype._redundancy_completion_task->clone(_robot);
+
+	const int dof = _robot->dof();
+	for (const auto& prototype_state : prototype._task_rate_states) {
+		TaskRateState state;
+		state.rate_divider = prototype_state.rate_divider;
+		state.hold_mode = prototype_state.hold_mode;
+		state.cycles_since_update = state.rate_divider;
+		state.model_updated = true;
+		state.torques = VectorXd::Zero(dof);
+		state.previous_torques = VectorXd::Zero(dof);
+		state.held_torques = VectorXd::Zero(dof);
+		state.held_torques_coordinates = VectorXd::Zero(dof);
+		state.N_prec = MatrixXd::Identity(dof, dof);
+		state.held_nullspace = MatrixXd::Identity(dof, dof);
+		state.has_torques = false;
+		_task_rate_states.push_back(state);
+	}
+	resetTaskRateStatistics();
+
+	_kinematic_commands_initialized = false;
+	_kinematic_joint_positions = _robot->q();
+	_kinematic_joint_velocities = VectorXd::Zero(dof);
+	_kinematic_inverse_joint_weights =
+		prototype._kinematic_inverse_joint_weights;
+	_kinematic_damping = prototype._kinematic_damping;
+}
+
+std::shared_ptr<RobotController> RobotController::clone(
+	std::shared_ptr<Sai2Model::Sai2Model>& robot) const {
+	if (robot->dof() != _robot->dof()) {
+		throw std::invalid_argument(
+			"The robot model must have the same dof as the prototype in "
+			"RobotController::clone");
+	}
+	return std::shared_ptr<RobotController>(new RobotController(robot, *this));
+}
+
 void RobotController::updateControllerTaskModels() {
+	SAI2_TRACE_SCOPE("updateControllerTaskModels", "RobotController");
+	if (_use_nullspace_basis) {
+		NullspaceBasis N_prec_basis(_robot->M());
+		for (int i = 0; i < _tasks.size(); i++) {
+			SAI2_TRACE_SCOPE(_task_trace_names[i], "task model");
+			TaskRateState& state = _task_rate_states[i];
+			state.model_updated =
+				state.cycles_since_update >= state.rate_divider ||
+				hasPendingEmergencyStopTransition(*_tasks[i]);
+			if (state.rate_divider == 1) {
+				_tasks[i]->updateTaskModel(N_prec_basis);
+				N_prec_basis = _tasks[i]->getTaskAndPreviousNullspaceBasis();
+				continue;
+			}
+			if (state.model_updated) {
+				const auto start = chrono::steady_clock::now();
+				_tasks[i]->updateTaskModel(N_prec_basis);
+				const NullspaceBasis task_and_previous_nullspace_basis =
+					_tasks[i]->getTaskAndPreviousNullspaceBasis();
+				state.held_task_jacobian = N_prec_basis.constraintJacobian(
+					task_and_previous_nullspace_basis);
+				N_prec_basis = task_and_previous_nullspace_basis;
+				state.compute_time += elapsedSeconds(start);
+			} else {
+				// combine the current nullspace of the higher priority tasks
+				// with the constraints of the last update of the slow task, so
+				// that the lower priority tasks stay consistent with the
+				// faster tasks (as the dense path does)
+				const auto start = chrono::steady_clock::now();
+				state.N_prec_basis = N_prec_basis;
+				N_prec_basis =
+					N_prec_basis.restrictedTo(state.held_task_jacobian);
+				state.hold_time += elapsedSeconds(start);
+			}
+		}
+		_redundancy_completion_task->updateTaskModel(N_prec_basis);
+		_redundancy_completion_nullspace_basis = N_prec_basis;
+		return;
+	}
+
 	const int dof = _robot->dof();
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
-	for (auto& task : _tasks) {
-		task->updateTaskModel(N_prec);
-		N_prec = task->getTaskAndPreviousNullspace();
+	for (int i = 0; i < _tasks.size(); i++) {
+		SAI2_TRACE_SCOPE(_task_trace_names[i], "task model");
+		TaskRateState& state = _task_rate_states[i];
+		state.model_updated = state.cycles_since_update >= state.rate_divider ||
+							  hasPendingEmergencyStopTransition(*_tasks[i]);
+		if (state.rate_divider == 1) {
+			_tasks[i]->updateTaskModel(N_prec);
+			N_prec = _tasks[i]->getTaskAndPreviousNullspace();
+			continue;
+		}
+		if (state.model_updated) {
+			const auto start = chrono::steady_clock::now();
+			_tasks[i]->updateTaskModel(N_prec);
+			N_prec = _tasks[i]->getTaskAndPreviousNullspace();
+			state.held_nullspace = N_prec;
+			state.compute_time += elapsedSeconds(start);
+		} else {
+			// combine the current nullspace of the higher priority tasks with
+			// the nullspace of the last update of the slow task, so that the
+			// lower priority tasks stay consistent with the faster tasks
+			const auto start = chrono::steady_clock::now();
+			state.N_prec = N_prec;
+			N_prec.noalias() = state.N_prec * state.held_nullspace;
+			state.hold_time += elapsedSeconds(start);
+		}
 	}
 	_redundancy_completion_task->updateTaskModel(N_prec);
 }
 
 Eigen::VectorXd RobotController::computeControlTorques() {
+	SAI2_TRACE_SCOPE("computeControlTorques", "RobotController");
 	const int dof = _robot->dof();
 	VectorXd control_torques = VectorXd::Zero(dof);
 	VectorXd previous_tasks_disturbance = VectorXd::Zero(dof);
-	for (auto& task : _tasks) {
-		previous_tasks_disturbance = (MatrixXd::Identity(dof, dof) -
-									  task->getTaskNullspace().transpose()) *
-									 control_torques;
-		control_torques += task->computeTorques() - previous_tasks_disturbance;
-	}
-	previous_tasks_disturbance =
-		_redundancy_completion_task->getPreviousTasksNullspace().transpose() *
-		control_torques;
+	for (int i = 0; i < _tasks.size(); i++) {
+		SAI2_TRACE_SCOPE(_task_trace_names[i], "task torques");
+		TaskRateState& state = _task_rate_states[i];
+		previous_tasks_disturbance =
+			control_torques -
+			_tasks[i]->projectTorquesInTaskNullspace(control_torques);
+		if (state.rate_divider == 1) {
+			control_torques +=
+				_tasks[i]->computeTorques() - previous_tasks_disturbance;
+			continue;
+		}
+		if (state.model_updated) {
+			const auto start = chrono::steady_clock::now();
+			state.previous_torques = state.torques;
+			state.torques = _tasks[i]->computeTorques();
+			if (!state.has_torques) {
+				state.previous_torques = state.torques;
+				state.has_torques = true;
+			}
+			control_torques += state.torques - previous_tasks_disturbance;
+			state.cycles_since_update = 0;
+			state.computed_cycles++;
+			state.compute_time += elapsedSeconds(start);
+		} else {
+			// hold or extrapolate the task torques, and project them in the
+			// current nullspace of the higher priority tasks
+			const auto start = chrono::steady_clock::now();
+			state.held_torques = state.torques;
+			if (state.hold_mode == EXTRAPOLATE_TORQUES) {
+				state.held_torques +=
+					(state.torques - state.previous_torques) *
+					((double)state.cycles_since_update / state.rate_divider);
+			}
+			if (_use_nullspace_basis) {
+				const int rank = state.N_prec_basis.rank();
+				state.held_torques_coordinates.head(rank).noalias() =
+					state.N_prec_basis.basis().transpose() * state.held_torques;
+				control_torques.noalias() +=
+					state.N_prec_basis.massWeightedBasis() *
+					state.held_torques_coordinates.head(rank);
+			} else {
+				control_torques.noalias() +=
+					state.N_prec.transpose() * state.held_torques;
+			}
+			control_torques -= previous_tasks_disturbance;
+			state.held_cycles++;
+			state.hold_time += elapsedSeconds(start);
+		}
+		state.cycles_since_update++;
+	}
+	if (_use_nullspace_basis) {
+		previous_tasks_disturbance =
+			_redundancy_completion_nullspace_basis.projectTorques(
+				control_torques);
+	} else {
+		previous_tasks_disturbance =
+			_redundancy_completion_task->getPreviousTasksNullspace()
+				.transpose() *
+			control_torques;
+	}
 	control_torques += _redundancy_completion_task->computeTorques() -
 					   previous_tasks_disturbance;
 
 	if (_enable_gravity_compensation) {
-		control_torques += _robot->jointGravityVector();
+		if (_approximate_dynamics) {
+			control_torques += _approximate_dynamics->jointGravityVector();
+		} else {
+			control_torques += _robot->jointGravityVector();
+		}
 	}
 	return control_torques;
 }
 
+void RobotController::triggerEmergencyStop() {
+	const auto trigger_time = chrono::steady_clock::now();
+	for (auto& task : _tasks) {
+		task->triggerEmergencyStop(trigger_time);
+	}
+	_redundancy_completion_task->triggerEmergencyStop(trigger_time);
+}
+
+void RobotController::releaseEmergencyStop() {
+	for (auto& task : _tasks) {
+		task->releaseEmergencyStop();
+	}
+	_redundancy_completion_task->releaseEmergencyStop();
+}
+
+bool RobotController::isEmergencyStopEngaged() const {
+	for (const auto& task : _tasks) {
+		if (!task->isEmergencyStopEngaged()) {
+			return false;
+		}
+	}
+	return _redundancy_completion_task->isEmergencyStopEngaged();
+}
+
+double RobotController::getMaxEmergencyStopLatency() const {
+	double max_latency =
+		_redundancy_completion_task->getMaxEmergencyStopLatency();
+	for (const auto& task : _tasks) {
+		max_latency = std::max(max_latency, task->getMaxEmergencyStopLatency());
+	}
+	return max_latency;
+}
+
+unsigned long RobotController::getNumLateEmergencyStops() const {
+	unsigned long num_late_stops =
+		_redundancy_completion_task->getNumLateEmergencyStops();
+	for (const auto& task : _tasks) {
+		num_late_stops += task->getNumLateEmergencyStops();
+	}
+	return num_late_stops;
+}
+
 void RobotController::reinitializeTasks() {
 	for (auto& task : _tasks) {
 		task->reInitializeTask();
 	}
 	_redundancy_completion_task->reInitializeTask();
+	// the slow tasks are updated at the next cycle
+	for (auto& state : _task_rate_states) {
+		state.cycles_since_update = state.rate_divider;
+		state.torques.setZero();
+		state.previous_torques.setZero();
+		state.has_torques = false;
+	}
+	_kinematic_commands_initialized = false;
+}
+
+void RobotController::computeKinematicCommands() {
+	SAI2_TRACE_SCOPE("computeKinematicCommands", "RobotController");
+	const int dof = _robot->dof();
+	if (_robot->qSize() != dof) {
+		throw std::runtime_error(
+			"kinematic resolution not supported for robots with spherical "
+			"joints in RobotController::computeKinematicCommands");
+	}
+	for (const auto& state : _task_rate_states) {
+		if (state.rate_divider != 1) {
+			throw std::runtime_error(
+				"all the tasks must run at the controller rate in "
+				"RobotController::computeKinematicCommands");
+		}
+	}
+	if (!_kinematic_commands_initialized) {
+		_kinematic_joint_positions = _robot->q();
+		_kinematic_commands_initialized = true;
+	}
+
+	// recursive task priority resolution:
+	// dq += J_p^# (v - J dq), N -= J_p^# J_p with J_p = J N and the weighted
+	// damped pseudo inverse J_p^# = W^-1 J_p^T (J_p W^-1 J_p^T + d^2 I)^-1
+	_kinematic_joint_velocities.setZero(dof);
+	_kinematic_nullspace.setIdentity(dof, dof);
+	auto resolveTask = [&](TemplateTask& task, const char* trace_name) {
+		SAI2_TRACE_SCOPE(trace_name, "task kinematics");
+		task.computeKinematicTaskQuantities(_kinematic_task_jacobian,
+											_kinematic_task_velocity);
+		const MatrixXd projected_jacobian =
+			_kinematic_task_jacobian * _kinematic_nullspace;
+		const MatrixXd weighted_projected_jacobian_t =
+			_kinematic_inverse_joint_weights.asDiagonal() *
+			projected_jacobian.transpose();
+		MatrixXd A = projected_jacobian * weighted_projected_jacobian_t;
+		A.diagonal().array() += _kinematic_damping * _kinematic_damping;
+		const MatrixXd pseudo_inverse =
+			weighted_projected_jacobian_t *
+			A.ldlt().solve(MatrixXd::Identity(A.rows(), A.cols()));
+		_kinematic_joint_velocities +=
+			pseudo_inverse *
+			(_kinematic_task_velocity -
+			 _kinematic_task_jacobian * _kinematic_joint_velocities);
+		_kinematic_nullspace -= pseudo_inverse * projected_jacobian;
+	};
+	for (int i = 0; i < _tasks.size(); i++) {
+		resolveTask(*_tasks[i], _task_trace_names[i]);
+	}
+	resolveTask(*_redundancy_completion_task, "redundancy_completion_task");
+
+	_kinematic_joint_positions += _kinematic_joint_velocities * _loop_timestep;
+}
+
+void RobotController::setKinematicJointWeights(const VectorXd& joint_weights) {
+	if (joint_weights.size() != _robot->dof()) {
+		throw std::invalid_argument(
+			"joint weights size not consistent with robot dof in "
+			"RobotController::setKinematicJointWeights");
+	}
+	if (joint_weights.minCoeff() <= 0) {
+		throw std::invalid_argument(
+			"joint weights should be strictly positive in "
+			"RobotController::setKinematicJointWeights");
+	}
+	_kinematic_inverse_joint_weights = joint_weights.cwiseInverse();
+}
+
+void RobotController::setKinematicDamping(const double damping) {
+	if (damping < 0) {
+		throw std::invalid_argument(
+			"damping cannot be negative in "
+			"RobotController::setKinematicDamping");
+	}
+	_kinematic_damping = damping;
+}
+
+void RobotController::setTaskRateHoldMode(const std::string& task_name,
+										  const TaskRateHoldMode hold_mode) {
+	_task_rate_states[taskIndex(task_name, "setTaskRateHoldMode")].hold_mode =
+		hold_mode;
+}
+
+TaskRateStatistics RobotController::getTaskRateStatistics(
+	const std::string& task_name) const {
+	const TaskRateState& state =
+		_task_rate_states[taskIndex(task_name, "getTaskRateStatistics")];
+	TaskRateStatistics statistics;
+	statistics.rate_divider = state.rate_divider;
+	statistics.computed_cycles = state.computed_cycles;
+	statistics.held_cycles = state.held_cycles;
+	statistics.average_compute_time =
+		state.computed_cycles > 0 ? state.compute_time / state.computed_cycles
+								  : 0.0;
+	statistics.saved_time =
+		state.held_cycles * statistics.average_compute_time - state.hold_time;
+	return statistics;
+}
+
+void RobotController::resetTaskRateStatistics() {
+	for (auto& state : _task_rate_states) {
+		state.computed_cycles = 0;
+		state.held_cycles = 0;
+		state.compute_time = 0.0;
+		state.hold_time = 0.0;
+	}
+}
+
+bool RobotController::allTaskModelsUpdated() const {
+	for (const auto& state : _task_rate_states) {
+		if (!state.model_updated) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int RobotController::taskIndex(const std::string& task_name,
+							   const std::string& function) const {
+	for (int i = 0; i < _tasks.size(); i++) {
+		if (_tasks[i]->getTaskName() == task_name) {
+			return i;
+		}
+	}
+	throw std::invalid_argument("Task " + task_name +
+								" not found in RobotController::" + function);
 }
 
 std::shared_ptr<JointTask> RobotController::getJointTaskByName(
@@ -14,16 +14,70 @@
 #include <memory>
 #include <vector>
 
+#include "helper_modules/ApproximateDynamics.h"
+#include "helper_modules/TraceRecorder.h"
 #include "tasks/TemplateTask.h"
 #include "tasks/JointTask.h"
 #include "tasks/MotionForceTask.h"
 
 namespace Sai2Primitives {
 
+/**
+ * @brief How the contribution of a task running at a lower rate than the
+ * controller is generated between two of its updates
+ */
+enum TaskRateHoldMode {
+	// hold the last computed task torques
+	HOLD_TORQUES,
+	// extrapolate linearly from the last two computed task torques
+	EXTRAPOLATE_TORQUES,
+};
+
+/**
+ * @brief Timing statistics of a task running at a divided rate
+ */
+struct TaskRateStatistics {
+	// the task is updated every rate_divider controller cycles
+	int rate_divider;
+	// number of cycles where the task model and torques were computed
+	long computed_cycles;
+	// number of cycles where the task contribution was held or extrapolated
+	long held_cycles;
+	// average time of a task model update and torque computation (s)
+	double average_compute_time;
+	// estimated cpu time saved by the held cycles (s)
+	double saved_time;
+};
+
 class RobotController {
 public:
+	/**
+	 * @brief Construct a new Robot Controller
+	 * @details The tasks can run at a lower rate than the controller: the
+	 * controller runs at the rate of the tasks with the smallest loop timestep,
+	 * and a task whose loop timestep is k times larger (k integer) only updates
+	 * its model and computes its torques every k cycles. Its contribution is
+	 * held or extrapolated in between (see setTaskRateHoldMode), and projected
+	 * in the current nullspace of the higher priority tasks so that it does
+	 * not disturb the faster tasks.
+	 */
 	RobotController(std::shared_ptr<Sai2Model::Sai2Model>& robot, std::vector<std::shared_ptr<TemplateTask>>& tasks);
 
+	/**
+	 * @brief Creates a controller with the same tasks and settings as this one
+	 * for another robot model with the same joints, to build many identical
+	 * controllers from a configured prototype. The tasks are cloned (see
+	 * TemplateTask::cloneTask), sharing their immutable configuration with the
+	 * tasks of this controller, and the checks of the constructor are not
+	 * repeated. The approximate dynamics model is not copied since it is tied
+	 * to the robot model of this controller.
+	 *
+	 * @param robot The robot model of the new controller
+	 * @return std::shared_ptr<RobotController> the new controller
+	 */
+	std::shared_ptr<RobotController> clone(
+		std::shared_ptr<Sai2Model::Sai2Model>& robot) const;
+
 	void updateControllerTaskModels();
 
 	Eigen::VectorXd computeControlTorques();
@@ -32,8 +86,72 @@ public:
 		_enable_gravity_compensation = enable_gravity_compensation;
 	}
 
+	/**
+	 * @brief Uses the gravity vector of an approximate dynamics model for the
+	 * gravity compensation instead of computing it from the robot model. The
+	 * approximate model should be updated (instead of the robot model) before
+	 * computing the control torques. Pass nullptr to go back to the robot
+	 * model.
+	 *
+	 * @param approximate_dynamics  The approximate dynamics model of the robot
+	 */
+	void setApproximateDynamicsModel(
+		std::shared_ptr<ApproximateDynamicsModel> approximate_dynamics) {
+		_approximate_dynamics = approximate_dynamics;
+	}
+
 	void reinitializeTasks();
 
+	/**
+	 * @brief Requests an emergency stop of all the tasks (see
+	 * TemplateTask::triggerEmergencyStop). Can be called from any thread, it
+	 * does not lock or allocate. At the next cycle, every task follows its
+	 * precomputed brake trajectory, including the tasks running at a divided
+	 * rate, which are updated at that cycle.
+	 */
+	void triggerEmergencyStop();
+
+	/**
+	 * @brief Releases the emergency stop of all the tasks. Can be called from
+	 * any thread. The tasks hold the state where they stopped until new goals
+	 * are given.
+	 */
+	void releaseEmergencyStop();
+
+	bool isEmergencyStopEngaged() const;
+
+	/**
+	 * @brief Maximum time between an emergency stop request and the end of
+	 * the computation of the braking torques of all the tasks (s), and the
+	 * number of task stops that took longer than one loop timestep
+	 */
+	double getMaxEmergencyStopLatency() const;
+	unsigned long getNumLateEmergencyStops() const;
+
+	/**
+	 * @brief Enables or disables the basis representation of the nullspaces.
+	 * When enabled, each priority level passes a basis of the remaining motion
+	 * space (of size dof x r) to the next one instead of a dense dof x dof
+	 * projector, and the torque projections are done in O(dof * r). The
+	 * motion force tasks only avoid the dense projectors away from
+	 * singularities, and use them in the singularity blending region. Disabled
+	 * by default.
+	 *
+	 * @param enable_nullspace_basis
+	 */
+	void enableNullspaceBasisRepresentation(
+		const bool enable_nullspace_basis = true) {
+		_use_nullspace_basis = enable_nullspace_basis;
+		// the held nullspaces are in the representation of the previous mode,
+		// the slow tasks are updated at the next cycle
+		for (auto& state : _task_rate_states) {
+			state.cycles_since_update = state.rate_divider;
+		}
+	}
+	bool getNullspaceBasisRepresentationEnabled() const {
+		return _use_nullspace_basis;
+	}
+
 	std::shared_ptr<JointTask> getRedundancyCompletionTask() {
 		return _redundancy_completion_task;
 	}
@@ -45,12 +163,158 @@ public:
 		return _task_names;
 	}
 
+	/**
+	 * @brief Gets the tasks of the controller in priority order (without the
+	 * redundancy completion task)
+	 */
+	const std::vector<std::shared_ptr<TemplateTask>>& getTasks() const {
+		return _tasks;
+	}
+
+	/**
+	 * @brief Gets the loop timestep of the controller, the smallest loop
+	 * timestep of its tasks
+	 */
+	double getLoopTimestep() const { return _loop_timestep; }
+
+	/**
+	 * @brief Sets how the contribution of a task running at a divided rate is
+	 * generated between its updates. Defaults to HOLD_TORQUES.
+	 *
+	 * @param task_name
+	 * @param hold_mode
+	 */
+	void setTaskRateHoldMode(const std::string& task_name,
+							 const TaskRateHoldMode hold_mode);
+
+	/**
+	 * @brief Gets the rate divider of a task and the cpu time saved by running
+	 * it at that rate
+	 *
+	 * @param task_name
+	 * @return TaskRateStatistics
+	 */
+	TaskRateStatistics getTaskRateStatistics(
+		const std::string& task_name) const;
+
+	void resetTaskRateStatistics();
+
+	/**
+	 * @brief Whether all the tasks updated their model at the last call to
+	 * updateControllerTaskModels (always true when no task runs at a divided
+	 * rate). A controller reinitialized at such a cycle has its divided rate
+	 * tasks in phase with this one.
+	 */
+	bool allTaskModelsUpdated() const;
+
+	/**
+	 * @brief Kinematic resolution of the task hierarchy, for robots that take
+	 * joint position or velocity commands. It uses the same tasks as the
+	 * torque control but only the robot kinematics (the robot model only needs
+	 * updateKinematics, no mass matrix, inertia or gravity is used): the joint
+	 * velocities are computed by the recursive task priority algorithm with
+	 * weighted damped pseudo inverses and kinematic nullspaces, and
+	 * integrated into joint position commands. Replaces
+	 * updateControllerTaskModels and computeControlTorques in that mode. All
+	 * the tasks must run at the controller rate.
+	 */
+	void computeKinematicCommands();
+
+	/**
+	 * @brief Gets the joint position command of the kinematic resolution. It
+	 * is the integral of the velocity commands from the robot configuration at
+	 * the first call (or at the last reinitialization)
+	 */
+	const VectorXd& getCommandedJointPositions() const {
+		return _kinematic_joint_positions;
+	}
+
+	/**
+	 * @brief Gets the joint velocity command of the kinematic resolution
+	 */
+	const VectorXd& getCommandedJointVelocities() const {
+		return _kinematic_joint_velocities;
+	}
+
+	/**
+	 * @brief Sets the joint weights of the pseudo inverses of the kinematic
+	 * resolution: joints with a higher weight move less. Defaults to 1.
+	 *
+	 * @param joint_weights strictly positive weights, one per dof
+	 */
+	void setKinematicJointWeights(const VectorXd& joint_weights);
+
+	/**
+	 * @brief Sets the damping of the pseudo inverses of the kinematic
+	 * resolution, to bound the joint velocities near singularities. Defaults
+	 * to 1e-2.
+	 */
+	void setKinematicDamping(const double damping);
+
 private:
+	struct TaskRateState {
+		int rate_divider;
+		TaskRateHoldMode hold_mode;
+		// cycles since the last update of the task, the task is updated when
+		// it reaches the rate divider
+		int cycles_since_update;
+		bool model_updated;
+
+		// last two computed task torques
+		bool has_torques;
+		VectorXd torques;
+		VectorXd previous_torques;
+		// torques held or extrapolated at the current held cycle, and their
+		// coordinates in the nullspace basis in basis mode (preallocated for
+		// the full rank)
+		VectorXd held_torques;
+		VectorXd held_torques_coordinates;
+		// nullspace of the higher priority tasks at the last held cycle, to
+		// project the held torques
+		MatrixXd N_prec;
+		NullspaceBasis N_prec_basis;
+		// task and previous nullspace at the last update
+		MatrixXd held_nullspace;
+		// constraints of the task at the last update, in basis mode
+		MatrixXd held_task_jacobian;
+
+		long computed_cycles;
+		long held_cycles;
+		double compute_time;
+		double hold_time;
+	};
+
+	// constructor used by clone
+	RobotController(std::shared_ptr<Sai2Model::Sai2Model>& robot,
+					const RobotController& prototype);
+
+	int taskIndex(const std::string& task_name,
+				  const std::string& function) const;
+
     std::shared_ptr<Sai2Model::Sai2Model> _robot;
 	std::vector<std::shared_ptr<TemplateTask>> _tasks;
 	std::vector<std::string> _task_names;
+	// task names used in the recorded traces
+	std::vector<const char*> _task_trace_names;
 	std::shared_ptr<JointTask> _redundancy_completion_task;
 	bool _enable_gravity_compensation;
+	std::shared_ptr<ApproximateDynamicsModel> _approximate_dynamics;
+
+	bool _use_nullspace_basis;
+	NullspaceBasis _redundancy_completion_nullspace_basis;
+
+	double _loop_timestep;
+	std::vector<TaskRateState> _task_rate_states;
+
+	// kinematic resolution
+	bool _kinematic_commands_initialized;
+	VectorXd _kinematic_joint_positions;
+	VectorXd _kinematic_joint_velocities;
+	VectorXd _kinematic_inverse_joint_weights;
+	double _kinematic_damping;
+	MatrixXd _kinematic_nullspace;
+	MatrixXd _kinematic_task_jacobian;
+	VectorXd _kinematic_task_velocity;
 };
 
 } /* namespace Sai2Primitives */
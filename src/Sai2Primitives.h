@@ -1,7 +1,12 @@
 #include "tasks/JointTask.h"
 #include "tasks/MotionForceTask.h"
+#include "tasks/CollisionAvoidanceTask.h"
 #include "tasks/TemplateTask.h"
 
 #include "POPCBilateralTeleoperation.h"
 #include "RobotController.h"
+#include "BatchedMotionForceController.h"
+#include "TrajectoryPlayback.h"
+#include "ShadowModeChecker.h"
+#include "ColumnarTelemetry.h"
 #include "HapticDeviceController.h"
\ No newline at end of file
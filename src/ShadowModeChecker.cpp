@@ -0,0 +1,337 @@
+#include "ShadowModeChecker.h"
+
+#include <stdexcept>
+
+namespace Sai2Primitives {
+
+namespace {
+const double DEFAULT_TORQUE_TOLERANCE = 1e-6;
+const double DEFAULT_NULLSPACE_TOLERANCE = 1e-6;
+
+ShadowModeStatistics emptyStatistics() {
+	ShadowModeStatistics statistics = {};
+	statistics.last_divergent_cycle = -1;
+	return statistics;
+}
+}  // namespace
+
+ShadowModeChecker::ShadowModeChecker(
+	std::shared_ptr<RobotController> controller,
+	std::shared_ptr<Sai2Model::Sai2Model> mirror_robot,
+	std::shared_ptr<Sai2Model::Sai2Model> reference_robot,
+	BackgroundExecutor& executor, const int snapshot_capacity)
+	: _controller(controller),
+	  _mirror_robot(mirror_robot),
+	  _reference_robot(reference_robot),
+	  _snapshots(
+		  executor, [this](const CycleSnapshot& snapshot) { replay(snapshot); },
+		  [this]() { publishStatistics(); }),
+	  _cycle(0),
+	  _resynchronize_next_snapshot(true),
+	  _torque_tolerance(DEFAULT_TORQUE_TOLERANCE),
+	  _nullspace_tolerance(DEFAULT_NULLSPACE_TOLERANCE),
+	  _reset_statistics_requested(false),
+	  _statistics(emptyStatistics()),
+	  _torque_error_sum(0),
+	  _nullspace_error_sum(0),
+	  _published_statistics(emptyStatistics()) {
+	if (snapshot_capacity <= 0) {
+		throw std::invalid_argument(
+			"snapshot capacity should be strictly positive in "
+			"ShadowModeChecker::ShadowModeChecker\n");
+	}
+	_tasks = sortTasks(_controller);
+	_robot = _tasks.joint_tasks.back()->getConstRobotModel();
+	const int dof = _robot->dof();
+	if (_mirror_robot->dof() != dof || _reference_robot->dof() != dof) {
+		throw std::invalid_argument(
+			"shadow robot models dof not consistent with the production robot "
+			"in ShadowModeChecker::ShadowModeChecker\n");
+	}
+	if (_mirror_robot == _reference_robot ||
+		_mirror_robot.get() == _robot.get() ||
+		_reference_robot.get() == _robot.get()) {
+		throw std::invalid_argument(
+			"the production, mirror and reference controllers need distinct "
+			"robot models in ShadowModeChecker::ShadowModeChecker\n");
+	}
+
+	_mirror_controller = _controller->clone(_mirror_robot);
+	_mirror_tasks = sortTasks(_mirror_controller);
+
+	// the approximate dynamics model is not cloned, so the reference uses the
+	// dynamics of its robot model
+	_reference_controller = _controller->clone(_reference_robot);
+	_reference_controller->enableNullspaceBasisRepresentation(false);
+	_reference_tasks = sortTasks(_reference_controller);
+
+	// the clones follow the desired states of the production tasks
+	for (auto& task : _mirror_tasks.joint_tasks) {
+		task->disableInternalOtg();
+	}
+	for (auto& task : _mirror_tasks.motion_force_tasks) {
+		task->disableInternalOtg();
+	}
+	for (auto& task : _reference_tasks.joint_tasks) {
+		task->disableInternalOtg();
+	}
+	for (auto& task : _reference_tasks.motion_force_tasks) {
+		task->disableInternalOtg();
+	}
+
+	// all the snapshots are allocated here so that capture does not allocate
+	CycleSnapshot snapshot;
+	snapshot.cycle = 0;
+	snapshot.resynchronize = false;
+	snapshot.q = VectorXd::Zero(dof);
+	snapshot.dq = VectorXd::Zero(dof);
+	snapshot.M = MatrixXd::Zero(dof, dof);
+	snapshot.control_torques = VectorXd::Zero(dof);
+	for (const auto& task : _tasks.joint_tasks) {
+		JointTaskInputs inputs;
+		inputs.desired_position = task->getDesiredPosition();
+		inputs.desired_velocity = task->getDesiredVelocity();
+		inputs.desired_acceleration = task->getDesiredAcceleration();
+		snapshot.joint_tasks.push_back(inputs);
+	}
+	snapshot.motion_force_tasks.resize(_tasks.motion_force_tasks.size());
+	_snapshots.allocate(snapshot_capacity, snapshot,
+						_controller->getLoopTimestep());
+}
+
+ShadowModeChecker::~ShadowModeChecker() { waitForReplay(); }
+
+ShadowModeChecker::ControllerTasks ShadowModeChecker::sortTasks(
+	const std::shared_ptr<RobotController>& controller) {
+	ControllerTasks sorted_tasks;
+	for (const auto& task : controller->getTasks()) {
+		switch (task->getTaskType()) {
+			case JOINT_TASK:
+				sorted_tasks.joint_tasks.push_back(
+					std::dynamic_pointer_cast<JointTask>(task));
+				break;
+			case MOTION_FORCE_TASK:
+				sorted_tasks.motion_force_tasks.push_back(
+					std::dynamic_pointer_cast<MotionForceTask>(task));
+				break;
+			default:
+				throw std::invalid_argument(
+					"only joint tasks and motion force tasks are supported in "
+					"ShadowModeChecker::ShadowModeChecker\n");
+		}
+		sorted_tasks.tasks.push_back(task);
+	}
+	sorted_tasks.joint_tasks.push_back(
+		controller->getRedundancyCompletionTask());
+	return sorted_tasks;
+}
+
+void ShadowModeChecker::capture(const VectorXd& control_torques) {
+	if (control_torques.size() != _robot->dof()) {
+		throw std::invalid_argument(
+			"control torques size not consistent with the robot dof in "
+			"ShadowModeChecker::capture\n");
+	}
+	if (_resynchronize_next_snapshot &&
+		!_controller->allTaskModelsUpdated()) {
+		// the clones are reinitialized at a cycle where all the production
+		// tasks update, like the clones do after the reinitialization, so that
+		// the tasks running at a divided rate hold the same torques
+		_cycle++;
+		return;
+	}
+	CycleSnapshot* free_snapshot = _snapshots.beginWrite();
+	if (free_snapshot == nullptr) {
+		// the replay fell behind, the clones are resynchronized at the next
+		// captured cycle
+		_resynchronize_next_snapshot = true;
+		_cycle++;
+		return;
+	}
+
+	CycleSnapshot& snapshot = *free_snapshot;
+	snapshot.cycle = _cycle++;
+	snapshot.resynchronize = _resynchronize_next_snapshot;
+	_resynchronize_next_snapshot = false;
+	snapshot.q = _robot->q();
+	snapshot.dq = _robot->dq();
+	snapshot.M = _robot->M();
+	snapshot.control_torques = control_torques;
+	for (int i = 0; i < _tasks.joint_tasks.size(); i++) {
+		const auto& task = _tasks.joint_tasks[i];
+		JointTaskInputs& inputs = snapshot.joint_tasks[i];
+		inputs.desired_position = task->getDesiredPosition();
+		inputs.desired_velocity = task->getDesiredVelocity();
+		inputs.desired_acceleration = task->getDesiredAcceleration();
+	}
+	for (int i = 0; i < _tasks.motion_force_tasks.size(); i++) {
+		const auto& task = _tasks.motion_force_tasks[i];
+		MotionForceTaskInputs& inputs = snapshot.motion_force_tasks[i];
+		inputs.desired_position = task->getDesiredPosition();
+		inputs.desired_orientation = task->getDesiredOrientation();
+		inputs.desired_linear_velocity = task->getDesiredLinearVelocity();
+		inputs.desired_angular_velocity = task->getDesiredAngularVelocity();
+		inputs.desired_linear_acceleration =
+			task->getDesiredLinearAcceleration();
+		inputs.desired_angular_acceleration =
+			task->getDesiredAngularAcceleration();
+		inputs.sensed_force_sensor_frame = task->getSensedForceSensor();
+		inputs.sensed_moment_sensor_frame = task->getSensedMomentSensor();
+		inputs.goal_force = task->getGoalForceSetpoint();
+		inputs.goal_moment = task->getGoalMomentSetpoint();
+	}
+	_snapshots.commitWrite();
+}
+
+void ShadowModeChecker::setTolerances(const ShadowModeTolerances& tolerances) {
+	if (tolerances.torque < 0 || tolerances.nullspace < 0) {
+		throw std::invalid_argument(
+			"tolerances should be positive in "
+			"ShadowModeChecker::setTolerances\n");
+	}
+	_torque_tolerance = tolerances.torque;
+	_nullspace_tolerance = tolerances.nullspace;
+}
+
+ShadowModeTolerances ShadowModeChecker::getTolerances() const {
+	ShadowModeTolerances tolerances;
+	tolerances.torque = _torque_tolerance;
+	tolerances.nullspace = _nullspace_tolerance;
+	return tolerances;
+}
+
+ShadowModeStatistics ShadowModeChecker::getStatistics() {
+	_published_statistics.update();
+	ShadowModeStatistics statistics = _published_statistics.read();
+	statistics.num_captured_cycles = _snapshots.getNumCapturedCycles();
+	statistics.num_dropped_cycles = _snapshots.getNumDroppedCycles();
+	return statistics;
+}
+
+void ShadowModeChecker::resetStatistics() {
+	_snapshots.resetCycleCounters();
+	_reset_statistics_requested = true;
+}
+
+void ShadowModeChecker::waitForReplay() const { _snapshots.waitForDrain(); }
+
+void ShadowModeChecker::publishStatistics() {
+	_published_statistics.publish(_statistics);
+}
+
+void ShadowModeChecker::replay(const CycleSnapshot& snapshot) {
+	if (_reset_statistics_requested.exchange(false)) {
+		_statistics = emptyStatistics();
+		_torque_error_sum = 0;
+		_nullspace_error_sum = 0;
+	}
+	if (snapshot.resynchronize) {
+		_statistics.num_resynchronizations++;
+	}
+
+	// the mirror uses the production mass matrix (possibly from approximate
+	// dynamics), the reference computes everything
+	applySnapshot(snapshot, _mirror_robot, _mirror_controller, _mirror_tasks,
+				  true);
+	_mirror_controller->updateControllerTaskModels();
+	_mirror_controller->computeControlTorques();
+
+	applySnapshot(snapshot, _reference_robot, _reference_controller,
+				  _reference_tasks, false);
+	_reference_controller->updateControllerTaskModels();
+	const VectorXd reference_torques =
+		_reference_controller->computeControlTorques();
+
+	const double torque_error =
+		(snapshot.control_torques - reference_torques).cwiseAbs().maxCoeff();
+	double nullspace_error = 0;
+	for (int i = 0; i < _reference_tasks.tasks.size(); i++) {
+		const MatrixXd mirror_nullspace = taskAndPreviousNullspace(
+			_mirror_controller, _mirror_tasks.tasks[i]);
+		const MatrixXd reference_nullspace =
+			_reference_tasks.tasks[i]->getTaskAndPreviousNullspace();
+		nullspace_error = std::max(
+			nullspace_error,
+			(mirror_nullspace - reference_nullspace).cwiseAbs().maxCoeff());
+	}
+	bool singularity_divergence = false;
+	for (int i = 0; i < _reference_tasks.motion_force_tasks.size(); i++) {
+		if (_mirror_tasks.motion_force_tasks[i]->getSingularityTypes() !=
+			_reference_tasks.motion_force_tasks[i]->getSingularityTypes()) {
+			singularity_divergence = true;
+		}
+	}
+
+	_statistics.num_checked_cycles++;
+	_torque_error_sum += torque_error;
+	_nullspace_error_sum += nullspace_error;
+	_statistics.max_torque_error =
+		std::max(_statistics.max_torque_error, torque_error);
+	_statistics.max_nullspace_error =
+		std::max(_statistics.max_nullspace_error, nullspace_error);
+	_statistics.mean_torque_error =
+		_torque_error_sum / _statistics.num_checked_cycles;
+	_statistics.mean_nullspace_error =
+		_nullspace_error_sum / _statistics.num_checked_cycles;
+
+	const bool torque_divergence = torque_error > _torque_tolerance;
+	const bool nullspace_divergence = nullspace_error > _nullspace_tolerance;
+	_statistics.num_torque_divergences += torque_divergence;
+	_statistics.num_nullspace_divergences += nullspace_divergence;
+	_statistics.num_singularity_divergences += singularity_divergence;
+	if (torque_divergence || nullspace_divergence || singularity_divergence) {
+		_statistics.num_divergent_cycles++;
+		_statistics.last_divergent_cycle = snapshot.cycle;
+	}
+}
+
+void ShadowModeChecker::applySnapshot(
+	const CycleSnapshot& snapshot,
+	const std::shared_ptr<Sai2Model::Sai2Model>& robot,
+	const std::shared_ptr<RobotController>& controller,
+	const ControllerTasks& tasks, const bool use_snapshot_M) {
+	robot->setQ(snapshot.q);
+	robot->setDq(snapshot.dq);
+	if (use_snapshot_M) {
+		robot->updateModel(snapshot.M);
+	} else {
+		robot->updateModel();
+	}
+	if (snapshot.resynchronize) {
+		// resets the integrators, singularity histories and held torques
+		controller->reinitializeTasks();
+	}
+
+	for (int i = 0; i < tasks.joint_tasks.size(); i++) {
+		const auto& task = tasks.joint_tasks[i];
+		const JointTaskInputs& inputs = snapshot.joint_tasks[i];
+		task->setGoalPosition(inputs.desired_position);
+		task->setGoalVelocity(inputs.desired_velocity);
+		task->setGoalAcceleration(inputs.desired_acceleration);
+	}
+	for (int i = 0; i < tasks.motion_force_tasks.size(); i++) {
+		const auto& task = tasks.motion_force_tasks[i];
+		const MotionForceTaskInputs& inputs = snapshot.motion_force_tasks[i];
+		task->setGoalPosition(inputs.desired_position);
+		task->setGoalOrientation(inputs.desired_orientation);
+		task->setGoalLinearVelocity(inputs.desired_linear_velocity);
+		task->setGoalAngularVelocity(inputs.desired_angular_velocity);
+		task->setGoalLinearAcceleration(inputs.desired_linear_acceleration);
+		task->setGoalAngularAcceleration(inputs.desired_angular_acceleration);
+		task->setGoalForce(inputs.goal_force);
+		task->setGoalMoment(inputs.goal_moment);
+		task->updateSensedForceAndMoment(inputs.sensed_force_sensor_frame,
+										 inputs.sensed_moment_sensor_frame);
+	}
+}
+
+MatrixXd ShadowModeChecker::taskAndPreviousNullspace(
+	const std::shared_ptr<RobotController>& controller,
+	const std::shared_ptr<TemplateTask>& task) const {
+	if (controller->getNullspaceBasisRepresentationEnabled()) {
+		return task->getTaskAndPreviousNullspaceBasis().toProjector();
+	}
+	return task->getTaskAndPreviousNullspace();
+}
+
+}  // namespace Sai2Primitives
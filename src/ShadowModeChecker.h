@@ -0,0 +1,259 @@
+/**
+ * ShadowModeChecker.h
+ *
+ *	Runs a reference implementation of a RobotController in the background and
+ * compares it with the production controller, to validate the optimized
+ * execution paths (nullspace basis representation, approximate dynamics
+ * tables) on the real robot. At each cycle, the control
+ * thread copies the inputs of the cycle (robot state, mass matrix, desired
+ * states of the tasks, sensed and goal forces) and the production torques
+ * into a preallocated ring of snapshots. The snapshots are replayed in order
+ * on a BackgroundExecutor through two clones of the production controller:
+ *
+ * - a mirror, with the same settings as the production controller and fed
+ * with the production mass matrix, that reproduces the production nullspaces
+ * and singularity classifications (extracting them from the production
+ * controller would cost time on the control thread)
+ * - the reference, with all the fast paths disabled: dense nullspace
+ * projectors and dynamics computed by the robot model
+ *
+ * Both clones keep the rate dividers of the production tasks. They are
+ * (re)initialized at a captured cycle where all the production tasks update
+ * their model, so that the tasks running at a divided rate update at the same
+ * cycles as the production ones and hold the same contributions in between.
+ * The cycles waiting for such a cycle are not captured.
+ *
+ * The control torques of the production controller, and the nullspaces and
+ * singularity classifications of the mirror, are compared with the reference
+ * against configurable tolerances, and the divergences are accumulated in
+ * statistics.
+ *
+ * The trajectory generators of the clones are disabled and their tasks follow
+ * the desired states computed by the production tasks, so the asynchronous or
+ * shared trajectory generation of the production controller is not replayed.
+ * The configuration of the production controller (gains, selections...) is
+ * copied when the checker is created, later changes are not mirrored. Only the
+ * torque control mode is checked (not the kinematic resolution), only joint
+ * tasks and motion force tasks are supported, and the emergency stops of the
+ * production controller are not replayed.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_SHADOW_MODE_CHECKER_H
+#define SAI2_PRIMITIVES_SHADOW_MODE_CHECKER_H
+
+#include <Eigen/Dense>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "RobotController.h"
+#include "helper_modules/BackgroundExecutor.h"
+#include "helper_modules/SnapshotRing.h"
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+/**
+ * @brief      Tolerances of the comparison with the reference implementation
+ */
+struct ShadowModeTolerances {
+	// maximum absolute difference of the control torques
+	double torque;
+	// maximum absolute difference of the coefficients of the nullspace
+	// projectors of the tasks (task and previous tasks nullspace)
+	double nullspace;
+};
+
+/**
+ * @brief      Divergence statistics between the production and reference
+ * implementations
+ */
+struct ShadowModeStatistics {
+	// cycles copied by the control thread
+	unsigned long num_captured_cycles;
+	// cycles not copied because the snapshot ring was full (the background
+	// thread fell behind)
+	unsigned long num_dropped_cycles;
+	// reinitializations of the tasks of the clones, at the first captured
+	// cycle and after dropped cycles (their integrators and singularity
+	// histories restart from zero, unlike the production ones)
+	unsigned long num_resynchronizations;
+	// cycles replayed and compared
+	unsigned long num_checked_cycles;
+	// cycles where at least one of the comparisons exceeded its tolerance
+	unsigned long num_divergent_cycles;
+	unsigned long num_torque_divergences;
+	unsigned long num_nullspace_divergences;
+	unsigned long num_singularity_divergences;
+	// maximum absolute difference over the torques (resp. the nullspace
+	// projector coefficients), maximum and mean over the checked cycles
+	double max_torque_error;
+	double mean_torque_error;
+	double max_nullspace_error;
+	double mean_nullspace_error;
+	// index of the last divergent captured cycle, -1 if none
+	long last_divergent_cycle;
+};
+
+class ShadowModeChecker {
+public:
+	/**
+	 * @brief      Creates the checker and clones the production controller.
+	 * To be called from the control thread (or while it does not run the
+	 * controller), after the controller is configured.
+	 *
+	 * @param[in]  controller          The production controller
+	 * @param[in]  mirror_robot        A robot model with the same joints as
+	 *                                 the production robot (same URDF), used
+	 *                                 by the mirror controller
+	 * @param[in]  reference_robot     Another robot model with the same
+	 *                                 joints, used by the reference controller
+	 * @param[in]  executor            The executor where the replay runs
+	 * @param[in]  snapshot_capacity   The number of cycles that can wait for
+	 *                                 the replay before cycles are dropped
+	 */
+	ShadowModeChecker(
+		std::shared_ptr<RobotController> controller,
+		std::shared_ptr<Sai2Model::Sai2Model> mirror_robot,
+		std::shared_ptr<Sai2Model::Sai2Model> reference_robot,
+		BackgroundExecutor& executor = BackgroundExecutor::instance(),
+		const int snapshot_capacity = 64);
+
+	/**
+	 * @brief      Waits for the replay of the pending snapshots to stop
+	 */
+	~ShadowModeChecker();
+
+	// disallow copy and asssign constructors
+	ShadowModeChecker(ShadowModeChecker const&) = delete;
+	ShadowModeChecker& operator=(ShadowModeChecker const&) = delete;
+
+	/**
+	 * @brief      Copies the inputs of the current cycle and the production
+	 * torques, and schedules their replay. To be called from the control
+	 * thread after computeControlTorques, and after the sensed forces of the
+	 * motion force tasks are updated. Does not allocate and does not block.
+	 *
+	 * @param[in]  control_torques  The torques computed by the production
+	 *                              controller at this cycle
+	 */
+	void capture(const VectorXd& control_torques);
+
+	/**
+	 * @brief      Sets the tolerances of the comparisons. Defaults to 1e-6 for
+	 * the torques and for the nullspaces, which only tolerates rounding
+	 * differences. Looser tolerances are needed with approximate dynamics.
+	 * Takes effect for the cycles replayed after the call.
+	 */
+	void setTolerances(const ShadowModeTolerances& tolerances);
+	ShadowModeTolerances getTolerances() const;
+
+	/**
+	 * @brief      Gets the statistics published by the last replay. To be
+	 * called from a single thread.
+	 */
+	ShadowModeStatistics getStatistics();
+
+	/**
+	 * @brief      Resets the statistics (the replay statistics are reset at the
+	 * next replayed cycle)
+	 */
+	void resetStatistics();
+
+	/**
+	 * @brief      Blocks until the captured snapshots are replayed. Not to be
+	 * called from the control thread.
+	 */
+	void waitForReplay() const;
+
+private:
+	struct JointTaskInputs {
+		VectorXd desired_position;
+		VectorXd desired_velocity;
+		VectorXd desired_acceleration;
+	};
+
+	struct MotionForceTaskInputs {
+		Vector3d desired_position;
+		Matrix3d desired_orientation;
+		Vector3d desired_linear_velocity;
+		Vector3d desired_angular_velocity;
+		Vector3d desired_linear_acceleration;
+		Vector3d desired_angular_acceleration;
+		Vector3d sensed_force_sensor_frame;
+		Vector3d sensed_moment_sensor_frame;
+		Vector3d goal_force;
+		Vector3d goal_moment;
+	};
+
+	struct CycleSnapshot {
+		long cycle;
+		// the clones are reinitialized before replaying this cycle
+		bool resynchronize;
+		VectorXd q;
+		VectorXd dq;
+		MatrixXd M;
+		VectorXd control_torques;
+		std::vector<JointTaskInputs> joint_tasks;
+		std::vector<MotionForceTaskInputs> motion_force_tasks;
+	};
+
+	// tasks of a controller, sorted by type in the same order as the tasks
+	// of the production controller (the redundancy completion task is the
+	// last joint task)
+	struct ControllerTasks {
+		std::vector<std::shared_ptr<JointTask>> joint_tasks;
+		std::vector<std::shared_ptr<MotionForceTask>> motion_force_tasks;
+		// all the tasks in priority order, for the nullspaces
+		std::vector<std::shared_ptr<TemplateTask>> tasks;
+	};
+
+	static ControllerTasks sortTasks(
+		const std::shared_ptr<RobotController>& controller);
+
+	// background side
+	void publishStatistics();
+	void replay(const CycleSnapshot& snapshot);
+	void applySnapshot(const CycleSnapshot& snapshot,
+					   const std::shared_ptr<Sai2Model::Sai2Model>& robot,
+					   const std::shared_ptr<RobotController>& controller,
+					   const ControllerTasks& tasks, const bool use_snapshot_M);
+	MatrixXd taskAndPreviousNullspace(
+		const std::shared_ptr<RobotController>& controller,
+		const std::shared_ptr<TemplateTask>& task) const;
+
+	std::shared_ptr<RobotController> _controller;
+	std::shared_ptr<const Sai2Model::Sai2Model> _robot;
+	ControllerTasks _tasks;
+
+	std::shared_ptr<Sai2Model::Sai2Model> _mirror_robot;
+	std::shared_ptr<RobotController> _mirror_controller;
+	ControllerTasks _mirror_tasks;
+
+	std::shared_ptr<Sai2Model::Sai2Model> _reference_robot;
+	std::shared_ptr<RobotController> _reference_controller;
+	ControllerTasks _reference_tasks;
+
+	// snapshots of the control thread, replayed on the executor
+	SnapshotRing<CycleSnapshot> _snapshots;
+
+	// control thread side
+	long _cycle;
+	bool _resynchronize_next_snapshot;
+
+	// background side
+	std::atomic<double> _torque_tolerance;
+	std::atomic<double> _nullspace_tolerance;
+	std::atomic<bool> _reset_statistics_requested;
+	ShadowModeStatistics _statistics;
+	double _torque_error_sum;
+	double _nullspace_error_sum;
+	ResultSlot<ShadowModeStatistics> _published_statistics;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_SHADOW_MODE_CHECKER_H
@@ -0,0 +1,372 @@
+#include "TrajectoryPlayback.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace Sai2Primitives {
+
+namespace {
+const char TRAJECTORY_FILE_MAGIC[8] = {'S', 'A', 'I', '2', 'T', 'R', 'J', '\0'};
+const uint32_t TRAJECTORY_FILE_VERSION = 1;
+const double DEFAULT_PREFETCH_WINDOW = 1.0;
+// madvise calls that can wait for the executor
+const int PAGE_REQUEST_CAPACITY = 16;
+
+TrajectoryFileHeader makeHeader(const TrajectoryType type,
+								const uint32_t position_size,
+								const uint32_t velocity_size,
+								const double sample_period) {
+	TrajectoryFileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, TRAJECTORY_FILE_MAGIC, sizeof(header.magic));
+	header.version = TRAJECTORY_FILE_VERSION;
+	header.type = type;
+	header.position_size = position_size;
+	header.velocity_size = velocity_size;
+	header.sample_period = sample_period;
+	header.num_samples = 0;
+	return header;
+}
+
+// cubic hermite interpolation of a position and its derivative on a segment of
+// duration T, at the normalized time s in [0, 1]
+template <typename Derived>
+void hermiteInterpolation(const Eigen::MatrixBase<Derived>& p0,
+						  const Eigen::MatrixBase<Derived>& v0,
+						  const Eigen::MatrixBase<Derived>& p1,
+						  const Eigen::MatrixBase<Derived>& v1, const double T,
+						  const double s, Eigen::Ref<VectorXd> position,
+						  Eigen::Ref<VectorXd> velocity) {
+	const double s2 = s * s;
+	const double s3 = s2 * s;
+	position = (2 * s3 - 3 * s2 + 1) * p0 + (s3 - 2 * s2 + s) * T * v0 +
+			   (-2 * s3 + 3 * s2) * p1 + (s3 - s2) * T * v1;
+	velocity = ((6 * s2 - 6 * s) * p0 + (-6 * s2 + 6 * s) * p1) / T +
+			   (3 * s2 - 4 * s + 1) * v0 + (3 * s2 - 2 * s) * v1;
+}
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+// TrajectoryFileWriter
+////////////////////////////////////////////////////////////////////////////////
+
+TrajectoryFileWriter::TrajectoryFileWriter(const std::string& filename,
+										   const int dof,
+										   const double sample_period) {
+	if (dof <= 0 || sample_period <= 0) {
+		throw std::invalid_argument(
+			"dof and sample period should be strictly positive in "
+			"TrajectoryFileWriter::TrajectoryFileWriter\n");
+	}
+	_header = makeHeader(JOINT_TRAJECTORY, dof, dof, sample_period);
+	open(filename);
+}
+
+TrajectoryFileWriter::TrajectoryFileWriter(const std::string& filename,
+										   const double sample_period) {
+	if (sample_period <= 0) {
+		throw std::invalid_argument(
+			"sample period should be strictly positive in "
+			"TrajectoryFileWriter::TrajectoryFileWriter\n");
+	}
+	_header = makeHeader(CARTESIAN_TRAJECTORY, 7, 6, sample_period);
+	open(filename);
+}
+
+TrajectoryFileWriter::~TrajectoryFileWriter() { close(); }
+
+void TrajectoryFileWriter::open(const std::string& filename) {
+	_file.open(filename, std::ios::binary | std::ios::trunc);
+	if (!_file.is_open()) {
+		throw std::invalid_argument("could not open file " + filename +
+									" in TrajectoryFileWriter::open\n");
+	}
+	_file.write(reinterpret_cast<const char*>(&_header), sizeof(_header));
+}
+
+void TrajectoryFileWriter::addSample(const VectorXd& position,
+									 const VectorXd& velocity,
+									 const VectorXd& acceleration) {
+	if (_header.type != JOINT_TRAJECTORY) {
+		throw std::invalid_argument(
+			"joint sample added to a cartesian trajectory in "
+			"TrajectoryFileWriter::addSample\n");
+	}
+	if (position.size() != _header.position_size ||
+		velocity.size() != _header.velocity_size ||
+		acceleration.size() != _header.velocity_size) {
+		throw std::invalid_argument(
+			"sample size not consistent with the trajectory dof in "
+			"TrajectoryFileWriter::addSample\n");
+	}
+	_file.write(reinterpret_cast<const char*>(position.data()),
+				position.size() * sizeof(double));
+	_file.write(reinterpret_cast<const char*>(velocity.data()),
+				velocity.size() * sizeof(double));
+	_file.write(reinterpret_cast<const char*>(acceleration.data()),
+				acceleration.size() * sizeof(double));
+	_header.num_samples++;
+}
+
+void TrajectoryFileWriter::addSample(const Vector3d& position,
+									 const Matrix3d& orientation,
+									 const Vector3d& linear_velocity,
+									 const Vector3d& angular_velocity,
+									 const Vector3d& linear_acceleration,
+									 const Vector3d& angular_acceleration) {
+	if (_header.type != CARTESIAN_TRAJECTORY) {
+		throw std::invalid_argument(
+			"cartesian sample added to a joint trajectory in "
+			"TrajectoryFileWriter::addSample\n");
+	}
+	const Quaterniond quaternion(orientation);
+	double record[19];
+	Map<Vector3d>(record + 0) = position;
+	record[3] = quaternion.w();
+	record[4] = quaternion.x();
+	record[5] = quaternion.y();
+	record[6] = quaternion.z();
+	Map<Vector3d>(record + 7) = linear_velocity;
+	Map<Vector3d>(record + 10) = angular_velocity;
+	Map<Vector3d>(record + 13) = linear_acceleration;
+	Map<Vector3d>(record + 16) = angular_acceleration;
+	_file.write(reinterpret_cast<const char*>(record), sizeof(record));
+	_header.num_samples++;
+}
+
+void TrajectoryFileWriter::close() {
+	if (!_file.is_open()) {
+		return;
+	}
+	_file.seekp(0);
+	_file.write(reinterpret_cast<const char*>(&_header), sizeof(_header));
+	_file.close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TrajectoryPlayback
+////////////////////////////////////////////////////////////////////////////////
+
+TrajectoryPlayback::TrajectoryPlayback(const std::string& filename,
+									   BackgroundExecutor* executor)
+	: _fd(-1),
+	  _mapping(MAP_FAILED),
+	  _mapping_size(0),
+	  _prefetched_until(0),
+	  _released_until(0),
+	  _finished(false),
+	  _page_requests(executor ? *executor : BackgroundExecutor::instance(),
+					 [this](const PageRequest& request) {
+						 madvise(static_cast<char*>(_mapping) + request.start,
+								 request.length, request.advice);
+					 }) {
+	_fd = ::open(filename.c_str(), O_RDONLY);
+	if (_fd < 0) {
+		throw std::invalid_argument("could not open file " + filename +
+									" in TrajectoryPlayback::TrajectoryPlayback\n");
+	}
+	struct stat file_stat;
+	if (fstat(_fd, &file_stat) != 0 ||
+		file_stat.st_size < (off_t)sizeof(TrajectoryFileHeader)) {
+		::close(_fd);
+		throw std::invalid_argument(
+			"file " + filename +
+			" is not a trajectory file in "
+			"TrajectoryPlayback::TrajectoryPlayback\n");
+	}
+	_mapping_size = file_stat.st_size;
+	_mapping = mmap(nullptr, _mapping_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (_mapping == MAP_FAILED) {
+		::close(_fd);
+		throw std::invalid_argument("could not map file " + filename +
+									" in TrajectoryPlayback::TrajectoryPlayback\n");
+	}
+	madvise(_mapping, _mapping_size, MADV_SEQUENTIAL);
+
+	std::memcpy(&_header, _mapping, sizeof(_header));
+	_record_size = _header.position_size + 2 * _header.velocity_size;
+	const bool valid_sizes =
+		(_header.type == JOINT_TRAJECTORY &&
+		 _header.position_size == _header.velocity_size &&
+		 _header.position_size > 0) ||
+		(_header.type == CARTESIAN_TRAJECTORY && _header.position_size == 7 &&
+		 _header.velocity_size == 6);
+	if (std::memcmp(_header.magic, TRAJECTORY_FILE_MAGIC,
+					sizeof(_header.magic)) != 0 ||
+		_header.version != TRAJECTORY_FILE_VERSION || !valid_sizes ||
+		_header.sample_period <= 0 || _header.num_samples == 0 ||
+		_mapping_size < sizeof(_header) + _header.num_samples * _record_size *
+											  sizeof(double)) {
+		munmap(_mapping, _mapping_size);
+		::close(_fd);
+		throw std::invalid_argument(
+			"file " + filename +
+			" is not a valid trajectory file in "
+			"TrajectoryPlayback::TrajectoryPlayback\n");
+	}
+	_samples = reinterpret_cast<const double*>(
+		static_cast<const char*>(_mapping) + sizeof(_header));
+	_page_size = sysconf(_SC_PAGESIZE);
+	setPrefetchWindow(DEFAULT_PREFETCH_WINDOW);
+
+	if (_header.type == JOINT_TRAJECTORY) {
+		_joint_position.setZero(_header.position_size);
+		_joint_velocity.setZero(_header.velocity_size);
+		_joint_acceleration.setZero(_header.velocity_size);
+	}
+	update(0.0);
+}
+
+TrajectoryPlayback::~TrajectoryPlayback() {
+	// the queued madvise calls refer to the mapping
+	_page_requests.waitForDrain();
+	munmap(_mapping, _mapping_size);
+	::close(_fd);
+}
+
+double TrajectoryPlayback::getDuration() const {
+	return (_header.num_samples - 1) * _header.sample_period;
+}
+
+void TrajectoryPlayback::setPrefetchWindow(const double window_duration) {
+	if (window_duration <= 0) {
+		throw std::invalid_argument(
+			"prefetch window should be strictly positive in "
+			"TrajectoryPlayback::setPrefetchWindow\n");
+	}
+	_window_samples =
+		std::max<uint64_t>(1, std::ceil(window_duration / _header.sample_period));
+	// the prefetched pages last for one window, which is the time budget of
+	// the executor for a full queue
+	_page_requests.waitForDrain();
+	_page_requests.allocate(PAGE_REQUEST_CAPACITY, PageRequest{0, 0, 0},
+							window_duration / PAGE_REQUEST_CAPACITY);
+}
+
+const double* TrajectoryPlayback::sample(const uint64_t index) const {
+	return _samples + index * _record_size;
+}
+
+void TrajectoryPlayback::managePages(const uint64_t index) {
+	char* base = static_cast<char*>(_mapping);
+	const size_t offset = reinterpret_cast<const char*>(sample(index)) - base;
+	const size_t window_bytes = _window_samples * _record_size * sizeof(double);
+
+	// prefetch two windows ahead once less than one window is prefetched
+	if (offset + window_bytes > _prefetched_until &&
+		_prefetched_until < _mapping_size) {
+		const size_t start = std::max(_prefetched_until, offset) /
+							 _page_size * _page_size;
+		const size_t end =
+			std::min(_mapping_size, offset + 2 * window_bytes);
+		if (requestPages(start, end, MADV_WILLNEED)) {
+			_prefetched_until = end;
+		}
+	}
+
+	// release the pages more than one window behind
+	if (offset > window_bytes) {
+		const size_t release_end =
+			(offset - window_bytes) / _page_size * _page_size;
+		if (release_end > _released_until + window_bytes &&
+			requestPages(_released_until, release_end, MADV_DONTNEED)) {
+			_released_until = release_end;
+		}
+	}
+	// after a backward jump, the released pages are faulted back in
+	if (offset < _released_until) {
+		_released_until = offset / _page_size * _page_size;
+		_prefetched_until = std::min(_prefetched_until, _released_until);
+	}
+}
+
+bool TrajectoryPlayback::requestPages(const size_t start, const size_t end,
+									  const int advice) {
+	PageRequest* request = _page_requests.beginWrite();
+	if (request == nullptr) {
+		return false;
+	}
+	request->start = start;
+	request->length = end - start;
+	request->advice = advice;
+	_page_requests.commitWrite();
+	return true;
+}
+
+void TrajectoryPlayback::update(const double time) {
+	const double T = _header.sample_period;
+	const uint64_t last_index = _header.num_samples - 1;
+	const double clamped_time = std::clamp(time, 0.0, getDuration());
+	_finished = time >= getDuration();
+
+	uint64_t index = std::min<uint64_t>(clamped_time / T, last_index);
+	uint64_t next_index = std::min(index + 1, last_index);
+	const double s =
+		next_index == index ? 0.0 : clamped_time / T - (double)index;
+	managePages(index);
+
+	const int p = _header.position_size;
+	const int v = _header.velocity_size;
+	const double* s0 = sample(index);
+	const double* s1 = sample(next_index);
+
+	if (_header.type == JOINT_TRAJECTORY) {
+		hermiteInterpolation(Map<const VectorXd>(s0, p),
+							 Map<const VectorXd>(s0 + p, v),
+							 Map<const VectorXd>(s1, p),
+							 Map<const VectorXd>(s1 + p, v), T, s,
+							 _joint_position, _joint_velocity);
+		_joint_acceleration = (1 - s) * Map<const VectorXd>(s0 + p + v, v) +
+							  s * Map<const VectorXd>(s1 + p + v, v);
+		return;
+	}
+
+	hermiteInterpolation(Map<const Vector3d>(s0), Map<const Vector3d>(s0 + 7),
+						 Map<const Vector3d>(s1), Map<const Vector3d>(s1 + 7), T,
+						 s, _position, _linear_velocity);
+	const Quaterniond q0(s0[3], s0[4], s0[5], s0[6]);
+	const Quaterniond q1(s1[3], s1[4], s1[5], s1[6]);
+	_orientation = q0.slerp(s, q1).normalized().toRotationMatrix();
+	_angular_velocity = (1 - s) * Map<const Vector3d>(s0 + 10) +
+						s * Map<const Vector3d>(s1 + 10);
+	_linear_acceleration = (1 - s) * Map<const Vector3d>(s0 + 13) +
+						   s * Map<const Vector3d>(s1 + 13);
+	_angular_acceleration = (1 - s) * Map<const Vector3d>(s0 + 16) +
+							s * Map<const Vector3d>(s1 + 16);
+}
+
+void TrajectoryPlayback::feedGoals(JointTask& task, const double time) {
+	if (_header.type != JOINT_TRAJECTORY) {
+		throw std::invalid_argument(
+			"cartesian trajectory cannot be fed to a JointTask in "
+			"TrajectoryPlayback::feedGoals\n");
+	}
+	update(time);
+	task.setGoalPosition(_joint_position);
+	task.setGoalVelocity(_joint_velocity);
+	task.setGoalAcceleration(_joint_acceleration);
+}
+
+void TrajectoryPlayback::feedGoals(MotionForceTask& task, const double time) {
+	if (_header.type != CARTESIAN_TRAJECTORY) {
+		throw std::invalid_argument(
+			"joint trajectory cannot be fed to a MotionForceTask in "
+			"TrajectoryPlayback::feedGoals\n");
+	}
+	update(time);
+	task.setGoalPosition(_position);
+	task.setGoalOrientation(_orientation);
+	task.setGoalLinearVelocity(_linear_velocity);
+	task.setGoalAngularVelocity(_angular_velocity);
+	task.setGoalLinearAcceleration(_linear_acceleration);
+	task.setGoalAngularAcceleration(_angular_acceleration);
+}
+
+}  // namespace Sai2Primitives
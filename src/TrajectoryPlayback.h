@@ -0,0 +1,253 @@
+/**
+ * TrajectoryPlayback.h
+ *
+ *	Playback of long recorded trajectories (joint or cartesian) from a compact
+ * binary file. The file is memory mapped, so opening it takes constant time
+ * whatever its length, and only a window around the playback time is kept
+ * resident: the pages ahead are prefetched and the pages already played are
+ * released, so the memory usage stays flat. The prefetch and release system
+ * calls run on a BackgroundExecutor, the control thread only queues them. The
+ * samples are interpolated at the requested time and fed as goals to a
+ * JointTask or MotionForceTask.
+ * TrajectoryFileWriter writes the files.
+ *
+ * File layout: a 64 bytes header, then num_samples records of
+ * position_size + 2 * velocity_size doubles (position, velocity,
+ * acceleration). Joint trajectories have position_size = velocity_size = dof.
+ * Cartesian trajectories have a position [x y z qw qx qy qz] and a velocity
+ * [linear angular].
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_TRAJECTORY_PLAYBACK_H
+#define SAI2_PRIMITIVES_TRAJECTORY_PLAYBACK_H
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "helper_modules/BackgroundExecutor.h"
+#include "helper_modules/SnapshotRing.h"
+#include "tasks/JointTask.h"
+#include "tasks/MotionForceTask.h"
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+enum TrajectoryType : uint32_t {
+	JOINT_TRAJECTORY = 0,
+	CARTESIAN_TRAJECTORY = 1,
+};
+
+/**
+ * @brief      Header of a trajectory file
+ */
+struct TrajectoryFileHeader {
+	char magic[8];
+	uint32_t version;
+	TrajectoryType type;
+	uint32_t position_size;
+	uint32_t velocity_size;
+	double sample_period;
+	uint64_t num_samples;
+	uint8_t reserved[24];
+};
+static_assert(sizeof(TrajectoryFileHeader) == 64,
+			  "unexpected trajectory file header size");
+
+class TrajectoryFileWriter {
+public:
+	/**
+	 * @brief      Creates a joint trajectory file
+	 *
+	 * @param[in]  filename       The file name
+	 * @param[in]  dof            The number of joints
+	 * @param[in]  sample_period  The sample period (s)
+	 */
+	TrajectoryFileWriter(const std::string& filename, const int dof,
+						 const double sample_period);
+
+	/**
+	 * @brief      Creates a cartesian trajectory file
+	 *
+	 * @param[in]  filename       The file name
+	 * @param[in]  sample_period  The sample period (s)
+	 */
+	TrajectoryFileWriter(const std::string& filename,
+						 const double sample_period);
+
+	~TrajectoryFileWriter();
+
+	// disallow copy and asssign constructors
+	TrajectoryFileWriter(TrajectoryFileWriter const&) = delete;
+	TrajectoryFileWriter& operator=(TrajectoryFileWriter const&) = delete;
+
+	/**
+	 * @brief      Appends a joint sample
+	 */
+	void addSample(const VectorXd& position, const VectorXd& velocity,
+				   const VectorXd& acceleration);
+
+	/**
+	 * @brief      Appends a cartesian sample
+	 */
+	void addSample(const Vector3d& position, const Matrix3d& orientation,
+				   const Vector3d& linear_velocity,
+				   const Vector3d& angular_velocity,
+				   const Vector3d& linear_acceleration,
+				   const Vector3d& angular_acceleration);
+
+	/**
+	 * @brief      Writes the number of samples in the header and closes the
+	 * file. Called by the destructor if needed.
+	 */
+	void close();
+
+	uint64_t getNumSamples() const { return _header.num_samples; }
+
+private:
+	void open(const std::string& filename);
+
+	std::ofstream _file;
+	TrajectoryFileHeader _header;
+};
+
+class TrajectoryPlayback {
+public:
+	/**
+	 * @brief      Maps a trajectory file. Throws if the file cannot be mapped
+	 * or is not a valid trajectory file.
+	 *
+	 * @param[in]  filename  The file name
+	 * @param[in]  executor  The executor running the prefetch and release of
+	 *                       the pages, or nullptr for the shared one
+	 */
+	TrajectoryPlayback(const std::string& filename,
+					   BackgroundExecutor* executor = nullptr);
+	~TrajectoryPlayback();
+
+	// disallow copy and asssign constructors
+	TrajectoryPlayback(TrajectoryPlayback const&) = delete;
+	TrajectoryPlayback& operator=(TrajectoryPlayback const&) = delete;
+
+	TrajectoryType getType() const { return _header.type; }
+	int getPositionSize() const { return _header.position_size; }
+	int getVelocitySize() const { return _header.velocity_size; }
+	uint64_t getNumSamples() const { return _header.num_samples; }
+	double getSamplePeriod() const { return _header.sample_period; }
+	double getDuration() const;
+
+	/**
+	 * @brief      Sets the duration of trajectory prefetched ahead of the
+	 * playback time, and kept resident behind it. Defaults to 1 second. Waits
+	 * for the pending prefetch and release requests, so it should not be
+	 * called from the control thread.
+	 */
+	void setPrefetchWindow(const double window_duration);
+
+	/**
+	 * @brief      Interpolates the trajectory at the given time (clamped to
+	 * the duration of the trajectory), and queues the prefetch and release of
+	 * the pages around it. Does not allocate and does not make system calls.
+	 *
+	 * @param[in]  time  The playback time (s)
+	 */
+	void update(const double time);
+
+	/**
+	 * @brief      Whether the last update was at or after the end of the
+	 * trajectory
+	 */
+	bool isFinished() const { return _finished; }
+
+	/**
+	 * @brief      Number of prefetch or release requests dropped because the
+	 * executor fell behind. The corresponding pages are requested again at
+	 * the next updates.
+	 */
+	unsigned long getNumDroppedPageRequests() const {
+		return _page_requests.getNumDroppedCycles();
+	}
+
+	/**
+	 * @brief      Interpolated joint position, velocity and acceleration (joint
+	 * trajectories)
+	 */
+	const VectorXd& getJointPosition() const { return _joint_position; }
+	const VectorXd& getJointVelocity() const { return _joint_velocity; }
+	const VectorXd& getJointAcceleration() const {
+		return _joint_acceleration;
+	}
+
+	/**
+	 * @brief      Interpolated cartesian pose, velocity and acceleration
+	 * (cartesian trajectories)
+	 */
+	const Vector3d& getPosition() const { return _position; }
+	const Matrix3d& getOrientation() const { return _orientation; }
+	const Vector3d& getLinearVelocity() const { return _linear_velocity; }
+	const Vector3d& getAngularVelocity() const { return _angular_velocity; }
+	const Vector3d& getLinearAcceleration() const {
+		return _linear_acceleration;
+	}
+	const Vector3d& getAngularAcceleration() const {
+		return _angular_acceleration;
+	}
+
+	/**
+	 * @brief      Updates the playback at the given time and sets the goal
+	 * position, velocity and acceleration of the task
+	 */
+	void feedGoals(JointTask& task, const double time);
+	void feedGoals(MotionForceTask& task, const double time);
+
+private:
+	// madvise call queued by the control thread
+	struct PageRequest {
+		size_t start;
+		size_t length;
+		int advice;
+	};
+
+	// pointer to the first double of a sample
+	const double* sample(const uint64_t index) const;
+	// queues the prefetch of the pages ahead of a sample and the release of
+	// the ones behind it
+	void managePages(const uint64_t index);
+	// queues a madvise call, returns false if the queue is full
+	bool requestPages(const size_t start, const size_t end, const int advice);
+
+	int _fd;
+	void* _mapping;
+	size_t _mapping_size;
+	TrajectoryFileHeader _header;
+	const double* _samples;
+	size_t _record_size;
+
+	uint64_t _window_samples;
+	size_t _prefetched_until;
+	size_t _released_until;
+	size_t _page_size;
+	bool _finished;
+
+	// madvise calls, made on the executor
+	SnapshotRing<PageRequest> _page_requests;
+
+	VectorXd _joint_position;
+	VectorXd _joint_velocity;
+	VectorXd _joint_acceleration;
+
+	Vector3d _position;
+	Matrix3d _orientation;
+	Vector3d _linear_velocity;
+	Vector3d _angular_velocity;
+	Vector3d _linear_acceleration;
+	Vector3d _angular_acceleration;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_TRAJECTORY_PLAYBACK_H
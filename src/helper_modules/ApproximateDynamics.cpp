@@ -0,0 +1,496 @@
+#include "ApproximateDynamics.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace Sai2Primitives {
+
+namespace {
+const char DYNAMICS_TABLE_MAGIC[8] = {'S', 'A', 'I', '2', 'D', 'Y', 'N', '\0'};
+const uint32_t DYNAMICS_TABLE_VERSION = 1;
+const int DEFAULT_NUM_NODES = 11;
+const int DEFAULT_NUM_VALIDATION_SAMPLES = 1000;
+// number of random configurations used to detect if the dynamics depend on
+// a joint
+const int NUM_DEPENDENCY_SAMPLES = 10;
+
+uint64_t numGridNodes(const DynamicsTableGrid& grid) {
+	uint64_t num_nodes = 1;
+	for (uint32_t k = 0; k < grid.num_dims; k++) {
+		num_nodes *= grid.num_nodes[k];
+	}
+	return num_nodes;
+}
+
+bool gridCovers(const DynamicsTableGrid& grid, const VectorXd& q) {
+	for (uint32_t k = 0; k < grid.num_dims; k++) {
+		const double q_k = q(grid.joint_index[k]);
+		if (q_k < grid.lower[k] || q_k > grid.upper[k]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool isValidGrid(const DynamicsTableGrid& grid, const uint32_t dof,
+				 const uint32_t num_outputs, const size_t file_size) {
+	if (grid.num_outputs != num_outputs || grid.num_dims > dof) {
+		return false;
+	}
+	for (uint32_t k = 0; k < grid.num_dims; k++) {
+		if (grid.joint_index[k] >= dof || grid.num_nodes[k] < 2 ||
+			!(grid.upper[k] > grid.lower[k])) {
+			return false;
+		}
+	}
+	return grid.data_offset % sizeof(double) == 0 &&
+		   grid.data_size == numGridNodes(grid) * num_outputs &&
+		   grid.data_offset + grid.data_size * sizeof(double) <= file_size;
+}
+
+void packUpperTriangle(const MatrixXd& M, double* values) {
+	int k = 0;
+	for (int i = 0; i < M.rows(); i++) {
+		for (int j = i; j < M.cols(); j++) {
+			values[k++] = M(i, j);
+		}
+	}
+}
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+// DynamicsTable
+////////////////////////////////////////////////////////////////////////////////
+
+DynamicsTable::DynamicsTable(const std::string& filename)
+	: _fd(-1), _mapping(MAP_FAILED), _mapping_size(0) {
+	_fd = ::open(filename.c_str(), O_RDONLY);
+	if (_fd < 0) {
+		throw std::invalid_argument("could not open file " + filename +
+									" in DynamicsTable::DynamicsTable\n");
+	}
+	struct stat file_stat;
+	if (fstat(_fd, &file_stat) != 0 ||
+		file_stat.st_size < (off_t)sizeof(DynamicsTableFileHeader)) {
+		::close(_fd);
+		throw std::invalid_argument("file " + filename +
+									" is not a dynamics table in "
+									"DynamicsTable::DynamicsTable\n");
+	}
+	_mapping_size = file_stat.st_size;
+	_mapping = mmap(nullptr, _mapping_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (_mapping == MAP_FAILED) {
+		::close(_fd);
+		throw std::invalid_argument("could not map file " + filename +
+									" in DynamicsTable::DynamicsTable\n");
+	}
+
+	std::memcpy(&_header, _mapping, sizeof(_header));
+	const uint32_t dof = _header.dof;
+	if (std::memcmp(_header.magic, DYNAMICS_TABLE_MAGIC,
+					sizeof(_header.magic)) != 0 ||
+		_header.version != DYNAMICS_TABLE_VERSION || dof == 0 ||
+		dof > DYNAMICS_TABLE_MAX_DOF ||
+		(_header.interpolation_order != 1 &&
+		 _header.interpolation_order != 3) ||
+		!isValidGrid(_header.mass_matrix, dof, dof * (dof + 1) / 2,
+					 _mapping_size) ||
+		!isValidGrid(_header.gravity, dof, dof, _mapping_size)) {
+		munmap(_mapping, _mapping_size);
+		::close(_fd);
+		throw std::invalid_argument("file " + filename +
+									" is not a valid dynamics table in "
+									"DynamicsTable::DynamicsTable\n");
+	}
+	const char* base = static_cast<const char*>(_mapping);
+	_mass_matrix_data = reinterpret_cast<const double*>(
+		base + _header.mass_matrix.data_offset);
+	_gravity_data =
+		reinterpret_cast<const double*>(base + _header.gravity.data_offset);
+	_values.setZero(_header.mass_matrix.num_outputs);
+}
+
+DynamicsTable::~DynamicsTable() {
+	munmap(_mapping, _mapping_size);
+	::close(_fd);
+}
+
+bool DynamicsTable::massMatrixCovers(const VectorXd& q) const {
+	return gridCovers(_header.mass_matrix, q);
+}
+
+bool DynamicsTable::gravityCovers(const VectorXd& q) const {
+	return gridCovers(_header.gravity, q);
+}
+
+void DynamicsTable::interpolateMassMatrix(const VectorXd& q,
+										  MatrixXd& M) const {
+	interpolate(_header.mass_matrix, _mass_matrix_data, q);
+	int k = 0;
+	for (uint32_t i = 0; i < _header.dof; i++) {
+		for (uint32_t j = i; j < _header.dof; j++) {
+			M(i, j) = _values(k);
+			M(j, i) = _values(k);
+			k++;
+		}
+	}
+}
+
+void DynamicsTable::interpolateGravity(const VectorXd& q, VectorXd& g) const {
+	interpolate(_header.gravity, _gravity_data, q);
+	g = _values.head(_header.dof);
+}
+
+void DynamicsTable::interpolate(const DynamicsTableGrid& grid,
+								const double* data, const VectorXd& q) const {
+	const int num_dims = grid.num_dims;
+	const int num_outputs = grid.num_outputs;
+
+	// lagrange weights of the nodes surrounding q along each dimension
+	int first_node[DYNAMICS_TABLE_MAX_DOF];
+	int stencil_size[DYNAMICS_TABLE_MAX_DOF];
+	double weights[DYNAMICS_TABLE_MAX_DOF][4];
+	size_t stride[DYNAMICS_TABLE_MAX_DOF];
+	size_t current_stride = num_outputs;
+	int num_stencil_nodes = 1;
+	for (int k = num_dims - 1; k >= 0; k--) {
+		const int n = grid.num_nodes[k];
+		const double node_spacing = (grid.upper[k] - grid.lower[k]) / (n - 1);
+		const double x = (q(grid.joint_index[k]) - grid.lower[k]) / node_spacing;
+		const int m = std::min<int>(_header.interpolation_order + 1, n);
+		const int i0 =
+			std::clamp((int)std::floor(x) - (m - 1) / 2, 0, n - m);
+		for (int a = 0; a < m; a++) {
+			double w = 1.0;
+			for (int b = 0; b < m; b++) {
+				if (b != a) {
+					w *= (x - (i0 + b)) / (a - b);
+				}
+			}
+			weights[k][a] = w;
+		}
+		first_node[k] = i0;
+		stencil_size[k] = m;
+		stride[k] = current_stride;
+		current_stride *= n;
+		num_stencil_nodes *= m;
+	}
+
+	// weighted sum over the stencil, the last dimension varying the fastest
+	int counter[DYNAMICS_TABLE_MAX_DOF] = {0};
+	_values.head(num_outputs).setZero();
+	for (int node = 0; node < num_stencil_nodes; node++) {
+		double w = 1.0;
+		size_t offset = 0;
+		for (int k = 0; k < num_dims; k++) {
+			w *= weights[k][counter[k]];
+			offset += (first_node[k] + counter[k]) * stride[k];
+		}
+		_values.head(num_outputs) +=
+			w * Map<const VectorXd>(data + offset, num_outputs);
+		for (int k = num_dims - 1; k >= 0; k--) {
+			if (++counter[k] < stencil_size[k]) {
+				break;
+			}
+			counter[k] = 0;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// DynamicsTableFitter
+////////////////////////////////////////////////////////////////////////////////
+
+DynamicsTableFitter::DynamicsTableFitter(
+	std::shared_ptr<Sai2Model::Sai2Model> robot)
+	: _robot(robot),
+	  _dof(robot->dof()),
+	  _interpolation_order(3),
+	  _num_validation_samples(DEFAULT_NUM_VALIDATION_SAMPLES) {
+	if (_robot->qSize() != _dof) {
+		throw std::invalid_argument(
+			"robots with spherical joints are not supported in "
+			"DynamicsTableFitter::DynamicsTableFitter\n");
+	}
+	if (_dof > DYNAMICS_TABLE_MAX_DOF) {
+		throw std::invalid_argument(
+			"robot has too many dof in "
+			"DynamicsTableFitter::DynamicsTableFitter\n");
+	}
+	_lower = VectorXd::Constant(_dof, -M_PI);
+	_upper = VectorXd::Constant(_dof, M_PI);
+	for (const auto& limit : _robot->jointLimits()) {
+		if (limit.position_upper > limit.position_lower) {
+			_lower(limit.index) = limit.position_lower;
+			_upper(limit.index) = limit.position_upper;
+		}
+	}
+	_num_nodes = VectorXi::Constant(_dof, DEFAULT_NUM_NODES);
+}
+
+void DynamicsTableFitter::setRegion(const VectorXd& lower,
+									const VectorXd& upper) {
+	if (lower.size() != _dof || upper.size() != _dof) {
+		throw std::invalid_argument(
+			"region size does not match the robot dof in "
+			"DynamicsTableFitter::setRegion\n");
+	}
+	if ((upper - lower).minCoeff() <= 0) {
+		throw std::invalid_argument(
+			"region upper bound should be above the lower bound in "
+			"DynamicsTableFitter::setRegion\n");
+	}
+	_lower = lower;
+	_upper = upper;
+}
+
+void DynamicsTableFitter::setNumNodes(const VectorXi& num_nodes) {
+	if (num_nodes.size() != _dof) {
+		throw std::invalid_argument(
+			"num nodes size does not match the robot dof in "
+			"DynamicsTableFitter::setNumNodes\n");
+	}
+	if (num_nodes.minCoeff() < 1) {
+		throw std::invalid_argument(
+			"there should be at least one node per joint in "
+			"DynamicsTableFitter::setNumNodes\n");
+	}
+	_num_nodes = num_nodes;
+}
+
+void DynamicsTableFitter::setInterpolationOrder(
+	const int interpolation_order) {
+	if (interpolation_order != 1 && interpolation_order != 3) {
+		throw std::invalid_argument(
+			"interpolation order should be 1 or 3 in "
+			"DynamicsTableFitter::setInterpolationOrder\n");
+	}
+	_interpolation_order = interpolation_order;
+}
+
+void DynamicsTableFitter::setNumValidationSamples(
+	const int num_validation_samples) {
+	if (num_validation_samples <= 0) {
+		throw std::invalid_argument(
+			"number of validation samples should be strictly positive in "
+			"DynamicsTableFitter::setNumValidationSamples\n");
+	}
+	_num_validation_samples = num_validation_samples;
+}
+
+void DynamicsTableFitter::computeExactDynamics(const VectorXd& q,
+											   MatrixXd& M, VectorXd& g) {
+	_robot->setQ(q);
+	_robot->updateModel();
+	M = _robot->M();
+	g = _robot->jointGravityVector();
+}
+
+void DynamicsTableFitter::detectDependencies(const int joint,
+											 bool& mass_matrix_depends,
+											 bool& gravity_depends) {
+	std::mt19937 generator(joint);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	MatrixXd M0, M1;
+	VectorXd g0, g1;
+	mass_matrix_depends = false;
+	gravity_depends = false;
+	for (int i = 0; i < NUM_DEPENDENCY_SAMPLES; i++) {
+		VectorXd q = _lower;
+		for (int j = 0; j < _dof; j++) {
+			q(j) += uniform(generator) * (_upper(j) - _lower(j));
+		}
+		computeExactDynamics(q, M0, g0);
+		q(joint) = _lower(joint) + uniform(generator) *
+									   (_upper(joint) - _lower(joint));
+		computeExactDynamics(q, M1, g1);
+		mass_matrix_depends = mass_matrix_depends ||
+							  (M1 - M0).norm() > 1e-9 * (1.0 + M0.norm());
+		gravity_depends =
+			gravity_depends || (g1 - g0).norm() > 1e-9 * (1.0 + g0.norm());
+	}
+}
+
+DynamicsTableAccuracy DynamicsTableFitter::fit(const std::string& filename) {
+	const VectorXd saved_q = _robot->q();
+
+	DynamicsTableFileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, DYNAMICS_TABLE_MAGIC, sizeof(header.magic));
+	header.version = DYNAMICS_TABLE_VERSION;
+	header.dof = _dof;
+	header.interpolation_order = _interpolation_order;
+	header.mass_matrix.num_outputs = _dof * (_dof + 1) / 2;
+	header.gravity.num_outputs = _dof;
+
+	// grids over the joints the quantities depend on
+	for (int j = 0; j < _dof; j++) {
+		if (_num_nodes(j) < 2) {
+			continue;
+		}
+		bool mass_matrix_depends, gravity_depends;
+		detectDependencies(j, mass_matrix_depends, gravity_depends);
+		for (auto grid : {&header.mass_matrix, &header.gravity}) {
+			if (grid == &header.mass_matrix ? !mass_matrix_depends
+											: !gravity_depends) {
+				continue;
+			}
+			grid->joint_index[grid->num_dims] = j;
+			grid->num_nodes[grid->num_dims] = _num_nodes(j);
+			grid->lower[grid->num_dims] = _lower(j);
+			grid->upper[grid->num_dims] = _upper(j);
+			grid->num_dims++;
+		}
+	}
+	header.mass_matrix.data_offset = sizeof(header);
+	header.mass_matrix.data_size =
+		numGridNodes(header.mass_matrix) * header.mass_matrix.num_outputs;
+	header.gravity.data_offset = header.mass_matrix.data_offset +
+								 header.mass_matrix.data_size * sizeof(double);
+	header.gravity.data_size =
+		numGridNodes(header.gravity) * header.gravity.num_outputs;
+
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		throw std::invalid_argument("could not open file " + filename +
+									" in DynamicsTableFitter::fit\n");
+	}
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	// sample the exact dynamics at the grid nodes, the joints out of the grid
+	// being at the center of their range
+	const VectorXd center = 0.5 * (_lower + _upper);
+	MatrixXd M;
+	VectorXd g;
+	std::vector<double> values(header.mass_matrix.num_outputs);
+	for (const auto grid : {&header.mass_matrix, &header.gravity}) {
+		const uint64_t num_nodes = numGridNodes(*grid);
+		int counter[DYNAMICS_TABLE_MAX_DOF] = {0};
+		for (uint64_t node = 0; node < num_nodes; node++) {
+			VectorXd q = center;
+			for (uint32_t k = 0; k < grid->num_dims; k++) {
+				q(grid->joint_index[k]) =
+					grid->lower[k] + counter[k] * (grid->upper[k] - grid->lower[k]) /
+										 (grid->num_nodes[k] - 1);
+			}
+			computeExactDynamics(q, M, g);
+			if (grid == &header.mass_matrix) {
+				packUpperTriangle(M, values.data());
+			} else {
+				std::copy(g.data(), g.data() + _dof, values.data());
+			}
+			file.write(reinterpret_cast<const char*>(values.data()),
+					   grid->num_outputs * sizeof(double));
+			for (int k = grid->num_dims - 1; k >= 0; k--) {
+				if (++counter[k] < (int)grid->num_nodes[k]) {
+					break;
+				}
+				counter[k] = 0;
+			}
+		}
+	}
+	file.close();
+	if (!file) {
+		throw std::invalid_argument("could not write file " + filename +
+									" in DynamicsTableFitter::fit\n");
+	}
+
+	// interpolation error on random configurations
+	DynamicsTableAccuracy accuracy;
+	std::memset(&accuracy, 0, sizeof(accuracy));
+	{
+		DynamicsTable table(filename);
+		std::mt19937 generator(_dof);
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		MatrixXd M_table = MatrixXd::Zero(_dof, _dof);
+		VectorXd g_table = VectorXd::Zero(_dof);
+		for (int i = 0; i < _num_validation_samples; i++) {
+			VectorXd q = _lower;
+			for (int j = 0; j < _dof; j++) {
+				q(j) += uniform(generator) * (_upper(j) - _lower(j));
+			}
+			computeExactDynamics(q, M, g);
+			table.interpolateMassMatrix(q, M_table);
+			table.interpolateGravity(q, g_table);
+			const double M_error = (M_table - M).norm();
+			const double g_error = (g_table - g).norm();
+			accuracy.mass_matrix_max_error =
+				std::max(accuracy.mass_matrix_max_error, M_error);
+			accuracy.mass_matrix_max_relative_error =
+				std::max(accuracy.mass_matrix_max_relative_error,
+						 M_error / std::max(M.norm(), 1e-12));
+			accuracy.gravity_max_error =
+				std::max(accuracy.gravity_max_error, g_error);
+			if (g.norm() > 1e-12) {
+				accuracy.gravity_max_relative_error =
+					std::max(accuracy.gravity_max_relative_error,
+							 g_error / g.norm());
+			}
+		}
+		accuracy.num_validation_samples = _num_validation_samples;
+	}
+	std::fstream update_file(filename,
+							 std::ios::binary | std::ios::in | std::ios::out);
+	update_file.seekp(offsetof(DynamicsTableFileHeader, accuracy));
+	update_file.write(reinterpret_cast<const char*>(&accuracy),
+					  sizeof(accuracy));
+	update_file.close();
+
+	_robot->setQ(saved_q);
+	_robot->updateModel();
+	return accuracy;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ApproximateDynamicsModel
+////////////////////////////////////////////////////////////////////////////////
+
+ApproximateDynamicsModel::ApproximateDynamicsModel(
+	std::shared_ptr<Sai2Model::Sai2Model> robot, const std::string& table_file)
+	: _robot(robot),
+	  _table(table_file),
+	  _mass_matrix_from_table(false),
+	  _gravity_from_table(false),
+	  _num_exact_fallbacks(0) {
+	if (_table.dof() != _robot->dof() || _robot->qSize() != _robot->dof()) {
+		throw std::invalid_argument(
+			"dynamics table does not match the robot dof in "
+			"ApproximateDynamicsModel::ApproximateDynamicsModel\n");
+	}
+	_mass_matrix = MatrixXd::Zero(_robot->dof(), _robot->dof());
+	_gravity = VectorXd::Zero(_robot->dof());
+}
+
+void ApproximateDynamicsModel::updateModel() {
+	const VectorXd& q = _robot->q();
+	_mass_matrix_from_table = _table.massMatrixCovers(q);
+	_gravity_from_table = _table.gravityCovers(q);
+
+	if (_mass_matrix_from_table) {
+		_table.interpolateMassMatrix(q, _mass_matrix);
+		_robot->updateModel(_mass_matrix);
+	} else {
+		_robot->updateModel();
+	}
+	if (_gravity_from_table) {
+		_table.interpolateGravity(q, _gravity);
+	} else {
+		_gravity = _robot->jointGravityVector();
+	}
+	if (!_mass_matrix_from_table || !_gravity_from_table) {
+		_num_exact_fallbacks++;
+	}
+}
+
+}  // namespace Sai2Primitives
@@ -0,0 +1,256 @@
+/**
+ * ApproximateDynamics.h
+ *
+ *	Precomputed tables of the mass matrix and joint gravity vector of low dof
+ * arms, to replace the recursive dynamics computations in the control loop.
+ * DynamicsTableFitter (offline) samples the exact dynamics on a regular grid
+ * of joint positions over a box of the joint space, writes the grid to a
+ * table file and reports the interpolation error on random configurations.
+ * The joints the mass matrix or the gravity vector do not depend on (the first
+ * joint for the mass matrix of any fixed base arm) are detected and left out
+ * of the corresponding grid. ApproximateDynamicsModel memory maps the table
+ * and updates the robot model with the interpolated mass matrix (tensor
+ * product Lagrange interpolation), and provides the interpolated gravity
+ * vector. Outside the fitted box, the exact dynamics are used.
+ *
+ * File layout: a fixed size DynamicsTableFileHeader, followed by the mass
+ * matrix grid (upper triangle of the matrix, row by row, at each node) and the
+ * gravity grid. The nodes are ordered with the last joint of the grid varying
+ * the fastest.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_APPROXIMATE_DYNAMICS_H
+#define SAI2_PRIMITIVES_APPROXIMATE_DYNAMICS_H
+
+#include <Sai2Model.h>
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+const int DYNAMICS_TABLE_MAX_DOF = 16;
+
+/**
+ * @brief      Interpolation error measured on random configurations of the
+ * fitted region. The relative errors are the norm of the error divided by the
+ * norm of the exact value (Frobenius norm for the mass matrix).
+ */
+struct DynamicsTableAccuracy {
+	double mass_matrix_max_error;
+	double mass_matrix_max_relative_error;
+	double gravity_max_error;
+	double gravity_max_relative_error;
+	uint64_t num_validation_samples;
+};
+
+/**
+ * @brief      Grid of one of the tables in the file
+ */
+struct DynamicsTableGrid {
+	// number of values at each node
+	uint32_t num_outputs;
+	// number of joints the grid spans
+	uint32_t num_dims;
+	uint32_t joint_index[DYNAMICS_TABLE_MAX_DOF];
+	uint32_t num_nodes[DYNAMICS_TABLE_MAX_DOF];
+	double lower[DYNAMICS_TABLE_MAX_DOF];
+	double upper[DYNAMICS_TABLE_MAX_DOF];
+	// position of the values in the file, in bytes, and number of values
+	uint64_t data_offset;
+	uint64_t data_size;
+};
+
+/**
+ * @brief      Header of a dynamics table file
+ */
+struct DynamicsTableFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t dof;
+	uint32_t interpolation_order;
+	uint32_t reserved;
+	DynamicsTableAccuracy accuracy;
+	DynamicsTableGrid mass_matrix;
+	DynamicsTableGrid gravity;
+};
+
+/**
+ * @brief      Read only view of a dynamics table file, memory mapped
+ */
+class DynamicsTable {
+public:
+	/**
+	 * @brief      Maps a table file. Throws if it is not a valid table file.
+	 */
+	DynamicsTable(const std::string& filename);
+	~DynamicsTable();
+
+	// disallow copy and asssign constructors
+	DynamicsTable(DynamicsTable const&) = delete;
+	DynamicsTable& operator=(DynamicsTable const&) = delete;
+
+	int dof() const { return _header.dof; }
+	int getInterpolationOrder() const { return _header.interpolation_order; }
+	const DynamicsTableAccuracy& getAccuracy() const {
+		return _header.accuracy;
+	}
+	const DynamicsTableGrid& getMassMatrixGrid() const {
+		return _header.mass_matrix;
+	}
+	const DynamicsTableGrid& getGravityGrid() const { return _header.gravity; }
+
+	/**
+	 * @brief      Whether the joint positions are in the region covered by the
+	 * mass matrix (resp. gravity) grid
+	 */
+	bool massMatrixCovers(const VectorXd& q) const;
+	bool gravityCovers(const VectorXd& q) const;
+
+	/**
+	 * @brief      Interpolates the mass matrix (resp. gravity vector) at the
+	 * joint positions. The output must have the right size (no allocation).
+	 * The joint positions should be in the covered region.
+	 */
+	void interpolateMassMatrix(const VectorXd& q, MatrixXd& M) const;
+	void interpolateGravity(const VectorXd& q, VectorXd& g) const;
+
+private:
+	// tensor product interpolation of a grid, written in _values
+	void interpolate(const DynamicsTableGrid& grid, const double* data,
+					 const VectorXd& q) const;
+
+	int _fd;
+	void* _mapping;
+	size_t _mapping_size;
+	DynamicsTableFileHeader _header;
+	const double* _mass_matrix_data;
+	const double* _gravity_data;
+
+	mutable VectorXd _values;
+};
+
+class DynamicsTableFitter {
+public:
+	/**
+	 * @brief      Constructor. The default region is the joint limits of the
+	 * robot (or [-pi, pi] for the joints without limits).
+	 *
+	 * @param[in]  robot  The robot model, used to compute the exact dynamics.
+	 *                    Its state is restored after fitting.
+	 */
+	DynamicsTableFitter(std::shared_ptr<Sai2Model::Sai2Model> robot);
+
+	/**
+	 * @brief      Sets the box of joint positions to fit
+	 */
+	void setRegion(const VectorXd& lower, const VectorXd& upper);
+
+	/**
+	 * @brief      Sets the number of grid nodes along each joint (default 11).
+	 * A joint with a single node is assumed not to affect the dynamics, which
+	 * are then evaluated at the center of its range.
+	 */
+	void setNumNodes(const VectorXi& num_nodes);
+	void setNumNodes(const int num_nodes) {
+		setNumNodes(VectorXi::Constant(_dof, num_nodes));
+	}
+
+	/**
+	 * @brief      Sets the interpolation order: 1 for multilinear (2^n nodes
+	 * per evaluation for a grid spanning n joints), 3 for cubic (4^n nodes,
+	 * default). Cubic is much more accurate for a given grid, linear is
+	 * cheaper to evaluate on grids spanning 5 or more joints.
+	 */
+	void setInterpolationOrder(const int interpolation_order);
+
+	void setNumValidationSamples(const int num_validation_samples);
+
+	/**
+	 * @brief      Samples the dynamics on the grids, writes the table file and
+	 * measures the interpolation error. Can take a few seconds to minutes
+	 * depending on the grid sizes.
+	 *
+	 * @param[in]  filename  The table file
+	 *
+	 * @return     The measured accuracy, also written in the file
+	 */
+	DynamicsTableAccuracy fit(const std::string& filename);
+
+private:
+	// whether the mass matrix and the gravity vector depend on a joint
+	void detectDependencies(const int joint, bool& mass_matrix_depends,
+							bool& gravity_depends);
+	void computeExactDynamics(const VectorXd& q, MatrixXd& M, VectorXd& g);
+
+	std::shared_ptr<Sai2Model::Sai2Model> _robot;
+	int _dof;
+	VectorXd _lower;
+	VectorXd _upper;
+	VectorXi _num_nodes;
+	int _interpolation_order;
+	int _num_validation_samples;
+};
+
+class ApproximateDynamicsModel {
+public:
+	/**
+	 * @brief      Constructor
+	 *
+	 * @param[in]  robot       The robot model to update
+	 * @param[in]  table_file  A table fitted for this robot
+	 */
+	ApproximateDynamicsModel(std::shared_ptr<Sai2Model::Sai2Model> robot,
+							 const std::string& table_file);
+
+	/**
+	 * @brief      To call instead of the updateModel function of the robot
+	 * model, after setting its joint positions and velocities. Updates the
+	 * kinematics, sets the interpolated mass matrix in the robot model (so
+	 * the tasks use it for their task inertias), and interpolates the gravity
+	 * vector. Uses the exact dynamics for the quantities whose fitted region
+	 * does not contain the joint positions.
+	 */
+	void updateModel();
+
+	/**
+	 * @brief      Gravity vector computed at the last updateModel
+	 */
+	const VectorXd& jointGravityVector() const { return _gravity; }
+
+	/**
+	 * @brief      Whether the last updateModel used the tables for the mass
+	 * matrix and for the gravity vector
+	 */
+	bool massMatrixFromTable() const { return _mass_matrix_from_table; }
+	bool gravityFromTable() const { return _gravity_from_table; }
+
+	/**
+	 * @brief      Number of updates that used the exact dynamics for the mass
+	 * matrix or the gravity vector because the robot was outside of the
+	 * fitted region
+	 */
+	unsigned long getNumExactFallbacks() const { return _num_exact_fallbacks; }
+
+	const DynamicsTable& getTable() const { return _table; }
+
+private:
+	std::shared_ptr<Sai2Model::Sai2Model> _robot;
+	DynamicsTable _table;
+
+	MatrixXd _mass_matrix;
+	VectorXd _gravity;
+	bool _mass_matrix_from_table;
+	bool _gravity_from_table;
+	unsigned long _num_exact_fallbacks;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_APPROXIMATE_DYNAMICS_H
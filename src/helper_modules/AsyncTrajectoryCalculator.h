@@ -0,0 +1,513 @@
+/**
+ * AsyncTrajectoryCalculator.h
+ *
+ *	Deadline bounded trajectory recalculation for the OTG wrappers. When a new
+ * goal is requested, the Ruckig calculation is handed to a BackgroundExecutor
+ * and the control thread keeps sampling the trajectory it was playing (or a
+ * Ruckig brake trajectory if the current state exceeds the new limits). The
+ * new trajectory starts from the state predicted at a fixed handover time, a
+ * configurable number of cycles after the request, so the output stays
+ * continuous. The control thread never waits for the worker: if the
+ * calculation is not done at the handover time, the output keeps following
+ * the current (or brake) trajectory and the handover is retried at the next
+ * cycles. The new trajectory is then sampled at the time elapsed since the
+ * planned handover, so the output stays on schedule but jumps by the
+ * difference between the two trajectories over that delay, which is counted.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_ASYNC_TRAJECTORY_CALCULATOR_H
+#define SAI2_PRIMITIVES_ASYNC_TRAJECTORY_CALCULATOR_H
+
+#include <Eigen/Dense>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <ruckig/brake.hpp>
+#include <ruckig/ruckig.hpp>
+#include <thread>
+#include <vector>
+
+#include "BackgroundExecutor.h"
+#include "SharedRuckig.h"
+
+namespace Sai2Primitives {
+
+template <size_t DOFs>
+class AsyncTrajectoryCalculator {
+public:
+	typedef ruckig::InputParameter<DOFs, ruckig::EigenVector> Input;
+	typedef ruckig::Trajectory<DOFs, ruckig::EigenVector> Trajectory;
+	typedef ruckig::EigenVector<double, DOFs> Vector;
+
+	/**
+	 * @brief      Constructor. Starts holding the given state.
+	 *
+	 * @param[in]  initial_state  Input whose current state is the state to
+	 *                            hold, also used for the dimensions
+	 * @param[in]  loop_time      The duration of a control loop
+	 * @param[in]  executor       The executor running the calculations
+	 */
+	AsyncTrajectoryCalculator(const Input& initial_state, const double loop_time,
+							  BackgroundExecutor& executor)
+		: _dofs(initial_state.degrees_of_freedom),
+		  _loop_time(loop_time),
+		  _executor(executor),
+		  _handover_cycles(1),
+		  _requests{{initial_state}, {initial_state}},
+		  _pending_request(nullptr),
+		  _pending_request_submitted(false),
+		  _jobs_in_flight(0),
+		  _last_request_input(initial_state),
+		  _has_last_request(false),
+		  _playing_trajectory(false),
+		  _time(0),
+		  _handover(false),
+		  _num_recalculations(0),
+		  _num_late_handovers(0),
+		  _handover_delay(0),
+		  _max_handover_delay(0) {
+		_otg.reset(new SharedRuckig<DOFs>(_dofs, loop_time));
+		if constexpr (DOFs == 0) {
+			_trajectory.reset(new Trajectory(_dofs));
+		} else {
+			_trajectory.reset(new Trajectory());
+		}
+		for (Request& request : _requests) {
+			if constexpr (DOFs == 0) {
+				request.trajectory.reset(new Trajectory(_dofs));
+			} else {
+				request.trajectory.reset(new Trajectory());
+			}
+		}
+		_brake.resize(_dofs);
+		_brake_end_position = initial_state.current_position;
+		_brake_end_velocity = initial_state.current_velocity;
+		_brake_end_acceleration = initial_state.current_acceleration;
+		reset(initial_state.current_position, initial_state.current_velocity,
+			  initial_state.current_acceleration);
+	}
+
+	/**
+	 * @brief      Destructor. Blocks until the jobs submitted to the executor
+	 * have been consumed, since they refer to this object.
+	 */
+	~AsyncTrajectoryCalculator() {
+		cancelRequest();
+		while (_jobs_in_flight.load(std::memory_order_acquire) > 0) {
+			std::this_thread::yield();
+		}
+	}
+
+	AsyncTrajectoryCalculator(const AsyncTrajectoryCalculator&) = delete;
+	AsyncTrajectoryCalculator& operator=(const AsyncTrajectoryCalculator&) =
+		delete;
+
+	/**
+	 * @brief      Sets the time between a request and the switch to the new
+	 * trajectory, rounded to a number of cycles (at least one)
+	 */
+	void setMaxHandoverLatency(const double max_handover_latency) {
+		if (max_handover_latency <= 0) {
+			throw std::invalid_argument(
+				"max handover latency should be strictly positive in "
+				"AsyncTrajectoryCalculator::setMaxHandoverLatency\n");
+		}
+		_handover_cycles = std::max(
+			1, (int)std::lround(max_handover_latency / _loop_time));
+	}
+	double getMaxHandoverLatency() const {
+		return _handover_cycles * _loop_time;
+	}
+
+	BackgroundExecutor& getExecutor() const { return _executor; }
+
+	/**
+	 * @brief      Cancels the pending request (if any, without waiting for its
+	 * calculation) and holds the given state. The next call to needsRequest() will return true.
+	 */
+	void reset(const Vector& position, const Vector& velocity,
+			   const Vector& acceleration) {
+		cancelRequest();
+		_playing_trajectory = false;
+		_time = 0;
+		for (auto& brake : _brake) {
+			brake = ruckig::BrakeProfile();
+		}
+		_brake_end_position = position;
+		_brake_end_velocity = velocity;
+		_brake_end_acceleration = acceleration;
+		_has_last_request = false;
+	}
+
+	bool isRequestPending() const { return _pending_request != nullptr; }
+
+	/**
+	 * @brief      Whether the targets, limits or interface of the input differ
+	 * from the ones of the last request, so a new trajectory is needed
+	 */
+	bool needsRequest(const Input& input) const {
+		if (!_has_last_request) {
+			return true;
+		}
+		const Input& last = _last_request_input;
+		return input.control_interface != last.control_interface ||
+			   input.synchronization != last.synchronization ||
+			   input.target_position != last.target_position ||
+			   input.target_velocity != last.target_velocity ||
+			   input.target_acceleration != last.target_acceleration ||
+			   input.max_velocity != last.max_velocity ||
+			   input.max_acceleration != last.max_acceleration ||
+			   input.max_jerk != last.max_jerk ||
+			   input.min_velocity != last.min_velocity ||
+			   input.min_acceleration != last.min_acceleration;
+	}
+
+	/**
+	 * @brief      Requests a trajectory to the targets of the input. The
+	 * current state of the input is the last output state, expressed in the
+	 * coordinates of the request. If it exceeds the new limits, the output
+	 * follows a Ruckig brake trajectory until the handover (the brake starts
+	 * from the current state, so it is in the coordinates of the request).
+	 * Otherwise, the output keeps following the trajectory being played, and
+	 * the predicted handover state is passed to to_request_coordinates to be
+	 * expressed in the coordinates of the request, if they differ.
+	 *
+	 * @param[in]  input                   The input
+	 * @param[in]  to_request_coordinates  Callable (position, velocity,
+	 *                                     acceleration) transforming a state
+	 *                                     of the trajectory being played
+	 *
+	 * @return     true if the output follows a brake trajectory until the
+	 *             handover
+	 */
+	template <typename Transform>
+	bool requestTrajectory(const Input& input,
+						   const Transform& to_request_coordinates) {
+		cancelRequest();
+		// the worker runs one job at a time, so at most one request can still
+		// be calculated after its cancellation and the other one is idle
+		Request* request = &_requests[0];
+		if (request->state.load(std::memory_order_acquire) != REQUEST_IDLE) {
+			request = &_requests[1];
+		}
+		request->input = input;
+		_last_request_input = input;
+		_has_last_request = true;
+
+		const bool braking = startBrakeIfNeeded(input);
+		const double handover_time = _handover_cycles * _loop_time;
+		sample(_time + handover_time, request->input.current_position,
+			   request->input.current_velocity,
+			   request->input.current_acceleration);
+		if (!braking) {
+			to_request_coordinates(request->input.current_position,
+								   request->input.current_velocity,
+								   request->input.current_acceleration);
+		}
+		_cycles_to_handover = _handover_cycles;
+		_num_recalculations++;
+
+		request->state.store(REQUEST_QUEUED, std::memory_order_release);
+		_pending_request = request;
+		submitRequest();
+		return braking;
+	}
+
+	bool requestTrajectory(const Input& input) {
+		return requestTrajectory(input, [](Vector&, Vector&, Vector&) {});
+	}
+
+	/**
+	 * @brief      Advances of one cycle and computes the output state. From
+	 * the handover cycle, switches to the requested trajectory as soon as its
+	 * calculation is done, without waiting for it.
+	 *
+	 * @return     Result::Working while a trajectory is being played or
+	 * requested, Result::Finished after the end of the trajectory, or the
+	 * Ruckig error of the calculation at the handover
+	 */
+	ruckig::Result update(Vector& position, Vector& velocity,
+						  Vector& acceleration) {
+		_handover = false;
+		_time += _loop_time;
+		if (isRequestPending() && !_pending_request_submitted) {
+			// retry a submission refused by the executor
+			submitRequest();
+		}
+		if (isRequestPending() && --_cycles_to_handover <= 0) {
+			const ruckig::Result result = handover();
+			if (result != ruckig::Result::Working &&
+				result != ruckig::Result::ErrorPositionalLimits) {
+				// keep playing the previous trajectory, the request will be
+				// made again
+				_has_last_request = false;
+				sample(_time, position, velocity, acceleration);
+				return result;
+			}
+		}
+		sample(_time, position, velocity, acceleration);
+
+		if (isRequestPending() ||
+			(_playing_trajectory && _time <= _trajectory->get_duration())) {
+			return ruckig::Result::Working;
+		}
+		return ruckig::Result::Finished;
+	}
+
+	/**
+	 * @brief      Whether the last update switched to a new trajectory
+	 */
+	bool didHandover() const { return _handover; }
+
+	unsigned long getNumRecalculations() const { return _num_recalculations; }
+
+	/**
+	 * @brief      Number of handovers for which the calculation was not done
+	 * in time
+	 */
+	unsigned long getNumLateHandovers() const { return _num_late_handovers; }
+
+	/**
+	 * @brief      Total and maximum time (s) by which the late handovers were
+	 * delayed, waiting for their calculation
+	 */
+	double getHandoverDelay() const { return _handover_delay; }
+	double getMaxHandoverDelay() const { return _max_handover_delay; }
+
+	void resetHandoverStatistics() {
+		_num_recalculations = 0;
+		_num_late_handovers = 0;
+		_handover_delay = 0;
+		_max_handover_delay = 0;
+	}
+
+private:
+	enum RequestState : int {
+		REQUEST_IDLE = 0,
+		REQUEST_QUEUED,
+		REQUEST_RUNNING,
+		REQUEST_DONE,
+		// cancelled while running, the worker discards the result
+		REQUEST_CANCELLED,
+	};
+
+	// request shared with the worker: its input is written by the control
+	// thread when the request is idle, and read by the thread that sets it
+	// to running
+	struct Request {
+		Request(const Input& input) : state(REQUEST_IDLE), input(input) {}
+
+		std::atomic<int> state;
+		Input input;
+		std::unique_ptr<Trajectory> trajectory;
+		ruckig::Result result;
+	};
+
+	void submitRequest() {
+		Request* request = _pending_request;
+		_jobs_in_flight.fetch_add(1, std::memory_order_acq_rel);
+		_pending_request_submitted = _executor.submit(
+			[this, request]() { runQueuedRequest(*request); },
+			std::chrono::duration_cast<BackgroundExecutor::Clock::duration>(
+				std::chrono::duration<double>(
+					std::max(_cycles_to_handover, 1) * _loop_time)),
+			BackgroundExecutor::RUN_LATE_JOB);
+		if (!_pending_request_submitted) {
+			_jobs_in_flight.fetch_sub(1, std::memory_order_acq_rel);
+		}
+	}
+
+	// executed by the worker. A job that finds the request cancelled or
+	// already taken does nothing.
+	void runQueuedRequest(Request& request) {
+		int expected = REQUEST_QUEUED;
+		if (request.state.compare_exchange_strong(expected, REQUEST_RUNNING,
+												  std::memory_order_acq_rel)) {
+			request.result =
+				_otg->calculate(request.input, *request.trajectory);
+			expected = REQUEST_RUNNING;
+			if (!request.state.compare_exchange_strong(
+					expected, REQUEST_DONE, std::memory_order_acq_rel)) {
+				// cancelled during the calculation
+				request.state.store(REQUEST_IDLE, std::memory_order_release);
+			}
+		}
+		_jobs_in_flight.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	// withdraws the pending request. A calculation already running is left to
+	// finish on the worker, which then frees the request.
+	void cancelRequest() {
+		if (!isRequestPending()) {
+			return;
+		}
+		// the worker can start or finish the calculation concurrently
+		std::atomic<int>& state = _pending_request->state;
+		int expected = state.load(std::memory_order_acquire);
+		while (!state.compare_exchange_weak(
+			expected,
+			expected == REQUEST_RUNNING ? REQUEST_CANCELLED : REQUEST_IDLE,
+			std::memory_order_acq_rel)) {
+		}
+		_pending_request = nullptr;
+	}
+
+	// called at each cycle from the planned handover until the calculation
+	// is done. Returns Result::Working while it is not done.
+	ruckig::Result handover() {
+		Request& request = *_pending_request;
+		int expected = REQUEST_QUEUED;
+		if (!_pending_request_submitted &&
+			request.state.compare_exchange_strong(expected, REQUEST_RUNNING,
+												  std::memory_order_acq_rel)) {
+			// refused by the executor until the handover, calculate it here
+			request.result = _otg->calculate(request.input, *request.trajectory);
+			request.state.store(REQUEST_DONE, std::memory_order_release);
+		}
+		if (request.state.load(std::memory_order_acquire) != REQUEST_DONE) {
+			// keep following the current trajectory, and hand over at a next
+			// cycle
+			if (_cycles_to_handover == 0) {
+				_num_late_handovers++;
+			}
+			return ruckig::Result::Working;
+		}
+		// cycles elapsed since the planned handover
+		const double delay = -_cycles_to_handover * _loop_time;
+		if (delay > 0) {
+			_handover_delay += delay;
+			_max_handover_delay = std::max(_max_handover_delay, delay);
+		}
+		request.state.store(REQUEST_IDLE, std::memory_order_release);
+		_pending_request = nullptr;
+
+		if (request.result != ruckig::Result::Working &&
+			request.result != ruckig::Result::ErrorPositionalLimits) {
+			return request.result;
+		}
+		std::swap(_trajectory, request.trajectory);
+		_playing_trajectory = true;
+		_time = delay;
+		_handover = true;
+		return request.result;
+	}
+
+	// replaces the trajectory being played by a brake trajectory from the
+	// current state of the input if it exceeds the limits of the input
+	bool startBrakeIfNeeded(const Input& input) {
+		if (input.control_interface != ruckig::ControlInterface::Position) {
+			return false;
+		}
+		bool braking = false;
+		for (size_t i = 0; i < _dofs; i++) {
+			const double v_max = input.max_velocity[i];
+			const double v_min =
+				input.min_velocity ? input.min_velocity.value()[i] : -v_max;
+			const double a_max = input.max_acceleration[i];
+			const double a_min = input.min_acceleration
+									 ? input.min_acceleration.value()[i]
+									 : -a_max;
+			ruckig::BrakeProfile& brake = _brake[i];
+			brake = ruckig::BrakeProfile();
+			if (!std::isinf(input.max_jerk[i])) {
+				brake.get_position_brake_trajectory(
+					input.current_velocity[i], input.current_acceleration[i],
+					v_max, v_min, a_max, a_min, input.max_jerk[i]);
+			} else if (!std::isinf(a_max)) {
+				brake.get_second_order_position_brake_trajectory(
+					input.current_velocity[i], v_max, v_min, a_max, a_min);
+			}
+			braking = braking || brake.t[0] > 0.0 || brake.t[1] > 0.0;
+		}
+		if (!braking) {
+			return false;
+		}
+
+		for (size_t i = 0; i < _dofs; i++) {
+			double p = input.current_position[i];
+			double v = input.current_velocity[i];
+			double a = input.current_acceleration[i];
+			if (!std::isinf(input.max_jerk[i])) {
+				_brake[i].finalize(p, v, a);
+			} else {
+				_brake[i].finalize_second_order(p, v, a);
+				// the acceleration is not part of the state of second order
+				// trajectories
+				a = 0;
+			}
+			_brake_end_position[i] = p;
+			_brake_end_velocity[i] = v;
+			_brake_end_acceleration[i] = a;
+		}
+		_playing_trajectory = false;
+		_time = 0;
+		return true;
+	}
+
+	// state of the trajectory being played (or of the brake trajectory, which
+	// continues at constant acceleration after its end) at the given time
+	void sample(const double time, Vector& position, Vector& velocity,
+				Vector& acceleration) const {
+		if (_playing_trajectory) {
+			_trajectory->at_time(time, position, velocity, acceleration);
+			return;
+		}
+		for (size_t i = 0; i < _dofs; i++) {
+			const ruckig::BrakeProfile& brake = _brake[i];
+			std::tuple<double, double, double> state;
+			if (time < brake.t[0]) {
+				state = ruckig::integrate(time, brake.p[0], brake.v[0],
+										  brake.a[0], brake.j[0]);
+			} else if (time < brake.t[0] + brake.t[1]) {
+				state = ruckig::integrate(time - brake.t[0], brake.p[1],
+										  brake.v[1], brake.a[1], brake.j[1]);
+			} else {
+				state = ruckig::integrate(time - brake.duration,
+										  _brake_end_position[i],
+										  _brake_end_velocity[i],
+										  _brake_end_acceleration[i], 0.0);
+			}
+			std::tie(position[i], velocity[i], acceleration[i]) = state;
+		}
+	}
+
+	size_t _dofs;
+	double _loop_time;
+	BackgroundExecutor& _executor;
+	int _handover_cycles;
+	int _cycles_to_handover;
+
+	// two requests, so that a new request never waits for the calculation
+	// of a cancelled one
+	Request _requests[2];
+	Request* _pending_request;
+	bool _pending_request_submitted;
+	std::atomic<int> _jobs_in_flight;
+	std::unique_ptr<SharedRuckig<DOFs>> _otg;
+
+	Input _last_request_input;
+	bool _has_last_request;
+
+	// what is being played: a calculated trajectory, or a brake trajectory
+	// (zero duration to hold a state)
+	bool _playing_trajectory;
+	std::unique_ptr<Trajectory> _trajectory;
+	std::vector<ruckig::BrakeProfile> _brake;
+	Vector _brake_end_position;
+	Vector _brake_end_velocity;
+	Vector _brake_end_acceleration;
+	double _time;
+	bool _handover;
+
+	unsigned long _num_recalculations;
+	unsigned long _num_late_handovers;
+	double _handover_delay;
+	double _max_handover_delay;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_ASYNC_TRAJECTORY_CALCULATOR_H
@@ -0,0 +1,226 @@
+#include "BackgroundExecutor.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Sai2Primitives {
+
+namespace {
+// upper bound of the time a job waits if its wake up notification raced with
+// the worker going to sleep
+const std::chrono::milliseconds WORKER_WAKEUP_PERIOD(1);
+}  // namespace
+
+BackgroundExecutor::BackgroundExecutor(const int cpu_core,
+									   const size_t queue_capacity)
+	: _cpu_core(-1),
+	  _queue_capacity(queue_capacity),
+	  _submission_mask(0),
+	  _submission_enqueue_position(0),
+	  _submission_dequeue_position(0),
+	  _num_pending_jobs(0),
+	  _job_running(false),
+	  _stop(false),
+	  _num_executed_jobs(0),
+	  _num_failed_jobs(0),
+	  _num_rejected_jobs(0),
+	  _num_dropped_late_jobs(0),
+	  _num_missed_deadlines(0) {
+	if (queue_capacity == 0) {
+		throw std::invalid_argument(
+			"queue capacity must be strictly positive in "
+			"BackgroundExecutor::BackgroundExecutor\n");
+	}
+	size_t submission_size = 1;
+	while (submission_size < _queue_capacity) {
+		submission_size *= 2;
+	}
+	_submissions.reset(new SubmissionCell[submission_size]);
+	for (size_t i = 0; i < submission_size; i++) {
+		_submissions[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	_submission_mask = submission_size - 1;
+	_queue.reserve(_queue_capacity);
+	_worker = std::thread(&BackgroundExecutor::workerLoop, this);
+	setCpuCore(cpu_core);
+}
+
+BackgroundExecutor::~BackgroundExecutor() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_job_available.notify_all();
+	if (_worker.joinable()) {
+		_worker.join();
+	}
+}
+
+BackgroundExecutor& BackgroundExecutor::instance() {
+	static BackgroundExecutor executor;
+	return executor;
+}
+
+bool BackgroundExecutor::submit(std::function<void()> job,
+								const Clock::time_point& deadline,
+								const LateJobPolicy policy) {
+	if (!job) {
+		throw std::invalid_argument("empty job in BackgroundExecutor::submit\n");
+	}
+	// the pending jobs count bounds the submission queue and the heap together
+	if (_num_pending_jobs.fetch_add(1) >= _queue_capacity) {
+		_num_pending_jobs--;
+		++_num_rejected_jobs;
+		return false;
+	}
+	Job submitted_job{std::move(job), deadline, policy};
+	// cannot fail, there are fewer pending jobs than cells
+	pushSubmission(submitted_job);
+
+	// if the worker holds the mutex it may be between its last check and its
+	// sleep, and the periodic wake up picks the job
+	if (_mutex.try_lock()) {
+		_mutex.unlock();
+	}
+	_job_available.notify_one();
+	return true;
+}
+
+bool BackgroundExecutor::pushSubmission(Job& job) {
+	size_t position =
+		_submission_enqueue_position.load(std::memory_order_relaxed);
+	SubmissionCell* cell;
+	while (true) {
+		cell = &_submissions[position & _submission_mask];
+		const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		const intptr_t difference =
+			static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+		if (difference == 0) {
+			if (_submission_enqueue_position.compare_exchange_weak(
+					position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (difference < 0) {
+			return false;
+		} else {
+			position =
+				_submission_enqueue_position.load(std::memory_order_relaxed);
+		}
+	}
+	cell->job = std::move(job);
+	cell->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+bool BackgroundExecutor::popSubmission(Job& job) {
+	SubmissionCell& cell =
+		_submissions[_submission_dequeue_position & _submission_mask];
+	if (cell.sequence.load(std::memory_order_acquire) !=
+		_submission_dequeue_position + 1) {
+		return false;
+	}
+	job = std::move(cell.job);
+	cell.job.function = nullptr;
+	cell.sequence.store(_submission_dequeue_position + _submission_mask + 1,
+						std::memory_order_release);
+	_submission_dequeue_position++;
+	return true;
+}
+
+bool BackgroundExecutor::hasSubmission() const {
+	return _submissions[_submission_dequeue_position & _submission_mask]
+			   .sequence.load(std::memory_order_acquire) ==
+		   _submission_dequeue_position + 1;
+}
+
+void BackgroundExecutor::setCpuCore(const int cpu_core) {
+	const int num_cores = static_cast<int>(std::thread::hardware_concurrency());
+	if (cpu_core < -1 || (num_cores > 0 && cpu_core >= num_cores)) {
+		throw std::invalid_argument("cpu core " + std::to_string(cpu_core) +
+									" does not exist in "
+									"BackgroundExecutor::setCpuCore\n");
+	}
+#ifdef __linux__
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	if (cpu_core == -1) {
+		for (int i = 0; i < CPU_SETSIZE; i++) {
+			CPU_SET(i, &cpu_set);
+		}
+	} else {
+		CPU_SET(cpu_core, &cpu_set);
+	}
+	if (pthread_setaffinity_np(_worker.native_handle(), sizeof(cpu_set_t),
+							   &cpu_set) != 0) {
+		throw std::runtime_error("could not set the affinity to core " +
+								 std::to_string(cpu_core) +
+								 " in BackgroundExecutor::setCpuCore\n");
+	}
+#endif
+	_cpu_core = cpu_core;
+}
+
+void BackgroundExecutor::waitUntilIdle() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_idle.wait(lock,
+			   [this] { return _num_pending_jobs == 0 && !_job_running; });
+}
+
+void BackgroundExecutor::workerLoop() {
+	Job job;
+	while (!_stop) {
+		while (popSubmission(job)) {
+			_queue.push_back(std::move(job));
+			std::push_heap(_queue.begin(), _queue.end(), laterDeadline);
+		}
+		if (_queue.empty()) {
+			std::unique_lock<std::mutex> lock(_mutex);
+			if (_num_pending_jobs == 0) {
+				_idle.notify_all();
+			}
+			_job_available.wait_for(lock, WORKER_WAKEUP_PERIOD, [this] {
+				return _stop || hasSubmission();
+			});
+			continue;
+		}
+
+		std::pop_heap(_queue.begin(), _queue.end(), laterDeadline);
+		job = std::move(_queue.back());
+		_queue.pop_back();
+
+		if (Clock::now() > job.deadline && job.policy == DROP_LATE_JOB) {
+			++_num_dropped_late_jobs;
+		} else {
+			_job_running = true;
+			try {
+				job.function();
+			} catch (...) {
+				// a failing job must not take the worker (and the process)
+				// down
+				++_num_failed_jobs;
+			}
+			if (Clock::now() > job.deadline) {
+				++_num_missed_deadlines;
+			}
+			++_num_executed_jobs;
+		}
+		job.function = nullptr;
+		{
+			// the idle waiters check both under the mutex
+			std::lock_guard<std::mutex> lock(_mutex);
+			_num_pending_jobs--;
+			_job_running = false;
+		}
+	}
+	std::lock_guard<std::mutex> lock(_mutex);
+	_idle.notify_all();
+}
+
+} /* namespace Sai2Primitives */
@@ -0,0 +1,274 @@
+/**
+ * BackgroundExecutor.h
+ *
+ *	Executor for auxiliary work that does not need to run inside the control
+ * period (singularity classification, telemetry draining, trajectory
+ * precomputation, low rate model updates, logging...). Jobs are submitted
+ * with a deadline to a single worker thread that can be pinned to a non real
+ * time core, and are executed earliest deadline first. Submission goes through
+ * a bounded lock-free queue that only the worker drains, so submitting from the
+ * control thread never waits for the worker. Results are handed back to the
+ * control thread through lock-free ResultSlot objects, so the control thread
+ * never blocks on auxiliary computations. A job that throws is counted as
+ * failed and does not stop the worker.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_BACKGROUND_EXECUTOR_H
+#define SAI2_PRIMITIVES_BACKGROUND_EXECUTOR_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Sai2Primitives {
+
+/**
+ * @brief      Lock-free slot used to hand the result of a background job back
+ * to a consumer thread. It is a triple buffer with a single producer and a
+ * single consumer: the producer never overwrites the value being read and the
+ * consumer always gets the most recently published value. All the buffers are
+ * allocated at construction, so publishing and reading fixed size objects
+ * (or dynamic objects that keep the same size) does not allocate.
+ *
+ * @tparam     T     type of the result
+ */
+template <typename T>
+class ResultSlot {
+public:
+	ResultSlot() : ResultSlot(T()) {}
+
+	/**
+	 * @brief      Constructs the slot with all the buffers initialized to a
+	 * given value (useful to preallocate dynamic Eigen objects)
+	 *
+	 * @param[in]  initial_value  The initial value
+	 */
+	explicit ResultSlot(const T& initial_value)
+		: _buffers{initial_value, initial_value, initial_value},
+		  _write_index(0),
+		  _read_index(1),
+		  _middle(2) {}
+
+	ResultSlot(const ResultSlot&) = delete;
+	ResultSlot& operator=(const ResultSlot&) = delete;
+
+	/**
+	 * @brief      Producer side. Buffer to be filled before calling publish()
+	 *
+	 * @return     reference to the buffer owned by the producer
+	 */
+	T& writeBuffer() { return _buffers[_write_index]; }
+
+	/**
+	 * @brief      Producer side. Makes the content of the write buffer
+	 * available to the consumer
+	 */
+	void publish() {
+		_write_index =
+			_middle.exchange(_write_index | FRESH_BIT, std::memory_order_acq_rel) &
+			INDEX_MASK;
+	}
+
+	/**
+	 * @brief      Producer side. Copies the value in the write buffer and
+	 * publishes it
+	 *
+	 * @param[in]  value  The value to publish
+	 */
+	void publish(const T& value) {
+		writeBuffer() = value;
+		publish();
+	}
+
+	/**
+	 * @brief      Consumer side. Whether a value was published since the last
+	 * call to update()
+	 */
+	bool hasNewResult() const {
+		return _middle.load(std::memory_order_acquire) & FRESH_BIT;
+	}
+
+	/**
+	 * @brief      Consumer side. Takes ownership of the most recently published
+	 * value if there is one
+	 *
+	 * @return     true if a new value was received
+	 */
+	bool update() {
+		if (!hasNewResult()) {
+			return false;
+		}
+		_read_index =
+			_middle.exchange(_read_index, std::memory_order_acq_rel) & INDEX_MASK;
+		return true;
+	}
+
+	/**
+	 * @brief      Consumer side. The last value received by update()
+	 */
+	const T& read() const { return _buffers[_read_index]; }
+
+private:
+	static constexpr unsigned int INDEX_MASK = 0x3;
+	static constexpr unsigned int FRESH_BIT = 0x4;
+
+	std::array<T, 3> _buffers;
+	unsigned int _write_index;
+	unsigned int _read_index;
+	std::atomic<unsigned int> _middle;
+};
+
+class BackgroundExecutor {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	/**
+	 * @brief      What to do with a job whose deadline has already passed when
+	 * the worker gets to it
+	 */
+	enum LateJobPolicy {
+		DROP_LATE_JOB = 0,
+		RUN_LATE_JOB,
+	};
+
+	/**
+	 * @brief      Creates an executor and starts its worker thread
+	 *
+	 * @param[in]  cpu_core        The core to pin the worker thread to, or -1
+	 *                             to let the OS schedule it
+	 * @param[in]  queue_capacity  The maximum number of pending jobs. The
+	 *                             queues are allocated once so that submitting
+	 *                             a job does not grow them.
+	 */
+	explicit BackgroundExecutor(const int cpu_core = -1,
+								const size_t queue_capacity = 64);
+	~BackgroundExecutor();
+
+	BackgroundExecutor(const BackgroundExecutor&) = delete;
+	BackgroundExecutor& operator=(const BackgroundExecutor&) = delete;
+
+	/**
+	 * @brief      The executor shared by the library components. Its core can
+	 * be configured with setCpuCore
+	 */
+	static BackgroundExecutor& instance();
+
+	/**
+	 * @brief      Submits a job to be executed before the given deadline. Jobs
+	 * are executed earliest deadline first. The job should not hold a
+	 * reference to objects that may be destroyed before it runs. Lock-free and
+	 * safe to call from several threads.
+	 *
+	 * @param[in]  job       The job
+	 * @param[in]  deadline  The deadline
+	 * @param[in]  policy    What to do if the deadline has passed when the
+	 *                       job is dequeued
+	 *
+	 * @return     false if the queue is full and the job was rejected
+	 */
+	bool submit(std::function<void()> job, const Clock::time_point& deadline,
+				const LateJobPolicy policy = DROP_LATE_JOB);
+
+	/**
+	 * @brief      Same as above with a deadline relative to now
+	 */
+	bool submit(std::function<void()> job, const Clock::duration& time_budget,
+				const LateJobPolicy policy = DROP_LATE_JOB) {
+		return submit(std::move(job), Clock::now() + time_budget, policy);
+	}
+
+	/**
+	 * @brief      Pins the worker thread to a core. Only effective on linux.
+	 *
+	 * @param[in]  cpu_core  The core, or -1 to remove the pinning
+	 */
+	void setCpuCore(const int cpu_core);
+	int getCpuCore() const { return _cpu_core; }
+
+	/**
+	 * @brief      Blocks until the queue is empty and no job is running. Not
+	 * to be called from the control thread.
+	 */
+	void waitUntilIdle();
+
+	size_t getNumPendingJobs() const { return _num_pending_jobs; }
+	unsigned long getNumExecutedJobs() const { return _num_executed_jobs; }
+	/**
+	 * @brief      Number of executed jobs that threw an exception (included in
+	 * the executed jobs)
+	 */
+	unsigned long getNumFailedJobs() const { return _num_failed_jobs; }
+	unsigned long getNumRejectedJobs() const { return _num_rejected_jobs; }
+	unsigned long getNumDroppedLateJobs() const {
+		return _num_dropped_late_jobs;
+	}
+	unsigned long getNumMissedDeadlines() const {
+		return _num_missed_deadlines;
+	}
+
+private:
+	struct Job {
+		std::function<void()> function;
+		Clock::time_point deadline;
+		LateJobPolicy policy;
+	};
+
+	// cell of the submission queue, the sequence tells whether the cell is
+	// free for the producer of a given position or filled for the consumer
+	struct SubmissionCell {
+		std::atomic<size_t> sequence;
+		Job job;
+	};
+
+	static bool laterDeadline(const Job& a, const Job& b) {
+		return a.deadline > b.deadline;
+	}
+
+	// bounded multiple producer single consumer queue (Vyukov)
+	bool pushSubmission(Job& job);
+	bool popSubmission(Job& job);
+	bool hasSubmission() const;
+
+	void workerLoop();
+
+	int _cpu_core;
+	size_t _queue_capacity;
+
+	// submission queue, size is a power of 2 at least the queue capacity
+	std::unique_ptr<SubmissionCell[]> _submissions;
+	size_t _submission_mask;
+	alignas(64) std::atomic<size_t> _submission_enqueue_position;
+	alignas(64) size_t _submission_dequeue_position;
+	std::atomic<size_t> _num_pending_jobs;
+
+	// worker side min heap on the deadline, capacity reserved at construction
+	std::vector<Job> _queue;
+
+	// only used to put the worker to sleep and to wait until idle, never
+	// locked by submit
+	std::mutex _mutex;
+	std::condition_variable _job_available;
+	std::condition_variable _idle;
+	std::atomic<bool> _job_running;
+	std::atomic<bool> _stop;
+
+	std::atomic<unsigned long> _num_executed_jobs;
+	std::atomic<unsigned long> _num_failed_jobs;
+	std::atomic<unsigned long> _num_rejected_jobs;
+	std::atomic<unsigned long> _num_dropped_late_jobs;
+	std::atomic<unsigned long> _num_missed_deadlines;
+
+	std::thread _worker;
+};
+
+} /* namespace Sai2Primitives */
+
+#endif /* SAI2_PRIMITIVES_BACKGROUND_EXECUTOR_H */
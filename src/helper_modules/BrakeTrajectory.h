@@ -0,0 +1,254 @@
+/**
+ * BrakeTrajectory.h
+ *
+ *	Emergency stop trajectory for the OTG wrappers. While the trajectory
+ * generator runs, a trajectory bringing its current state to rest with the
+ * velocity, acceleration and jerk limits of the generator is recomputed
+ * whenever the state changes. It is computed in closed form for each axis, in
+ * O(dof) and without allocation: a Ruckig brake profile first brings the
+ * state within the limits if needed (as in AsyncTrajectoryCalculator), then
+ * the velocity is brought to zero in minimum time with a jerk limited
+ * acceleration ramp (or a constant acceleration without jerk limits). The
+ * axes stop independently, each at its own time. When a stop is triggered,
+ * the brake trajectory is played from the next cycle without any new
+ * calculation.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_BRAKE_TRAJECTORY_H
+#define SAI2_PRIMITIVES_BRAKE_TRAJECTORY_H
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <ruckig/brake.hpp>
+#include <ruckig/ruckig.hpp>
+#include <vector>
+
+namespace Sai2Primitives {
+
+template <size_t DOFs>
+class BrakeTrajectory {
+public:
+	typedef ruckig::InputParameter<DOFs, ruckig::EigenVector> Input;
+	typedef ruckig::EigenVector<double, DOFs> Vector;
+
+	/**
+	 * @brief      Constructor. Starts at rest at the current position of the
+	 * input, which is also used for the dimensions.
+	 *
+	 * @param[in]  initial_state  The initial state
+	 * @param[in]  loop_time      The duration of a control loop
+	 */
+	BrakeTrajectory(const Input& initial_state, const double loop_time)
+		: _dofs(initial_state.degrees_of_freedom),
+		  _loop_time(loop_time),
+		  _axes(initial_state.degrees_of_freedom),
+		  _active(false),
+		  _duration(0),
+		  _time(0) {
+		for (size_t i = 0; i < _dofs; i++) {
+			_axes[i].end_position = initial_state.current_position[i];
+		}
+	}
+
+	BrakeTrajectory(const BrakeTrajectory&) = delete;
+	BrakeTrajectory& operator=(const BrakeTrajectory&) = delete;
+
+	/**
+	 * @brief      Recomputes the brake trajectory from a state, with the
+	 * limits of the trajectory generator. Does nothing while the brake
+	 * trajectory is being played.
+	 *
+	 * @param[in]  limits        Input of the trajectory generator (only its
+	 *                           limits are used)
+	 * @param[in]  position      The position to brake from
+	 * @param[in]  velocity      The velocity to brake from
+	 * @param[in]  acceleration  The acceleration to brake from
+	 */
+	void precompute(const Input& limits, const Vector& position,
+					const Vector& velocity, const Vector& acceleration) {
+		if (_active) {
+			return;
+		}
+		_duration = 0;
+		for (size_t i = 0; i < _dofs; i++) {
+			computeAxis(limits, i, position[i], velocity[i], acceleration[i]);
+		}
+	}
+
+	/**
+	 * @brief      Recomputes the brake trajectory from a state with zero
+	 * acceleration (a measured state for instance)
+	 */
+	void precompute(const Input& limits, const Vector& position,
+					const Vector& velocity) {
+		if (_active) {
+			return;
+		}
+		_duration = 0;
+		for (size_t i = 0; i < _dofs; i++) {
+			computeAxis(limits, i, position[i], velocity[i], 0.0);
+		}
+	}
+
+	/**
+	 * @brief      Starts playing the last precomputed brake trajectory. The
+	 * first call to update() returns its state one loop after the state it
+	 * was computed from.
+	 */
+	void start() {
+		_active = true;
+		_time = 0;
+	}
+
+	/**
+	 * @brief      Stops playing the brake trajectory. The next call to
+	 * precompute() computes a new one.
+	 */
+	void release() { _active = false; }
+
+	bool isActive() const { return _active; }
+
+	/**
+	 * @brief      Steps the brake trajectory by one loop
+	 *
+	 * @return     true once the trajectory is at rest
+	 */
+	bool update(Vector& position, Vector& velocity, Vector& acceleration) {
+		_time += _loop_time;
+		for (size_t i = 0; i < _dofs; i++) {
+			const Axis& axis = _axes[i];
+			double t = _time;
+			int k = 0;
+			while (k < axis.num_segments && t >= axis.segments[k].duration) {
+				t -= axis.segments[k].duration;
+				k++;
+			}
+			if (k == axis.num_segments) {
+				position[i] = axis.end_position;
+				velocity[i] = 0;
+				acceleration[i] = 0;
+				continue;
+			}
+			const Segment& segment = axis.segments[k];
+			std::tie(position[i], velocity[i], acceleration[i]) =
+				ruckig::integrate(t, segment.p, segment.v, segment.a,
+								  segment.j);
+		}
+		return _time >= _duration;
+	}
+
+	/**
+	 * @brief      Duration of the last precomputed brake trajectory (s)
+	 */
+	double getDuration() const { return _duration; }
+
+private:
+	// constant jerk segment, from the state (p, v, a)
+	struct Segment {
+		double duration, p, v, a, j;
+	};
+
+	// at most 2 segments to get within the limits, and 3 to stop
+	struct Axis {
+		std::array<Segment, 5> segments;
+		int num_segments;
+		double end_position;
+	};
+
+	// appends a segment to the axis and integrates the state along it
+	static void addSegment(Axis& axis, const double duration, double& p,
+						   double& v, double& a, const double j) {
+		if (duration <= 0) {
+			return;
+		}
+		axis.segments[axis.num_segments++] = {duration, p, v, a, j};
+		std::tie(p, v, a) = ruckig::integrate(duration, p, v, a, j);
+	}
+
+	void computeAxis(const Input& limits, const size_t i, double p, double v,
+					 double a) {
+		Axis& axis = _axes[i];
+		axis.num_segments = 0;
+		const double v_max = limits.max_velocity[i];
+		const double a_max = limits.max_acceleration[i];
+		const double j_max = limits.max_jerk[i];
+		const bool jerk_limited = !std::isinf(j_max);
+
+		// bring the state within the limits
+		ruckig::BrakeProfile brake;
+		if (jerk_limited) {
+			brake.get_position_brake_trajectory(v, a, v_max, -v_max, a_max,
+												-a_max, j_max);
+			addSegment(axis, brake.t[0], p, v, a, brake.j[0]);
+			addSegment(axis, brake.t[1], p, v, a, brake.j[1]);
+		} else {
+			// the acceleration is not part of the state of second order
+			// trajectories
+			if (!std::isinf(a_max)) {
+				brake.get_second_order_position_brake_trajectory(
+					v, v_max, -v_max, a_max, -a_max);
+				a = brake.a[0];
+				addSegment(axis, brake.t[0], p, v, a, 0.0);
+			}
+			a = 0;
+		}
+
+		// bring the velocity to zero, accelerating against the velocity
+		// reached when ramping the acceleration down to zero
+		const double ramp_down_time = jerk_limited ? std::abs(a) / j_max : 0;
+		const double ramp_down_velocity = v + 0.5 * a * ramp_down_time;
+		if (std::abs(ramp_down_velocity) < 1e-12 ||
+			(!jerk_limited && std::isinf(a_max))) {
+			addSegment(axis, ramp_down_time, p, v, a, a > 0 ? -j_max : j_max);
+		} else {
+			// ramp the acceleration up to a peak in the stopping direction,
+			// hold it if it reaches the limit, and ramp it down to zero
+			const double direction = ramp_down_velocity < 0 ? 1.0 : -1.0;
+			const double stopping_velocity = -direction * v;
+			const double stopping_acceleration = direction * a;
+			double peak = a_max;
+			double peak_ramp_time = 0;
+			double constant_time = stopping_velocity / a_max;
+			if (jerk_limited) {
+				peak = std::min(
+					a_max, std::sqrt(j_max * stopping_velocity +
+									 0.5 * stopping_acceleration *
+										 stopping_acceleration));
+				peak_ramp_time = peak / j_max;
+				constant_time = std::max(
+					0.0, (stopping_velocity - peak * peak_ramp_time +
+						  0.5 * stopping_acceleration *
+							  stopping_acceleration / j_max) /
+							 peak);
+				addSegment(axis, (peak - stopping_acceleration) / j_max, p, v,
+						   a, direction * j_max);
+			}
+			a = direction * peak;
+			addSegment(axis, constant_time, p, v, a, 0.0);
+			addSegment(axis, peak_ramp_time, p, v, a, -direction * j_max);
+		}
+		axis.end_position = p;
+
+		double duration = 0;
+		for (int k = 0; k < axis.num_segments; k++) {
+			duration += axis.segments[k].duration;
+		}
+		_duration = std::max(_duration, duration);
+	}
+
+	size_t _dofs;
+	double _loop_time;
+	std::vector<Axis> _axes;
+
+	bool _active;
+	double _duration;
+	double _time;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_BRAKE_TRAJECTORY_H
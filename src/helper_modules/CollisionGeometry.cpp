@@ -0,0 +1,567 @@
+#include "CollisionGeometry.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+const int GJK_MAX_ITERATIONS = 32;
+// relative progress of the squared distance under which GJK stops
+const double GJK_RELATIVE_TOLERANCE = 1e-10;
+// squared distance under which the cores are considered in contact
+const double GJK_CONTACT_TOLERANCE = 1e-16;
+
+// a vertex of the GJK simplex, with the support points on the two shapes and
+// the support directions in the shape frames that produced them
+struct SupportPoint {
+	Eigen::Vector3d w;
+	Eigen::Vector3d point_a;
+	Eigen::Vector3d point_b;
+	Eigen::Vector3d direction_a;
+	Eigen::Vector3d direction_b;
+};
+
+struct Simplex {
+	std::array<SupportPoint, 4> vertices;
+	std::array<double, 4> lambdas;
+	int size;
+};
+
+SupportPoint supportFromLocalDirections(
+	const Sai2Primitives::ConvexShape& shape_a, const Eigen::Affine3d& pose_a,
+	const Sai2Primitives::ConvexShape& shape_b, const Eigen::Affine3d& pose_b,
+	const Eigen::Vector3d& direction_a, const Eigen::Vector3d& direction_b) {
+	SupportPoint support;
+	support.direction_a = direction_a;
+	support.direction_b = direction_b;
+	support.point_a = pose_a * shape_a.coreSupport(direction_a);
+	support.point_b = pose_b * shape_b.coreSupport(direction_b);
+	support.w = support.point_a - support.point_b;
+	return support;
+}
+
+// support point of the minkowski difference of the cores (a - b) along a
+// world frame direction
+SupportPoint support(const Sai2Primitives::ConvexShape& shape_a,
+					 const Eigen::Affine3d& pose_a,
+					 const Sai2Primitives::ConvexShape& shape_b,
+					 const Eigen::Affine3d& pose_b,
+					 const Eigen::Vector3d& direction) {
+	return supportFromLocalDirections(
+		shape_a, pose_a, shape_b, pose_b,
+		pose_a.linear().transpose() * direction,
+		-pose_b.linear().transpose() * direction);
+}
+
+// keeps the given vertices of the simplex, in order
+void keepVertices(Simplex& simplex, const int count, const int* indices,
+				  const double* lambdas) {
+	std::array<SupportPoint, 4> kept;
+	for (int i = 0; i < count; i++) {
+		kept[i] = simplex.vertices[indices[i]];
+		simplex.lambdas[i] = lambdas[i];
+	}
+	for (int i = 0; i < count; i++) {
+		simplex.vertices[i] = kept[i];
+	}
+	simplex.size = count;
+}
+
+// closest point to the origin of the segment (i, j) of the simplex
+void closestOnSegment(const Simplex& simplex, const int i, const int j,
+					  int& count, int* indices, double* lambdas) {
+	const Eigen::Vector3d& a = simplex.vertices[i].w;
+	const Eigen::Vector3d ab = simplex.vertices[j].w - a;
+	const double ab_squared_norm = ab.squaredNorm();
+	const double t =
+		ab_squared_norm > 0 ? -a.dot(ab) / ab_squared_norm : 0.0;
+	if (t <= 0) {
+		count = 1;
+		indices[0] = i;
+		lambdas[0] = 1.0;
+	} else if (t >= 1) {
+		count = 1;
+		indices[0] = j;
+		lambdas[0] = 1.0;
+	} else {
+		count = 2;
+		indices[0] = i;
+		indices[1] = j;
+		lambdas[0] = 1.0 - t;
+		lambdas[1] = t;
+	}
+}
+
+// closest point to the origin of the triangle (i, j, k) of the simplex
+// (Ericson, Real-Time Collision Detection, 5.1.5)
+void closestOnTriangle(const Simplex& simplex, const int i, const int j,
+					   const int k, int& count, int* indices,
+					   double* lambdas) {
+	const Eigen::Vector3d& a = simplex.vertices[i].w;
+	const Eigen::Vector3d& b = simplex.vertices[j].w;
+	const Eigen::Vector3d& c = simplex.vertices[k].w;
+	const Eigen::Vector3d ab = b - a;
+	const Eigen::Vector3d ac = c - a;
+
+	const double d1 = -ab.dot(a);
+	const double d2 = -ac.dot(a);
+	if (d1 <= 0 && d2 <= 0) {
+		count = 1;
+		indices[0] = i;
+		lambdas[0] = 1.0;
+		return;
+	}
+	const double d3 = -ab.dot(b);
+	const double d4 = -ac.dot(b);
+	if (d3 >= 0 && d4 <= d3) {
+		count = 1;
+		indices[0] = j;
+		lambdas[0] = 1.0;
+		return;
+	}
+	const double vc = d1 * d4 - d3 * d2;
+	if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+		const double t = d1 / (d1 - d3);
+		count = 2;
+		indices[0] = i;
+		indices[1] = j;
+		lambdas[0] = 1.0 - t;
+		lambdas[1] = t;
+		return;
+	}
+	const double d5 = -ab.dot(c);
+	const double d6 = -ac.dot(c);
+	if (d6 >= 0 && d5 <= d6) {
+		count = 1;
+		indices[0] = k;
+		lambdas[0] = 1.0;
+		return;
+	}
+	const double vb = d5 * d2 - d1 * d6;
+	if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+		const double t = d2 / (d2 - d6);
+		count = 2;
+		indices[0] = i;
+		indices[1] = k;
+		lambdas[0] = 1.0 - t;
+		lambdas[1] = t;
+		return;
+	}
+	const double va = d3 * d6 - d5 * d4;
+	if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) {
+		const double t = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		count = 2;
+		indices[0] = j;
+		indices[1] = k;
+		lambdas[0] = 1.0 - t;
+		lambdas[1] = t;
+		return;
+	}
+	const double denominator = va + vb + vc;
+	if (denominator <= 0) {
+		// degenerate triangle, the closest point is on one of its edges
+		const int edges[3][2] = {{i, j}, {i, k}, {j, k}};
+		double best_squared_norm = std::numeric_limits<double>::infinity();
+		for (const auto& edge : edges) {
+			int edge_count = 0;
+			int edge_indices[2];
+			double edge_lambdas[2];
+			closestOnSegment(simplex, edge[0], edge[1], edge_count,
+							 edge_indices, edge_lambdas);
+			Eigen::Vector3d v = Eigen::Vector3d::Zero();
+			for (int n = 0; n < edge_count; n++) {
+				v += edge_lambdas[n] * simplex.vertices[edge_indices[n]].w;
+			}
+			if (v.squaredNorm() < best_squared_norm) {
+				best_squared_norm = v.squaredNorm();
+				count = edge_count;
+				std::copy(edge_indices, edge_indices + edge_count, indices);
+				std::copy(edge_lambdas, edge_lambdas + edge_count, lambdas);
+			}
+		}
+		return;
+	}
+	count = 3;
+	indices[0] = i;
+	indices[1] = j;
+	indices[2] = k;
+	lambdas[1] = vb / denominator;
+	lambdas[2] = vc / denominator;
+	lambdas[0] = 1.0 - lambdas[1] - lambdas[2];
+}
+
+Eigen::Vector3d combination(const Simplex& simplex, const int count,
+							const int* indices, const double* lambdas) {
+	Eigen::Vector3d v = Eigen::Vector3d::Zero();
+	for (int i = 0; i < count; i++) {
+		v += lambdas[i] * simplex.vertices[indices[i]].w;
+	}
+	return v;
+}
+
+// reduces the simplex to the vertices of its feature closest to the origin
+// and computes the closest point. Returns false if the origin is inside the
+// simplex (tetrahedron)
+bool reduceSimplex(Simplex& simplex, Eigen::Vector3d& v) {
+	int count = 0;
+	int indices[4];
+	double lambdas[4];
+	if (simplex.size == 1) {
+		simplex.lambdas[0] = 1.0;
+		v = simplex.vertices[0].w;
+		return true;
+	} else if (simplex.size == 2) {
+		closestOnSegment(simplex, 0, 1, count, indices, lambdas);
+	} else if (simplex.size == 3) {
+		closestOnTriangle(simplex, 0, 1, 2, count, indices, lambdas);
+	} else {
+		// test the faces of the tetrahedron that have the origin on their
+		// outer side
+		static const int faces[4][4] = {
+			{0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 3, 1}, {1, 2, 3, 0}};
+		double best_squared_norm = std::numeric_limits<double>::infinity();
+		bool outside_any = false;
+		for (const auto& face : faces) {
+			const Eigen::Vector3d& a = simplex.vertices[face[0]].w;
+			const Eigen::Vector3d normal =
+				(simplex.vertices[face[1]].w - a)
+					.cross(simplex.vertices[face[2]].w - a);
+			const double side_origin = -normal.dot(a);
+			const double side_opposite =
+				normal.dot(simplex.vertices[face[3]].w - a);
+			// a flat tetrahedron has no inside, all its faces are tested
+			if (side_origin * side_opposite > 0 &&
+				std::abs(side_opposite) > 1e-14 * normal.norm()) {
+				continue;
+			}
+			outside_any = true;
+			int face_count = 0;
+			int face_indices[3];
+			double face_lambdas[3];
+			closestOnTriangle(simplex, face[0], face[1], face[2], face_count,
+							  face_indices, face_lambdas);
+			const double squared_norm =
+				combination(simplex, face_count, face_indices, face_lambdas)
+					.squaredNorm();
+			if (squared_norm < best_squared_norm) {
+				best_squared_norm = squared_norm;
+				count = face_count;
+				std::copy(face_indices, face_indices + face_count, indices);
+				std::copy(face_lambdas, face_lambdas + face_count, lambdas);
+			}
+		}
+		if (!outside_any) {
+			return false;
+		}
+	}
+	v = combination(simplex, count, indices, lambdas);
+	keepVertices(simplex, count, indices, lambdas);
+	return true;
+}
+
+}  // namespace
+
+namespace Sai2Primitives {
+
+ConvexShape::ConvexShape(const ShapeType type, const double radius)
+	: _type(type),
+	  _radius(radius),
+	  _bounding_radius(radius),
+	  _half_length(0.0),
+	  _half_extents(Vector3d::Zero()) {
+	if (radius < 0) {
+		throw std::invalid_argument(
+			"radius should be positive or zero in ConvexShape::ConvexShape\n");
+	}
+}
+
+ConvexShape ConvexShape::sphere(const double radius) {
+	if (radius <= 0) {
+		throw std::invalid_argument(
+			"radius should be strictly positive in ConvexShape::sphere\n");
+	}
+	return ConvexShape(SPHERE, radius);
+}
+
+ConvexShape ConvexShape::capsule(const double radius,
+								 const double half_length) {
+	if (radius <= 0 || half_length < 0) {
+		throw std::invalid_argument(
+			"radius should be strictly positive and half_length positive in "
+			"ConvexShape::capsule\n");
+	}
+	ConvexShape shape(CAPSULE, radius);
+	shape._half_length = half_length;
+	shape._bounding_radius = half_length + radius;
+	return shape;
+}
+
+ConvexShape ConvexShape::box(const Vector3d& half_extents,
+							 const double radius) {
+	if (half_extents.minCoeff() < 0) {
+		throw std::invalid_argument(
+			"half_extents should be positive in ConvexShape::box\n");
+	}
+	ConvexShape shape(BOX, radius);
+	shape._half_extents = half_extents;
+	shape._bounding_radius = half_extents.norm() + radius;
+	return shape;
+}
+
+ConvexShape ConvexShape::convexHull(const std::vector<Vector3d>& vertices,
+									const double radius) {
+	if (vertices.empty()) {
+		throw std::invalid_argument(
+			"vertices cannot be empty in ConvexShape::convexHull\n");
+	}
+	ConvexShape shape(CONVEX_HULL, radius);
+	shape._vertices = vertices;
+	double max_norm = 0;
+	for (const auto& vertex : vertices) {
+		max_norm = std::max(max_norm, vertex.norm());
+	}
+	shape._bounding_radius = max_norm + radius;
+	return shape;
+}
+
+Vector3d ConvexShape::coreSupport(const Vector3d& direction) const {
+	switch (_type) {
+		case CAPSULE:
+			return Vector3d(0, 0,
+							direction(2) >= 0 ? _half_length : -_half_length);
+		case BOX:
+			return Vector3d(
+				direction(0) >= 0 ? _half_extents(0) : -_half_extents(0),
+				direction(1) >= 0 ? _half_extents(1) : -_half_extents(1),
+				direction(2) >= 0 ? _half_extents(2) : -_half_extents(2));
+		case CONVEX_HULL: {
+			int best = 0;
+			double best_dot = _vertices[0].dot(direction);
+			for (int i = 1; i < _vertices.size(); i++) {
+				const double dot = _vertices[i].dot(direction);
+				if (dot > best_dot) {
+					best_dot = dot;
+					best = i;
+				}
+			}
+			return _vertices[best];
+		}
+		default:
+			return Vector3d::Zero();
+	}
+}
+
+void ConvexShape::boundingBox(const Affine3d& pose, Vector3d& lower,
+							  Vector3d& upper) const {
+	Vector3d half_size = Vector3d::Constant(_radius);
+	switch (_type) {
+		case CAPSULE:
+			half_size += _half_length * pose.linear().col(2).cwiseAbs();
+			break;
+		case BOX:
+			half_size += pose.linear().cwiseAbs() * _half_extents;
+			break;
+		case CONVEX_HULL: {
+			lower = upper = pose * _vertices[0];
+			for (int i = 1; i < _vertices.size(); i++) {
+				const Vector3d vertex = pose * _vertices[i];
+				lower = lower.cwiseMin(vertex);
+				upper = upper.cwiseMax(vertex);
+			}
+			lower.array() -= _radius;
+			upper.array() += _radius;
+			return;
+		}
+		default:
+			break;
+	}
+	lower = pose.translation() - half_size;
+	upper = pose.translation() + half_size;
+}
+
+ConvexDistanceResult computeConvexDistance(const ConvexShape& shape_a,
+										   const Affine3d& pose_a,
+										   const ConvexShape& shape_b,
+										   const Affine3d& pose_b,
+										   ConvexDistanceCache& cache) {
+	Simplex simplex;
+	simplex.size = 0;
+	// warm start from the closest features of the previous query
+	for (int i = 0; i < cache.num_features; i++) {
+		simplex.vertices[simplex.size++] = supportFromLocalDirections(
+			shape_a, pose_a, shape_b, pose_b, cache.directions_a[i],
+			cache.directions_b[i]);
+	}
+	if (simplex.size == 0) {
+		Vector3d direction = pose_b.translation() - pose_a.translation();
+		if (direction.squaredNorm() == 0) {
+			direction = Vector3d::UnitX();
+		}
+		simplex.vertices[simplex.size++] =
+			support(shape_a, pose_a, shape_b, pose_b, direction);
+	}
+
+	ConvexDistanceResult result;
+	result.cores_intersect = false;
+	result.num_iterations = 0;
+	Vector3d v = Vector3d::Zero();
+	double previous_squared_norm = std::numeric_limits<double>::infinity();
+	while (true) {
+		if (!reduceSimplex(simplex, v)) {
+			result.cores_intersect = true;
+			break;
+		}
+		const double squared_norm = v.squaredNorm();
+		if (squared_norm < GJK_CONTACT_TOLERANCE) {
+			result.cores_intersect = true;
+			break;
+		}
+		// stop when the distance does not decrease anymore
+		if (result.num_iterations >= GJK_MAX_ITERATIONS ||
+			(result.num_iterations > 0 &&
+			 previous_squared_norm - squared_norm <=
+				 GJK_RELATIVE_TOLERANCE * previous_squared_norm)) {
+			break;
+		}
+		previous_squared_norm = squared_norm;
+		result.num_iterations++;
+
+		const SupportPoint w = support(shape_a, pose_a, shape_b, pose_b, -v);
+		if (squared_norm - v.dot(w.w) <=
+			GJK_RELATIVE_TOLERANCE * squared_norm) {
+			break;
+		}
+		bool duplicate = false;
+		for (int i = 0; i < simplex.size; i++) {
+			duplicate = duplicate || (simplex.vertices[i].w - w.w)
+											 .isZero(1e-12 * (1.0 + w.w.norm()));
+		}
+		if (duplicate) {
+			break;
+		}
+		simplex.vertices[simplex.size++] = w;
+	}
+
+	cache.num_features = simplex.size;
+	for (int i = 0; i < simplex.size; i++) {
+		cache.directions_a[i] = simplex.vertices[i].direction_a;
+		cache.directions_b[i] = simplex.vertices[i].direction_b;
+	}
+
+	result.point_a.setZero();
+	result.point_b.setZero();
+	if (result.cores_intersect) {
+		// the penetration is not computed, the normal of the previous query is
+		// kept
+		for (int i = 0; i < simplex.size; i++) {
+			result.point_a += simplex.vertices[i].point_a / simplex.size;
+		}
+		result.point_b = result.point_a;
+		result.normal = cache.normal;
+		result.distance = -shape_a.getRadius() - shape_b.getRadius();
+		return result;
+	}
+	for (int i = 0; i < simplex.size; i++) {
+		result.point_a += simplex.lambdas[i] * simplex.vertices[i].point_a;
+		result.point_b += simplex.lambdas[i] * simplex.vertices[i].point_b;
+	}
+	const double core_distance = v.norm();
+	result.normal = v / core_distance;
+	cache.normal = result.normal;
+	result.point_a -= shape_a.getRadius() * result.normal;
+	result.point_b += shape_b.getRadius() * result.normal;
+	result.distance =
+		core_distance - shape_a.getRadius() - shape_b.getRadius();
+	return result;
+}
+
+void BoundingVolumeHierarchy::build(const Matrix3Xd& lower,
+									const Matrix3Xd& upper) {
+	if (lower.cols() != upper.cols()) {
+		throw std::invalid_argument(
+			"lower and upper should have the same size in "
+			"BoundingVolumeHierarchy::build\n");
+	}
+	const int num_boxes = lower.cols();
+	_indices.resize(num_boxes);
+	std::iota(_indices.begin(), _indices.end(), 0);
+	_nodes.clear();
+	if (num_boxes == 0) {
+		return;
+	}
+	_nodes.reserve(2 * (num_boxes / MAX_LEAF_SIZE + 1));
+	const Matrix3Xd centers = 0.5 * (lower + upper);
+	buildNode(centers, 0, num_boxes);
+	refit(lower, upper);
+}
+
+void BoundingVolumeHierarchy::refit(const Matrix3Xd& lower,
+									const Matrix3Xd& upper) {
+	if (lower.cols() != _indices.size() || upper.cols() != _indices.size()) {
+		throw std::invalid_argument(
+			"number of boxes not consistent with the last build in "
+			"BoundingVolumeHierarchy::refit\n");
+	}
+	_box_lower = lower;
+	_box_upper = upper;
+	if (!_nodes.empty()) {
+		refitNode(0, lower, upper);
+	}
+}
+
+int BoundingVolumeHierarchy::buildNode(const Matrix3Xd& centers,
+									   const int first, const int count) {
+	const int node_index = _nodes.size();
+	_nodes.emplace_back();
+	_nodes[node_index].first = first;
+	_nodes[node_index].count = count;
+	_nodes[node_index].left = -1;
+	_nodes[node_index].right = -1;
+	if (count <= MAX_LEAF_SIZE) {
+		return node_index;
+	}
+
+	// split at the median along the largest spread of the centers
+	Vector3d lower_center = centers.col(_indices[first]);
+	Vector3d upper_center = lower_center;
+	for (int i = first + 1; i < first + count; i++) {
+		lower_center = lower_center.cwiseMin(centers.col(_indices[i]));
+		upper_center = upper_center.cwiseMax(centers.col(_indices[i]));
+	}
+	int axis = 0;
+	(upper_center - lower_center).maxCoeff(&axis);
+	const int half = count / 2;
+	std::nth_element(_indices.begin() + first, _indices.begin() + first + half,
+					 _indices.begin() + first + count,
+					 [&centers, axis](const int i, const int j) {
+						 return centers(axis, i) < centers(axis, j);
+					 });
+
+	const int left = buildNode(centers, first, half);
+	const int right = buildNode(centers, first + half, count - half);
+	_nodes[node_index].left = left;
+	_nodes[node_index].right = right;
+	return node_index;
+}
+
+void BoundingVolumeHierarchy::refitNode(const int node_index,
+										const Matrix3Xd& lower,
+										const Matrix3Xd& upper) {
+	Node& node = _nodes[node_index];
+	if (node.left < 0) {
+		node.lower = lower.col(_indices[node.first]);
+		node.upper = upper.col(_indices[node.first]);
+		for (int i = node.first + 1; i < node.first + node.count; i++) {
+			node.lower = node.lower.cwiseMin(lower.col(_indices[i]));
+			node.upper = node.upper.cwiseMax(upper.col(_indices[i]));
+		}
+		return;
+	}
+	refitNode(node.left, lower, upper);
+	refitNode(node.right, lower, upper);
+	node.lower = _nodes[node.left].lower.cwiseMin(_nodes[node.right].lower);
+	node.upper = _nodes[node.left].upper.cwiseMax(_nodes[node.right].upper);
+}
+
+}  // namespace Sai2Primitives
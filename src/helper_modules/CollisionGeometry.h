@@ -0,0 +1,264 @@
+/**
+ * CollisionGeometry.h
+ *
+ *	Geometry used by the collision avoidance task: convex shapes defined by a
+ * support function (spheres, capsules, boxes and convex hulls, optionally
+ * rounded by a radius), a GJK distance query between two placed shapes that
+ * can be warm started from the result of the previous control cycle, and a
+ * bounding volume hierarchy of axis aligned boxes to only query the pairs of
+ * shapes that are close to each other.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_COLLISION_GEOMETRY_H
+#define SAI2_PRIMITIVES_COLLISION_GEOMETRY_H
+
+#include <Eigen/Dense>
+#include <array>
+#include <stdexcept>
+#include <vector>
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+/**
+ * @brief      Convex shape, made of a convex core (a point, a segment, a box or
+ * the convex hull of a set of points) swept by a sphere of a given radius. A
+ * sphere is a point core with a radius, a capsule a segment core with a radius.
+ * The distance queries are exact for the core and add the radius analytically,
+ * so rounded shapes cost the same as their core.
+ */
+class ConvexShape {
+public:
+	enum ShapeType {
+		SPHERE,
+		CAPSULE,
+		BOX,
+		CONVEX_HULL,
+	};
+
+	/**
+	 * @brief      A sphere centered at the origin of the shape frame
+	 */
+	static ConvexShape sphere(const double radius);
+
+	/**
+	 * @brief      A capsule along the z axis of the shape frame, centered at
+	 * its origin
+	 *
+	 * @param[in]  radius       The radius of the capsule
+	 * @param[in]  half_length  Half the length of the segment between the
+	 *                          centers of the two end spheres
+	 */
+	static ConvexShape capsule(const double radius, const double half_length);
+
+	/**
+	 * @brief      A box centered at the origin of the shape frame and aligned
+	 * with its axes, optionally with rounded edges
+	 *
+	 * @param[in]  half_extents  The half sizes of the box along x, y and z
+	 * @param[in]  radius        The radius of the rounding (the box then
+	 *                           extends radius further in all directions)
+	 */
+	static ConvexShape box(const Vector3d& half_extents,
+						   const double radius = 0.0);
+
+	/**
+	 * @brief      The convex hull of a set of points of the shape frame,
+	 * optionally rounded. The support function scans the points, so hulls
+	 * should be simplified to a few tens of points.
+	 *
+	 * @param[in]  vertices  The points
+	 * @param[in]  radius    The radius of the rounding
+	 */
+	static ConvexShape convexHull(const std::vector<Vector3d>& vertices,
+								  const double radius = 0.0);
+
+	/**
+	 * @brief      Support point of the core of the shape in the shape frame:
+	 * the point of the core that is the furthest along a direction
+	 *
+	 * @param[in]  direction  The direction (shape frame, not necessarily
+	 *                        normalized)
+	 */
+	Vector3d coreSupport(const Vector3d& direction) const;
+
+	/**
+	 * @brief      Axis aligned bounding box of the shape placed in the world
+	 * (radius included)
+	 *
+	 * @param[in]  pose  The pose of the shape frame in world frame
+	 * @param[out] lower The lower corner of the box
+	 * @param[out] upper The upper corner of the box
+	 */
+	void boundingBox(const Affine3d& pose, Vector3d& lower,
+					 Vector3d& upper) const;
+
+	ShapeType getType() const { return _type; }
+	double getRadius() const { return _radius; }
+
+	/**
+	 * @brief      Radius of a sphere centered at the origin of the shape frame
+	 * that contains the shape. Bounds the displacement of the points of the
+	 * shape when it rotates.
+	 */
+	double getBoundingRadius() const { return _bounding_radius; }
+
+private:
+	ConvexShape(const ShapeType type, const double radius);
+
+	ShapeType _type;
+	double _radius;
+	double _bounding_radius;
+	// half length of a capsule, half extents of a box
+	double _half_length;
+	Vector3d _half_extents;
+	// vertices of a convex hull
+	std::vector<Vector3d> _vertices;
+};
+
+/**
+ * @brief      Warm start data of the distance query between two shapes,
+ * carried from one control cycle to the next. It stores the support
+ * directions of the final GJK simplex in the frames of the two shapes (the
+ * closest features), so the next query starts from the same features in the
+ * new poses and usually converges in one or two iterations.
+ */
+struct ConvexDistanceCache {
+	int num_features;
+	std::array<Vector3d, 4> directions_a;
+	std::array<Vector3d, 4> directions_b;
+	// last separating direction (world frame, from b to a), used as normal
+	// when the cores intersect
+	Vector3d normal;
+
+	ConvexDistanceCache() : num_features(0), normal(Vector3d::UnitZ()) {}
+};
+
+/**
+ * @brief      Result of a distance query between two shapes
+ */
+struct ConvexDistanceResult {
+	// distance between the shapes (radius included). When the cores
+	// intersect, the penetration is not computed and the distance is minus
+	// the sum of the radii
+	double distance;
+	// closest points on the shapes (world frame)
+	Vector3d point_a;
+	Vector3d point_b;
+	// unit normal from shape b to shape a (world frame)
+	Vector3d normal;
+	bool cores_intersect;
+	int num_iterations;
+};
+
+/**
+ * @brief      Computes the distance between two placed convex shapes with the
+ * GJK algorithm, warm started from the cache and updating it
+ *
+ * @param[in]  shape_a  The first shape
+ * @param[in]  pose_a   Its pose in world frame
+ * @param[in]  shape_b  The second shape
+ * @param[in]  pose_b   Its pose in world frame
+ * @param      cache    The warm start data of this pair of shapes
+ *
+ * @return     The distance, closest points and normal
+ */
+ConvexDistanceResult computeConvexDistance(const ConvexShape& shape_a,
+										   const Affine3d& pose_a,
+										   const ConvexShape& shape_b,
+										   const Affine3d& pose_b,
+										   ConvexDistanceCache& cache);
+
+/**
+ * @brief      Bounding volume hierarchy of axis aligned boxes, built top down
+ * by splitting the boxes at the median of their centers along the largest
+ * dimension. The boxes can move, in which case the hierarchy is refitted
+ * without changing its topology, and rebuilt when boxes are added.
+ */
+class BoundingVolumeHierarchy {
+public:
+	BoundingVolumeHierarchy() = default;
+
+	/**
+	 * @brief      Builds the hierarchy of a set of boxes
+	 *
+	 * @param[in]  lower  The lower corners of the boxes (3 x num boxes)
+	 * @param[in]  upper  The upper corners of the boxes (3 x num boxes)
+	 */
+	void build(const Matrix3Xd& lower, const Matrix3Xd& upper);
+
+	/**
+	 * @brief      Updates the bounds of the hierarchy after the boxes moved.
+	 * The boxes must be the ones of the last build, in the same order.
+	 */
+	void refit(const Matrix3Xd& lower, const Matrix3Xd& upper);
+
+	/**
+	 * @brief      Calls callback(index) for every box that overlaps the query
+	 * box (in no particular order). Does not allocate.
+	 */
+	template <typename Callback>
+	void query(const Vector3d& lower, const Vector3d& upper,
+			   Callback&& callback) const {
+		if (_nodes.empty()) {
+			return;
+		}
+		std::array<int, MAX_DEPTH> stack;
+		int stack_size = 0;
+		stack[stack_size++] = 0;
+		while (stack_size > 0) {
+			const Node& node = _nodes[stack[--stack_size]];
+			if ((node.lower.array() > upper.array()).any() ||
+				(node.upper.array() < lower.array()).any()) {
+				continue;
+			}
+			if (node.left < 0) {
+				for (int i = node.first; i < node.first + node.count; i++) {
+					const int index = _indices[i];
+					if ((_box_lower.col(index).array() <= upper.array()).all() &&
+						(_box_upper.col(index).array() >= lower.array()).all()) {
+						callback(index);
+					}
+				}
+			} else {
+				stack[stack_size++] = node.left;
+				stack[stack_size++] = node.right;
+			}
+		}
+	}
+
+	int numBoxes() const { return _indices.size(); }
+
+private:
+	// the median splits keep the depth logarithmic in the number of boxes
+	static constexpr int MAX_DEPTH = 64;
+	static constexpr int MAX_LEAF_SIZE = 4;
+
+	struct Node {
+		Vector3d lower;
+		Vector3d upper;
+		// children, -1 for a leaf
+		int left;
+		int right;
+		// range of _indices of a leaf
+		int first;
+		int count;
+	};
+
+	int buildNode(const Matrix3Xd& centers, const int first, const int count);
+	void refitNode(const int node_index, const Matrix3Xd& lower,
+				   const Matrix3Xd& upper);
+
+	std::vector<Node> _nodes;
+	std::vector<int> _indices;
+	// copy of the boxes, tested individually in the leaves
+	Matrix3Xd _box_lower;
+	Matrix3Xd _box_upper;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_COLLISION_GEOMETRY_H
@@ -0,0 +1,485 @@
+#include "GainTuningEngine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+namespace Sai2Primitives {
+
+namespace {
+// cost given to diverged rollouts, finite so that candidates can be sorted
+const double DIVERGED_COST = 1e12;
+// penalty for candidates sampled outside of the search box
+const double OUT_OF_BOUNDS_PENALTY = 1e6;
+// joint velocity above which the simulation is considered diverged
+const double MAX_JOINT_VELOCITY = 1e3;
+
+RolloutScore divergedScore(const double duration) {
+	RolloutScore score;
+	score.diverged = true;
+	score.settling_time = duration;
+	score.cost = DIVERGED_COST;
+	return score;
+}
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+// ClosedLoopHarness
+////////////////////////////////////////////////////////////////////////////////
+
+ClosedLoopHarness::ClosedLoopHarness(
+	std::shared_ptr<Sai2Model::Sai2Model> robot, const double timestep)
+	: _robot(robot), _timestep(timestep) {
+	if (!_robot) {
+		throw std::invalid_argument(
+			"robot model cannot be null in "
+			"ClosedLoopHarness::ClosedLoopHarness\n");
+	}
+	if (timestep <= 0) {
+		throw std::invalid_argument(
+			"timestep should be strictly positive in "
+			"ClosedLoopHarness::ClosedLoopHarness\n");
+	}
+}
+
+void ClosedLoopHarness::resetRobotState(const VectorXd& q,
+										const VectorXd& dq) {
+	if (q.size() != _robot->qSize() || dq.size() != _robot->dof()) {
+		throw std::invalid_argument(
+			"state size not consistent with the robot in "
+			"ClosedLoopHarness::resetRobotState\n");
+	}
+	_robot->setQ(q);
+	_robot->setDq(dq);
+	_robot->updateModel();
+}
+
+RolloutScore ClosedLoopHarness::run(RolloutController& controller,
+									const double duration,
+									const RolloutScoreWeights& weights) {
+	RolloutScore score;
+	const int num_steps = std::max(1, (int)std::round(duration / _timestep));
+
+	double squared_error_sum = 0.0;
+	double squared_effort_sum = 0.0;
+	for (int i = 0; i < num_steps; i++) {
+		const double time = i * _timestep;
+		const VectorXd tau = controller.computeTorques(time);
+		const double error = controller.trackingError();
+
+		squared_error_sum += error * error;
+		squared_effort_sum += tau.squaredNorm();
+		if (error > weights.settling_threshold) {
+			score.settling_time = time + _timestep;
+		}
+
+		const VectorXd ddq = _robot->M().llt().solve(
+			tau - _robot->coriolisForce() - _robot->jointGravityVector());
+		const VectorXd dq = _robot->dq() + ddq * _timestep;
+		if (!dq.allFinite() || dq.cwiseAbs().maxCoeff() > MAX_JOINT_VELOCITY) {
+			score.diverged = true;
+			break;
+		}
+		_robot->setQ(_robot->q() + dq * _timestep);
+		_robot->setDq(dq);
+		_robot->updateModel();
+	}
+
+	if (score.diverged) {
+		return divergedScore(duration);
+	}
+
+	score.tracking_error = std::sqrt(squared_error_sum / num_steps);
+	score.effort = std::sqrt(squared_effort_sum / num_steps);
+	score.cost = weights.tracking_error * score.tracking_error +
+				 weights.effort * score.effort +
+				 weights.settling_time * score.settling_time;
+	return score;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// GainTuningEngine
+////////////////////////////////////////////////////////////////////////////////
+
+GainTuningEngine::GainTuningEngine(const TuningProblem& problem)
+	: _problem(problem),
+	  _num_threads(0),
+	  _max_generations(50),
+	  _initial_step_size(0.3),
+	  _seed(0),
+	  _generation(0),
+	  _num_running_workers(0),
+	  _stop_workers(false),
+	  _candidates(nullptr),
+	  _scores(nullptr),
+	  _next_candidate(0) {
+	const int n = _problem.lower_bounds.size();
+	if (n == 0 || _problem.upper_bounds.size() != n) {
+		throw std::invalid_argument(
+			"parameter bounds should be non empty and of the same size in "
+			"GainTuningEngine::GainTuningEngine\n");
+	}
+	if ((_problem.upper_bounds - _problem.lower_bounds).minCoeff() <= 0) {
+		throw std::invalid_argument(
+			"upper bounds should be strictly greater than lower bounds in "
+			"GainTuningEngine::GainTuningEngine\n");
+	}
+	if (_problem.log_scale && _problem.lower_bounds.minCoeff() <= 0) {
+		throw std::invalid_argument(
+			"bounds should be strictly positive for a log scale search in "
+			"GainTuningEngine::GainTuningEngine\n");
+	}
+	if (!_problem.create_robot || !_problem.create_controller) {
+		throw std::invalid_argument(
+			"robot and controller factories should be provided in "
+			"GainTuningEngine::GainTuningEngine\n");
+	}
+	if (_problem.num_scenarios <= 0 || _problem.rollout_duration <= 0 ||
+		_problem.timestep <= 0) {
+		throw std::invalid_argument(
+			"number of scenarios, rollout duration and timestep should be "
+			"strictly positive in GainTuningEngine::GainTuningEngine\n");
+	}
+	_population_size = 4 + (int)std::floor(3.0 * std::log((double)n));
+}
+
+GainTuningEngine::~GainTuningEngine() {
+	{
+		std::lock_guard<std::mutex> lock(_workers_mutex);
+		_stop_workers = true;
+	}
+	_generation_started.notify_all();
+	for (auto& worker : _workers) {
+		worker.join();
+	}
+}
+
+void GainTuningEngine::setNumThreads(const int num_threads) {
+	if (num_threads < 0) {
+		throw std::invalid_argument(
+			"number of threads cannot be negative in "
+			"GainTuningEngine::setNumThreads\n");
+	}
+	_num_threads = num_threads;
+}
+
+void GainTuningEngine::setPopulationSize(const int population_size) {
+	if (population_size < 2) {
+		throw std::invalid_argument(
+			"population size should be at least 2 in "
+			"GainTuningEngine::setPopulationSize\n");
+	}
+	_population_size = population_size;
+}
+
+void GainTuningEngine::setMaxGenerations(const int max_generations) {
+	if (max_generations <= 0) {
+		throw std::invalid_argument(
+			"max generations should be strictly positive in "
+			"GainTuningEngine::setMaxGenerations\n");
+	}
+	_max_generations = max_generations;
+}
+
+void GainTuningEngine::setInitialStepSize(const double initial_step_size) {
+	if (initial_step_size <= 0) {
+		throw std::invalid_argument(
+			"initial step size should be strictly positive in "
+			"GainTuningEngine::setInitialStepSize\n");
+	}
+	_initial_step_size = initial_step_size;
+}
+
+VectorXd GainTuningEngine::toParameters(const VectorXd& normalized) const {
+	if (_problem.log_scale) {
+		const VectorXd log_lower = _problem.lower_bounds.array().log();
+		const VectorXd log_upper = _problem.upper_bounds.array().log();
+		return (log_lower.array() +
+				normalized.array() * (log_upper - log_lower).array())
+			.exp();
+	}
+	return _problem.lower_bounds.array() +
+		   normalized.array() *
+			   (_problem.upper_bounds - _problem.lower_bounds).array();
+}
+
+VectorXd GainTuningEngine::toNormalized(const VectorXd& parameters) const {
+	if (_problem.log_scale) {
+		const VectorXd log_lower = _problem.lower_bounds.array().log();
+		const VectorXd log_upper = _problem.upper_bounds.array().log();
+		return (parameters.array().log() - log_lower.array()) /
+			   (log_upper - log_lower).array();
+	}
+	return (parameters - _problem.lower_bounds).array() /
+		   (_problem.upper_bounds - _problem.lower_bounds).array();
+}
+
+RolloutScore GainTuningEngine::evaluateOnHarness(ClosedLoopHarness& harness,
+												 const VectorXd& parameters) {
+	RolloutScore mean_score;
+	const VectorXd zero_velocity =
+		VectorXd::Zero(harness.getRobot()->dof());
+	for (int scenario = 0; scenario < _problem.num_scenarios; scenario++) {
+		harness.resetRobotState(_problem.initial_joint_positions,
+								zero_velocity);
+		// a controller that cannot be built or that throws during the rollout
+		// (singular task, invalid gains...) fails only this rollout
+		RolloutScore score;
+		try {
+			std::unique_ptr<RolloutController> controller =
+				_problem.create_controller(harness.getRobot(), parameters,
+										   scenario);
+			score = harness.run(*controller, _problem.rollout_duration,
+								_problem.weights);
+		} catch (...) {
+			score = divergedScore(_problem.rollout_duration);
+		}
+
+		mean_score.diverged = mean_score.diverged || score.diverged;
+		mean_score.tracking_error += score.tracking_error;
+		mean_score.effort += score.effort;
+		mean_score.settling_time += score.settling_time;
+		mean_score.cost += score.cost;
+	}
+	mean_score.tracking_error /= _problem.num_scenarios;
+	mean_score.effort /= _problem.num_scenarios;
+	mean_score.settling_time /= _problem.num_scenarios;
+	mean_score.cost /= _problem.num_scenarios;
+	return mean_score;
+}
+
+RolloutScore GainTuningEngine::evaluate(const VectorXd& parameters) {
+	if (parameters.size() != _problem.lower_bounds.size()) {
+		throw std::invalid_argument(
+			"parameters size not consistent with the bounds in "
+			"GainTuningEngine::evaluate\n");
+	}
+	ClosedLoopHarness harness(_problem.create_robot(), _problem.timestep);
+	return evaluateOnHarness(harness, parameters);
+}
+
+void GainTuningEngine::evaluateInParallel(
+	const std::vector<VectorXd>& candidates,
+	std::vector<RolloutScore>& scores) {
+	scores.resize(candidates.size());
+
+	// start the workers of the harnesses created since the last generation
+	_worker_errors.resize(_harnesses.size());
+	while (_workers.size() + 1 < _harnesses.size()) {
+		_workers.emplace_back(&GainTuningEngine::workerLoop, this,
+							  (int)_workers.size() + 1, _generation);
+	}
+
+	_candidates = &candidates;
+	_scores = &scores;
+	_next_candidate = 0;
+	std::fill(_worker_errors.begin(), _worker_errors.end(), nullptr);
+	{
+		std::lock_guard<std::mutex> lock(_workers_mutex);
+		_num_running_workers = _workers.size();
+		_generation++;
+	}
+	_generation_started.notify_all();
+	evaluateCandidates(0);
+	{
+		std::unique_lock<std::mutex> lock(_workers_mutex);
+		_generation_finished.wait(
+			lock, [this]() { return _num_running_workers == 0; });
+	}
+
+	// errors outside of the rollouts (robot state of the problem not
+	// consistent with the robot model) are rethrown in the calling thread
+	for (const auto& error : _worker_errors) {
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+}
+
+void GainTuningEngine::evaluateCandidates(const int worker_index) {
+	ClosedLoopHarness& harness = *_harnesses[worker_index];
+	try {
+		for (size_t i = _next_candidate++; i < _candidates->size();
+			 i = _next_candidate++) {
+			(*_scores)[i] = evaluateOnHarness(harness, (*_candidates)[i]);
+		}
+	} catch (...) {
+		_worker_errors[worker_index] = std::current_exception();
+		_next_candidate = _candidates->size();
+	}
+}
+
+void GainTuningEngine::workerLoop(const int worker_index, long generation) {
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(_workers_mutex);
+			_generation_started.wait(lock, [this, generation]() {
+				return _stop_workers || _generation != generation;
+			});
+			if (_stop_workers) {
+				return;
+			}
+			generation = _generation;
+		}
+		evaluateCandidates(worker_index);
+		{
+			std::lock_guard<std::mutex> lock(_workers_mutex);
+			if (--_num_running_workers == 0) {
+				_generation_finished.notify_one();
+			}
+		}
+	}
+}
+
+GainTuningEngine::Result GainTuningEngine::optimize(
+	const VectorXd& initial_parameters) {
+	const int n = _problem.lower_bounds.size();
+	if (initial_parameters.size() != n) {
+		throw std::invalid_argument(
+			"initial parameters size not consistent with the bounds in "
+			"GainTuningEngine::optimize\n");
+	}
+
+	// create the worker harnesses (robot models are not thread safe)
+	const int num_threads =
+		_num_threads > 0
+			? _num_threads
+			: std::max(1, (int)std::thread::hardware_concurrency());
+	while ((int)_harnesses.size() < num_threads) {
+		_harnesses.push_back(std::make_unique<ClosedLoopHarness>(
+			_problem.create_robot(), _problem.timestep));
+	}
+
+	// CMA-ES parameters, with the standard default values
+	const int lambda = _population_size;
+	const int mu = lambda / 2;
+	VectorXd weights(mu);
+	for (int i = 0; i < mu; i++) {
+		weights(i) = std::log(mu + 0.5) - std::log(i + 1.0);
+	}
+	weights /= weights.sum();
+	const double mu_eff = 1.0 / weights.squaredNorm();
+	const double c_c = (4.0 + mu_eff / n) / (n + 4.0 + 2.0 * mu_eff / n);
+	const double c_s = (mu_eff + 2.0) / (n + mu_eff + 5.0);
+	const double c_1 = 2.0 / ((n + 1.3) * (n + 1.3) + mu_eff);
+	const double c_mu =
+		std::min(1.0 - c_1, 2.0 * (mu_eff - 2.0 + 1.0 / mu_eff) /
+								((n + 2.0) * (n + 2.0) + mu_eff));
+	const double d_s =
+		1.0 + 2.0 * std::max(0.0, std::sqrt((mu_eff - 1.0) / (n + 1.0)) - 1.0) +
+		c_s;
+	const double chi_n =
+		std::sqrt((double)n) * (1.0 - 1.0 / (4.0 * n) + 1.0 / (21.0 * n * n));
+
+	// state, in the normalized search space
+	VectorXd mean = toNormalized(initial_parameters).cwiseMax(0.0).cwiseMin(1.0);
+	double sigma = _initial_step_size;
+	MatrixXd C = MatrixXd::Identity(n, n);
+	VectorXd p_c = VectorXd::Zero(n);
+	VectorXd p_s = VectorXd::Zero(n);
+
+	std::mt19937 generator(_seed);
+	std::normal_distribution<double> normal(0.0, 1.0);
+
+	Result result;
+	result.best_parameters = initial_parameters;
+	result.best_score.cost = std::numeric_limits<double>::infinity();
+	result.num_rollouts = 0;
+
+	std::vector<VectorXd> samples(lambda), candidates(lambda);
+	std::vector<RolloutScore> scores;
+	std::vector<double> costs(lambda);
+	std::vector<int> order(lambda);
+
+	const auto start = std::chrono::steady_clock::now();
+	int generation = 0;
+	for (; generation < _max_generations; generation++) {
+		SelfAdjointEigenSolver<MatrixXd> eigen_solver(C);
+		const MatrixXd B = eigen_solver.eigenvectors();
+		const VectorXd D = eigen_solver.eigenvalues().cwiseMax(1e-20).cwiseSqrt();
+
+		// sample the candidates, and evaluate them inside the search box
+		for (int k = 0; k < lambda; k++) {
+			VectorXd z(n);
+			for (int i = 0; i < n; i++) {
+				z(i) = normal(generator);
+			}
+			samples[k] = mean + sigma * B * D.asDiagonal() * z;
+			candidates[k] =
+				toParameters(samples[k].cwiseMax(0.0).cwiseMin(1.0));
+		}
+		evaluateInParallel(candidates, scores);
+		result.num_rollouts += (long)lambda * _problem.num_scenarios;
+
+		for (int k = 0; k < lambda; k++) {
+			const VectorXd clipped = samples[k].cwiseMax(0.0).cwiseMin(1.0);
+			costs[k] = scores[k].cost +
+					   OUT_OF_BOUNDS_PENALTY * (samples[k] - clipped).squaredNorm();
+			if (scores[k].cost < result.best_score.cost) {
+				result.best_score = scores[k];
+				result.best_parameters = candidates[k];
+			}
+		}
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(),
+				  [&costs](const int a, const int b) {
+					  return costs[a] < costs[b];
+				  });
+
+		// update the mean
+		const VectorXd previous_mean = mean;
+		mean.setZero();
+		for (int i = 0; i < mu; i++) {
+			mean += weights(i) * samples[order[i]];
+		}
+		const VectorXd mean_step = (mean - previous_mean) / sigma;
+
+		// update the evolution paths
+		const MatrixXd C_inverse_sqrt =
+			B * D.cwiseInverse().asDiagonal() * B.transpose();
+		p_s = (1.0 - c_s) * p_s +
+			  std::sqrt(c_s * (2.0 - c_s) * mu_eff) * C_inverse_sqrt * mean_step;
+		const double h_sigma =
+			p_s.norm() /
+						std::sqrt(1.0 - std::pow(1.0 - c_s,
+												 2.0 * (generation + 1))) /
+						chi_n <
+					1.4 + 2.0 / (n + 1.0)
+				? 1.0
+				: 0.0;
+		p_c = (1.0 - c_c) * p_c +
+			  h_sigma * std::sqrt(c_c * (2.0 - c_c) * mu_eff) * mean_step;
+
+		// update the covariance and the step size
+		MatrixXd rank_mu_update = MatrixXd::Zero(n, n);
+		for (int i = 0; i < mu; i++) {
+			const VectorXd y = (samples[order[i]] - previous_mean) / sigma;
+			rank_mu_update += weights(i) * y * y.transpose();
+		}
+		C = (1.0 - c_1 - c_mu) * C +
+			c_1 * (p_c * p_c.transpose() +
+				   (1.0 - h_sigma) * c_c * (2.0 - c_c) * C) +
+			c_mu * rank_mu_update;
+		sigma *= std::exp((c_s / d_s) * (p_s.norm() / chi_n - 1.0));
+
+		// stop when the search has converged
+		if (sigma * D.maxCoeff() < 1e-6) {
+			generation++;
+			break;
+		}
+	}
+
+	const double elapsed = std::chrono::duration<double>(
+							   std::chrono::steady_clock::now() - start)
+							   .count();
+	result.num_generations = generation;
+	result.rollouts_per_second =
+		elapsed > 0 ? result.num_rollouts / elapsed : 0.0;
+	return result;
+}
+
+}  // namespace Sai2Primitives
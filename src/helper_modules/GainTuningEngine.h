@@ -0,0 +1,279 @@
+/**
+ * GainTuningEngine.h
+ *
+ *	Automatic tuning of controller parameters (task gains, singularity handler
+ * bounds, damping tables...) on headless closed-loop rollouts. A rollout
+ * simulates the robot model with a simple rigid body integrator
+ * (ClosedLoopHarness) while a user provided RolloutController computes the
+ * torques with the library controllers. Each rollout is scored on tracking
+ * error, effort and settling time, and the parameters are searched with
+ * CMA-ES. The rollouts of a generation are run in parallel, with one robot
+ * model per worker thread. The worker threads are created at the first
+ * optimization and kept until the engine is destroyed.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_GAIN_TUNING_ENGINE_H
+#define SAI2_PRIMITIVES_GAIN_TUNING_ENGINE_H
+
+#include <Eigen/Dense>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Sai2Model.h"
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+/**
+ * @brief      Controller stepped by the closed-loop harness. It is created for
+ * a given set of parameters and scenario, and typically wraps a
+ * RobotController and its tasks built on the harness robot model.
+ */
+class RolloutController {
+public:
+	virtual ~RolloutController() = default;
+
+	/**
+	 * @brief      Computes the control torques. Called once per step, after
+	 * the robot model was updated with the current simulated state.
+	 *
+	 * @param[in]  time  The time since the start of the rollout
+	 *
+	 * @return     The joint torques
+	 */
+	virtual VectorXd computeTorques(const double time) = 0;
+
+	/**
+	 * @brief      The tracking error (for instance the norm of the position
+	 * error) at the current step, used to score the rollout
+	 */
+	virtual double trackingError() const = 0;
+};
+
+struct RolloutScore {
+	// root mean square of the tracking error
+	double tracking_error;
+	// root mean square of the norm of the control torques
+	double effort;
+	// last time the tracking error was above the settling threshold
+	double settling_time;
+	// weighted sum of the above
+	double cost;
+	// whether the simulation diverged
+	bool diverged;
+
+	RolloutScore()
+		: tracking_error(0.0),
+		  effort(0.0),
+		  settling_time(0.0),
+		  cost(0.0),
+		  diverged(false) {}
+};
+
+struct RolloutScoreWeights {
+	double tracking_error;
+	double effort;
+	double settling_time;
+	// tracking error under which the rollout is considered settled
+	double settling_threshold;
+
+	RolloutScoreWeights()
+		: tracking_error(1.0),
+		  effort(1e-4),
+		  settling_time(0.1),
+		  settling_threshold(1e-2) {}
+};
+
+/**
+ * @brief      Headless closed-loop simulation of a robot model. The joint
+ * accelerations are M^-1 (tau - b - g) and are integrated with a semi
+ * implicit Euler scheme, so the controller needs to compensate gravity.
+ */
+class ClosedLoopHarness {
+public:
+	ClosedLoopHarness(std::shared_ptr<Sai2Model::Sai2Model> robot,
+					  const double timestep);
+
+	/**
+	 * @brief      Sets the robot state and updates its model
+	 */
+	void resetRobotState(const VectorXd& q, const VectorXd& dq);
+
+	/**
+	 * @brief      Runs a rollout from the current robot state
+	 *
+	 * @param      controller  The controller
+	 * @param[in]  duration    The duration of the rollout
+	 * @param[in]  weights     The score weights
+	 *
+	 * @return     The score of the rollout
+	 */
+	RolloutScore run(RolloutController& controller, const double duration,
+					 const RolloutScoreWeights& weights);
+
+	std::shared_ptr<Sai2Model::Sai2Model>& getRobot() { return _robot; }
+	double getTimestep() const { return _timestep; }
+
+private:
+	std::shared_ptr<Sai2Model::Sai2Model> _robot;
+	double _timestep;
+};
+
+/**
+ * @brief      Definition of a tuning problem
+ */
+struct TuningProblem {
+	// bounds of the tuned parameters
+	VectorXd lower_bounds;
+	VectorXd upper_bounds;
+	// search the parameters in log scale (bounds must then be strictly
+	// positive), which suits gains spanning several orders of magnitude
+	bool log_scale = false;
+
+	// creates a robot model. Called once per worker thread, since robot
+	// models cannot be shared between threads
+	std::function<std::shared_ptr<Sai2Model::Sai2Model>()> create_robot;
+
+	// creates the controller for a set of parameters and a scenario index,
+	// on the robot model of the harness (already set to the initial state).
+	// If it throws, or if the controller throws during the rollout, the
+	// rollout is scored as diverged
+	std::function<std::unique_ptr<RolloutController>(
+		std::shared_ptr<Sai2Model::Sai2Model>& robot,
+		const VectorXd& parameters, const int scenario)>
+		create_controller;
+
+	// initial robot joint positions (the initial velocities are zero)
+	VectorXd initial_joint_positions;
+
+	// number of scenarios per evaluation (the cost is averaged over them)
+	int num_scenarios = 1;
+	double rollout_duration = 2.0;
+	double timestep = 1e-3;
+	RolloutScoreWeights weights;
+};
+
+class GainTuningEngine {
+public:
+	struct Result {
+		VectorXd best_parameters;
+		RolloutScore best_score;
+		int num_generations;
+		long num_rollouts;
+		double rollouts_per_second;
+	};
+
+	explicit GainTuningEngine(const TuningProblem& problem);
+
+	/**
+	 * @brief      Stops and joins the worker threads
+	 */
+	~GainTuningEngine();
+
+	// disallow copy and asssign constructors
+	GainTuningEngine(GainTuningEngine const&) = delete;
+	GainTuningEngine& operator=(GainTuningEngine const&) = delete;
+
+	/**
+	 * @brief      Sets the number of worker threads, 0 to use all the cores
+	 * (default)
+	 */
+	void setNumThreads(const int num_threads);
+	int getNumThreads() const { return _num_threads; }
+
+	/**
+	 * @brief      Sets the number of candidates per CMA-ES generation. The
+	 * default depends on the number of parameters. Using a multiple of the
+	 * number of threads makes a better use of them.
+	 */
+	void setPopulationSize(const int population_size);
+	int getPopulationSize() const { return _population_size; }
+
+	void setMaxGenerations(const int max_generations);
+	int getMaxGenerations() const { return _max_generations; }
+
+	/**
+	 * @brief      Sets the initial CMA-ES step size, relative to the size of
+	 * the search box (default 0.3)
+	 */
+	void setInitialStepSize(const double initial_step_size);
+
+	void setRandomSeed(const unsigned int seed) { _seed = seed; }
+
+	/**
+	 * @brief      Evaluates one set of parameters in the calling thread,
+	 * averaging over the scenarios
+	 */
+	RolloutScore evaluate(const VectorXd& parameters);
+
+	/**
+	 * @brief      Runs the CMA-ES optimization
+	 *
+	 * @param[in]  initial_parameters  The initial mean of the search
+	 *
+	 * @return     The best parameters found and statistics
+	 */
+	Result optimize(const VectorXd& initial_parameters);
+
+private:
+	// evaluates a set of parameters on the harness of a worker
+	RolloutScore evaluateOnHarness(ClosedLoopHarness& harness,
+								   const VectorXd& parameters);
+
+	// evaluates all the candidates in parallel, on the calling thread and the
+	// worker threads
+	void evaluateInParallel(const std::vector<VectorXd>& candidates,
+							std::vector<RolloutScore>& scores);
+
+	// evaluates the candidates of the current generation on the harness of a
+	// worker until there are none left
+	void evaluateCandidates(const int worker_index);
+
+	// loop of a worker thread, waiting for the generations
+	void workerLoop(const int worker_index, long generation);
+
+	// mapping between the normalized search space [0,1]^n and the parameters
+	VectorXd toParameters(const VectorXd& normalized) const;
+	VectorXd toNormalized(const VectorXd& parameters) const;
+
+	TuningProblem _problem;
+	int _num_threads;
+	int _population_size;
+	int _max_generations;
+	double _initial_step_size;
+	unsigned int _seed;
+
+	// one harness per worker thread, created on first use. The first harness
+	// is used by the calling thread
+	std::vector<std::unique_ptr<ClosedLoopHarness>> _harnesses;
+
+	// persistent worker threads, using the other harnesses
+	std::vector<std::thread> _workers;
+	std::mutex _workers_mutex;
+	std::condition_variable _generation_started;
+	std::condition_variable _generation_finished;
+	// incremented to start the evaluation of a generation
+	long _generation;
+	int _num_running_workers;
+	bool _stop_workers;
+
+	// candidates of the current generation
+	const std::vector<VectorXd>* _candidates;
+	std::vector<RolloutScore>* _scores;
+	std::atomic<size_t> _next_candidate;
+	// errors of the workers, rethrown in the calling thread
+	std::vector<std::exception_ptr> _worker_errors;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_GAIN_TUNING_ENGINE_H
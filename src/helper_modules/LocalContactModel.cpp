@@ -0,0 +1,129 @@
+#include "LocalContactModel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Sai2Primitives {
+
+namespace {
+// initial covariance of the stiffness estimation, for the force offset and
+// the stiffness
+const Matrix2d INITIAL_COVARIANCE = Vector2d(1e2, 1e8).asDiagonal();
+}  // namespace
+
+LocalContactModelEstimator::LocalContactModelEstimator()
+	: _contact_force_threshold(DefaultParameters::contact_force_threshold),
+	  _forgetting_factor(DefaultParameters::forgetting_factor),
+	  _min_stiffness(DefaultParameters::min_stiffness),
+	  _max_stiffness(DefaultParameters::max_stiffness),
+	  _initial_stiffness(DefaultParameters::initial_stiffness) {
+	reset();
+}
+
+void LocalContactModelEstimator::reset() {
+	_model = LocalContactModel();
+	_model.stiffness = _initial_stiffness;
+	resetStiffnessEstimation(Vector3d::Zero());
+}
+
+void LocalContactModelEstimator::resetStiffnessEstimation(
+	const Vector3d& reference_position) {
+	_reference_position = reference_position;
+	_theta << 0.0, _initial_stiffness;
+	_P = INITIAL_COVARIANCE;
+}
+
+void LocalContactModelEstimator::update(const Vector3d& robot_position,
+										const Vector3d& robot_sensed_force) {
+	// force applied by the environment on the robot
+	const Vector3d environment_force = -robot_sensed_force;
+	const double force_norm = environment_force.norm();
+
+	if (force_norm < _contact_force_threshold) {
+		// keep the last surface to render it if the device moves back into it
+		if (_model.in_contact) {
+			_model.in_contact = false;
+			_model.version++;
+		}
+		return;
+	}
+
+	// update the surface normal. A large change of normal means a different
+	// surface, so the stiffness estimation restarts
+	const Vector3d measured_normal = environment_force / force_norm;
+	const double normal_angle = std::acos(
+		std::clamp(measured_normal.dot(_model.surface_normal), -1.0, 1.0));
+	if (!_model.valid ||
+		normal_angle > DefaultParameters::normal_change_reset_angle) {
+		_model.surface_normal = measured_normal;
+		resetStiffnessEstimation(robot_position);
+	} else {
+		_model.surface_normal +=
+			DefaultParameters::normal_filter_gain *
+			(measured_normal - _model.surface_normal);
+		_model.surface_normal.normalize();
+	}
+	_model.in_contact = true;
+
+	// recursive least squares step on f_n = theta(0) - theta(1) * s
+	const double normal_force = environment_force.dot(_model.surface_normal);
+	const double normal_position =
+		(robot_position - _reference_position).dot(_model.surface_normal);
+	const Vector2d phi(1.0, -normal_position);
+	const Vector2d P_phi = _P * phi;
+	const Vector2d gain = P_phi / (_forgetting_factor + phi.dot(P_phi));
+	_theta += gain * (normal_force - phi.dot(_theta));
+	_P -= gain * P_phi.transpose();
+	// only forget while the covariance is bounded, to avoid its wind-up when
+	// the robot does not move along the normal
+	if (_P(1, 1) < INITIAL_COVARIANCE(1, 1)) {
+		_P /= _forgetting_factor;
+	}
+
+	// the surface is placed so that the model gives the current normal force
+	// at the current robot position
+	_model.stiffness = std::clamp(_theta(1), _min_stiffness, _max_stiffness);
+	_model.surface_point = robot_position + normal_force / _model.stiffness *
+												 _model.surface_normal;
+	_model.valid = true;
+	_model.version++;
+}
+
+void LocalContactModelEstimator::setContactForceThreshold(
+	const double contact_force_threshold) {
+	if (contact_force_threshold <= 0) {
+		throw std::invalid_argument(
+			"contact force threshold should be strictly positive in "
+			"LocalContactModelEstimator::setContactForceThreshold\n");
+	}
+	_contact_force_threshold = contact_force_threshold;
+}
+
+void LocalContactModelEstimator::setForgettingFactor(
+	const double forgetting_factor) {
+	if (forgetting_factor <= 0 || forgetting_factor > 1) {
+		throw std::invalid_argument(
+			"forgetting factor should be in (0, 1] in "
+			"LocalContactModelEstimator::setForgettingFactor\n");
+	}
+	_forgetting_factor = forgetting_factor;
+}
+
+void LocalContactModelEstimator::setStiffnessBounds(
+	const double min_stiffness, const double max_stiffness,
+	const double initial_stiffness) {
+	if (min_stiffness <= 0 || max_stiffness < min_stiffness ||
+		initial_stiffness < min_stiffness ||
+		initial_stiffness > max_stiffness) {
+		throw std::invalid_argument(
+			"stiffness bounds should be positive and contain the initial "
+			"stiffness in LocalContactModelEstimator::setStiffnessBounds\n");
+	}
+	_min_stiffness = min_stiffness;
+	_max_stiffness = max_stiffness;
+	_initial_stiffness = initial_stiffness;
+	_model.stiffness =
+		std::clamp(_model.stiffness, _min_stiffness, _max_stiffness);
+}
+
+}  // namespace Sai2Primitives
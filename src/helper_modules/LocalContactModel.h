@@ -0,0 +1,182 @@
+/**
+ * LocalContactModel.h
+ *
+ *	Lightweight contact model for model-mediated teleoperation. On the robot
+ * side, LocalContactModelEstimator fits a plane with a stiffness to the sensed
+ * contact force and position of the robot. Only the parameters of the model
+ * (LocalContactModel, a few doubles) are sent to the haptic device side, where
+ * the contact force is rendered against the local model at the device rate,
+ * independently of the communication latency. DelayInjector is a local
+ * stand-in for the communication channel, to test the teleoperation scheme
+ * with an artificial delay.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_LOCAL_CONTACT_MODEL_H
+#define SAI2_PRIMITIVES_LOCAL_CONTACT_MODEL_H
+
+#include <Eigen/Dense>
+#include <stdexcept>
+#include <vector>
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+/**
+ * @brief      Parameters of the local contact model: a plane with a normal
+ * stiffness. All the quantities are in robot world frame. This is the data
+ * streamed from the robot side to the device side.
+ */
+struct LocalContactModel {
+	// whether a contact was estimated since the last reset. The model renders
+	// no force when not valid
+	bool valid;
+	// whether the robot is currently in contact
+	bool in_contact;
+	// a point on the contact surface
+	Vector3d surface_point;
+	// unit normal of the surface, pointing out of the environment
+	Vector3d surface_normal;
+	// normal stiffness of the environment (N/m)
+	double stiffness;
+	// incremented every time the estimator updates the model
+	unsigned long version;
+
+	LocalContactModel()
+		: valid(false),
+		  in_contact(false),
+		  surface_point(Vector3d::Zero()),
+		  surface_normal(Vector3d::UnitZ()),
+		  stiffness(0.0),
+		  version(0) {}
+
+	/**
+	 * @brief      Force applied by the environment model on a point
+	 *
+	 * @param[in]  position  The position of the point (world frame)
+	 *
+	 * @return     The contact force (world frame)
+	 */
+	Vector3d computeContactForce(const Vector3d& position) const {
+		if (!valid) {
+			return Vector3d::Zero();
+		}
+		const double penetration =
+			(surface_point - position).dot(surface_normal);
+		if (penetration <= 0) {
+			return Vector3d::Zero();
+		}
+		return stiffness * penetration * surface_normal;
+	}
+};
+
+class LocalContactModelEstimator {
+public:
+	struct DefaultParameters {
+		static constexpr double contact_force_threshold = 2.0;
+		static constexpr double forgetting_factor = 0.995;
+		static constexpr double initial_stiffness = 1000.0;
+		static constexpr double min_stiffness = 100.0;
+		static constexpr double max_stiffness = 20000.0;
+		static constexpr double normal_filter_gain = 0.05;
+		static constexpr double normal_change_reset_angle = M_PI / 6.0;
+	};
+
+	LocalContactModelEstimator();
+	~LocalContactModelEstimator() = default;
+
+	/**
+	 * @brief      Updates the model with a new measurement. The stiffness is
+	 * estimated by recursive least squares on the normal force as a function
+	 * of the robot position along the normal, and the surface point is placed
+	 * such that the model reproduces the current normal force.
+	 *
+	 * @param[in]  robot_position      The robot position (world frame)
+	 * @param[in]  robot_sensed_force  The force applied by the robot on the
+	 *                                 environment (world frame), same
+	 *                                 convention as the sensed force of
+	 *                                 MotionForceTask
+	 */
+	void update(const Vector3d& robot_position,
+				const Vector3d& robot_sensed_force);
+
+	/**
+	 * @brief      Resets the model to not valid and the stiffness estimation
+	 * to its initial value
+	 */
+	void reset();
+
+	const LocalContactModel& getModel() const { return _model; }
+
+	void setContactForceThreshold(const double contact_force_threshold);
+	double getContactForceThreshold() const {
+		return _contact_force_threshold;
+	}
+
+	/**
+	 * @brief      Sets the forgetting factor of the stiffness estimation,
+	 * between 0 (excluded) and 1. Lower values adapt faster to a change of
+	 * environment.
+	 */
+	void setForgettingFactor(const double forgetting_factor);
+	double getForgettingFactor() const { return _forgetting_factor; }
+
+	/**
+	 * @brief      Sets the bounds of the estimated stiffness and its initial
+	 * value used before enough motion along the normal was observed
+	 */
+	void setStiffnessBounds(const double min_stiffness,
+							const double max_stiffness,
+							const double initial_stiffness);
+
+private:
+	void resetStiffnessEstimation(const Vector3d& reference_position);
+
+	LocalContactModel _model;
+
+	double _contact_force_threshold;
+	double _forgetting_factor;
+	double _min_stiffness;
+	double _max_stiffness;
+	double _initial_stiffness;
+
+	// recursive least squares on f_n = theta(0) - theta(1) * s, with s the
+	// position along the normal relative to the reference position, so that
+	// theta(1) is the stiffness
+	Vector3d _reference_position;
+	Vector2d _theta;
+	Matrix2d _P;
+};
+
+/**
+ * @brief      Local stand-in for a communication channel with a constant
+ * delay, in number of cycles. Each call to transmit sends a value and returns
+ * the value sent delay_cycles calls before (or the initial value at the
+ * beginning).
+ *
+ * @tparam     T     the transmitted type
+ */
+template <typename T>
+class DelayInjector {
+public:
+	DelayInjector(const size_t delay_cycles, const T& initial_value)
+		: _buffer(delay_cycles + 1, initial_value), _index(0) {}
+
+	T transmit(const T& value) {
+		_buffer[_index] = value;
+		_index = (_index + 1) % _buffer.size();
+		return _buffer[_index];
+	}
+
+	size_t getDelayCycles() const { return _buffer.size() - 1; }
+
+private:
+	std::vector<T> _buffer;
+	size_t _index;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_LOCAL_CONTACT_MODEL_H
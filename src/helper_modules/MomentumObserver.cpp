@@ -0,0 +1,95 @@
+#include "MomentumObserver.h"
+
+#include <stdexcept>
+
+namespace Sai2Primitives {
+
+MomentumObserver::MomentumObserver(
+	std::shared_ptr<Sai2Model::Sai2Model>& robot, const double loop_timestep)
+	: _robot(robot),
+	  _loop_timestep(loop_timestep),
+	  _observer_gain(DefaultParameters::observer_gain),
+	  _wrench_damping(DefaultParameters::wrench_damping) {
+	if (loop_timestep <= 0) {
+		throw std::invalid_argument(
+			"loop timestep should be strictly positive in "
+			"MomentumObserver::MomentumObserver\n");
+	}
+	if (_observer_gain * _loop_timestep >= 1.0) {
+		_observer_gain = 0.5 / _loop_timestep;
+	}
+	reset();
+}
+
+void MomentumObserver::reset() {
+	const int dof = _robot->dof();
+	_initialized = false;
+	_integral.setZero(dof);
+	_previous_mass_matrix.setZero(dof, dof);
+	_momentum.setZero(dof);
+	_mass_matrix_derivative_term.setZero(dof);
+	_external_joint_torques.setZero(dof);
+}
+
+void MomentumObserver::update(const VectorXd& applied_torques) {
+	if (applied_torques.size() != _robot->dof()) {
+		throw std::invalid_argument(
+			"applied torques size not consistent with robot dof in "
+			"MomentumObserver::update\n");
+	}
+	const MatrixXd& M = _robot->M();
+	const VectorXd& dq = _robot->dq();
+	_momentum.noalias() = M * dq;
+
+	if (!_initialized) {
+		_integral = _momentum;
+		_previous_mass_matrix = M;
+		_initialized = true;
+		return;
+	}
+
+	// p_dot = tau + tau_ext - b - g + M_dot * dq, with M_dot from the mass
+	// matrix of the previous cycle. The estimate r then follows
+	// r_dot = K (tau_ext - r)
+	_mass_matrix_derivative_term = _momentum;
+	_mass_matrix_derivative_term.noalias() -= _previous_mass_matrix * dq;
+	_integral += (applied_torques - _robot->coriolisForce() -
+				  _robot->jointGravityVector() + _external_joint_torques) *
+					 _loop_timestep +
+				 _mass_matrix_derivative_term;
+	_external_joint_torques = _observer_gain * (_momentum - _integral);
+	_previous_mass_matrix = M;
+}
+
+Vector6d MomentumObserver::computeExternalWrench(
+	const MatrixXd& jacobian) const {
+	if (jacobian.rows() != 6 || jacobian.cols() != _robot->dof()) {
+		throw std::invalid_argument(
+			"jacobian should be of size 6 x dof in "
+			"MomentumObserver::computeExternalWrench\n");
+	}
+	const Matrix<double, 6, 6> JJt =
+		jacobian * jacobian.transpose() +
+		_wrench_damping * _wrench_damping * Matrix<double, 6, 6>::Identity();
+	return JJt.ldlt().solve(jacobian * _external_joint_torques);
+}
+
+void MomentumObserver::setObserverGain(const double observer_gain) {
+	if (observer_gain <= 0 || observer_gain * _loop_timestep >= 1.0) {
+		throw std::invalid_argument(
+			"observer gain should be strictly positive and lower than the "
+			"loop frequency in MomentumObserver::setObserverGain\n");
+	}
+	_observer_gain = observer_gain;
+}
+
+void MomentumObserver::setWrenchDamping(const double wrench_damping) {
+	if (wrench_damping < 0) {
+		throw std::invalid_argument(
+			"wrench damping cannot be negative in "
+			"MomentumObserver::setWrenchDamping\n");
+	}
+	_wrench_damping = wrench_damping;
+}
+
+}  // namespace Sai2Primitives
@@ -0,0 +1,136 @@
+/**
+ * MomentumObserver.h
+ *
+ *	Sensorless estimation of the external joint torques with a generalized
+ * momentum observer, and of the corresponding external wrench at a given
+ * frame. It only uses the model quantities already computed at each control
+ * cycle (mass matrix, coriolis and gravity torques) and no joint acceleration.
+ * The estimate behaves as a first order low pass filter of the true external
+ * torques with a cutoff frequency equal to the observer gain (rad/s).
+ *
+ * An update costs two products of the mass matrix with the joint velocities
+ * and a copy of the mass matrix, so it is O(n^2) and not O(n): the momentum
+ * M * dq is computed from the dense mass matrix given by the robot model,
+ * which does not expose a recursive O(n) evaluation of the momentum. This
+ * stays small compared to the computation of the mass matrix itself in
+ * updateModel, and no matrix is factorized. See example 26 for the cost and
+ * bandwidth compared to a force sensor.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_MOMENTUM_OBSERVER_H
+#define SAI2_PRIMITIVES_MOMENTUM_OBSERVER_H
+
+#include <Eigen/Dense>
+#include <memory>
+
+#include "Sai2Model.h"
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+typedef Matrix<double, 6, 1> Vector6d;
+
+class MomentumObserver {
+public:
+	struct DefaultParameters {
+		// observer gain in rad/s (cutoff frequency of the estimate)
+		static constexpr double observer_gain = 100.0;
+		// damping of the least squares mapping to the external wrench
+		static constexpr double wrench_damping = 1e-3;
+	};
+
+	/**
+	 * @brief      Constructs the observer. The robot model needs to be updated
+	 * (updateModel) with the measured state before each call to update.
+	 *
+	 * @param      robot          The robot model
+	 * @param[in]  loop_timestep  The control loop timestep (s)
+	 */
+	MomentumObserver(std::shared_ptr<Sai2Model::Sai2Model>& robot,
+					 const double loop_timestep);
+	~MomentumObserver() = default;
+
+	// disallow empty, copy and asssign constructors
+	MomentumObserver() = delete;
+	MomentumObserver(MomentumObserver const&) = delete;
+	MomentumObserver& operator=(MomentumObserver const&) = delete;
+
+	/**
+	 * @brief      Resets the observer. The next update initializes the
+	 * momentum integral and the estimate is zero until then.
+	 */
+	void reset();
+
+	/**
+	 * @brief      Updates the estimation of the external joint torques. Needs
+	 * to be called once per control cycle, after the robot model update.
+	 *
+	 * @param[in]  applied_torques  The joint torques applied to the robot
+	 *                              during the previous cycle (including gravity
+	 *                              compensation if any)
+	 */
+	void update(const VectorXd& applied_torques);
+
+	/**
+	 * @brief      Gets the estimated external joint torques, applied by the
+	 * environment on the robot
+	 */
+	const VectorXd& getExternalJointTorques() const {
+		return _external_joint_torques;
+	}
+
+	/**
+	 * @brief      Computes the estimated external wrench at a frame, resolved
+	 * at the frame origin and in world frame, from a damped least squares
+	 * inversion of tau_ext = J^T F_ext. The wrench is the one applied by the
+	 * environment on the robot (opposite to the MotionForceTask sensed force
+	 * convention).
+	 *
+	 * @param[in]  jacobian  The 6 x dof jacobian of the frame in world frame
+	 *                       (linear part first)
+	 *
+	 * @return     The external force (first 3 elements) and moment
+	 */
+	Vector6d computeExternalWrench(const MatrixXd& jacobian) const;
+
+	/**
+	 * @brief      Sets the observer gain in rad/s, which is also the bandwidth
+	 * of the estimation. It should stay well below the control loop frequency
+	 * (gain * timestep < 1).
+	 */
+	void setObserverGain(const double observer_gain);
+	double getObserverGain() const { return _observer_gain; }
+
+	/**
+	 * @brief      Gets the bandwidth of the estimation in Hz
+	 */
+	double getBandwidth() const { return _observer_gain / (2.0 * M_PI); }
+
+	void setWrenchDamping(const double wrench_damping);
+	double getWrenchDamping() const { return _wrench_damping; }
+
+private:
+	std::shared_ptr<Sai2Model::Sai2Model> _robot;
+	double _loop_timestep;
+	double _observer_gain;
+	double _wrench_damping;
+
+	bool _initialized;
+	// integral of the momentum derivative model (initial momentum included)
+	VectorXd _integral;
+	// mass matrix of the previous cycle, for the time derivative of the mass
+	// matrix
+	MatrixXd _previous_mass_matrix;
+	VectorXd _external_joint_torques;
+
+	// preallocated for the update
+	VectorXd _momentum;
+	VectorXd _mass_matrix_derivative_term;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_MOMENTUM_OBSERVER_H
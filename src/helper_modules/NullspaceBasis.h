@@ -0,0 +1,141 @@
+/**
+ * NullspaceBasis.h
+ *
+ *	Representation of a dynamically consistent nullspace projector by a basis
+ * of the remaining motion space. If Z is a basis of the joint space directions
+ * that are not controlled by the higher priority tasks, normalized such that
+ * Z^T M Z = I, then the dynamically consistent nullspace is N = Z Z^T M. Storing
+ * Z and Y = M Z (both of size dof x r) allows to project torques, velocities
+ * and jacobians in O(dof * r) instead of using the dense dof x dof projector.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_NULLSPACE_BASIS_H
+#define SAI2_PRIMITIVES_NULLSPACE_BASIS_H
+
+#include <Eigen/Dense>
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+class NullspaceBasis {
+public:
+	/**
+	 * @brief      Default constructor, creates an empty basis (no remaining
+	 * motion space) for a robot with 0 dof
+	 */
+	NullspaceBasis() : _Z(MatrixXd::Zero(0, 0)), _Y(MatrixXd::Zero(0, 0)) {}
+
+	/**
+	 * @brief      Creates the basis of the full joint space (no higher priority
+	 * task), which corresponds to an identity nullspace projector
+	 *
+	 * @param[in]  M     The robot mass matrix
+	 */
+	explicit NullspaceBasis(const MatrixXd& M);
+
+	/**
+	 * @brief      Creates a basis from the matrices Z and Y = M Z. Z is
+	 * expected to verify Z^T M Z = I
+	 *
+	 * @param[in]  Z     The basis of the remaining motion space (dof x r)
+	 * @param[in]  Y     The mass weighted basis M Z (dof x r)
+	 */
+	NullspaceBasis(const MatrixXd& Z, const MatrixXd& Y);
+
+	/**
+	 * @brief      Creates a basis from a dense dynamically consistent nullspace
+	 * projector. This requires a decomposition of the projector and should not
+	 * be used in the control loop if it can be avoided.
+	 *
+	 * @param[in]  N     The dense nullspace projector
+	 * @param[in]  M     The robot mass matrix
+	 *
+	 * @return     The nullspace basis
+	 */
+	static NullspaceBasis fromProjector(const MatrixXd& N, const MatrixXd& M);
+
+	/**
+	 * @brief      Computes the basis of the motion space that remains after
+	 * adding a task with the given jacobian at a lower priority than the tasks
+	 * represented by this basis. The result is the basis equivalent of N_task *
+	 * N_prec
+	 *
+	 * @param[in]  task_jacobian  The task jacobian (k x dof). It does not need
+	 * to be projected in the nullspace of the previous tasks
+	 *
+	 * @return     The basis of the remaining motion space
+	 */
+	NullspaceBasis restrictedTo(const MatrixXd& task_jacobian) const;
+
+	/**
+	 * @brief      Computes a jacobian of the constraints added by a task that
+	 * restricted this basis to the given basis: this basis restricted to the
+	 * jacobian is the restricted basis. Restricting another basis (the
+	 * nullspace of the higher priority tasks at a later cycle for instance)
+	 * to it applies the same task constraints. The jacobian is M D^T where D
+	 * spans the motions of this basis removed by the task, computed in
+	 * O(dof * r^2), and has 0 rows if the task did not remove any motion.
+	 *
+	 * @param[in]  restricted_basis  This basis restricted by the task
+	 *
+	 * @return     The constraint jacobian (r x dof)
+	 */
+	MatrixXd constraintJacobian(const NullspaceBasis& restricted_basis) const;
+
+	/**
+	 * @brief      Number of dof of the robot
+	 */
+	int dof() const { return _Z.rows(); }
+
+	/**
+	 * @brief      Dimension of the remaining motion space
+	 */
+	int rank() const { return _Z.cols(); }
+
+	/**
+	 * @brief      Basis Z of the remaining motion space, with Z^T M Z = I
+	 */
+	const MatrixXd& basis() const { return _Z; }
+
+	/**
+	 * @brief      Mass weighted basis Y = M Z
+	 */
+	const MatrixXd& massWeightedBasis() const { return _Y; }
+
+	/**
+	 * @brief      Projects joint torques in the nullspace (N^T * torques)
+	 */
+	VectorXd projectTorques(const VectorXd& torques) const {
+		return _Y * (_Z.transpose() * torques);
+	}
+
+	/**
+	 * @brief      Projects joint velocities in the nullspace (N * velocities)
+	 */
+	VectorXd projectVelocities(const VectorXd& velocities) const {
+		return _Z * (_Y.transpose() * velocities);
+	}
+
+	/**
+	 * @brief      Projects a jacobian in the nullspace (J * N)
+	 */
+	MatrixXd projectJacobian(const MatrixXd& jacobian) const {
+		return (jacobian * _Z) * _Y.transpose();
+	}
+
+	/**
+	 * @brief      Converts to the dense nullspace projector N = Z Y^T
+	 */
+	MatrixXd toProjector() const { return _Z * _Y.transpose(); }
+
+private:
+	MatrixXd _Z;
+	MatrixXd _Y;
+};
+
+} /* namespace Sai2Primitives */
+
+#endif	// SAI2_PRIMITIVES_NULLSPACE_BASIS_H
@@ -0,0 +1,350 @@
+/**
+ * NumericalKernels.cpp
+ *
+ *	Runtime dispatch of the numerical kernels to the instruction set variants
+ *
+ * Created: October 2026
+ */
+
+#include "NumericalKernels.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+namespace NumericalKernels {
+
+// declarations of the instruction set variants, defined in
+// NumericalKernelsImpl.cpp
+#define SAI2_DECLARE_KERNELS(ISA)                                             \
+	namespace ISA {                                                           \
+	void applyDiagonalGains(const double* kp, const double* kv,               \
+							const double* ki, const double* position_error,   \
+							const double* velocity_error,                     \
+							const double* integrated_error, double* output,   \
+							const std::size_t size);                          \
+	void transposedMatrixVectorProduct(const double* A,                       \
+									   const std::size_t rows,                \
+									   const std::size_t cols,                \
+									   const double* x, double* output);      \
+	void matrixProduct(const double* A, const std::size_t rows,               \
+					   const std::size_t inner, const double* B,              \
+					   const std::size_t cols, double* output);               \
+	bool symmetricPositiveDefiniteInverse(const double* A,                    \
+										  const std::size_t n,                \
+										  double* output);                    \
+	void orientationError(const double* desired, const double* current,       \
+						  double* output);                                    \
+	double passivityObserverPower(                                            \
+		const double* force_error, const double* closed_loop_velocity,        \
+		const double* command, const double* velocity,                        \
+		const std::size_t size);                                              \
+	void batchedOperationalSpaceTorques(const BatchedOpSpaceBlock& block,     \
+										const BatchedOpSpaceGains& gains);    \
+	}
+
+SAI2_DECLARE_KERNELS(generic)
+#ifdef SAI2_KERNELS_X86
+SAI2_DECLARE_KERNELS(avx2)
+SAI2_DECLARE_KERNELS(avx512)
+#endif
+
+#undef SAI2_DECLARE_KERNELS
+
+namespace {
+
+// largest dimension of the matrix products for which the dispatched kernels
+// were measured faster than Eigen (7 dof), they are slower at 30 dof (see
+// example 24)
+const int SMALL_PRODUCT_MAX_SIZE = 12;
+
+struct KernelTable {
+	InstructionSet instruction_set;
+	// whether the variant was forced, the kernels are then always used.
+	// Otherwise they are only used where they were measured faster than Eigen
+	bool forced;
+	decltype(&generic::applyDiagonalGains) apply_diagonal_gains;
+	decltype(&generic::transposedMatrixVectorProduct)
+		transposed_matrix_vector_product;
+	decltype(&generic::matrixProduct) matrix_product;
+	decltype(&generic::symmetricPositiveDefiniteInverse)
+		symmetric_positive_definite_inverse;
+	decltype(&generic::orientationError) orientation_error;
+	decltype(&generic::passivityObserverPower) passivity_observer_power;
+	decltype(&generic::batchedOperationalSpaceTorques)
+		batched_operational_space_torques;
+};
+
+KernelTable makeKernelTable(const InstructionSet instruction_set) {
+	switch (instruction_set) {
+#ifdef SAI2_KERNELS_X86
+		case AVX512:
+			return KernelTable{AVX512, false, &avx512::applyDiagonalGains,
+							   &avx512::transposedMatrixVectorProduct,
+							   &avx512::matrixProduct,
+							   &avx512::symmetricPositiveDefiniteInverse,
+							   &avx512::orientationError,
+							   &avx512::passivityObserverPower,
+							   &avx512::batchedOperationalSpaceTorques};
+		case AVX2:
+			return KernelTable{AVX2, false, &avx2::applyDiagonalGains,
+							   &avx2::transposedMatrixVectorProduct,
+							   &avx2::matrixProduct,
+							   &avx2::symmetricPositiveDefiniteInverse,
+							   &avx2::orientationError,
+							   &avx2::passivityObserverPower,
+							   &avx2::batchedOperationalSpaceTorques};
+#endif
+		default:
+			return KernelTable{GENERIC, false, &generic::applyDiagonalGains,
+							   &generic::transposedMatrixVectorProduct,
+							   &generic::matrixProduct,
+							   &generic::symmetricPositiveDefiniteInverse,
+							   &generic::orientationError,
+							   &generic::passivityObserverPower,
+							   &generic::batchedOperationalSpaceTorques};
+	}
+}
+
+bool isSupported(const InstructionSet instruction_set) {
+	switch (instruction_set) {
+		case GENERIC:
+			return true;
+#ifdef SAI2_KERNELS_X86
+		case AVX2:
+			return __builtin_cpu_supports("avx2") &&
+				   __builtin_cpu_supports("fma");
+		case AVX512:
+			return __builtin_cpu_supports("avx512f") &&
+				   __builtin_cpu_supports("avx512dq") &&
+				   __builtin_cpu_supports("avx512vl") &&
+				   __builtin_cpu_supports("fma");
+#endif
+		default:
+			return false;
+	}
+}
+
+KernelTable makeForcedKernelTable(const InstructionSet instruction_set) {
+	KernelTable table = makeKernelTable(instruction_set);
+	table.forced = true;
+	return table;
+}
+
+// the table is selected once, the first time a kernel is used. The AVX-512
+// variant is never selected automatically since it was measured slower than
+// the AVX2 one at the controller sizes.
+KernelTable& kernelTable() {
+	static KernelTable table =
+		makeKernelTable(isSupported(AVX2) ? AVX2 : GENERIC);
+	return table;
+}
+
+// table of each instruction set, for the thread overrides
+const KernelTable& instructionSetKernelTable(
+	const InstructionSet instruction_set) {
+	static const KernelTable tables[] = {makeForcedKernelTable(GENERIC),
+										 makeForcedKernelTable(AVX2),
+										 makeForcedKernelTable(AVX512)};
+	return tables[instruction_set];
+}
+
+bool useSmallProductKernel(const KernelTable& table, const int rows,
+						   const int cols) {
+	return table.forced ||
+		   std::max(rows, cols) <= SMALL_PRODUCT_MAX_SIZE;
+}
+
+// table set for the calling thread by ScopedThreadInstructionSet, if any
+thread_local const KernelTable* thread_kernel_table = nullptr;
+
+const KernelTable& activeKernelTable() {
+	return thread_kernel_table ? *thread_kernel_table : kernelTable();
+}
+
+}  // namespace
+
+InstructionSet bestSupportedInstructionSet() {
+	if (isSupported(AVX512)) {
+		return AVX512;
+	}
+	if (isSupported(AVX2)) {
+		return AVX2;
+	}
+	return GENERIC;
+}
+
+InstructionSet activeInstructionSet() {
+	return activeKernelTable().instruction_set;
+}
+
+void setInstructionSet(const InstructionSet instruction_set) {
+	if (!isSupported(instruction_set)) {
+		throw std::invalid_argument(
+			"instruction set " + instructionSetName(instruction_set) +
+			" not supported by the cpu or not compiled in "
+			"NumericalKernels::setInstructionSet\n");
+	}
+	kernelTable() = makeForcedKernelTable(instruction_set);
+}
+
+ScopedThreadInstructionSet::ScopedThreadInstructionSet(
+	const InstructionSet instruction_set)
+	: _previous_table(thread_kernel_table) {
+	if (!isSupported(instruction_set)) {
+		throw std::invalid_argument(
+			"instruction set " + instructionSetName(instruction_set) +
+			" not supported by the cpu or not compiled in "
+			"NumericalKernels::ScopedThreadInstructionSet\n");
+	}
+	thread_kernel_table = &instructionSetKernelTable(instruction_set);
+}
+
+ScopedThreadInstructionSet::~ScopedThreadInstructionSet() {
+	thread_kernel_table = static_cast<const KernelTable*>(_previous_table);
+}
+
+std::string instructionSetName(const InstructionSet instruction_set) {
+	switch (instruction_set) {
+		case GENERIC:
+			return "generic";
+		case AVX2:
+			return "avx2";
+		case AVX512:
+			return "avx512";
+		default:
+			return "unknown";
+	}
+}
+
+void applyDiagonalGains(const VectorXd& kp, const VectorXd& kv,
+						const VectorXd& ki, const VectorXd& position_error,
+						const VectorXd& velocity_error,
+						const VectorXd& integrated_error, VectorXd& output) {
+	const int size = position_error.size();
+	if (kp.size() != size || kv.size() != size || ki.size() != size ||
+		velocity_error.size() != size || integrated_error.size() != size) {
+		throw std::invalid_argument(
+			"vector sizes not consistent in "
+			"NumericalKernels::applyDiagonalGains\n");
+	}
+	const KernelTable& table = activeKernelTable();
+	if (!table.forced) {
+		output = -kp.cwiseProduct(position_error) -
+				 kv.cwiseProduct(velocity_error) -
+				 ki.cwiseProduct(integrated_error);
+		return;
+	}
+	output.resize(size);
+	table.apply_diagonal_gains(
+		kp.data(), kv.data(), ki.data(), position_error.data(),
+		velocity_error.data(), integrated_error.data(), output.data(), size);
+}
+
+void transposedMatrixVectorProduct(const MatrixXd& A, const VectorXd& x,
+								   VectorXd& output) {
+	if (A.rows() != x.size()) {
+		throw std::invalid_argument(
+			"matrix and vector sizes not consistent in "
+			"NumericalKernels::transposedMatrixVectorProduct\n");
+	}
+	if (output.data() == x.data()) {
+		throw std::invalid_argument(
+			"output cannot alias the input vector in "
+			"NumericalKernels::transposedMatrixVectorProduct\n");
+	}
+	const KernelTable& table = activeKernelTable();
+	if (!useSmallProductKernel(table, A.rows(), A.cols())) {
+		output.noalias() = A.transpose() * x;
+		return;
+	}
+	output.resize(A.cols());
+	table.transposed_matrix_vector_product(
+		A.data(), A.rows(), A.cols(), x.data(), output.data());
+}
+
+void matrixProduct(const MatrixXd& A, const MatrixXd& B, MatrixXd& output) {
+	if (A.cols() != B.rows()) {
+		throw std::invalid_argument(
+			"matrix sizes not consistent in NumericalKernels::matrixProduct\n");
+	}
+	if (output.data() == A.data() || output.data() == B.data()) {
+		throw std::invalid_argument(
+			"output cannot alias the inputs in "
+			"NumericalKernels::matrixProduct\n");
+	}
+	const KernelTable& table = activeKernelTable();
+	if (!useSmallProductKernel(table, std::max(A.rows(), A.cols()),
+							   B.cols())) {
+		output.noalias() = A * B;
+		return;
+	}
+	output.resize(A.rows(), B.cols());
+	table.matrix_product(A.data(), A.rows(), A.cols(), B.data(), B.cols(),
+						 output.data());
+}
+
+void symmetricPositiveDefiniteInverse(const MatrixXd& A, MatrixXd& output) {
+	if (A.rows() != A.cols()) {
+		throw std::invalid_argument(
+			"matrix not square in "
+			"NumericalKernels::symmetricPositiveDefiniteInverse\n");
+	}
+	if (output.data() == A.data()) {
+		throw std::invalid_argument(
+			"output cannot alias the input in "
+			"NumericalKernels::symmetricPositiveDefiniteInverse\n");
+	}
+	const KernelTable& table = activeKernelTable();
+	output.resize(A.rows(), A.cols());
+	if (!table.forced || A.rows() > SMALL_SPD_MAX_SIZE ||
+		!table.symmetric_positive_definite_inverse(
+			A.data(), A.rows(), output.data())) {
+		output = A.inverse();
+	}
+}
+
+Vector3d orientationError(const Matrix3d& desired_orientation,
+						  const Matrix3d& current_orientation) {
+	const KernelTable& table = activeKernelTable();
+	Vector3d output;
+	if (!table.forced) {
+		output.setZero();
+		for (int i = 0; i < 3; i++) {
+			output -= 0.5 * current_orientation.col(i).cross(
+								desired_orientation.col(i));
+		}
+		return output;
+	}
+	table.orientation_error(
+		desired_orientation.data(), current_orientation.data(), output.data());
+	return output;
+}
+
+double passivityObserverPower(const Vector3d& force_error,
+							  const Vector3d& closed_loop_velocity,
+							  const Vector3d& command,
+							  const Vector3d& velocity) {
+	const KernelTable& table = activeKernelTable();
+	if (!table.forced) {
+		return force_error.dot(closed_loop_velocity) - command.dot(velocity);
+	}
+	return table.passivity_observer_power(
+		force_error.data(), closed_loop_velocity.data(), command.data(),
+		velocity.data(), 3);
+}
+
+void batchedOperationalSpaceTorques(const BatchedOpSpaceBlock& block,
+									const BatchedOpSpaceGains& gains) {
+	if (block.dof < 6) {
+		throw std::invalid_argument(
+			"batched operational space kernel needs at least 6 dof in "
+			"NumericalKernels::batchedOperationalSpaceTorques\n");
+	}
+	activeKernelTable().batched_operational_space_torques(block, gains);
+}
+
+}  // namespace NumericalKernels
+}  // namespace Sai2Primitives
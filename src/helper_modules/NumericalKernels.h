@@ -0,0 +1,159 @@
+/**
+ * NumericalKernels.h
+ *
+ *	Hot numerical kernels of the controllers, compiled for several instruction
+ * sets (generic x86-64/SSE2, AVX2+FMA and AVX-512 on x86-64 builds). The
+ * variant is chosen once, the first time a kernel is used, from the features of
+ * the cpu the program runs on: AVX2 when available, generic otherwise. The
+ * AVX-512 variant is only used when forced, it was measured slower than AVX2
+ * at the controller sizes (see the numerical kernels benchmark example).
+ *
+ * Unless a variant is forced (setInstructionSet or ScopedThreadInstructionSet),
+ * the wrappers only dispatch to the compiled kernels where they were measured
+ * faster than the Eigen expression (small matrix products and the batched
+ * kernel), and use Eigen otherwise. This is why the task and controller call
+ * sites keep their Eigen expressions.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_NUMERICAL_KERNELS_H
+#define SAI2_PRIMITIVES_NUMERICAL_KERNELS_H
+
+#include <Eigen/Dense>
+#include <string>
+
+#include "NumericalKernelsBatchLayout.h"
+
+namespace Sai2Primitives {
+namespace NumericalKernels {
+
+enum InstructionSet {
+	GENERIC = 0,
+	AVX2,
+	AVX512,
+};
+
+/**
+ * @brief      Returns the instruction set variant currently used by the
+ * kernels
+ */
+InstructionSet activeInstructionSet();
+
+/**
+ * @brief      Returns the best instruction set variant supported by the
+ * current cpu (and compiled in the library)
+ */
+InstructionSet bestSupportedInstructionSet();
+
+/**
+ * @brief      Forces the kernels to use a given instruction set variant, for
+ * benchmarking and testing purposes. The forced variant is used for all the
+ * kernels and sizes. Throws if the variant is not supported by
+ * the cpu or not compiled in the library. Not thread safe with respect to
+ * concurrent kernel calls.
+ *
+ * @param[in]  instruction_set  The instruction set to use
+ */
+void setInstructionSet(const InstructionSet instruction_set);
+
+/**
+ * @brief      Makes the kernels called from the current thread use a given
+ * instruction set variant while the object is in scope, without changing the
+ * variant used by the other threads, for example to test a variant on a
+ * background thread while the control thread keeps the automatic selection.
+ * Throws if the variant is not supported.
+ */
+class ScopedThreadInstructionSet {
+public:
+	explicit ScopedThreadInstructionSet(const InstructionSet instruction_set);
+	~ScopedThreadInstructionSet();
+
+	ScopedThreadInstructionSet(const ScopedThreadInstructionSet&) = delete;
+	ScopedThreadInstructionSet& operator=(const ScopedThreadInstructionSet&) =
+		delete;
+
+private:
+	const void* _previous_table;
+};
+
+/**
+ * @brief      Human readable name of an instruction set variant
+ */
+std::string instructionSetName(const InstructionSet instruction_set);
+
+/**
+ * @brief      Applies a diagonal PID control law:
+ * output = -kp * position_error - kv * velocity_error - ki * integrated_error
+ * where the gains are the diagonals of the gain matrices
+ */
+void applyDiagonalGains(const Eigen::VectorXd& kp, const Eigen::VectorXd& kv,
+						const Eigen::VectorXd& ki,
+						const Eigen::VectorXd& position_error,
+						const Eigen::VectorXd& velocity_error,
+						const Eigen::VectorXd& integrated_error,
+						Eigen::VectorXd& output);
+
+/**
+ * @brief      Computes output = A^T * x. Without a forced variant, the
+ * dispatched kernel is only used for matrices up to 12x12, Eigen is faster
+ * above
+ */
+void transposedMatrixVectorProduct(const Eigen::MatrixXd& A,
+								   const Eigen::VectorXd& x,
+								   Eigen::VectorXd& output);
+
+/**
+ * @brief      Computes output = A * B. Without a forced variant, the
+ * dispatched kernel is only used for matrices up to 12x12, Eigen is faster
+ * above
+ */
+void matrixProduct(const Eigen::MatrixXd& A, const Eigen::MatrixXd& B,
+				   Eigen::MatrixXd& output);
+
+/**
+ * @brief      Computes the inverse of a small (up to SMALL_SPD_MAX_SIZE)
+ * symmetric positive definite matrix from its cholesky factorization. Used to
+ * get the operational space inertia from its inverse. Larger matrices, and the
+ * ones that are not numerically positive definite, are inverted with Eigen, as
+ * are all matrices without a forced variant (no measured win).
+ */
+void symmetricPositiveDefiniteInverse(const Eigen::MatrixXd& A,
+									  Eigen::MatrixXd& output);
+
+/**
+ * @brief      Orientation error between two rotation matrices, same as
+ * Sai2Model::orientationError. For 3d quantities the dispatch costs more than
+ * the computation, so the Eigen version is used without a forced variant, and
+ * the same holds for passivityObserverPower and applyDiagonalGains.
+ */
+Eigen::Vector3d orientationError(const Eigen::Matrix3d& desired_orientation,
+								 const Eigen::Matrix3d& current_orientation);
+
+/**
+ * @brief      Power entering the POPC passivity observer over one cycle:
+ * force_error . closed_loop_velocity - command . velocity
+ */
+double passivityObserverPower(const Eigen::Vector3d& force_error,
+							  const Eigen::Vector3d& closed_loop_velocity,
+							  const Eigen::Vector3d& command,
+							  const Eigen::Vector3d& velocity);
+
+/**
+ * @brief      Computes the torques of a 6 dof motion task with full dynamic
+ * decoupling and a joint posture task projected in its dynamically consistent
+ * nullspace, for the BATCH_LANES robots of a batch block:
+ * tau = J^T Lambda (F* - J gamma) + M gamma + g, with F* the task PD output and
+ * gamma the posture PD output. The mass matrix and Lambda^-1 are assumed
+ * positive definite.
+ *
+ * @param[in]  block  The pointers to the block data
+ * @param[in]  gains  The gains
+ */
+void batchedOperationalSpaceTorques(const BatchedOpSpaceBlock& block,
+									const BatchedOpSpaceGains& gains);
+
+}  // namespace NumericalKernels
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_NUMERICAL_KERNELS_H
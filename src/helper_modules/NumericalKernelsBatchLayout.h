@@ -0,0 +1,75 @@
+/**
+ * NumericalKernelsBatchLayout.h
+ *
+ *	Data layout shared by the batched numerical kernels and their callers.
+ * A batch block holds BATCH_LANES robots. Every quantity of a block is stored
+ * as an array of [element][lane], so that the lanes of one element are
+ * contiguous and a kernel processes all the robots of a block in SIMD lanes.
+ * Matrices are column major at the element level. This header is included by
+ * NumericalKernelsImpl.cpp and must only contain plain data definitions.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_NUMERICAL_KERNELS_BATCH_LAYOUT_H
+#define SAI2_PRIMITIVES_NUMERICAL_KERNELS_BATCH_LAYOUT_H
+
+#include <cstddef>
+
+namespace Sai2Primitives {
+namespace NumericalKernels {
+
+// largest matrix handled by the small symmetric positive definite inverse
+// kernel (operational space matrices)
+constexpr std::size_t SMALL_SPD_MAX_SIZE = 6;
+
+// number of robots per batch block, one AVX-512 register or two AVX2
+// registers of doubles
+constexpr std::size_t BATCH_LANES = 8;
+
+/**
+ * @brief      Pointers to the data of one batch block for the batched
+ * operational space kernel. Sizes are given in elements and every array
+ * holds size * BATCH_LANES doubles.
+ */
+struct BatchedOpSpaceBlock {
+	std::size_t dof;
+
+	// inputs
+	const double* mass_matrix;		 // dof x dof
+	const double* jacobian;			 // 6 x dof, linear part first
+	const double* gravity;			 // dof
+	const double* q;				 // dof
+	const double* dq;				 // dof
+	const double* position;			 // 3
+	const double* orientation;		 // 3 x 3
+	const double* goal_position;	 // 3
+	const double* goal_orientation;	 // 3 x 3
+	const double* goal_posture;		 // dof
+
+	// scratch
+	double* mass_matrix_cholesky;	  // dof x dof
+	double* mass_inverse_jacobian_t;  // dof x 6
+	double* lambda_inverse_cholesky;  // 6 x 6
+	double* posture_acceleration;	  // dof
+
+	// output
+	double* torques;  // dof
+};
+
+/**
+ * @brief      Gains shared by all the robots of a batch
+ */
+struct BatchedOpSpaceGains {
+	double kp_pos;
+	double kv_pos;
+	double kp_ori;
+	double kv_ori;
+	double kp_joint;
+	double kv_joint;
+};
+
+}  // namespace NumericalKernels
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_NUMERICAL_KERNELS_BATCH_LAYOUT_H
@@ -0,0 +1,379 @@
+/**
+ * NumericalKernelsImpl.cpp
+ *
+ *	Implementation of the numerical kernels on raw column major arrays. This
+ * file is compiled once per instruction set, with the corresponding compiler
+ * flags and SAI2_KERNELS_ISA set to the name of the variant. It must not
+ * include any header defining inline functions or templates (Eigen, std
+ * containers...), otherwise the different variants of those would be merged by
+ * the linker and code using unsupported instructions could end up in the
+ * generic path. Square roots use the compiler builtin for the same reason.
+ *
+ * Created: October 2026
+ */
+
+#include <cstddef>
+
+#include "NumericalKernelsBatchLayout.h"
+
+#ifndef SAI2_KERNELS_ISA
+#define SAI2_KERNELS_ISA generic
+#endif
+
+namespace Sai2Primitives {
+namespace NumericalKernels {
+namespace SAI2_KERNELS_ISA {
+
+void applyDiagonalGains(const double* kp, const double* kv, const double* ki,
+						const double* position_error,
+						const double* velocity_error,
+						const double* integrated_error, double* output,
+						const std::size_t size) {
+	for (std::size_t i = 0; i < size; ++i) {
+		output[i] = -kp[i] * position_error[i] - kv[i] * velocity_error[i] -
+					ki[i] * integrated_error[i];
+	}
+}
+
+void transposedMatrixVectorProduct(const double* A, const std::size_t rows,
+								   const std::size_t cols, const double* x,
+								   double* output) {
+	// each output element is the dot product of a (contiguous) column of A
+	// with x
+	for (std::size_t j = 0; j < cols; ++j) {
+		const double* column = A + j * rows;
+		double sum = 0.0;
+#pragma omp simd reduction(+ : sum)
+		for (std::size_t i = 0; i < rows; ++i) {
+			sum += column[i] * x[i];
+		}
+		output[j] = sum;
+	}
+}
+
+void matrixProduct(const double* A, const std::size_t rows,
+				   const std::size_t inner, const double* B,
+				   const std::size_t cols, double* output) {
+	// column by column axpy formulation, vectorized along the rows
+	for (std::size_t j = 0; j < cols; ++j) {
+		double* output_column = output + j * rows;
+		for (std::size_t i = 0; i < rows; ++i) {
+			output_column[i] = 0.0;
+		}
+		for (std::size_t k = 0; k < inner; ++k) {
+			const double b = B[j * inner + k];
+			const double* A_column = A + k * rows;
+			for (std::size_t i = 0; i < rows; ++i) {
+				output_column[i] += A_column[i] * b;
+			}
+		}
+	}
+}
+
+bool symmetricPositiveDefiniteInverse(const double* A, const std::size_t n,
+									  double* output) {
+	// cholesky factor L of A, then the columns of A^-1 = L^-T L^-1 from the
+	// columns of the identity
+	double L[SMALL_SPD_MAX_SIZE * SMALL_SPD_MAX_SIZE];
+	for (std::size_t j = 0; j < n; ++j) {
+		double d = A[j + j * n];
+		for (std::size_t k = 0; k < j; ++k) {
+			d -= L[j + k * n] * L[j + k * n];
+		}
+		if (!(d > 0.0)) {
+			return false;
+		}
+		L[j + j * n] = __builtin_sqrt(d);
+		for (std::size_t i = j + 1; i < n; ++i) {
+			double v = A[i + j * n];
+			for (std::size_t k = 0; k < j; ++k) {
+				v -= L[i + k * n] * L[j + k * n];
+			}
+			L[i + j * n] = v / L[j + j * n];
+		}
+	}
+	for (std::size_t c = 0; c < n; ++c) {
+		double* x = output + c * n;
+		for (std::size_t i = 0; i < n; ++i) {
+			double v = i == c ? 1.0 : 0.0;
+			for (std::size_t k = 0; k < i; ++k) {
+				v -= L[i + k * n] * x[k];
+			}
+			x[i] = v / L[i + i * n];
+		}
+		for (std::size_t i = n; i-- > 0;) {
+			double v = x[i];
+			for (std::size_t k = i + 1; k < n; ++k) {
+				v -= L[k + i * n] * x[k];
+			}
+			x[i] = v / L[i + i * n];
+		}
+	}
+	return true;
+}
+
+void orientationError(const double* desired, const double* current,
+					  double* output) {
+	// -1/2 sum_i current.col(i) x desired.col(i)
+	double e0 = 0.0, e1 = 0.0, e2 = 0.0;
+	for (std::size_t i = 0; i < 3; ++i) {
+		const double* a = current + 3 * i;
+		const double* b = desired + 3 * i;
+		e0 += a[1] * b[2] - a[2] * b[1];
+		e1 += a[2] * b[0] - a[0] * b[2];
+		e2 += a[0] * b[1] - a[1] * b[0];
+	}
+	output[0] = -0.5 * e0;
+	output[1] = -0.5 * e1;
+	output[2] = -0.5 * e2;
+}
+
+double passivityObserverPower(const double* force_error,
+							  const double* closed_loop_velocity,
+							  const double* command, const double* velocity,
+							  const std::size_t size) {
+	double power = 0.0;
+#pragma omp simd reduction(+ : power)
+	for (std::size_t i = 0; i < size; ++i) {
+		power += force_error[i] * closed_loop_velocity[i] -
+				 command[i] * velocity[i];
+	}
+	return power;
+}
+
+namespace {
+
+constexpr std::size_t W = BATCH_LANES;
+
+// element (i, j) of a column major lane matrix with the given number of rows
+inline double* laneElement(double* matrix, const std::size_t rows,
+						   const std::size_t i, const std::size_t j) {
+	return matrix + (i + j * rows) * W;
+}
+inline const double* laneElement(const double* matrix, const std::size_t rows,
+								 const std::size_t i, const std::size_t j) {
+	return matrix + (i + j * rows) * W;
+}
+
+// lower cholesky factor of the n x n lane matrices in A, written in L
+void laneCholesky(const double* A, double* L, const std::size_t n) {
+	for (std::size_t j = 0; j < n; ++j) {
+		double* Ljj = laneElement(L, n, j, j);
+		const double* Ajj = laneElement(A, n, j, j);
+#pragma omp simd
+		for (std::size_t l = 0; l < W; ++l) {
+			Ljj[l] = Ajj[l];
+		}
+		for (std::size_t k = 0; k < j; ++k) {
+			const double* Ljk = laneElement(L, n, j, k);
+#pragma omp simd
+			for (std::size_t l = 0; l < W; ++l) {
+				Ljj[l] -= Ljk[l] * Ljk[l];
+			}
+		}
+#pragma omp simd
+		for (std::size_t l = 0; l < W; ++l) {
+			Ljj[l] = __builtin_sqrt(Ljj[l]);
+		}
+		for (std::size_t i = j + 1; i < n; ++i) {
+			double* Lij = laneElement(L, n, i, j);
+			const double* Aij = laneElement(A, n, i, j);
+#pragma omp simd
+			for (std::size_t l = 0; l < W; ++l) {
+				Lij[l] = Aij[l];
+			}
+			for (std::size_t k = 0; k < j; ++k) {
+				const double* Lik = laneElement(L, n, i, k);
+				const double* Ljk = laneElement(L, n, j, k);
+#pragma omp simd
+				for (std::size_t l = 0; l < W; ++l) {
+					Lij[l] -= Lik[l] * Ljk[l];
+				}
+			}
+#pragma omp simd
+			for (std::size_t l = 0; l < W; ++l) {
+				Lij[l] /= Ljj[l];
+			}
+		}
+	}
+}
+
+// solves L L^T x = b in place for the n lane vectors in x
+void laneCholeskySolve(const double* L, double* x, const std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i) {
+		double* xi = x + i * W;
+		for (std::size_t k = 0; k < i; ++k) {
+			const double* Lik = laneElement(L, n, i, k);
+			const double* xk = x + k * W;
+#pragma omp simd
+			for (std::size_t l = 0; l < W; ++l) {
+				xi[l] -= Lik[l] * xk[l];
+			}
+		}
+		const double* Lii = laneElement(L, n, i, i);
+#pragma omp simd
+		for (std::size_t l = 0; l < W; ++l) {
+			xi[l] /= Lii[l];
+		}
+	}
+	for (std::size_t i = n; i-- > 0;) {
+		double* xi = x + i * W;
+		for (std::size_t k = i + 1; k < n; ++k) {
+			const double* Lki = laneElement(L, n, k, i);
+			const double* xk = x + k * W;
+#pragma omp simd
+			for (std::size_t l = 0; l < W; ++l) {
+				xi[l] -= Lki[l] * xk[l];
+			}
+		}
+		const double* Lii = laneElement(L, n, i, i);
+#pragma omp simd
+		for (std::size_t l = 0; l < W; ++l) {
+			xi[l] /= Lii[l];
+		}
+	}
+}
+
+}  // namespace
+
+void batchedOperationalSpaceTorques(const BatchedOpSpaceBlock& block,
+									const BatchedOpSpaceGains& gains) {
+	const std::size_t n = block.dof;
+	const double* M = block.mass_matrix;
+	const double* J = block.jacobian;
+	double* L = block.mass_matrix_cholesky;
+	double* X = block.mass_inverse_jacobian_t;
+	double* LA = block.lambda_inverse_cholesky;
+	double* gamma = block.posture_acceleration;
+
+	// M^-1 J^T, column by column from the factorization of M
+	laneCholesky(M, L, n);
+	for (std::size_t c = 0; c < 6; ++c) {
+		double* x = X + c * n * W;
+		for (std::size_t k = 0; k < n; ++k) {
+			const double* Jck = laneElement(J, 6, c, k);
+#pragma omp simd
+			for (std::size_t l = 0; l < W; ++l) {
+				x[k * W + l] = Jck[l];
+			}
+		}
+		laneCholeskySolve(L, x, n);
+	}
+
+	// Lambda^-1 = J M^-1 J^T (lower part only) and its factorization
+	double lambda_inverse[36 * W];
+	for (std::size_t c = 0; c < 6; ++c) {
+		for (std::size_t r = c; r < 6; ++r) {
+			double* Arc = laneElement(lambda_inverse, 6, r, c);
+#pragma omp simd
+			for (std::size_t l = 0; l < W; ++l) {
+				Arc[l] = 0.0;
+			}
+			for (std::size_t k = 0; k < n; ++k) {
+				const double* Jrk = laneElement(J, 6, r, k);
+				const double* Xkc = laneElement(X, n, k, c);
+#pragma omp simd
+				for (std::size_t l = 0; l < W; ++l) {
+					Arc[l] += Jrk[l] * Xkc[l];
+				}
+			}
+		}
+	}
+	laneCholesky(lambda_inverse, LA, 6);
+
+	// posture joint space acceleration
+	for (std::size_t k = 0; k < n; ++k) {
+		const double* qk = block.q + k * W;
+		const double* dqk = block.dq + k * W;
+		const double* qdk = block.goal_posture + k * W;
+		double* gk = gamma + k * W;
+#pragma omp simd
+		for (std::size_t l = 0; l < W; ++l) {
+			gk[l] = -gains.kp_joint * (qk[l] - qdk[l]) - gains.kv_joint * dqk[l];
+		}
+	}
+
+	// task space errors and velocities
+	double error[6 * W];
+	const double* x = block.position;
+	const double* xd = block.goal_position;
+	const double* R = block.orientation;
+	const double* Rd = block.goal_orientation;
+#pragma omp simd
+	for (std::size_t l = 0; l < W; ++l) {
+		for (std::size_t i = 0; i < 3; ++i) {
+			error[i * W + l] = x[i * W + l] - xd[i * W + l];
+		}
+		// orientation error -1/2 sum_i R.col(i) x Rd.col(i)
+		double e0 = 0.0, e1 = 0.0, e2 = 0.0;
+		for (std::size_t i = 0; i < 3; ++i) {
+			const double a0 = R[(3 * i) * W + l], a1 = R[(3 * i + 1) * W + l],
+						 a2 = R[(3 * i + 2) * W + l];
+			const double b0 = Rd[(3 * i) * W + l],
+						 b1 = Rd[(3 * i + 1) * W + l],
+						 b2 = Rd[(3 * i + 2) * W + l];
+			e0 += a1 * b2 - a2 * b1;
+			e1 += a2 * b0 - a0 * b2;
+			e2 += a0 * b1 - a1 * b0;
+		}
+		error[3 * W + l] = -0.5 * e0;
+		error[4 * W + l] = -0.5 * e1;
+		error[5 * W + l] = -0.5 * e2;
+	}
+
+	// F = Lambda (F* - J gamma), which is the task force plus the term that
+	// projects the posture torques M gamma in the task nullspace
+	double force[6 * W];
+	for (std::size_t r = 0; r < 6; ++r) {
+		const double kp = r < 3 ? gains.kp_pos : gains.kp_ori;
+		const double kv = r < 3 ? gains.kv_pos : gains.kv_ori;
+		double velocity[W] = {};
+		double posture[W] = {};
+		for (std::size_t k = 0; k < n; ++k) {
+			const double* Jrk = laneElement(J, 6, r, k);
+			const double* dqk = block.dq + k * W;
+			const double* gk = gamma + k * W;
+#pragma omp simd
+			for (std::size_t l = 0; l < W; ++l) {
+				velocity[l] += Jrk[l] * dqk[l];
+				posture[l] += Jrk[l] * gk[l];
+			}
+		}
+#pragma omp simd
+		for (std::size_t l = 0; l < W; ++l) {
+			force[r * W + l] =
+				-kp * error[r * W + l] - kv * velocity[l] - posture[l];
+		}
+	}
+	laneCholeskySolve(LA, force, 6);
+
+	// tau = J^T F + M gamma + g
+	for (std::size_t k = 0; k < n; ++k) {
+		double* tk = block.torques + k * W;
+		const double* gk = block.gravity + k * W;
+#pragma omp simd
+		for (std::size_t l = 0; l < W; ++l) {
+			tk[l] = gk[l];
+		}
+		for (std::size_t r = 0; r < 6; ++r) {
+			const double* Jrk = laneElement(J, 6, r, k);
+			const double* fr = force + r * W;
+#pragma omp simd
+			for (std::size_t l = 0; l < W; ++l) {
+				tk[l] += Jrk[l] * fr[l];
+			}
+		}
+		for (std::size_t j = 0; j < n; ++j) {
+			const double* Mkj = laneElement(M, n, k, j);
+			const double* gj = gamma + j * W;
+#pragma omp simd
+			for (std::size_t l = 0; l < W; ++l) {
+				tk[l] += Mkj[l] * gj[l];
+			}
+		}
+	}
+}
+
+}  // namespace SAI2_KERNELS_ISA
+}  // namespace NumericalKernels
+}  // namespace Sai2Primitives
@@ -25,22 +25,71 @@ bool isValidRotation(const Matrix3d mat) {
 	}
 	return true;
 }
+
+Matrix3d rotationVectorToMatrix(const Vector3d& rotation_vector) {
+	if (rotation_vector.norm() < 1e-12) {
+		return Matrix3d::Identity();
+	}
+	return AngleAxisd(rotation_vector.norm(), rotation_vector.normalized())
+		.toRotationMatrix();
+}
+
+// expresses the angular part of a trajectory state, in the rotation vector
+// coordinates of the frame from, in the coordinates of the frame to
+void changeAngularReferenceFrame(const Matrix3d& from, const Matrix3d& to,
+								 Vector6d& position, Vector6d& velocity,
+								 Vector6d& acceleration) {
+	if (from == to) {
+		return;
+	}
+	const Matrix3d rotation = to.transpose() * from;
+	const AngleAxisd orientation(
+		rotation * rotationVectorToMatrix(position.tail<3>()));
+	position.tail<3>() = orientation.angle() * orientation.axis();
+	velocity.tail<3>() = rotation * velocity.tail<3>();
+	acceleration.tail<3>() = rotation * acceleration.tail<3>();
+}
 }  // namespace
 
 OTG_6dof_cartesian::OTG_6dof_cartesian(const Vector3d& initial_position,
 									   const Matrix3d& initial_orientation,
 									   const double loop_time) {
-	_otg = std::make_shared<Ruckig<6, EigenVector>>(loop_time);
+	_otg = std::make_shared<SharedRuckig<6>>(6, loop_time);
 	_input = InputParameter<6, EigenVector>();
 	_output = OutputParameter<6, EigenVector>();
 	_input.synchronization = Synchronization::Phase;
+	_brake.reset(new BrakeTrajectory<6>(_input, loop_time));
 
 	_reference_frame = initial_orientation;
+	_playback_frame = initial_orientation;
+	_request_frame = initial_orientation;
 	reInitialize(initial_position, initial_orientation);
 }
 
+OTG_6dof_cartesian::OTG_6dof_cartesian(const OTG_6dof_cartesian& prototype,
+									   const Vector3d& initial_position,
+									   const Matrix3d& initial_orientation)
+	: _max_handover_latency(prototype._max_handover_latency) {
+	_otg = std::make_shared<SharedRuckig<6>>(6,
+											 prototype._otg->getDeltaTime());
+	_input = prototype._input;
+	_output = OutputParameter<6, EigenVector>();
+	_brake.reset(
+		new BrakeTrajectory<6>(_input, prototype._otg->getDeltaTime()));
+
+	_reference_frame = initial_orientation;
+	_playback_frame = initial_orientation;
+	_request_frame = initial_orientation;
+	reInitialize(initial_position, initial_orientation);
+	if (prototype._async_calculator) {
+		enableAsynchronousRecalculation(
+			true, &prototype._async_calculator->getExecutor());
+	}
+}
+
 void OTG_6dof_cartesian::reInitialize(const Vector3d& initial_position,
 									  const Matrix3d& initial_orientation) {
+	_brake->release();
 	setGoalPosition(initial_position);
 	setGoalOrientation(initial_orientation);
 
@@ -51,9 +100,12 @@ void OTG_6dof_cartesian::reInitialize(const Vector3d& initial_position,
 	_output.new_position = _input.target_position;
 	_output.new_velocity.setZero();
 	_output.new_acceleration.setZero();
+	resetAsynchronousCalculator();
+	resetBrakeTrajectory();
 }
 
 void OTG_6dof_cartesian::reInitializeLinear(const Vector3d& initial_position) {
+	_brake->release();
 	setGoalPosition(initial_position);
 
 	_input.current_position.head<3>() = _input.target_position.head<3>();
@@ -63,10 +115,13 @@ void OTG_6dof_cartesian::reInitializeLinear(const Vector3d& initial_position) {
 	_output.new_position.head<3>() = _input.target_position.head<3>();
 	_output.new_velocity.head<3>().setZero();
 	_output.new_acceleration.head<3>().setZero();
+	resetAsynchronousCalculator();
+	resetBrakeTrajectory();
 }
 
 void OTG_6dof_cartesian::reInitializeAngular(
 	const Matrix3d& initial_orientation) {
+	_brake->release();
 	setGoalOrientation(initial_orientation);
 
 	_input.current_position.tail<3>() = _input.target_position.tail<3>();
@@ -76,6 +131,53 @@ void OTG_6dof_cartesian::reInitializeAngular(
 	_output.new_position.tail<3>() = _input.target_position.tail<3>();
 	_output.new_velocity.tail<3>().setZero();
 	_output.new_acceleration.tail<3>().setZero();
+	resetAsynchronousCalculator();
+	resetBrakeTrajectory();
+}
+
+void OTG_6dof_cartesian::reInitializeDirections(
+	const Matrix3d& linear_directions, const Vector3d& initial_position,
+	const Matrix3d& angular_directions, const Matrix3d& initial_orientation) {
+	_brake->release();
+	// linear part, in world frame
+	const Matrix3d linear_kept = Matrix3d::Identity() - linear_directions;
+	_output.new_position.head<3>() =
+		linear_kept * _output.new_position.head<3>() +
+		linear_directions * initial_position;
+	_output.new_velocity.head<3>() =
+		linear_kept * _output.new_velocity.head<3>();
+	_output.new_acceleration.head<3>() =
+		linear_kept * _output.new_acceleration.head<3>();
+
+	// angular part, in the rotation vector coordinates of a reference frame
+	// at the current orientation of the trajectory
+	resetAngularReferenceFrame();
+	const Matrix3d angular_directions_in_reference =
+		_reference_frame.transpose() * angular_directions * _reference_frame;
+	const Matrix3d angular_kept =
+		Matrix3d::Identity() - angular_directions_in_reference;
+	const AngleAxisd reference_to_initial(_reference_frame.transpose() *
+										  initial_orientation);
+	_output.new_position.tail<3>() = angular_directions_in_reference *
+									 reference_to_initial.angle() *
+									 reference_to_initial.axis();
+	_output.new_velocity.tail<3>() =
+		angular_kept * _output.new_velocity.tail<3>();
+	_output.new_acceleration.tail<3>() =
+		angular_kept * _output.new_acceleration.tail<3>();
+	_output.pass_to_input(_input);
+
+	// express the goal in the new reference frame
+	const AngleAxisd reference_to_goal(_reference_frame.transpose() *
+									   _goal_orientation_in_base_frame);
+	_input.target_position.tail<3>() =
+		reference_to_goal.angle() * reference_to_goal.axis();
+	_input.target_velocity.tail<3>() =
+		_reference_frame.transpose() * _goal_angular_velocity_in_base_frame;
+
+	_goal_reached = false;
+	resetAsynchronousCalculator();
+	resetBrakeTrajectory();
 }
 
 void OTG_6dof_cartesian::setMaxLinearVelocity(
@@ -133,6 +235,13 @@ void OTG_6dof_cartesian::setMaxJerk(const Vector3d& max_linear_jerk,
 
 void OTG_6dof_cartesian::setGoalPositionAndLinearVelocity(
 	const Vector3d& goal_position, const Vector3d& goal_linear_velocity) {
+	if (isBraking()) {
+		return;
+	}
+	if (getVelocityStreamingEnabled()) {
+		setGoalLinearVelocity(goal_linear_velocity);
+		return;
+	}
 	if (goal_position.isApprox(_input.target_position.head<3>(), 1e-3) &&
 		goal_linear_velocity.isApprox(_input.target_velocity.head<3>(), 1e-3)) {
 		return;
@@ -144,6 +253,14 @@ void OTG_6dof_cartesian::setGoalPositionAndLinearVelocity(
 
 void OTG_6dof_cartesian::setGoalOrientationAndAngularVelocity(
 	const Matrix3d& goal_orientation, const Vector3d& goal_angular_velocity) {
+	if (isBraking()) {
+		return;
+	}
+	if (getVelocityStreamingEnabled()) {
+		setGoalAngularVelocity(goal_angular_velocity);
+		return;
+	}
+
 	if (!isValidRotation(goal_orientation)) {
 		throw std::invalid_argument(
 			"goal orientation is not a valid rotation matrix "
@@ -157,13 +274,137 @@ void OTG_6dof_cartesian::setGoalOrientationAndAngularVelocity(
 	}
 
 	_goal_reached = false;
+	resetAngularReferenceFrame();
+	_goal_orientation_in_base_frame = goal_orientation;
+	_goal_angular_velocity_in_base_frame = goal_angular_velocity;
+
+	// set the target position and velocity in the new reference frame
+	Matrix3d reference_to_goal =
+		_reference_frame.transpose() * _goal_orientation_in_base_frame;
+	AngleAxisd reference_to_goal_angle_axis = AngleAxisd(reference_to_goal);
+	_input.target_position.tail<3>() = reference_to_goal_angle_axis.angle() *
+									   reference_to_goal_angle_axis.axis();
+	_input.target_velocity.tail<3>() =
+		_reference_frame.transpose() * _goal_angular_velocity_in_base_frame;
+}
+
+void OTG_6dof_cartesian::setGoalLinearVelocity(
+	const Vector3d& goal_linear_velocity) {
+	if (isBraking()) {
+		return;
+	}
+	// the velocity interface ignores the velocity limits, so the goal is
+	// scaled to respect them
+	Vector3d bounded_goal_velocity = goal_linear_velocity;
+	const double velocity_ratio =
+		goal_linear_velocity.cwiseAbs()
+			.cwiseQuotient(_input.max_velocity.head<3>())
+			.maxCoeff();
+	if (velocity_ratio > 1.0) {
+		bounded_goal_velocity /= velocity_ratio;
+	}
+
+	if (bounded_goal_velocity.isApprox(_input.target_velocity.head<3>(),
+									   1e-3)) {
+		return;
+	}
+	_goal_reached = false;
+	_input.target_velocity.head<3>() = bounded_goal_velocity;
+}
+
+void OTG_6dof_cartesian::setGoalAngularVelocity(
+	const Vector3d& goal_angular_velocity) {
+	if (isBraking()) {
+		return;
+	}
+	Vector3d bounded_goal_velocity = goal_angular_velocity;
+	const double velocity_ratio =
+		goal_angular_velocity.cwiseAbs()
+			.cwiseQuotient(_input.max_velocity.tail<3>())
+			.maxCoeff();
+	if (velocity_ratio > 1.0) {
+		bounded_goal_velocity /= velocity_ratio;
+	}
+
+	if (_goal_angular_velocity_in_base_frame.isApprox(bounded_goal_velocity,
+													  1e-3)) {
+		return;
+	}
+
+	// the angular velocity is integrated in the rotation vector coordinates
+	// of the reference frame, which is exact for a constant rotation axis, so
+	// the reference frame is reset when the goal changes
+	_goal_reached = false;
+	resetAngularReferenceFrame();
+	_goal_angular_velocity_in_base_frame = bounded_goal_velocity;
+	_input.target_velocity.tail<3>() =
+		_reference_frame.transpose() * _goal_angular_velocity_in_base_frame;
+}
+
+void OTG_6dof_cartesian::enableVelocityStreaming(
+	const bool enable_velocity_streaming) {
+	if (enable_velocity_streaming == getVelocityStreamingEnabled()) {
+		return;
+	}
+	_goal_reached = false;
+	if (enable_velocity_streaming) {
+		_input.control_interface = ControlInterface::Velocity;
+	} else {
+		_input.control_interface = ControlInterface::Position;
+		_input.target_position.head<3>() = _input.current_position.head<3>();
+		_input.target_velocity.head<3>().setZero();
+		resetAngularReferenceFrame();
+		_goal_orientation_in_base_frame = _reference_frame;
+		_goal_angular_velocity_in_base_frame.setZero();
+		_input.target_position.tail<3>().setZero();
+		_input.target_velocity.tail<3>().setZero();
+	}
+	resetAsynchronousCalculator();
+}
+
+void OTG_6dof_cartesian::enableAsynchronousRecalculation(
+	const bool enable_asynchronous_recalculation,
+	BackgroundExecutor* executor) {
+	if (!enable_asynchronous_recalculation) {
+		_async_calculator.reset();
+		return;
+	}
+	_async_calculator.reset(new AsyncTrajectoryCalculator<6>(
+		_input, _otg->getDeltaTime(),
+		executor ? *executor : BackgroundExecutor::instance()));
+	_async_calculator->setMaxHandoverLatency(_max_handover_latency);
+	resetAsynchronousCalculator();
+}
+
+void OTG_6dof_cartesian::setMaxHandoverLatency(
+	const double max_handover_latency) {
+	if (max_handover_latency <= 0) {
+		throw std::invalid_argument(
+			"max handover latency should be strictly positive in "
+			"OTG_6dof_cartesian::setMaxHandoverLatency\n");
+	}
+	_max_handover_latency = max_handover_latency;
+	if (_async_calculator) {
+		_async_calculator->setMaxHandoverLatency(_max_handover_latency);
+	}
+}
+
+void OTG_6dof_cartesian::resetAsynchronousCalculator() {
+	_playback_frame = _reference_frame;
+	_request_frame = _reference_frame;
+	if (_async_calculator) {
+		_async_calculator->reset(_input.current_position,
+								 _input.current_velocity,
+								 _input.current_acceleration);
+	}
+}
+
+void OTG_6dof_cartesian::resetAngularReferenceFrame() {
 	// the new reference frame is the current orientation
 	Matrix3d new_reference_frame = getNextOrientation();
 	Matrix3d R_new_to_previous_reference =
 		new_reference_frame.transpose() * _reference_frame;
 	_reference_frame = new_reference_frame;
-	_goal_orientation_in_base_frame = goal_orientation;
-	_goal_angular_velocity_in_base_frame = goal_angular_velocity;
 
 	// set the new orientation representation vector in otg to zero and
 	// rotate input current velocity and acceleration to the new reference
@@ -174,24 +415,132 @@ void OTG_6dof_cartesian::setGoalOrientationAndAngularVelocity(
 	_output.new_acceleration.tail<3>() =
 		R_new_to_previous_reference * _output.new_acceleration.tail<3>();
 	_output.pass_to_input(_input);
+}
 
-	// set the target position and velocity in the new reference frame
-	Matrix3d reference_to_goal =
-		_reference_frame.transpose() * _goal_orientation_in_base_frame;
-	AngleAxisd reference_to_goal_angle_axis = AngleAxisd(reference_to_goal);
-	_input.target_position.tail<3>() = reference_to_goal_angle_axis.angle() *
-									   reference_to_goal_angle_axis.axis();
-	_input.target_velocity.tail<3>() =
-		_reference_frame.transpose() * _goal_angular_velocity_in_base_frame;
+void OTG_6dof_cartesian::resetBrakeTrajectory() {
+	_brake->release();
+	_brake_frame = _reference_frame;
+	_brake->precompute(_input, _output.new_position, _output.new_velocity,
+					   _output.new_acceleration);
+}
+
+void OTG_6dof_cartesian::brake() {
+	if (isBraking()) {
+		return;
+	}
+	// the brake trajectory is played in the frame it was computed in
+	_reference_frame = _brake_frame;
+	_playback_frame = _brake_frame;
+	_request_frame = _brake_frame;
+	_brake->start();
+	SAI2_TRACE_INSTANT("brake", "OTG_6dof_cartesian");
+}
+
+void OTG_6dof_cartesian::releaseBrake() {
+	if (!isBraking()) {
+		return;
+	}
+	_brake->release();
+	_output.pass_to_input(_input);
+	_goal_reached = false;
+	_input.target_velocity.setZero();
+	_goal_angular_velocity_in_base_frame.setZero();
+	if (!getVelocityStreamingEnabled()) {
+		_input.target_position.head<3>() = _input.current_position.head<3>();
+		resetAngularReferenceFrame();
+		_goal_orientation_in_base_frame = _reference_frame;
+		_input.target_position.tail<3>().setZero();
+	}
+	resetAsynchronousCalculator();
+}
+
+void OTG_6dof_cartesian::precomputeBrakeTrajectory(
+	const Vector3d& position, const Matrix3d& orientation,
+	const Vector3d& linear_velocity, const Vector3d& angular_velocity) {
+	if (isBraking()) {
+		return;
+	}
+	_reference_frame = orientation;
+	_output.new_position.head<3>() = position;
+	_output.new_position.tail<3>().setZero();
+	_output.new_velocity.head<3>() = linear_velocity;
+	_output.new_velocity.tail<3>() = orientation.transpose() * angular_velocity;
+	_output.new_acceleration.setZero();
+	_output.pass_to_input(_input);
+	_brake_frame = _reference_frame;
+	_brake->precompute(_input, _output.new_position, _output.new_velocity,
+					   _output.new_acceleration);
 }
 
 void OTG_6dof_cartesian::update() {
+	if (isBraking()) {
+		_goal_reached =
+			_brake->update(_output.new_position, _output.new_velocity,
+						   _output.new_acceleration);
+		return;
+	}
 	if (_goal_reached) {
 		return;
 	}
+	updateTrajectory();
+	_brake_frame = _reference_frame;
+	_brake->precompute(_input, _output.new_position, _output.new_velocity,
+					   _output.new_acceleration);
+}
+
+void OTG_6dof_cartesian::updateTrajectory() {
+	SAI2_TRACE_SCOPE("update", "OTG_6dof_cartesian");
 	// compute next state and get result value
 	OutputParameter<6, EigenVector> previous_output = _output;
-	_result_value = _otg->update(_input, _output);
+	if (_async_calculator && !getVelocityStreamingEnabled()) {
+		// the calculation is requested from the background executor, and the
+		// output keeps following the previous trajectory until the handover
+		if (!_async_calculator->isRequestPending() &&
+			_async_calculator->needsRequest(_input)) {
+			const bool braking = _async_calculator->requestTrajectory(
+				_input, [this](Vector6d& position, Vector6d& velocity,
+							   Vector6d& acceleration) {
+					changeAngularReferenceFrame(_playback_frame,
+												_reference_frame, position,
+												velocity, acceleration);
+				});
+			_request_frame = _reference_frame;
+			if (braking) {
+				_playback_frame = _reference_frame;
+			}
+			SAI2_TRACE_INSTANT("trajectory recalculation request",
+							   "OTG_6dof_cartesian");
+		}
+		_result_value = _async_calculator->update(_output.new_position,
+												  _output.new_velocity,
+												  _output.new_acceleration);
+		if (_async_calculator->didHandover()) {
+			_playback_frame = _request_frame;
+			SAI2_TRACE_INSTANT("trajectory handover", "OTG_6dof_cartesian");
+		}
+		changeAngularReferenceFrame(_playback_frame, _reference_frame,
+									_output.new_position, _output.new_velocity,
+									_output.new_acceleration);
+	} else {
+		_result_value = _otg->update(_input, _output);
+		if (_output.new_calculation) {
+			SAI2_TRACE_INSTANT("trajectory recalculation",
+							   "OTG_6dof_cartesian");
+		}
+	}
+
+	// in velocity streaming mode, the trajectory keeps being integrated at the
+	// goal velocity once it is reached, and the goal is reached only when the
+	// robot stops
+	if (getVelocityStreamingEnabled() && (_result_value == Result::Finished ||
+										  _result_value == Result::Working)) {
+		_output.pass_to_input(_input);
+		if (_result_value == Result::Finished &&
+			_output.new_velocity.norm() < 1e-3) {
+			_goal_reached = true;
+		}
+		return;
+	}
 
 	// if the goal is reached, either return if the current velocity is
 	// zero, or set a new goal to the current position with zero velocity
@@ -219,11 +568,15 @@ void OTG_6dof_cartesian::update() {
 			  << _result_value << "\n";
 	_input.current_velocity.setZero();
 	_input.current_acceleration.setZero();
+	resetAsynchronousCalculator();
 }
 
 Matrix3d OTG_6dof_cartesian::getNextOrientation() const {
+	// the rotation vector is only neglected when numerically zero, since the
+	// reference frame can be reset every cycle when streaming goals and
+	// neglecting small rotations would then accumulate
 	Matrix3d next_orientation;
-	if (_output.new_position.tail<3>().norm() < 1e-3) {
+	if (_output.new_position.tail<3>().norm() < 1e-12) {
 		next_orientation.setIdentity();
 	} else {
 		next_orientation =
@@ -15,6 +15,11 @@
 #include <memory>
 #include <ruckig/ruckig.hpp>
 
+#include "AsyncTrajectoryCalculator.h"
+#include "BrakeTrajectory.h"
+#include "SharedRuckig.h"
+#include "TraceRecorder.h"
+
 using namespace Eigen;
 using namespace ruckig;
 namespace Sai2Primitives {
@@ -40,6 +45,19 @@ public:
 	/**
 	 * @brief      destructor
 	 */
+	/**
+	 * @brief      Constructs an OTG with the same limits and settings as a
+	 * prototype (jerk limits, velocity streaming, asynchronous recalculation
+	 * on the same executor), at rest at the given pose. Used to clone tasks.
+	 *
+	 * @param[in]  prototype            The OTG to copy the settings from
+	 * @param[in]  initial_position     The initial position
+	 * @param[in]  initial_orientation  The initial orientation
+	 */
+	OTG_6dof_cartesian(const OTG_6dof_cartesian& prototype,
+					   const Vector3d& initial_position,
+					   const Matrix3d& initial_orientation);
+
 	~OTG_6dof_cartesian() = default;
 
 	/**
@@ -55,6 +73,25 @@ public:
 	void reInitializeLinear(const Vector3d& initial_position);
 	void reInitializeAngular(const Matrix3d& initial_orientation);
 
+	/**
+	 * @brief      Re initializes the trajectory generator along some
+	 * directions only: the trajectory restarts at rest from the given pose
+	 * along these directions, and continues unchanged along the orthogonal
+	 * ones. The goal is not changed. Used when the directions controlled by a
+	 * partial task change.
+	 *
+	 * @param[in]  linear_directions    Projector (in world frame) on the
+	 *                                  linear directions to re initialize
+	 * @param[in]  initial_position     The initial position along them
+	 * @param[in]  angular_directions   Projector (in world frame) on the
+	 *                                  angular directions to re initialize
+	 * @param[in]  initial_orientation  The initial orientation along them
+	 */
+	void reInitializeDirections(const Matrix3d& linear_directions,
+								const Vector3d& initial_position,
+								const Matrix3d& angular_directions,
+								const Matrix3d& initial_orientation);
+
 	/**
 	 * @brief      Sets the maximum linear velocity for the trajectory generator
 	 *
@@ -212,6 +249,132 @@ public:
 											 Vector3d::Zero());
 	}
 
+	/**
+	 * @brief      Sets the goal linear velocity in velocity streaming mode. The
+	 * goal is scaled down (keeping its direction) if it exceeds the maximum
+	 * linear velocity.
+	 *
+	 * @param[in]  goal_linear_velocity  The goal linear velocity
+	 */
+	void setGoalLinearVelocity(const Vector3d& goal_linear_velocity);
+
+	/**
+	 * @brief      Sets the goal angular velocity (in base frame) in velocity
+	 * streaming mode. The goal is scaled down (keeping its direction) if it
+	 * exceeds the maximum angular velocity.
+	 *
+	 * @param[in]  goal_angular_velocity  The goal angular velocity
+	 */
+	void setGoalAngularVelocity(const Vector3d& goal_angular_velocity);
+
+	/**
+	 * @brief      Enables or disables the velocity streaming mode. In this
+	 * mode, Ruckig's velocity interface is used: only the goal linear and
+	 * angular velocities are tracked (goal position and orientation are
+	 * ignored) and the position and orientation are obtained by integration,
+	 * which is much cheaper to compute when the goal changes at every cycle
+	 * (jogging, teleoperation). The mode can be switched at any time and the
+	 * trajectory continues from the current state. When going back to the
+	 * position mode, the goal is set to stop at the current pose until a new
+	 * goal position and orientation are given.
+	 *
+	 * @param[in]  enable_velocity_streaming  true to use the velocity interface
+	 */
+	void enableVelocityStreaming(const bool enable_velocity_streaming = true);
+
+	bool getVelocityStreamingEnabled() const {
+		return _input.control_interface == ControlInterface::Velocity;
+	}
+
+	/**
+	 * @brief      Enables or disables the asynchronous recalculation mode. In
+	 * this mode, the trajectory calculation triggered by a new goal or new
+	 * limits runs on a background executor instead of inside update(). The
+	 * output keeps following the previous trajectory (or a Ruckig brake
+	 * trajectory if the current state exceeds the new limits) and switches to
+	 * the new trajectory after the max handover latency, from the state
+	 * predicted at that time. If the calculation is not done by then, update()
+	 * does not wait for it: the output keeps following the previous trajectory
+	 * and switches at the first cycle where the calculation is done, to the
+	 * state of the new trajectory at the time elapsed since the planned
+	 * handover (see getHandoverDelay). The velocity streaming mode always
+	 * calculates inside update().
+	 *
+	 * @param[in]  enable_asynchronous_recalculation  true to enable the mode
+	 * @param[in]  executor  The executor running the calculations, or nullptr
+	 *                       for the shared one
+	 */
+	void enableAsynchronousRecalculation(
+		const bool enable_asynchronous_recalculation = true,
+		BackgroundExecutor* executor = nullptr);
+
+	bool getAsynchronousRecalculationEnabled() const {
+		return _async_calculator != nullptr;
+	}
+
+	/**
+	 * @brief      Sets the delay between a goal change and the switch to the
+	 * new trajectory in asynchronous recalculation mode, rounded to a whole
+	 * number of control loops. Defaults to 2 ms.
+	 *
+	 * @param[in]  max_handover_latency  The max handover latency (s)
+	 */
+	void setMaxHandoverLatency(const double max_handover_latency);
+
+	double getMaxHandoverLatency() const { return _max_handover_latency; }
+
+	/**
+	 * @brief      Total time (s) by which handovers were delayed because their
+	 * calculation was not done in time in asynchronous recalculation mode, and
+	 * number of such late handovers
+	 */
+	double getHandoverDelay() const {
+		return _async_calculator ? _async_calculator->getHandoverDelay() : 0;
+	}
+	unsigned long getNumLateHandovers() const {
+		return _async_calculator ? _async_calculator->getNumLateHandovers() : 0;
+	}
+
+	/**
+	 * @brief      Switches to the brake trajectory precomputed at the last
+	 * update, which brings the trajectory to rest with the current limits. The
+	 * next calls to update() play it without any new calculation, and the
+	 * goals are ignored until releaseBrake() is called.
+	 */
+	void brake();
+
+	/**
+	 * @brief      Leaves the brake trajectory. The goal is set to the current
+	 * pose with zero velocity (or to zero velocity in velocity streaming
+	 * mode), and new goals are followed again from the current state.
+	 */
+	void releaseBrake();
+
+	bool isBraking() const { return _brake->isActive(); }
+
+	/**
+	 * @brief      Sets the state of the trajectory generator to a given state
+	 * and precomputes the brake trajectory from it. Used by the tasks that do
+	 * not follow the output of the trajectory generator, so that they can
+	 * brake with its limits too. The goal is left unchanged.
+	 *
+	 * @param[in]  position          The position to brake from
+	 * @param[in]  orientation       The orientation to brake from
+	 * @param[in]  linear_velocity   The linear velocity to brake from
+	 * @param[in]  angular_velocity  The angular velocity to brake from (world
+	 *                               frame)
+	 */
+	void precomputeBrakeTrajectory(const Vector3d& position,
+								   const Matrix3d& orientation,
+								   const Vector3d& linear_velocity,
+								   const Vector3d& angular_velocity);
+
+	/**
+	 * @brief      Duration (s) of the brake trajectory precomputed at the last
+	 * update
+	 */
+	double getBrakeDuration() const { return _brake->getDuration(); }
+
 	/**
 	 * @brief      Runs the trajectory generation to compute the next desired
 	 * state. Should be called once per control loop
@@ -250,9 +413,38 @@ public:
 	Vector3d _goal_angular_velocity_in_base_frame;
 
 	// Ruckig variables
-	std::shared_ptr<Ruckig<6, EigenVector>> _otg;
+	std::shared_ptr<SharedRuckig<6>> _otg;
 	InputParameter<6, EigenVector> _input;
 	OutputParameter<6, EigenVector> _output;
+
+private:
+	// makes the current orientation the reference frame of the angular part
+	// of the trajectory, and expresses the current angular state in it
+	void resetAngularReferenceFrame();
+
+	// restarts the asynchronous calculator from the current state
+	void resetAsynchronousCalculator();
+
+	// steps the trajectory towards the goal
+	void updateTrajectory();
+
+	// leaves the brake trajectory and precomputes a new one from the current
+	// state, after the state was reinitialized
+	void resetBrakeTrajectory();
+
+	// asynchronous recalculation mode. The trajectory played by the
+	// calculator and the requested one are expressed in the reference frames
+	// current when they were requested, which may differ from the current
+	// reference frame until the handover
+	double _max_handover_latency = 0.002;
+	std::unique_ptr<AsyncTrajectoryCalculator<6>> _async_calculator;
+	Matrix3d _playback_frame;
+	Matrix3d _request_frame;
+
+	// trajectory to rest from the last output, played on emergency stops. It
+	// is expressed in the reference frame current when it was computed
+	std::unique_ptr<BrakeTrajectory<6>> _brake;
+	Matrix3d _brake_frame;
 };
 
 } /* namespace Sai2Primitives */
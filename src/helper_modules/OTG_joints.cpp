@@ -17,14 +17,35 @@ namespace Sai2Primitives {
 OTG_joints::OTG_joints(const VectorXd& initial_position,
 					   const double loop_time) {
 	_dim = initial_position.size();
-	_otg.reset(new Ruckig<DynamicDOFs, EigenVector>(_dim, loop_time));
+	_otg.reset(new SharedRuckig<DynamicDOFs>(_dim, loop_time));
 	_input = InputParameter<DynamicDOFs, EigenVector>(_dim);
 	_output = OutputParameter<DynamicDOFs, EigenVector>(_dim);
 	_input.synchronization = Synchronization::Phase;
+	_input.current_position = initial_position;
+	_brake.reset(new BrakeTrajectory<DynamicDOFs>(_input, loop_time));
 
 	reInitialize(initial_position);
 }
 
+OTG_joints::OTG_joints(const OTG_joints& prototype,
+					   const VectorXd& initial_position)
+	: _dim(prototype._dim),
+	  _max_handover_latency(prototype._max_handover_latency) {
+	_otg.reset(
+		new SharedRuckig<DynamicDOFs>(_dim, prototype._otg->getDeltaTime()));
+	_input = prototype._input;
+	_output = OutputParameter<DynamicDOFs, EigenVector>(_dim);
+	_input.current_position = initial_position;
+	_brake.reset(new BrakeTrajectory<DynamicDOFs>(
+		_input, prototype._otg->getDeltaTime()));
+
+	reInitialize(initial_position);
+	if (prototype._async_calculator) {
+		enableAsynchronousRecalculation(
+			true, &prototype._async_calculator->getExecutor());
+	}
+}
+
 void OTG_joints::reInitialize(const VectorXd& initial_position) {
 	if (initial_position.size() != _dim) {
 		throw std::invalid_argument(
@@ -32,12 +53,20 @@ void OTG_joints::reInitialize(const VectorXd& initial_position) {
 			"OTG_joints object in OTG_joints::reInitialize\n");
 	}
 
+	_brake->release();
 	setGoalPosition(initial_position);
 
 	_output.new_position = initial_position;
 	_output.new_velocity.setZero();
 	_output.new_acceleration.setZero();
 	_output.pass_to_input(_input);
+	if (_async_calculator) {
+		_async_calculator->reset(_input.current_position,
+								 _input.current_velocity,
+								 _input.current_acceleration);
+	}
+	_brake->precompute(_input, _output.new_position, _output.new_velocity,
+					   _output.new_acceleration);
 }
 
 void OTG_joints::setMaxVelocity(const VectorXd& max_velocity) {
@@ -104,6 +133,14 @@ void OTG_joints::setGoalPositionAndVelocity(const VectorXd& goal_position,
 			"OTG_joints::setGoalPositionAndVelocity\n");
 	}
 
+	if (isBraking()) {
+		return;
+	}
+	if (getVelocityStreamingEnabled()) {
+		setGoalVelocity(goal_velocity);
+		return;
+	}
+
 	if (goal_position.isApprox(_input.target_position) &&
 		goal_velocity.isApprox(_input.target_velocity)) {
 		return;
@@ -114,13 +151,164 @@ void OTG_joints::setGoalPositionAndVelocity(const VectorXd& goal_position,
 	_input.target_velocity = goal_velocity;
 }
 
+void OTG_joints::setGoalVelocity(const VectorXd& goal_velocity) {
+	if (goal_velocity.size() != _dim) {
+		throw std::invalid_argument(
+			"goal velocity size does not match the dimension of the "
+			"OTG_joints object in OTG_joints::setGoalVelocity\n");
+	}
+	if (isBraking()) {
+		return;
+	}
+
+	// the velocity interface ignores the velocity limits, so the goal is
+	// scaled to respect them
+	VectorXd bounded_goal_velocity = goal_velocity;
+	const double velocity_ratio =
+		goal_velocity.cwiseAbs().cwiseQuotient(_input.max_velocity).maxCoeff();
+	if (velocity_ratio > 1.0) {
+		bounded_goal_velocity /= velocity_ratio;
+	}
+
+	if (bounded_goal_velocity.isApprox(_input.target_velocity)) {
+		return;
+	}
+
+	_goal_reached = false;
+	_input.target_velocity = bounded_goal_velocity;
+}
+
+void OTG_joints::enableVelocityStreaming(const bool enable_velocity_streaming) {
+	if (enable_velocity_streaming == getVelocityStreamingEnabled()) {
+		return;
+	}
+	_goal_reached = false;
+	if (enable_velocity_streaming) {
+		_input.control_interface = ControlInterface::Velocity;
+	} else {
+		_input.control_interface = ControlInterface::Position;
+		_input.target_position = _input.current_position;
+		_input.target_velocity.setZero();
+	}
+	if (_async_calculator) {
+		_async_calculator->reset(_input.current_position,
+								 _input.current_velocity,
+								 _input.current_acceleration);
+	}
+}
+
+void OTG_joints::enableAsynchronousRecalculation(
+	const bool enable_asynchronous_recalculation,
+	BackgroundExecutor* executor) {
+	if (!enable_asynchronous_recalculation) {
+		_async_calculator.reset();
+		return;
+	}
+	_async_calculator.reset(new AsyncTrajectoryCalculator<DynamicDOFs>(
+		_input, _otg->getDeltaTime(),
+		executor ? *executor : BackgroundExecutor::instance()));
+	_async_calculator->setMaxHandoverLatency(_max_handover_latency);
+}
+
+void OTG_joints::setMaxHandoverLatency(const double max_handover_latency) {
+	if (max_handover_latency <= 0) {
+		throw std::invalid_argument(
+			"max handover latency should be strictly positive in "
+			"OTG_joints::setMaxHandoverLatency\n");
+	}
+	_max_handover_latency = max_handover_latency;
+	if (_async_calculator) {
+		_async_calculator->setMaxHandoverLatency(_max_handover_latency);
+	}
+}
+
+void OTG_joints::brake() {
+	if (isBraking()) {
+		return;
+	}
+	_brake->start();
+	SAI2_TRACE_INSTANT("brake", "OTG_joints");
+}
+
+void OTG_joints::releaseBrake() {
+	if (!isBraking()) {
+		return;
+	}
+	_brake->release();
+	_output.pass_to_input(_input);
+	_input.target_position = _input.current_position;
+	_input.target_velocity.setZero();
+	_goal_reached = false;
+	if (_async_calculator) {
+		_async_calculator->reset(_input.current_position,
+								 _input.current_velocity,
+								 _input.current_acceleration);
+	}
+}
+
+void OTG_joints::precomputeBrakeTrajectory(const VectorXd& position,
+										   const VectorXd& velocity) {
+	if (position.size() != _dim || velocity.size() != _dim) {
+		throw std::invalid_argument(
+			"position or velocity size does not match the dimension of the "
+			"OTG_joints object in OTG_joints::precomputeBrakeTrajectory\n");
+	}
+	_brake->precompute(_input, position, velocity);
+}
+
 void OTG_joints::update() {
+	if (isBraking()) {
+		_goal_reached =
+			_brake->update(_output.new_position, _output.new_velocity,
+						   _output.new_acceleration);
+		return;
+	}
 	if (_goal_reached) {
 		return;
 	}
+	updateTrajectory();
+	_brake->precompute(_input, _output.new_position, _output.new_velocity,
+					   _output.new_acceleration);
+}
+
+void OTG_joints::updateTrajectory() {
+	SAI2_TRACE_SCOPE("update", "OTG_joints");
 	// compute next state and get result value
 	OutputParameter<DynamicDOFs, EigenVector> previous_output = _output;
-	_result_value = _otg->update(_input, _output);
+	if (_async_calculator && !getVelocityStreamingEnabled()) {
+		// the calculation is requested from the background executor, and the
+		// output keeps following the previous trajectory until the handover
+		if (!_async_calculator->isRequestPending() &&
+			_async_calculator->needsRequest(_input)) {
+			_async_calculator->requestTrajectory(_input);
+			SAI2_TRACE_INSTANT("trajectory recalculation request",
+							   "OTG_joints");
+		}
+		_result_value = _async_calculator->update(_output.new_position,
+												  _output.new_velocity,
+												  _output.new_acceleration);
+		if (_async_calculator->didHandover()) {
+			SAI2_TRACE_INSTANT("trajectory handover", "OTG_joints");
+		}
+	} else {
+		_result_value = _otg->update(_input, _output);
+		if (_output.new_calculation) {
+			SAI2_TRACE_INSTANT("trajectory recalculation", "OTG_joints");
+		}
+	}
+
+	// in velocity streaming mode, the trajectory keeps being integrated at the
+	// goal velocity once it is reached, and the goal is reached only when the
+	// robot stops
+	if (getVelocityStreamingEnabled() && (_result_value == Result::Finished ||
+										  _result_value == Result::Working)) {
+		_output.pass_to_input(_input);
+		if (_result_value == Result::Finished &&
+			_output.new_velocity.norm() < 1e-3) {
+			_goal_reached = true;
+		}
+		return;
+	}
 
 	// if the goal is reached, either return if the current velocity is
 	// zero, or set a new goal to the current position with zero velocity
@@ -128,7 +316,7 @@ void OTG_joints::update() {
 		if (_output.new_velocity.norm() < 1e-3) {
 			_goal_reached = true;
 		} else {
-			setGoalPosition(_goal_position_eigen);
+			setGoalPosition(_input.target_position);
 		}
 		return;
 	}
@@ -147,6 +335,11 @@ void OTG_joints::update() {
 			  << _result_value << "\n";
 	_input.current_velocity.setZero();
 	_input.current_acceleration.setZero();
+	if (_async_calculator) {
+		_async_calculator->reset(_input.current_position,
+								 _input.current_velocity,
+								 _input.current_acceleration);
+	}
 }
 
 } /* namespace Sai2Primitives */
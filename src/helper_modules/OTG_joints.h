@@ -13,6 +13,11 @@
 #include <Eigen/Dense>
 #include <ruckig/ruckig.hpp>
 
+#include "AsyncTrajectoryCalculator.h"
+#include "BrakeTrajectory.h"
+#include "SharedRuckig.h"
+#include "TraceRecorder.h"
+
 #include <memory>
 
 using namespace Eigen;
@@ -35,6 +40,17 @@ public:
 	/**
 	 * @brief      destructor
 	 */
+	/**
+	 * @brief      Constructs an OTG with the same limits and settings as a
+	 * prototype (jerk limits, velocity streaming, asynchronous recalculation
+	 * on the same executor), at rest at the given position. Used to clone
+	 * tasks.
+	 *
+	 * @param[in]  prototype         The OTG to copy the settings from
+	 * @param[in]  initial_position  The initial position
+	 */
+	OTG_joints(const OTG_joints& prototype, const VectorXd& initial_position);
+
 	~OTG_joints() = default;
 
 	/**
@@ -127,6 +143,117 @@ public:
 		setGoalPositionAndVelocity(goal_position, VectorXd::Zero(_dim));
 	}
 
+	/**
+	 * @brief      Sets the goal velocity in velocity streaming mode. The goal
+	 * velocity is scaled down (keeping its direction) if it exceeds the
+	 * maximum velocity.
+	 *
+	 * @param[in]  goal_velocity  The goal velocity
+	 */
+	void setGoalVelocity(const VectorXd& goal_velocity);
+
+	/**
+	 * @brief      Enables or disables the velocity streaming mode. In this
+	 * mode, Ruckig's velocity interface is used: only the goal velocity is
+	 * tracked (the goal position is ignored) and the position is obtained by
+	 * integration, which is much cheaper to compute when the goal changes at
+	 * every cycle (jogging, teleoperation). The mode can be switched at any
+	 * time and the trajectory continues from the current state. When going
+	 * back to the position mode, the goal is set to stop at the current
+	 * position until a new goal position is given.
+	 *
+	 * @param[in]  enable_velocity_streaming  true to use the velocity interface
+	 */
+	void enableVelocityStreaming(const bool enable_velocity_streaming = true);
+
+	bool getVelocityStreamingEnabled() const {
+		return _input.control_interface == ControlInterface::Velocity;
+	}
+
+	/**
+	 * @brief      Enables or disables the asynchronous recalculation mode. In
+	 * this mode, the trajectory calculation triggered by a new goal or new
+	 * limits runs on a background executor instead of inside update(). The
+	 * output keeps following the previous trajectory (or a Ruckig brake
+	 * trajectory if the current state exceeds the new limits) and switches to
+	 * the new trajectory after the max handover latency, from the state
+	 * predicted at that time. If the calculation is not done by then, update()
+	 * does not wait for it: the output keeps following the previous trajectory
+	 * and switches at the first cycle where the calculation is done, to the
+	 * state of the new trajectory at the time elapsed since the planned
+	 * handover (see getHandoverDelay). The velocity streaming mode always
+	 * calculates inside update().
+	 *
+	 * @param[in]  enable_asynchronous_recalculation  true to enable the mode
+	 * @param[in]  executor  The executor running the calculations, or nullptr
+	 *                       for the shared one
+	 */
+	void enableAsynchronousRecalculation(
+		const bool enable_asynchronous_recalculation = true,
+		BackgroundExecutor* executor = nullptr);
+
+	bool getAsynchronousRecalculationEnabled() const {
+		return _async_calculator != nullptr;
+	}
+
+	/**
+	 * @brief      Sets the delay between a goal change and the switch to the
+	 * new trajectory in asynchronous recalculation mode, rounded to a whole
+	 * number of control loops. Defaults to 2 ms.
+	 *
+	 * @param[in]  max_handover_latency  The max handover latency (s)
+	 */
+	void setMaxHandoverLatency(const double max_handover_latency);
+
+	double getMaxHandoverLatency() const { return _max_handover_latency; }
+
+	/**
+	 * @brief      Total time (s) by which handovers were delayed because their
+	 * calculation was not done in time in asynchronous recalculation mode, and
+	 * number of such late handovers
+	 */
+	double getHandoverDelay() const {
+		return _async_calculator ? _async_calculator->getHandoverDelay() : 0;
+	}
+	unsigned long getNumLateHandovers() const {
+		return _async_calculator ? _async_calculator->getNumLateHandovers() : 0;
+	}
+
+	/**
+	 * @brief      Switches to the brake trajectory precomputed at the last
+	 * update, which brings the trajectory to rest with the current limits. The
+	 * next calls to update() play it without any new calculation, and the
+	 * goals are ignored until releaseBrake() is called.
+	 */
+	void brake();
+
+	/**
+	 * @brief      Leaves the brake trajectory. The goal is set to the current
+	 * position with zero velocity (or to zero velocity in velocity streaming
+	 * mode), and new goals are followed again from the current state.
+	 */
+	void releaseBrake();
+
+	bool isBraking() const { return _brake->isActive(); }
+
+	/**
+	 * @brief      Precomputes the brake trajectory from a given state instead
+	 * of the output of the trajectory generator. Used by the tasks that do
+	 * not follow the output of the trajectory generator, so that they can
+	 * brake with its limits too.
+	 *
+	 * @param[in]  position  The position to brake from
+	 * @param[in]  velocity  The velocity to brake from
+	 */
+	void precomputeBrakeTrajectory(const VectorXd& position,
+								   const VectorXd& velocity);
+
+	/**
+	 * @brief      Duration (s) of the brake trajectory precomputed at the last
+	 * update
+	 */
+	double getBrakeDuration() const { return _brake->getDuration(); }
+
 	/**
 	 * @brief      Runs the trajectory generation to compute the next desired
 	 * state. Should be called once per control loop
@@ -164,6 +291,9 @@ public:
 	bool isGoalReached() const { return _goal_reached; }
 
 private:
+	// steps the trajectory towards the goal
+	void updateTrajectory();
+
 	int _dim;
 
 	bool _goal_reached = false;
@@ -172,9 +302,15 @@ private:
 	VectorXd _goal_position_eigen;
 	VectorXd _goal_velocity_eigen;
 
-	std::unique_ptr<Ruckig<DynamicDOFs, EigenVector>> _otg;
+	std::unique_ptr<SharedRuckig<DynamicDOFs>> _otg;
 	InputParameter<DynamicDOFs, EigenVector> _input {0};
 	OutputParameter<DynamicDOFs, EigenVector> _output {0};
+
+	double _max_handover_latency = 0.002;
+	std::unique_ptr<AsyncTrajectoryCalculator<DynamicDOFs>> _async_calculator;
+
+	// trajectory to rest from the last output, played on emergency stops
+	std::unique_ptr<BrakeTrajectory<DynamicDOFs>> _brake;
 };
 
 } /* namespace Sai2Primitives */
@@ -23,6 +23,7 @@ public:
     void reInitialize();
     void enable();
     void disable();
+    bool isEnabled() const { return _is_enabled; }
 
 	Vector3d computePassivitySaturatedForce(
 		const Vector3d& fd, const Vector3d& fs,
@@ -0,0 +1,143 @@
+/**
+ * SharedRuckig.h
+ *
+ *	Drop in replacement of the Ruckig update function for the OTG wrappers,
+ * where the Ruckig calculator is shared by all the trajectory generators of a
+ * thread. A Ruckig instance holds about 12 kB of scratch space used only
+ * while a new trajectory is calculated, so each OTG only keeps the input of
+ * its last calculation (to detect when a new one is needed), and borrows the
+ * calculator of the thread it runs on. This keeps the memory of large fleets
+ * of controllers proportional to their actual state.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_SHARED_RUCKIG_H
+#define SAI2_PRIMITIVES_SHARED_RUCKIG_H
+
+#include <memory>
+#include <ruckig/ruckig.hpp>
+#include <vector>
+
+namespace Sai2Primitives {
+
+template <size_t DOFs>
+class SharedRuckig {
+public:
+	typedef ruckig::Ruckig<DOFs, ruckig::EigenVector> Calculator;
+	typedef ruckig::InputParameter<DOFs, ruckig::EigenVector> Input;
+	typedef ruckig::OutputParameter<DOFs, ruckig::EigenVector> Output;
+	typedef ruckig::Trajectory<DOFs, ruckig::EigenVector> Trajectory;
+
+	/**
+	 * @brief      Constructor
+	 *
+	 * @param[in]  dofs        The number of degrees of freedom
+	 * @param[in]  delta_time  The duration of a control loop
+	 */
+	SharedRuckig(const size_t dofs, const double delta_time)
+		: _dofs(dofs),
+		  _delta_time(delta_time),
+		  _current_input(makeInput(dofs)),
+		  _current_input_initialized(false) {}
+
+	double getDeltaTime() const { return _delta_time; }
+
+	/**
+	 * @brief      Forces a new calculation at the next update
+	 */
+	void reset() { _current_input_initialized = false; }
+
+	/**
+	 * @brief      Calculates a trajectory with the calculator of the calling
+	 * thread (same as Ruckig::calculate)
+	 */
+	ruckig::Result calculate(const Input& input, Trajectory& trajectory) {
+		bool was_interrupted = false;
+		return calculate(input, trajectory, was_interrupted);
+	}
+	ruckig::Result calculate(const Input& input, Trajectory& trajectory,
+							 bool& was_interrupted) {
+		Calculator& calculator = threadCalculator(_dofs);
+		calculator.delta_time = _delta_time;
+		return calculator.calculate(input, trajectory, was_interrupted);
+	}
+
+	/**
+	 * @brief      Steps the output along the trajectory, calculating a new
+	 * one if the input changed (same as Ruckig::update)
+	 */
+	ruckig::Result update(const Input& input, Output& output) {
+		output.new_calculation = false;
+
+		ruckig::Result result = ruckig::Result::Working;
+		if (input != _current_input || !_current_input_initialized) {
+			result = calculate(input, output.trajectory,
+							   output.was_calculation_interrupted);
+			if (result != ruckig::Result::Working &&
+				result != ruckig::Result::ErrorPositionalLimits) {
+				return result;
+			}
+
+			_current_input = input;
+			_current_input_initialized = true;
+			output.time = 0.0;
+			output.new_calculation = true;
+		}
+
+		const size_t old_section = output.new_section;
+		output.time += _delta_time;
+		output.trajectory.at_time(output.time, output.new_position,
+								  output.new_velocity, output.new_acceleration,
+								  output.new_jerk, output.new_section);
+		output.did_section_change = (output.new_section > old_section);
+
+		output.pass_to_input(_current_input);
+
+		if (output.time > output.trajectory.get_duration()) {
+			return ruckig::Result::Finished;
+		}
+		return result;
+	}
+
+	/**
+	 * @brief      The calculator shared by the trajectory generators of the
+	 * calling thread, created at the first calculation of the thread
+	 */
+	static Calculator& threadCalculator(const size_t dofs) {
+		if constexpr (DOFs == 0) {
+			thread_local std::vector<std::unique_ptr<Calculator>> calculators;
+			if (calculators.size() <= dofs) {
+				calculators.resize(dofs + 1);
+			}
+			if (!calculators[dofs]) {
+				calculators[dofs].reset(new Calculator(dofs, 0.001));
+			}
+			return *calculators[dofs];
+		} else {
+			thread_local std::unique_ptr<Calculator> calculator(
+				new Calculator(0.001));
+			return *calculator;
+		}
+	}
+
+private:
+	static Input makeInput(const size_t dofs) {
+		if constexpr (DOFs == 0) {
+			return Input(dofs);
+		} else {
+			return Input();
+		}
+	}
+
+	size_t _dofs;
+	double _delta_time;
+
+	// input of the last calculation, to detect when a new one is needed
+	Input _current_input;
+	bool _current_input_initialized;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_SHARED_RUCKIG_H
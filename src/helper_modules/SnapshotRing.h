@@ -0,0 +1,195 @@
+/**
+ * SnapshotRing.h
+ *
+ *	Single producer single consumer ring of preallocated snapshots, used to
+ * hand the per cycle state of the control thread to a consumer running on a
+ * BackgroundExecutor (telemetry writer, shadow mode replay...). The control
+ * thread fills a free snapshot and commits it, which schedules a drain job on
+ * the executor if none is pending. The drain job consumes all the committed
+ * snapshots in order. When the consumer falls behind and the ring is full, the
+ * cycle is dropped and counted instead of blocking the control thread.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_SNAPSHOT_RING_H
+#define SAI2_PRIMITIVES_SNAPSHOT_RING_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "BackgroundExecutor.h"
+
+namespace Sai2Primitives {
+
+/**
+ * @brief      Ring of snapshots written by the control thread and drained on
+ * a BackgroundExecutor
+ *
+ * @tparam     Snapshot  type of the snapshots. The snapshots are copies of the
+ *                       prototype given to allocate, so dynamic Eigen members
+ *                       keep their size and are never reallocated.
+ */
+template <typename Snapshot>
+class SnapshotRing {
+public:
+	/**
+	 * @brief      Creates an empty ring, allocate needs to be called before
+	 * the first write
+	 *
+	 * @param[in]  executor   The executor where the snapshots are drained
+	 * @param[in]  consume    Called on each snapshot, in order, from the
+	 *                        drain job
+	 * @param[in]  on_drained Called (if set) each time the drain job has
+	 *                        consumed all the committed snapshots
+	 */
+	SnapshotRing(BackgroundExecutor& executor,
+				 std::function<void(const Snapshot&)> consume,
+				 std::function<void()> on_drained = nullptr)
+		: _executor(executor),
+		  _consume(consume),
+		  _on_drained(on_drained),
+		  _num_written(0),
+		  _num_drained(0),
+		  _drain_scheduled(false),
+		  _drain_running(false),
+		  _num_captured_cycles(0),
+		  _num_dropped_cycles(0) {}
+
+	/**
+	 * @brief      Waits for the pending drain
+	 */
+	~SnapshotRing() { waitForDrain(); }
+
+	SnapshotRing(const SnapshotRing&) = delete;
+	SnapshotRing& operator=(const SnapshotRing&) = delete;
+
+	/**
+	 * @brief      Allocates all the snapshots. Not to be called while the ring
+	 * is in use.
+	 *
+	 * @param[in]  capacity     The number of cycles that can wait to be
+	 *                          drained before cycles are dropped
+	 * @param[in]  prototype    The initial value of all the snapshots
+	 * @param[in]  loop_timestep  The control period, the drain job is given
+	 *                          the time needed by the control thread to fill
+	 *                          the ring as a deadline
+	 */
+	void allocate(const int capacity, const Snapshot& prototype,
+				  const double loop_timestep) {
+		if (capacity <= 0) {
+			throw std::invalid_argument(
+				"snapshot capacity should be strictly positive in "
+				"SnapshotRing::allocate\n");
+		}
+		_snapshots.assign(capacity, prototype);
+		_time_budget = std::chrono::duration_cast<
+			BackgroundExecutor::Clock::duration>(
+			std::chrono::duration<double>(capacity * loop_timestep));
+	}
+
+	/**
+	 * @brief      Control thread side. Counts a captured cycle and returns the
+	 * snapshot to fill, or nullptr if the ring is full (the cycle is then
+	 * counted as dropped). Does not allocate and does not block.
+	 */
+	Snapshot* beginWrite() {
+		_num_captured_cycles++;
+		const unsigned long num_written =
+			_num_written.load(std::memory_order_relaxed);
+		if (num_written - _num_drained.load(std::memory_order_acquire) >=
+			_snapshots.size()) {
+			// the drain fell behind
+			_num_dropped_cycles++;
+			return nullptr;
+		}
+		return &_snapshots[num_written % _snapshots.size()];
+	}
+
+	/**
+	 * @brief      Control thread side. Makes the snapshot returned by the last
+	 * beginWrite available to the drain and schedules the drain if needed
+	 */
+	void commitWrite() {
+		_num_written.store(_num_written.load(std::memory_order_relaxed) + 1,
+						   std::memory_order_release);
+		if (!_drain_scheduled.exchange(true)) {
+			if (!_executor.submit([this]() { drain(); }, _time_budget,
+								  BackgroundExecutor::RUN_LATE_JOB)) {
+				// executor queue full, retried at the next cycle
+				_drain_scheduled = false;
+			}
+		}
+	}
+
+	/**
+	 * @brief      Consumes all the committed snapshots. Runs in the drain job,
+	 * and can be called by the owner when no drain is pending (for instance
+	 * to drain the snapshots left by an executor that refused the last job).
+	 */
+	void drain() {
+		_drain_running = true;
+		while (true) {
+			unsigned long num_drained =
+				_num_drained.load(std::memory_order_relaxed);
+			while (num_drained != _num_written.load(std::memory_order_acquire)) {
+				_consume(_snapshots[num_drained % _snapshots.size()]);
+				num_drained++;
+				_num_drained.store(num_drained, std::memory_order_release);
+			}
+			if (_on_drained) {
+				_on_drained();
+			}
+
+			// a snapshot written after the last check would otherwise wait for
+			// the next commit to be drained
+			_drain_scheduled = false;
+			if (num_drained == _num_written.load() ||
+				_drain_scheduled.exchange(true)) {
+				break;
+			}
+		}
+		_drain_running = false;
+	}
+
+	/**
+	 * @brief      Blocks until the committed snapshots are drained. Not to be
+	 * called from the control thread.
+	 */
+	void waitForDrain() const {
+		while (_drain_scheduled || _drain_running) {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+
+	unsigned long getNumCapturedCycles() const { return _num_captured_cycles; }
+	unsigned long getNumDroppedCycles() const { return _num_dropped_cycles; }
+
+	void resetCycleCounters() {
+		_num_captured_cycles = 0;
+		_num_dropped_cycles = 0;
+	}
+
+private:
+	BackgroundExecutor& _executor;
+	BackgroundExecutor::Clock::duration _time_budget;
+	std::function<void(const Snapshot&)> _consume;
+	std::function<void()> _on_drained;
+
+	std::vector<Snapshot> _snapshots;
+	std::atomic<unsigned long> _num_written;
+	std::atomic<unsigned long> _num_drained;
+	std::atomic<bool> _drain_scheduled;
+	std::atomic<bool> _drain_running;
+
+	std::atomic<unsigned long> _num_captured_cycles;
+	std::atomic<unsigned long> _num_dropped_cycles;
+};
+
+}  // namespace Sai2Primitives
+
+#endif	// SAI2_PRIMITIVES_SNAPSHOT_RING_H
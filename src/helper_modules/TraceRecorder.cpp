@@ -0,0 +1,230 @@
+#include "TraceRecorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <unordered_set>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SAI2_TRACE_USE_TSC
+#endif
+
+namespace Sai2Primitives {
+
+namespace {
+const size_t DEFAULT_BUFFER_CAPACITY = 1 << 16;
+
+size_t roundUpToPowerOfTwo(const size_t value) {
+	size_t result = 1;
+	while (result < value) {
+		result <<= 1;
+	}
+	return result;
+}
+
+void writeJsonString(std::ofstream& file, const char* str) {
+	file << '"';
+	for (const char* c = str; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			file << '\\';
+		}
+		file << *c;
+	}
+	file << '"';
+}
+}  // namespace
+
+TraceRecorder& TraceRecorder::instance() {
+	static TraceRecorder recorder;
+	return recorder;
+}
+
+TraceRecorder::TraceRecorder()
+	: _enabled(false),
+	  _buffer_capacity(DEFAULT_BUFFER_CAPACITY),
+	  _start_timestamp(timestamp()),
+	  _start_time(steadyClockNanoseconds()),
+	  _next_thread_id(0) {}
+
+int64_t TraceRecorder::timestamp() {
+#ifdef SAI2_TRACE_USE_TSC
+	return __rdtsc();
+#else
+	return steadyClockNanoseconds();
+#endif
+}
+
+int64_t TraceRecorder::steadyClockNanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+TraceRecorder::ThreadBufferHandle::~ThreadBufferHandle() {
+	if (buffer != nullptr) {
+		TraceRecorder::instance().releaseThreadBuffer(buffer);
+	}
+}
+
+TraceRecorder::ThreadBuffer& TraceRecorder::threadBuffer() {
+	thread_local ThreadBufferHandle handle;
+	if (handle.buffer == nullptr) {
+		handle.buffer = acquireThreadBuffer();
+	}
+	return *handle.buffer;
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::acquireThreadBuffer() {
+	const size_t capacity = _buffer_capacity.load(std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lock(_buffers_mutex);
+	if (_free_buffers.empty()) {
+		_buffers.push_back(
+			std::make_shared<ThreadBuffer>(capacity, _next_thread_id++));
+		return _buffers.back().get();
+	}
+	// reuse the buffer of an exited thread, its events are discarded
+	ThreadBuffer* buffer = _free_buffers.back();
+	_free_buffers.pop_back();
+	if (buffer->events.size() != capacity) {
+		buffer->events.assign(capacity, TraceEvent());
+	}
+	buffer->write_index.store(0, std::memory_order_release);
+	buffer->thread_id = _next_thread_id++;
+	buffer->thread_name.clear();
+	return buffer;
+}
+
+void TraceRecorder::releaseThreadBuffer(ThreadBuffer* buffer) {
+	std::lock_guard<std::mutex> lock(_buffers_mutex);
+	_free_buffers.push_back(buffer);
+}
+
+void TraceRecorder::registerThread() { threadBuffer(); }
+
+void TraceRecorder::record(const char* name, const char* category,
+						   const TraceEventPhase phase) {
+	ThreadBuffer& buffer = threadBuffer();
+	const uint64_t index = buffer.write_index.load(std::memory_order_relaxed);
+	TraceEvent& event = buffer.events[index & (buffer.events.size() - 1)];
+	event.name = name;
+	event.category = category;
+	event.timestamp = timestamp();
+	event.phase = phase;
+	buffer.write_index.store(index + 1, std::memory_order_release);
+}
+
+void TraceRecorder::setBufferCapacity(const size_t capacity) {
+	if (capacity == 0) {
+		throw std::invalid_argument(
+			"buffer capacity should be strictly positive in "
+			"TraceRecorder::setBufferCapacity\n");
+	}
+	_buffer_capacity.store(roundUpToPowerOfTwo(capacity),
+						   std::memory_order_relaxed);
+}
+
+void TraceRecorder::setThreadName(const std::string& thread_name) {
+	ThreadBuffer& buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(_buffers_mutex);
+	buffer.thread_name = thread_name;
+}
+
+const char* TraceRecorder::internName(const std::string& name) {
+	static std::mutex names_mutex;
+	static std::unordered_set<std::string> names;
+	std::lock_guard<std::mutex> lock(names_mutex);
+	return names.insert(name).first->c_str();
+}
+
+bool TraceRecorder::exportChromeTrace(const std::string& filename) const {
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		return false;
+	}
+	file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	bool first_event = true;
+	auto separator = [&]() {
+		if (!first_event) {
+			file << ",\n";
+		}
+		first_event = false;
+	};
+
+	// conversion of the raw timestamps to nanoseconds since the creation of
+	// the recorder
+	double nanoseconds_per_tick = 1.0;
+#ifdef SAI2_TRACE_USE_TSC
+	const int64_t export_timestamp = timestamp();
+	const int64_t export_time = steadyClockNanoseconds();
+	if (export_timestamp > _start_timestamp) {
+		nanoseconds_per_tick = (double)(export_time - _start_time) /
+							   (export_timestamp - _start_timestamp);
+	}
+#endif
+
+	std::lock_guard<std::mutex> lock(_buffers_mutex);
+	std::vector<TraceEvent> events;
+	for (const auto& buffer : _buffers) {
+		if (!buffer->thread_name.empty()) {
+			separator();
+			file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+					"\"tid\":"
+				 << buffer->thread_id << ",\"args\":{\"name\":";
+			writeJsonString(file, buffer->thread_name.c_str());
+			file << "}}";
+		}
+
+		// copy the events, then discard the ones the owning thread may have
+		// overwritten during the copy
+		const uint64_t capacity = buffer->events.size();
+		const uint64_t end =
+			buffer->write_index.load(std::memory_order_acquire);
+		const uint64_t begin = end > capacity ? end - capacity : 0;
+		events.clear();
+		for (uint64_t i = begin; i < end; i++) {
+			events.push_back(buffer->events[i & (capacity - 1)]);
+		}
+		const uint64_t end_after_copy =
+			buffer->write_index.load(std::memory_order_acquire);
+		const uint64_t first_valid =
+			end_after_copy >= capacity ? end_after_copy - capacity + 1 : 0;
+		const size_t skipped =
+			first_valid > begin ? std::min<uint64_t>(first_valid - begin,
+													 events.size())
+								: 0;
+
+		for (size_t i = skipped; i < events.size(); i++) {
+			const TraceEvent& event = events[i];
+			separator();
+			file << "{\"name\":";
+			writeJsonString(file, event.name);
+			file << ",\"cat\":";
+			writeJsonString(file, event.category);
+			const int64_t time = std::max<int64_t>(
+				0, std::llround((event.timestamp - _start_timestamp) *
+								nanoseconds_per_tick));
+			file << ",\"ph\":\"" << (char)event.phase << "\",\"ts\":"
+				 << time / 1000 << "." << std::setfill('0') << std::setw(3)
+				 << time % 1000 << ",\"pid\":1,\"tid\":" << buffer->thread_id;
+			if (event.phase == TRACE_INSTANT) {
+				file << ",\"s\":\"t\"";
+			}
+			file << "}";
+		}
+	}
+	file << "]}\n";
+	return file.good();
+}
+
+void TraceRecorder::clear() {
+	std::lock_guard<std::mutex> lock(_buffers_mutex);
+	for (auto& buffer : _buffers) {
+		buffer->write_index.store(0, std::memory_order_release);
+	}
+}
+
+}  // namespace Sai2Primitives
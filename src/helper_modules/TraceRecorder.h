@@ -0,0 +1,217 @@
+/**
+ * TraceRecorder.h
+ *
+ *	Lightweight in-process recorder of the timeline of the controller stages
+ * (robot controller, tasks, singularity handler, OTG, haptic controller).
+ * Begin/end events are written in per-thread lock-free ring buffers, and the
+ * recorded timeline can be exported on demand as a Chrome trace event JSON
+ * file, which can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing.
+ * Recording is disabled by default, and costs a single relaxed atomic load per
+ * stage when disabled. Defining SAI2_PRIMITIVES_DISABLE_TRACING at compile time
+ * removes the instrumentation entirely.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_TRACE_RECORDER_H
+#define SAI2_PRIMITIVES_TRACE_RECORDER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Sai2Primitives {
+
+enum TraceEventPhase : char {
+	TRACE_BEGIN = 'B',
+	TRACE_END = 'E',
+	TRACE_INSTANT = 'i',
+};
+
+/**
+ * @brief      A trace event. The name and category must point to strings that
+ * outlive the recorder (string literals or names interned with
+ * TraceRecorder::internName), so that recording never allocates.
+ */
+struct TraceEvent {
+	const char* name;
+	const char* category;
+	// raw timestamp (cpu time stamp counter ticks on x86, nanoseconds
+	// otherwise), converted to time at export
+	int64_t timestamp;
+	TraceEventPhase phase;
+};
+
+class TraceRecorder {
+public:
+	/**
+	 * @brief      Gets the process wide recorder used by the library
+	 * instrumentation
+	 */
+	static TraceRecorder& instance();
+
+	~TraceRecorder() = default;
+
+	// disallow copy and asssign constructors
+	TraceRecorder(TraceRecorder const&) = delete;
+	TraceRecorder& operator=(TraceRecorder const&) = delete;
+
+	void enable() { _enabled.store(true, std::memory_order_relaxed); }
+	void disable() { _enabled.store(false, std::memory_order_relaxed); }
+	bool isEnabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief      Records an event in the ring buffer of the calling thread.
+	 * The buffer of a thread is acquired at its registration (or at its first
+	 * event if it was not registered), and the oldest events are overwritten
+	 * when it is full.
+	 */
+	void record(const char* name, const char* category,
+				const TraceEventPhase phase);
+
+	/**
+	 * @brief      Sets the capacity (in events, rounded up to a power of 2) of
+	 * the buffers acquired after the call (see registerThread). Defaults to
+	 * 65536 events (2 MB) per thread.
+	 */
+	void setBufferCapacity(const size_t capacity);
+
+	/**
+	 * @brief      Acquires the buffer of the calling thread, so that its first
+	 * event does not lock or allocate. To be called by the control thread
+	 * before the control loop. When a thread exits, its buffer is kept for the
+	 * export and reused by the next thread that acquires one (the events of
+	 * the exited thread are then discarded), so the memory is bounded by the
+	 * number of threads recording at the same time.
+	 */
+	void registerThread();
+
+	/**
+	 * @brief      Names the calling thread in the exported trace (registers
+	 * the thread)
+	 */
+	void setThreadName(const std::string& thread_name);
+
+	/**
+	 * @brief      Returns a pointer to a copy of the name that lives as long as
+	 * the program, to use dynamic names (task names for instance) in events.
+	 * Allocates, so it should be called outside of the control loop.
+	 */
+	static const char* internName(const std::string& name);
+
+	/**
+	 * @brief      Writes the events currently in the buffers of all the
+	 * threads to a Chrome trace event JSON file. Can be called while the other
+	 * threads are recording; events overwritten during the export are skipped.
+	 *
+	 * @param[in]  filename  The output file
+	 *
+	 * @return     false if the file could not be written
+	 */
+	bool exportChromeTrace(const std::string& filename) const;
+
+	/**
+	 * @brief      Discards the recorded events. Must not be called while other
+	 * threads are recording.
+	 */
+	void clear();
+
+private:
+	TraceRecorder();
+
+	struct ThreadBuffer {
+		ThreadBuffer(const size_t capacity, const int thread_id)
+			: events(capacity), write_index(0), thread_id(thread_id) {}
+
+		std::vector<TraceEvent> events;
+		// total number of events written, only modified by the owning thread
+		std::atomic<uint64_t> write_index;
+		int thread_id;
+		std::string thread_name;
+	};
+
+	// owned by a thread_local of each registered thread, returns the buffer to
+	// the free buffers when the thread exits
+	struct ThreadBufferHandle {
+		~ThreadBufferHandle();
+		ThreadBuffer* buffer = nullptr;
+	};
+
+	ThreadBuffer& threadBuffer();
+	ThreadBuffer* acquireThreadBuffer();
+	void releaseThreadBuffer(ThreadBuffer* buffer);
+	// raw timestamp, read in a few nanoseconds
+	static int64_t timestamp();
+	static int64_t steadyClockNanoseconds();
+
+	std::atomic<bool> _enabled;
+	std::atomic<size_t> _buffer_capacity;
+	// raw timestamp and steady clock time at the creation of the recorder, to
+	// calibrate the raw timestamps at export
+	int64_t _start_timestamp;
+	int64_t _start_time;
+
+	mutable std::mutex _buffers_mutex;
+	std::vector<std::shared_ptr<ThreadBuffer>> _buffers;
+	// buffers of the exited threads, to be reused
+	std::vector<ThreadBuffer*> _free_buffers;
+	int _next_thread_id;
+};
+
+/**
+ * @brief      Records a begin event on construction and the matching end event
+ * on destruction if the recorder is enabled
+ */
+class TraceScope {
+public:
+	TraceScope(const char* name, const char* category)
+		: _name(name), _category(category) {
+		TraceRecorder& recorder = TraceRecorder::instance();
+		_active = recorder.isEnabled();
+		if (_active) {
+			recorder.record(_name, _category, TRACE_BEGIN);
+		}
+	}
+	~TraceScope() {
+		if (_active) {
+			TraceRecorder::instance().record(_name, _category, TRACE_END);
+		}
+	}
+
+	TraceScope(TraceScope const&) = delete;
+	TraceScope& operator=(TraceScope const&) = delete;
+
+private:
+	const char* _name;
+	const char* _category;
+	bool _active;
+};
+
+}  // namespace Sai2Primitives
+
+#ifndef SAI2_PRIMITIVES_DISABLE_TRACING
+#define SAI2_TRACE_CONCAT_IMPL(a, b) a##b
+#define SAI2_TRACE_CONCAT(a, b) SAI2_TRACE_CONCAT_IMPL(a, b)
+// traces the enclosing scope
+#define SAI2_TRACE_SCOPE(name, category)                   \
+	Sai2Primitives::TraceScope SAI2_TRACE_CONCAT(          \
+		_sai2_trace_scope_, __LINE__)(name, category)
+// records an instant event
+#define SAI2_TRACE_INSTANT(name, category)                                 \
+	do {                                                                   \
+		if (Sai2Primitives::TraceRecorder::instance().isEnabled()) {       \
+			Sai2Primitives::TraceRecorder::instance().record(              \
+				name, category, Sai2Primitives::TRACE_INSTANT);            \
+		}                                                                  \
+	} while (0)
+#else
+#define SAI2_TRACE_SCOPE(name, category)
+#define SAI2_TRACE_INSTANT(name, category) \
+	do {                                   \
+	} while (0)
+#endif
+
+#endif	// SAI2_PRIMITIVES_TRACE_RECORDER_H
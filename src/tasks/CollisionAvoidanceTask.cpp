@@ -0,0 +1,495 @@
+#include "CollisionAvoidanceTask.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+namespace {
+
+// maximum number of obstacle pairs whose distance query state is kept between
+// cycles
+const int MAX_OBSTACLE_PAIR_STATES = 4096;
+
+// tolerance on the singular values of the projected jacobian of the active
+// pairs, as in Sai2Model::matrixRangeBasis. The gram matrix of the jacobian
+// has the squared singular values
+const double RANGE_TOLERANCE = 1e-6;
+
+std::uint64_t obstaclePairKey(const int proxy_index, const int obstacle_index) {
+	return (static_cast<std::uint64_t>(proxy_index) << 32) |
+		   static_cast<std::uint32_t>(obstacle_index);
+}
+
+}  // namespace
+
+CollisionAvoidanceTask::CollisionAvoidanceTask(
+	std::shared_ptr<Sai2Model::Sai2Model>& robot, const std::string& task_name,
+	const double loop_timestep)
+	: TemplateTask(robot, task_name, TaskType::COLLISION_AVOIDANCE_TASK,
+				   loop_timestep),
+	  _obstacle_hierarchy_needs_rebuild(false),
+	  _obstacle_hierarchy_needs_refit(false),
+	  _activation_distance(DefaultParameters::activation_distance),
+	  _kp(DefaultParameters::kp),
+	  _kv(DefaultParameters::kv),
+	  _max_repulsive_acceleration(
+		  DefaultParameters::max_repulsive_acceleration),
+	  _max_active_pairs(DefaultParameters::max_active_pairs),
+	  _cycle(0),
+	  _proxies_initialized(false),
+	  _minimum_distance(std::numeric_limits<double>::infinity()),
+	  _num_candidate_pairs(0),
+	  _num_distance_queries(0),
+	  _task_rank(0) {
+	const int dof = getConstRobotModel()->dof();
+	_N_prec = MatrixXd::Identity(dof, dof);
+	_N = MatrixXd::Identity(dof, dof);
+	_M_llt = LLT<MatrixXd>(dof);
+	allocateModel();
+}
+
+void CollisionAvoidanceTask::allocateModel() {
+	const int dof = getConstRobotModel()->dof();
+	const int max_pairs = _max_active_pairs;
+	_active_pairs.reserve(max_pairs);
+	_jacobian.setZero(max_pairs, dof);
+	_projected_jacobian.setZero(max_pairs, dof);
+	_gram_matrix.setZero(max_pairs, max_pairs);
+	_gram_matrix_solver = SelfAdjointEigenSolver<MatrixXd>(max_pairs);
+	_range_vectors.setZero(max_pairs, max_pairs);
+	_range_projector.setZero(max_pairs, max_pairs);
+	_weighted_jacobian_transpose.setZero(dof, max_pairs);
+	_Lambda_inverse.setZero(max_pairs, max_pairs);
+	_Lambda_inverse_llt = LLT<MatrixXd>(max_pairs);
+	_Lambda.setZero(max_pairs, max_pairs);
+	_Jbar.setZero(dof, max_pairs);
+	_distance_velocities.setZero(max_pairs);
+	_desired_accelerations.setZero(max_pairs);
+	_task_force.setZero(max_pairs);
+	_active_pairs.clear();
+	_task_rank = 0;
+	_N.setIdentity();
+}
+
+int CollisionAvoidanceTask::addLinkProxy(const std::string& link_name,
+										 const ConvexShape& shape,
+										 const Affine3d& transform_in_link) {
+	const Affine3d pose =
+		getConstRobotModel()->transformInWorld(link_name, transform_in_link);
+	LinkProxy proxy{link_name, shape, transform_in_link, pose,
+					Vector3d::Zero(), Vector3d::Zero(), 0.0};
+	shape.boundingBox(pose, proxy.box_lower, proxy.box_upper);
+	_proxies.push_back(proxy);
+	_proxies_initialized = false;
+	reserveObstaclePairStates();
+	return _proxies.size() - 1;
+}
+
+int CollisionAvoidanceTask::addObstacle(const ConvexShape& shape,
+										const Affine3d& pose_in_world) {
+	_obstacles.push_back(Obstacle{shape, pose_in_world, 0.0});
+	_obstacle_hierarchy_needs_rebuild = true;
+	reserveObstaclePairStates();
+	return _obstacles.size() - 1;
+}
+
+void CollisionAvoidanceTask::setObstaclePose(const int obstacle_index,
+											 const Affine3d& pose_in_world) {
+	if (obstacle_index < 0 || obstacle_index >= _obstacles.size()) {
+		throw std::invalid_argument(
+			"obstacle index out of range in "
+			"CollisionAvoidanceTask::setObstaclePose\n");
+	}
+	Obstacle& obstacle = _obstacles[obstacle_index];
+	// accumulated until the next cycle
+	obstacle.motion_bound +=
+		(pose_in_world.translation() - obstacle.pose.translation()).norm() +
+		rotationMotionBound(obstacle.pose, pose_in_world,
+							obstacle.shape.getBoundingRadius());
+	obstacle.pose = pose_in_world;
+	_obstacle_hierarchy_needs_refit = true;
+}
+
+void CollisionAvoidanceTask::clearObstacles() {
+	_obstacles.clear();
+	_obstacle_pair_states.clear();
+	_previous_obstacle_pair_states.clear();
+	_obstacle_hierarchy_needs_rebuild = true;
+}
+
+void CollisionAvoidanceTask::addSelfCollisionPair(const int proxy_a,
+												  const int proxy_b) {
+	if (proxy_a < 0 || proxy_a >= _proxies.size() || proxy_b < 0 ||
+		proxy_b >= _proxies.size()) {
+		throw std::invalid_argument(
+			"proxy index out of range in "
+			"CollisionAvoidanceTask::addSelfCollisionPair\n");
+	}
+	if (_proxies[proxy_a].link_name == _proxies[proxy_b].link_name) {
+		throw std::invalid_argument(
+			"the two proxies cannot be attached to the same link in "
+			"CollisionAvoidanceTask::addSelfCollisionPair\n");
+	}
+	_self_collision_pairs.push_back(std::make_pair(proxy_a, proxy_b));
+	_self_collision_pair_states.push_back(PairState());
+}
+
+void CollisionAvoidanceTask::setActivationDistance(
+	const double activation_distance) {
+	if (activation_distance <= 0) {
+		throw std::invalid_argument(
+			"activation distance should be strictly positive in "
+			"CollisionAvoidanceTask::setActivationDistance\n");
+	}
+	_activation_distance = activation_distance;
+}
+
+void CollisionAvoidanceTask::setGains(const double kp, const double kv) {
+	if (kp < 0 || kv < 0) {
+		throw std::invalid_argument(
+			"gains should be positive or zero in "
+			"CollisionAvoidanceTask::setGains\n");
+	}
+	_kp = kp;
+	_kv = kv;
+}
+
+void CollisionAvoidanceTask::setMaxRepulsiveAcceleration(
+	const double max_repulsive_acceleration) {
+	if (max_repulsive_acceleration <= 0) {
+		throw std::invalid_argument(
+			"max repulsive acceleration should be strictly positive in "
+			"CollisionAvoidanceTask::setMaxRepulsiveAcceleration\n");
+	}
+	_max_repulsive_acceleration = max_repulsive_acceleration;
+}
+
+void CollisionAvoidanceTask::setMaxActivePairs(const int max_active_pairs) {
+	if (max_active_pairs < 1) {
+		throw std::invalid_argument(
+			"max active pairs should be at least 1 in "
+			"CollisionAvoidanceTask::setMaxActivePairs\n");
+	}
+	_max_active_pairs = max_active_pairs;
+	allocateModel();
+}
+
+double CollisionAvoidanceTask::rotationMotionBound(
+	const Affine3d& previous_pose, const Affine3d& pose,
+	const double bounding_radius) {
+	const double angle =
+		AngleAxisd(previous_pose.linear().transpose() * pose.linear()).angle();
+	return std::abs(angle) * bounding_radius;
+}
+
+void CollisionAvoidanceTask::updateProxies() {
+	for (auto& proxy : _proxies) {
+		const Affine3d pose = getConstRobotModel()->transformInWorld(
+			proxy.link_name, proxy.transform_in_link);
+		if (_proxies_initialized) {
+			proxy.motion_bound =
+				(pose.translation() - proxy.pose.translation()).norm() +
+				rotationMotionBound(proxy.pose, pose,
+									proxy.shape.getBoundingRadius());
+		} else {
+			proxy.motion_bound = std::numeric_limits<double>::infinity();
+		}
+		proxy.pose = pose;
+		proxy.shape.boundingBox(pose, proxy.box_lower, proxy.box_upper);
+	}
+	_proxies_initialized = true;
+}
+
+void CollisionAvoidanceTask::updateObstacleHierarchy() {
+	if (!_obstacle_hierarchy_needs_rebuild &&
+		!_obstacle_hierarchy_needs_refit) {
+		return;
+	}
+	_obstacle_box_lower.resize(3, _obstacles.size());
+	_obstacle_box_upper.resize(3, _obstacles.size());
+	for (int i = 0; i < _obstacles.size(); i++) {
+		Vector3d lower, upper;
+		_obstacles[i].shape.boundingBox(_obstacles[i].pose, lower, upper);
+		_obstacle_box_lower.col(i) = lower;
+		_obstacle_box_upper.col(i) = upper;
+	}
+	if (_obstacle_hierarchy_needs_rebuild) {
+		_obstacle_hierarchy.build(_obstacle_box_lower, _obstacle_box_upper);
+	} else {
+		_obstacle_hierarchy.refit(_obstacle_box_lower, _obstacle_box_upper);
+	}
+	_obstacle_hierarchy_needs_rebuild = false;
+	_obstacle_hierarchy_needs_refit = false;
+}
+
+void CollisionAvoidanceTask::reserveObstaclePairStates() {
+	const size_t capacity =
+		std::min(_proxies.size() * _obstacles.size(),
+				 static_cast<size_t>(MAX_OBSTACLE_PAIR_STATES));
+	_obstacle_pair_states.reserve(capacity);
+	_previous_obstacle_pair_states.reserve(capacity);
+}
+
+void CollisionAvoidanceTask::processPair(const int proxy_index,
+										 const int other_index,
+										 const bool self_collision,
+										 PairState& state) {
+	_num_candidate_pairs++;
+	const LinkProxy& proxy = _proxies[proxy_index];
+	const ConvexShape& other_shape =
+		self_collision ? _proxies[other_index].shape
+					   : _obstacles[other_index].shape;
+	const Affine3d& other_pose = self_collision ? _proxies[other_index].pose
+												: _obstacles[other_index].pose;
+	const double other_motion_bound =
+		self_collision ? _proxies[other_index].motion_bound
+					   : _obstacles[other_index].motion_bound;
+
+	// the distance cannot have decreased more than the displacement of the
+	// two shapes since the last query
+	if (state.last_candidate_cycle + 1 == _cycle) {
+		state.distance_lower_bound -= proxy.motion_bound + other_motion_bound;
+	} else {
+		state.distance_lower_bound = -std::numeric_limits<double>::infinity();
+	}
+	state.last_candidate_cycle = _cycle;
+	if (state.distance_lower_bound >= _activation_distance) {
+		return;
+	}
+
+	_num_distance_queries++;
+	const ConvexDistanceResult result = computeConvexDistance(
+		proxy.shape, proxy.pose, other_shape, other_pose, state.cache);
+	state.distance_lower_bound = result.distance;
+	_minimum_distance = std::min(_minimum_distance, result.distance);
+	if (result.distance < _activation_distance) {
+		CollisionPair pair;
+		pair.proxy = proxy_index;
+		pair.other = other_index;
+		pair.self_collision = self_collision;
+		pair.distance = result.distance;
+		pair.point = result.point_a;
+		pair.other_point = result.point_b;
+		pair.normal = result.normal;
+		_close_pairs.push_back(pair);
+	}
+}
+
+void CollisionAvoidanceTask::selectActivePairs() {
+	if (_close_pairs.size() > _max_active_pairs) {
+		std::nth_element(
+			_close_pairs.begin(), _close_pairs.begin() + _max_active_pairs,
+			_close_pairs.end(),
+			[](const CollisionPair& a, const CollisionPair& b) {
+				return a.distance < b.distance;
+			});
+		_close_pairs.resize(_max_active_pairs);
+	}
+	_active_pairs.assign(_close_pairs.begin(), _close_pairs.end());
+}
+
+void CollisionAvoidanceTask::updateTaskModel(const MatrixXd& N_prec) {
+	const int robot_dof = getConstRobotModel()->dof();
+	if (N_prec.rows() != N_prec.cols()) {
+		throw std::invalid_argument(
+			"N_prec matrix not square in "
+			"CollisionAvoidanceTask::updateTaskModel\n");
+	}
+	if (N_prec.rows() != robot_dof) {
+		throw std::invalid_argument(
+			"N_prec matrix size not consistent with robot dof in "
+			"CollisionAvoidanceTask::updateTaskModel\n");
+	}
+	_N_prec = N_prec;
+
+	// distance queries
+	_cycle++;
+	updateProxies();
+	updateObstacleHierarchy();
+	_close_pairs.clear();
+	_minimum_distance = std::numeric_limits<double>::infinity();
+	_num_candidate_pairs = 0;
+	_num_distance_queries = 0;
+	// the states of the candidates of the last cycle are carried over to
+	// the candidates of this cycle
+	std::swap(_obstacle_pair_states, _previous_obstacle_pair_states);
+	_obstacle_pair_states.clear();
+	const auto key_less = [](const ObstaclePairState& pair_state,
+							 const std::uint64_t key) {
+		return pair_state.key < key;
+	};
+	for (int i = 0; i < _proxies.size(); i++) {
+		const Vector3d lower =
+			_proxies[i].box_lower.array() - _activation_distance;
+		const Vector3d upper =
+			_proxies[i].box_upper.array() + _activation_distance;
+		_obstacle_hierarchy.query(lower, upper, [&](const int obstacle_index) {
+			if (_obstacle_pair_states.size() ==
+				_obstacle_pair_states.capacity()) {
+				PairState state = PairState();
+				processPair(i, obstacle_index, false, state);
+				return;
+			}
+			const std::uint64_t key = obstaclePairKey(i, obstacle_index);
+			const auto previous = std::lower_bound(
+				_previous_obstacle_pair_states.begin(),
+				_previous_obstacle_pair_states.end(), key, key_less);
+			_obstacle_pair_states.push_back(ObstaclePairState{
+				key, previous != _previous_obstacle_pair_states.end() &&
+							 previous->key == key
+						 ? previous->state
+						 : PairState()});
+			processPair(i, obstacle_index, false,
+						_obstacle_pair_states.back().state);
+		});
+	}
+	std::sort(_obstacle_pair_states.begin(), _obstacle_pair_states.end(),
+			  [](const ObstaclePairState& a, const ObstaclePairState& b) {
+				  return a.key < b.key;
+			  });
+	for (int i = 0; i < _self_collision_pairs.size(); i++) {
+		const LinkProxy& proxy_a = _proxies[_self_collision_pairs[i].first];
+		const LinkProxy& proxy_b = _proxies[_self_collision_pairs[i].second];
+		if ((proxy_a.box_lower.array() - _activation_distance >
+			 proxy_b.box_upper.array())
+				.any() ||
+			(proxy_a.box_upper.array() + _activation_distance <
+			 proxy_b.box_lower.array())
+				.any()) {
+			continue;
+		}
+		processPair(_self_collision_pairs[i].first,
+					_self_collision_pairs[i].second, true,
+					_self_collision_pair_states[i]);
+	}
+	for (auto& obstacle : _obstacles) {
+		obstacle.motion_bound = 0;
+	}
+	selectActivePairs();
+
+	// model of the active pairs: the distance jacobians along the normals
+	const int num_active_pairs = _active_pairs.size();
+	_jacobian.bottomRows(_max_active_pairs - num_active_pairs).setZero();
+	for (int i = 0; i < num_active_pairs; i++) {
+		const CollisionPair& pair = _active_pairs[i];
+		const LinkProxy& proxy = _proxies[pair.proxy];
+		_jacobian.row(i).noalias() =
+			pair.normal.transpose() *
+			getConstRobotModel()
+				->JWorldFrame(proxy.link_name,
+							  proxy.transform_in_link *
+								  (proxy.pose.inverse() * pair.point))
+				.topRows(3);
+		if (pair.self_collision) {
+			const LinkProxy& other = _proxies[pair.other];
+			_jacobian.row(i).noalias() -=
+				pair.normal.transpose() *
+				getConstRobotModel()
+					->JWorldFrame(other.link_name,
+								  other.transform_in_link *
+									  (other.pose.inverse() * pair.other_point))
+					.topRows(3);
+		}
+	}
+	if (num_active_pairs == 0) {
+		_projected_jacobian.setZero();
+		_task_rank = 0;
+		_N.setIdentity();
+		return;
+	}
+	_projected_jacobian.noalias() = _jacobian * _N_prec;
+
+	// range of the projected jacobian: the eigenvectors of its gram matrix
+	// with a non zero singular value
+	_gram_matrix.noalias() =
+		_projected_jacobian * _projected_jacobian.transpose();
+	_gram_matrix_solver.compute(_gram_matrix);
+	_range_vectors = _gram_matrix_solver.eigenvectors();
+	_task_rank = 0;
+	for (int i = 0; i < _max_active_pairs; i++) {
+		if (_gram_matrix_solver.eigenvalues()(i) >
+			RANGE_TOLERANCE * RANGE_TOLERANCE) {
+			_task_rank++;
+		} else {
+			_range_vectors.col(i).setZero();
+		}
+	}
+	if (_task_rank == 0) {
+		// the active pairs cannot be controlled in the nullspace of the
+		// higher priority tasks
+		_N.setIdentity();
+		return;
+	}
+	_range_projector.noalias() = _range_vectors * _range_vectors.transpose();
+
+	// operational space matrices restricted to the range, as given by
+	// Sai2Model::operationalSpaceMatrices for the jacobian expressed in a
+	// basis of the range: Lambda is the inverse of P J M^-1 J^T P on the range
+	// (P the projector on the range) and zero outside of it
+	_M_llt.compute(getConstRobotModel()->M());
+	_weighted_jacobian_transpose = _projected_jacobian.transpose();
+	_M_llt.matrixL().solveInPlace(_weighted_jacobian_transpose);
+	_Lambda.noalias() = _weighted_jacobian_transpose.transpose() *
+						_weighted_jacobian_transpose;
+	_Lambda_inverse.noalias() = _range_projector * _Lambda;
+	_Lambda.noalias() = _Lambda_inverse * _range_projector;
+	_Lambda_inverse = _Lambda - _range_projector;
+	_Lambda_inverse.diagonal().array() += 1.0;
+	_Lambda_inverse_llt.compute(_Lambda_inverse);
+	_Lambda.setIdentity();
+	_Lambda_inverse_llt.solveInPlace(_Lambda);
+	_Lambda += _range_projector;
+	_Lambda.diagonal().array() -= 1.0;
+
+	// N = I - Jbar J with Jbar = M^-1 J^T Lambda
+	_Jbar.noalias() = _weighted_jacobian_transpose * _Lambda;
+	_M_llt.matrixU().solveInPlace(_Jbar);
+	_N.setIdentity();
+	_N.noalias() -= _Jbar * _projected_jacobian;
+}
+
+VectorXd CollisionAvoidanceTask::computeTorques() {
+	// the repulsion has no trajectory to brake, it stays active during
+	// emergency stops
+	pollEmergencyStop();
+	VectorXd task_joint_torques = VectorXd::Zero(getConstRobotModel()->dof());
+	if (_task_rank == 0) {
+		recordEmergencyStopLatency();
+		return task_joint_torques;
+	}
+
+	_distance_velocities.noalias() = _jacobian * getConstRobotModel()->dq();
+	for (int i = 0; i < _active_pairs.size(); i++) {
+		_desired_accelerations(i) = std::clamp(
+			_kp * (_activation_distance - _active_pairs[i].distance) -
+				_kv * _distance_velocities(i),
+			0.0, _max_repulsive_acceleration);
+	}
+	_desired_accelerations.tail(_max_active_pairs - _active_pairs.size())
+		.setZero();
+
+	_task_force.noalias() = _Lambda * _desired_accelerations;
+	task_joint_torques.noalias() =
+		_projected_jacobian.transpose() * _task_force;
+	recordEmergencyStopLatency();
+	return task_joint_torques;
+}
+
+void CollisionAvoidanceTask::reInitializeTask() {
+	_obstacle_pair_states.clear();
+	_previous_obstacle_pair_states.clear();
+	for (auto& state : _self_collision_pair_states) {
+		state = PairState();
+	}
+	_proxies_initialized = false;
+	_close_pairs.clear();
+	_active_pairs.clear();
+	_task_rank = 0;
+	_N.setIdentity();
+}
+
+} /* namespace Sai2Primitives */
@@ -0,0 +1,336 @@
+/**
+ * CollisionAvoidanceTask.h
+ *
+ *	Collision and self collision avoidance task. The links of the robot are
+ * approximated by convex proxies (spheres, capsules, boxes or convex hulls)
+ * and the environment by convex obstacles, stored in a bounding volume
+ * hierarchy. At each cycle, only the pairs of shapes whose bounding boxes are
+ * within the activation distance are queried, and the distance of a pair that
+ * cannot have come closer than the activation distance since its last query
+ * (given the motion of its shapes) is not recomputed. The distance queries are
+ * warm started from the closest features of the previous cycle.
+ *
+ * Each pair closer than the activation distance is a one dimensional task
+ * along the shortest distance direction, with a repulsive acceleration
+ * proportional to the distance to the activation boundary and damped by the
+ * approach velocity. The active pairs are controlled with dynamic decoupling
+ * in the nullspace of the higher priority tasks, and the nullspace of the
+ * task is the nullspace of the active pairs, so the lower priority tasks
+ * cannot push the robot towards the obstacles. The task is meant to be the
+ * highest priority task of a RobotController. Its dimension changes when
+ * pairs activate and release, and the repulsive acceleration is zero at the
+ * activation boundary.
+ *
+ * Created: October 2026
+ */
+
+#ifndef SAI2_PRIMITIVES_COLLISION_AVOIDANCE_TASK_H_
+#define SAI2_PRIMITIVES_COLLISION_AVOIDANCE_TASK_H_
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Sai2Model.h"
+#include "TemplateTask.h"
+#include "helper_modules/CollisionGeometry.h"
+
+using namespace Eigen;
+
+namespace Sai2Primitives {
+
+/**
+ * @brief      A pair of shapes closer than the activation distance
+ */
+struct CollisionPair {
+	// index of the link proxy
+	int proxy;
+	// index of the obstacle, or of the other link proxy for a self collision
+	// pair
+	int other;
+	bool self_collision;
+	double distance;
+	// closest points on the proxy and on the other shape (world frame)
+	Vector3d point;
+	Vector3d other_point;
+	// unit normal from the other shape to the proxy (world frame)
+	Vector3d normal;
+};
+
+class CollisionAvoidanceTask : public TemplateTask {
+public:
+	struct DefaultParameters {
+		static constexpr double activation_distance = 0.05;
+		static constexpr double kp = 200.0;
+		static constexpr double kv = 30.0;
+		static constexpr double max_repulsive_acceleration = 20.0;
+		static constexpr int max_active_pairs = 8;
+	};
+
+	/**
+	 * @brief      Constructor. The task has no proxy and no obstacle, they are
+	 * added afterwards.
+	 *
+	 * @param      robot          A pointer to a Sai2Model object for the robot
+	 *                            that is to be controlled
+	 * @param[in]  task_name      The task name
+	 * @param[in]  loop_timestep  time taken by a control loop
+	 */
+	CollisionAvoidanceTask(std::shared_ptr<Sai2Model::Sai2Model>& robot,
+						   const std::string& task_name =
+							   "collision_avoidance_task",
+						   const double loop_timestep = 0.001);
+
+	// -------- proxies and obstacles --------
+
+	/**
+	 * @brief      Attaches a convex proxy to a link of the robot
+	 *
+	 * @param[in]  link_name          The link
+	 * @param[in]  shape              The shape of the proxy
+	 * @param[in]  transform_in_link  The pose of the shape frame in link frame
+	 *
+	 * @return     The index of the proxy
+	 */
+	int addLinkProxy(const std::string& link_name, const ConvexShape& shape,
+					 const Affine3d& transform_in_link = Affine3d::Identity());
+
+	/**
+	 * @brief      Adds an obstacle of the environment. The hierarchy of the
+	 * obstacles is rebuilt at the next cycle, so the obstacles should be added
+	 * before the control starts.
+	 *
+	 * @param[in]  shape          The shape of the obstacle
+	 * @param[in]  pose_in_world  The pose of the shape frame in world frame
+	 *
+	 * @return     The index of the obstacle
+	 */
+	int addObstacle(const ConvexShape& shape, const Affine3d& pose_in_world);
+
+	/**
+	 * @brief      Moves an obstacle. The hierarchy is refitted at the next
+	 * cycle. The velocity of the obstacle is not taken into account in the
+	 * damping of the repulsion.
+	 *
+	 * @param[in]  obstacle_index  The index returned by addObstacle
+	 * @param[in]  pose_in_world   The new pose of the obstacle
+	 */
+	void setObstaclePose(const int obstacle_index,
+						 const Affine3d& pose_in_world);
+
+	/**
+	 * @brief      Removes all the obstacles
+	 */
+	void clearObstacles();
+
+	/**
+	 * @brief      Avoids the collisions between two link proxies. Self
+	 * collision pairs are explicit, because neighboring links usually overlap
+	 * at their joint.
+	 *
+	 * @param[in]  proxy_a  The index of the first proxy
+	 * @param[in]  proxy_b  The index of the second proxy
+	 */
+	void addSelfCollisionPair(const int proxy_a, const int proxy_b);
+
+	int getNumLinkProxies() const { return _proxies.size(); }
+	int getNumObstacles() const { return _obstacles.size(); }
+
+	// -------- parameters --------
+
+	/**
+	 * @brief      Sets the distance under which a pair of shapes is repelled
+	 *
+	 * @param[in]  activation_distance  The distance (strictly positive)
+	 */
+	void setActivationDistance(const double activation_distance);
+	double getActivationDistance() const { return _activation_distance; }
+
+	/**
+	 * @brief      Sets the gains of the repulsion: the desired acceleration
+	 * along the normal of an active pair is kp * (activation_distance -
+	 * distance) - kv * distance_velocity, saturated between 0 and the maximum
+	 * repulsive acceleration
+	 */
+	void setGains(const double kp, const double kv);
+	double getKp() const { return _kp; }
+	double getKv() const { return _kv; }
+
+	void setMaxRepulsiveAcceleration(const double max_repulsive_acceleration);
+	double getMaxRepulsiveAcceleration() const {
+		return _max_repulsive_acceleration;
+	}
+
+	/**
+	 * @brief      Sets the maximum number of pairs controlled at the same
+	 * time. When more pairs are within the activation distance, only the
+	 * closest ones are controlled, which bounds the size of the task.
+	 */
+	void setMaxActivePairs(const int max_active_pairs);
+	int getMaxActivePairs() const { return _max_active_pairs; }
+
+	// -------- state --------
+
+	/**
+	 * @brief      The pairs controlled at the last cycle
+	 */
+	const std::vector<CollisionPair>& getActivePairs() const {
+		return _active_pairs;
+	}
+
+	/**
+	 * @brief      The minimum distance over the pairs queried at the last
+	 * cycle, or infinity if no pair was queried
+	 */
+	double getMinimumDistance() const { return _minimum_distance; }
+
+	/**
+	 * @brief      The number of pairs whose bounding boxes overlapped at the
+	 * last cycle, and the number of them that needed a distance query
+	 */
+	int getNumCandidatePairs() const { return _num_candidate_pairs; }
+	int getNumDistanceQueries() const { return _num_distance_queries; }
+
+	// -------- task interface --------
+
+	/**
+	 * @brief      Updates the proxies, queries the distances and updates the
+	 * model of the active pairs
+	 *
+	 * @param[in]  N_prec  The nullspace matrix of all the higher priority
+	 * tasks
+	 */
+	void updateTaskModel(const MatrixXd& N_prec) override;
+
+	/**
+	 * @brief      Computes the repulsive torques of the active pairs
+	 */
+	VectorXd computeTorques() override;
+
+	/**
+	 * @brief      Forgets the distance queries of the previous cycles (warm
+	 * start and motion bounds)
+	 */
+	void reInitializeTask() override;
+
+	MatrixXd getTaskNullspace() const override { return _N; }
+	MatrixXd getPreviousTasksNullspace() const override { return _N_prec; }
+	MatrixXd getTaskAndPreviousNullspace() const override {
+		return _N * _N_prec;
+	}
+
+private:
+	struct LinkProxy {
+		std::string link_name;
+		ConvexShape shape;
+		Affine3d transform_in_link;
+		Affine3d pose;
+		Vector3d box_lower;
+		Vector3d box_upper;
+		// bound on the displacement of the points of the proxy since the
+		// last cycle
+		double motion_bound;
+	};
+
+	struct Obstacle {
+		ConvexShape shape;
+		Affine3d pose;
+		double motion_bound;
+	};
+
+	// distance query state of a pair of shapes, kept between cycles
+	struct PairState {
+		ConvexDistanceCache cache;
+		// lower bound of the current distance, from the last query and the
+		// motion of the shapes since then
+		double distance_lower_bound;
+		// last cycle the pair was a candidate, the lower bound is only valid
+		// if the pair was a candidate at every cycle since the query
+		unsigned long last_candidate_cycle;
+	};
+
+	struct ObstaclePairState {
+		std::uint64_t key;
+		PairState state;
+	};
+
+	static double rotationMotionBound(const Affine3d& previous_pose,
+									  const Affine3d& pose,
+									  const double bounding_radius);
+	void updateProxies();
+	void updateObstacleHierarchy();
+	void processPair(const int proxy_index, const int other_index,
+					 const bool self_collision, PairState& state);
+	void selectActivePairs();
+	// allocates the model matrices for the maximum number of active pairs
+	void allocateModel();
+	// preallocates the obstacle pair states for the current proxies and
+	// obstacles
+	void reserveObstaclePairStates();
+
+	// proxies and obstacles
+	std::vector<LinkProxy> _proxies;
+	std::vector<Obstacle> _obstacles;
+	Matrix3Xd _obstacle_box_lower;
+	Matrix3Xd _obstacle_box_upper;
+	BoundingVolumeHierarchy _obstacle_hierarchy;
+	bool _obstacle_hierarchy_needs_rebuild;
+	bool _obstacle_hierarchy_needs_refit;
+	std::vector<std::pair<int, int>> _self_collision_pairs;
+
+	// parameters
+	double _activation_distance;
+	double _kp;
+	double _kv;
+	double _max_repulsive_acceleration;
+	int _max_active_pairs;
+
+	// states of the obstacle pairs that are candidates at the current and at
+	// the previous cycle, sorted by proxy and obstacle indices. Only the
+	// candidates are kept (the distance bound of a pair is lost when it stops
+	// being a candidate), and the pairs beyond the preallocated capacity are
+	// queried without state
+	std::vector<ObstaclePairState> _obstacle_pair_states;
+	std::vector<ObstaclePairState> _previous_obstacle_pair_states;
+	std::vector<PairState> _self_collision_pair_states;
+	unsigned long _cycle;
+	bool _proxies_initialized;
+
+	// pairs within the activation distance, and the controlled ones
+	std::vector<CollisionPair> _close_pairs;
+	std::vector<CollisionPair> _active_pairs;
+	double _minimum_distance;
+	int _num_candidate_pairs;
+	int _num_distance_queries;
+
+	// model. The matrices are allocated for the maximum number of active
+	// pairs, and the rows (and columns) of the inactive pairs are zero, so
+	// that the model update does not allocate
+	MatrixXd _N_prec;
+	MatrixXd _N;
+	MatrixXd _jacobian;
+	MatrixXd _projected_jacobian;
+	// number of independent directions of the active pairs in the nullspace
+	// of the higher priority tasks, 0 if the task does nothing
+	int _task_rank;
+	MatrixXd _gram_matrix;
+	SelfAdjointEigenSolver<MatrixXd> _gram_matrix_solver;
+	MatrixXd _range_vectors;
+	MatrixXd _range_projector;
+	LLT<MatrixXd> _M_llt;
+	MatrixXd _weighted_jacobian_transpose;
+	MatrixXd _Lambda_inverse;
+	LLT<MatrixXd> _Lambda_inverse_llt;
+	MatrixXd _Lambda;
+	MatrixXd _Jbar;
+	VectorXd _distance_velocities;
+	VectorXd _desired_accelerations;
+	VectorXd _task_force;
+};
+
+} /* namespace Sai2Primitives */
+
+/* SAI2_PRIMITIVES_COLLISION_AVOIDANCE_TASK_H_ */
+#endif
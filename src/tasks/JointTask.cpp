@@ -15,8 +15,8 @@ JointTask::JointTask(std::shared_ptr<Sai2Model::Sai2Model>& robot,
 					 const std::string& task_name, const double loop_timestep)
 	: TemplateTask(robot, task_name, TaskType::JOINT_TASK, loop_timestep) {
 	// selection for full joint task
-	_joint_selection = MatrixXd::Identity(getConstRobotModel()->dof(),
-										  getConstRobotModel()->dof());
+	_joint_selection = std::make_shared<const MatrixXd>(MatrixXd::Identity(
+		getConstRobotModel()->dof(), getConstRobotModel()->dof()));
 	_is_partial_joint_task = false;
 
 	initialSetup();
@@ -39,17 +39,52 @@ JointTask::JointTask(std::shared_ptr<Sai2Model::Sai2Model>& robot,
 			"joint selection matrix is not full rank in JointTask "
 			"constructor\n");
 	}
-	_joint_selection = joint_selection_matrix;
+	_joint_selection = std::make_shared<const MatrixXd>(joint_selection_matrix);
 	_is_partial_joint_task = true;
 
 	initialSetup();
 }
 
+JointTask::JointTask(std::shared_ptr<Sai2Model::Sai2Model>& robot,
+					 const JointTask& prototype)
+	: TemplateTask(robot, prototype.getTaskName(), TaskType::JOINT_TASK,
+				   prototype.getLoopTimestep()),
+	  _joint_selection(prototype._joint_selection),
+	  _is_partial_joint_task(prototype._is_partial_joint_task) {
+	_task_dof = prototype._task_dof;
+	_dynamic_decoupling_type = prototype._dynamic_decoupling_type;
+
+	_are_gains_isotropic = prototype._are_gains_isotropic;
+	_kp = prototype._kp;
+	_kv = prototype._kv;
+	_ki = prototype._ki;
+
+	_use_velocity_saturation_flag = prototype._use_velocity_saturation_flag;
+	_saturation_velocity = prototype._saturation_velocity;
+
+	initializeModelMatrices();
+
+	_use_internal_otg_flag = prototype._use_internal_otg_flag;
+	_otg = make_shared<OTG_joints>(
+		*prototype._otg, *_joint_selection * getConstRobotModel()->q());
+
+	reInitializeTask();
+}
+
+std::shared_ptr<JointTask> JointTask::clone(
+	std::shared_ptr<Sai2Model::Sai2Model>& robot) const {
+	if (robot->dof() != getConstRobotModel()->dof()) {
+		throw std::invalid_argument(
+			"robot dof not consistent with the prototype task in "
+			"JointTask::clone\n");
+	}
+	return std::shared_ptr<JointTask>(new JointTask(robot, *this));
+}
+
 void JointTask::initialSetup() {
-	const int robot_dof = getConstRobotModel()->dof();
-	_task_dof = _joint_selection.rows();
+	_task_dof = _joint_selection->rows();
 	setDynamicDecouplingType(DefaultParameters::dynamic_decoupling_type);
-	_current_position = _joint_selection * getConstRobotModel()->q();
+	_current_position = *_joint_selection * getConstRobotModel()->q();
 
 	// default values for gains and velocity saturation
 	setGains(DefaultParameters::kp, DefaultParameters::kv, DefaultParameters::ki);
@@ -60,16 +95,10 @@ void JointTask::initialSetup() {
 		disableVelocitySaturation();
 	}
 
-	// initialize matrices sizes
-	_N_prec = MatrixXd::Identity(robot_dof, robot_dof);
-	_M_partial = MatrixXd::Identity(_task_dof, _task_dof);
-	_M_partial_modified = MatrixXd::Identity(_task_dof, _task_dof);
-	_projected_jacobian = _joint_selection;
-	_N = MatrixXd::Zero(robot_dof, robot_dof);
-	_current_task_range = MatrixXd::Identity(_task_dof, _task_dof);
+	initializeModelMatrices();
 
 	// initialize internal otg
-	_otg = make_shared<OTG_joints>(_joint_selection * getConstRobotModel()->q(),
+	_otg = make_shared<OTG_joints>(*_joint_selection * getConstRobotModel()->q(),
 								   getLoopTimestep());
 	if(DefaultParameters::use_internal_otg) {
 		if(DefaultParameters::internal_otg_jerk_limited) {
@@ -87,10 +116,21 @@ void JointTask::initialSetup() {
 	reInitializeTask();
 }
 
+void JointTask::initializeModelMatrices() {
+	const int robot_dof = getConstRobotModel()->dof();
+	_N_prec = MatrixXd::Identity(robot_dof, robot_dof);
+	_M_partial = MatrixXd::Identity(_task_dof, _task_dof);
+	_M_partial_modified = MatrixXd::Identity(_task_dof, _task_dof);
+	_projected_jacobian = *_joint_selection;
+	_N = MatrixXd::Zero(robot_dof, robot_dof);
+	_current_task_range = MatrixXd::Identity(_task_dof, _task_dof);
+	_use_nullspace_basis = false;
+}
+
 void JointTask::reInitializeTask() {
 	const int robot_dof = getConstRobotModel()->dof();
 
-	_current_position = _joint_selection * getConstRobotModel()->q();
+	_current_position = *_joint_selection * getConstRobotModel()->q();
 	_current_velocity.setZero(_task_dof);
 
 	_goal_position = _current_position;
@@ -226,8 +266,9 @@ void JointTask::updateTaskModel(const MatrixXd& N_prec) {
 			"JointTask::updateTaskModel\n");
 	}
 
+	_use_nullspace_basis = false;
 	_N_prec = N_prec;
-	_projected_jacobian = _joint_selection * _N_prec;
+	_projected_jacobian = *_joint_selection * _N_prec;
 
 	if (_is_partial_joint_task) {
 		_current_task_range = Sai2Model::matrixRangeBasis(_projected_jacobian);
@@ -249,6 +290,56 @@ void JointTask::updateTaskModel(const MatrixXd& N_prec) {
 		_N.setZero(robot_dof, robot_dof);
 	}
 
+	updateModifiedMassMatrix();
+}
+
+void JointTask::updateTaskModel(const NullspaceBasis& N_prec_basis) {
+	const int robot_dof = getConstRobotModel()->dof();
+	if (N_prec_basis.dof() != robot_dof) {
+		throw std::invalid_argument(
+			"N_prec basis size not consistent with robot dof in "
+			"JointTask::updateTaskModel\n");
+	}
+
+	_use_nullspace_basis = true;
+	_N_prec_basis = N_prec_basis;
+	const MatrixXd restricted_jacobian =
+		*_joint_selection * _N_prec_basis.basis();
+	_projected_jacobian =
+		restricted_jacobian * _N_prec_basis.massWeightedBasis().transpose();
+
+	if (_is_partial_joint_task) {
+		_current_task_range = Sai2Model::matrixRangeBasis(_projected_jacobian);
+		if (_current_task_range.norm() == 0) {
+			// there is no controllable degree of freedom for the task, just
+			// return should maybe print a warning here
+			_basis_task_jacobian.setZero(0, _N_prec_basis.rank());
+			_task_and_previous_nullspace_basis = _N_prec_basis;
+			return;
+		}
+
+		// with Z^T M Z = I, the inverse of the task inertia is directly
+		// (J Z) (J Z)^T
+		_basis_task_jacobian =
+			_current_task_range.transpose() * restricted_jacobian;
+		_M_partial = (_basis_task_jacobian * _basis_task_jacobian.transpose())
+						 .completeOrthogonalDecomposition()
+						 .pseudoInverse();
+		_task_and_previous_nullspace_basis =
+			_N_prec_basis.restrictedTo(*_joint_selection);
+	} else {
+		_current_task_range = MatrixXd::Identity(_task_dof, _task_dof);
+		_M_partial = getConstRobotModel()->M();
+		_basis_task_jacobian = restricted_jacobian;
+		_task_and_previous_nullspace_basis =
+			NullspaceBasis(MatrixXd::Zero(robot_dof, 0),
+						   MatrixXd::Zero(robot_dof, 0));
+	}
+
+	updateModifiedMassMatrix();
+}
+
+void JointTask::updateModifiedMassMatrix() {
 	switch (_dynamic_decoupling_type) {
 		case FULL_DYNAMIC_DECOUPLING: {
 			_M_partial_modified = _M_partial;
@@ -291,18 +382,98 @@ void JointTask::updateTaskModel(const MatrixXd& N_prec) {
 	}
 }
 
-VectorXd JointTask::computeTorques() {
-	VectorXd partial_joint_task_torques = VectorXd::Zero(_task_dof);
-	_projected_jacobian = _joint_selection * _N_prec;
+MatrixXd JointTask::getTaskNullspace() const {
+	if (!_use_nullspace_basis) {
+		return _N;
+	}
+	const int robot_dof = getConstRobotModel()->dof();
+	if (!_is_partial_joint_task) {
+		return MatrixXd::Zero(robot_dof, robot_dof);
+	}
+	if (_basis_task_jacobian.rows() == 0) {
+		return MatrixXd::Identity(robot_dof, robot_dof);
+	}
+	// N = I - Jbar J with J = (J Z) Y^T and Jbar = Z (J Z)^T Lambda
+	return MatrixXd::Identity(robot_dof, robot_dof) -
+		   _N_prec_basis.basis() * _basis_task_jacobian.transpose() *
+			   _M_partial * _basis_task_jacobian *
+			   _N_prec_basis.massWeightedBasis().transpose();
+}
 
-	// update constroller state
-	_current_position = _joint_selection * getConstRobotModel()->q();
-	_current_velocity = _projected_jacobian * getConstRobotModel()->dq();
+MatrixXd JointTask::getPreviousTasksNullspace() const {
+	if (_use_nullspace_basis) {
+		return _N_prec_basis.toProjector();
+	}
+	return _N_prec;
+}
 
-	if (_current_task_range.norm() == 0) {
-		// there is no controllable degree of freedom for the task, just return
-		// zero torques. should maybe print a warning here
-		return partial_joint_task_torques;
+MatrixXd JointTask::getTaskAndPreviousNullspace() const {
+	if (_use_nullspace_basis) {
+		return _task_and_previous_nullspace_basis.toProjector();
+	}
+	return _N * _N_prec;
+}
+
+NullspaceBasis JointTask::getTaskAndPreviousNullspaceBasis() const {
+	if (_use_nullspace_basis) {
+		return _task_and_previous_nullspace_basis;
+	}
+	return TemplateTask::getTaskAndPreviousNullspaceBasis();
+}
+
+VectorXd JointTask::projectTorquesInTaskNullspace(
+	const VectorXd& torques) const {
+	if (!_use_nullspace_basis) {
+		return _N.transpose() * torques;
+	}
+	if (!_is_partial_joint_task) {
+		return VectorXd::Zero(torques.size());
+	}
+	if (_basis_task_jacobian.rows() == 0) {
+		return torques;
+	}
+	// N^T tau = tau - J^T Jbar^T tau, computed without forming N
+	const VectorXd task_force =
+		_M_partial *
+		(_basis_task_jacobian * (_N_prec_basis.basis().transpose() * torques));
+	return torques - _N_prec_basis.massWeightedBasis() *
+						 (_basis_task_jacobian.transpose() * task_force);
+}
+
+void JointTask::applyEmergencyStopTransition() {
+	switch (pollEmergencyStop()) {
+		case ENGAGE_EMERGENCY_STOP:
+			// without trajectory generation, the brake trajectory starts from
+			// the robot state, and is only computed when the stop engages
+			if (!_use_internal_otg_flag) {
+				_otg->precomputeBrakeTrajectory(
+					_current_position,
+					*_joint_selection * getConstRobotModel()->dq());
+			}
+			_otg->brake();
+			break;
+		case RELEASE_EMERGENCY_STOP:
+			// hold the state where the brake trajectory stopped
+			_otg->releaseBrake();
+			_goal_position = _otg->getNextPosition();
+			_goal_velocity.setZero(_task_dof);
+			_goal_acceleration.setZero(_task_dof);
+			break;
+		default:
+			break;
+	}
+}
+
+void JointTask::computeDesiredState() {
+	// on emergency stops, follow the brake trajectory (braking again if the
+	// otg was reinitialized during the stop, which makes it hold its state)
+	if (isEmergencyStopEngaged()) {
+		_otg->brake();
+		_otg->update();
+		_desired_position = _otg->getNextPosition();
+		_desired_velocity = _otg->getNextVelocity();
+		_desired_acceleration = _otg->getNextAcceleration();
+		return;
 	}
 
 	_desired_position = _goal_position;
@@ -318,6 +489,24 @@ VectorXd JointTask::computeTorques() {
 		_desired_velocity = _otg->getNextVelocity();
 		_desired_acceleration = _otg->getNextAcceleration();
 	}
+}
+
+VectorXd JointTask::computeTorques() {
+	VectorXd partial_joint_task_torques = VectorXd::Zero(_task_dof);
+
+	// update constroller state
+	_current_position = *_joint_selection * getConstRobotModel()->q();
+	_current_velocity = _projected_jacobian * getConstRobotModel()->dq();
+	applyEmergencyStopTransition();
+
+	if (_current_task_range.norm() == 0) {
+		// there is no controllable degree of freedom for the task, just return
+		// zero torques. should maybe print a warning here
+		recordEmergencyStopLatency();
+		return partial_joint_task_torques;
+	}
+
+	computeDesiredState();
 
 	// compute error for I term
 	_integrated_position_error +=
@@ -352,8 +541,39 @@ VectorXd JointTask::computeTorques() {
 			partial_joint_task_torques;
 
 	// return projected task torques
-	return _projected_jacobian.transpose() * _current_task_range *
-		   partial_joint_task_torques_in_range_space;
+	const VectorXd task_torques = _projected_jacobian.transpose() *
+								  _current_task_range *
+								  partial_joint_task_torques_in_range_space;
+	recordEmergencyStopLatency();
+	return task_torques;
+}
+
+void JointTask::computeKinematicTaskQuantities(
+	MatrixXd& task_jacobian, VectorXd& desired_task_velocity) {
+	task_jacobian = *_joint_selection;
+
+	// update controller state
+	_current_position = *_joint_selection * getConstRobotModel()->q();
+	_current_velocity = *_joint_selection * getConstRobotModel()->dq();
+	applyEmergencyStopTransition();
+
+	computeDesiredState();
+
+	// compute error for I term
+	_integrated_position_error +=
+		(_current_position - _desired_position) * getLoopTimestep();
+
+	// position feedback resolved at the velocity level
+	const MatrixXd kv_inverse = Sai2Model::computePseudoInverse(_kv);
+	desired_task_velocity =
+		_desired_velocity -
+		_kp * kv_inverse * (_current_position - _desired_position) -
+		_ki * kv_inverse * _integrated_position_error;
+	if (_use_velocity_saturation_flag) {
+		desired_task_velocity = desired_task_velocity.cwiseMax(
+			-_saturation_velocity).cwiseMin(_saturation_velocity);
+	}
+	recordEmergencyStopLatency();
 }
 
 void JointTask::enableInternalOtgAccelerationLimited(
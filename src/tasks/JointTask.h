@@ -73,6 +73,26 @@ public:
 			  const std::string& task_name = "partial_joint_task",
 			  const double loop_timestep = 0.001);
 
+	/**
+	 * @brief      Creates a joint task with the same configuration as this one
+	 * (joint selection, gains, velocity saturation, internal otg settings and
+	 * decoupling type) for another robot model with the same number of
+	 * joints. The joint selection matrix is shared with this task and is not
+	 * validated again. The state of the new task is initialized from its
+	 * robot model, as in the constructor.
+	 *
+	 * @param      robot  The robot model of the new task
+	 *
+	 * @return     The new task
+	 */
+	std::shared_ptr<JointTask> clone(
+		std::shared_ptr<Sai2Model::Sai2Model>& robot) const;
+
+	std::shared_ptr<TemplateTask> cloneTask(
+		std::shared_ptr<Sai2Model::Sai2Model>& robot) const override {
+		return clone(robot);
+	}
+
 	/**
 	 * @brief      update the task model (only _N_prec for a joint task)
 	 *
@@ -108,7 +128,7 @@ public:
 	 * @return const MatrixXd Joint Selection Matrix that projects the full
 	 * joint space to the controlled task space
 	 */
-	const MatrixXd getJointSelectionMatrix() const { return _joint_selection; }
+	const MatrixXd getJointSelectionMatrix() const { return *_joint_selection; }
 
 	int getTaskDof() const { return _task_dof; }
 
@@ -188,29 +208,66 @@ public:
 		return _desired_acceleration;
 	}
 
+	/**
+	 * @brief      update the task model using a basis representation of the
+	 * nullspace of the higher priority tasks. The task nullspace is then
+	 * only computed as a dense matrix on request.
+	 *
+	 * @param      N_prec_basis  The nullspace basis of all the higher priority
+	 *                           tasks
+	 */
+	void updateTaskModel(const NullspaceBasis& N_prec_basis) override;
+
+	/**
+	 * @brief      Computes the joint selection as the task jacobian and the
+	 * desired joint velocity, as the goal or internal otg velocity plus the
+	 * position feedback kv^-1 * kp * (desired position - current position)
+	 * (same closed loop time constant as in torque control). The velocity
+	 * saturation is applied if enabled.
+	 *
+	 * @param      task_jacobian          The task jacobian
+	 * @param      desired_task_velocity  The desired task velocity
+	 */
+	void computeKinematicTaskQuantities(
+		MatrixXd& task_jacobian, VectorXd& desired_task_velocity) override;
+
 	/**
 	 * @brief Get the nullspace of this task. Will be 0 if ths
 	 * is a full joint task
 	 *
 	 * @return const MatrixXd& Nullspace matrix
 	 */
-	MatrixXd getTaskNullspace() const override { return _N; }
+	MatrixXd getTaskNullspace() const override;
 
 	/**
 	 * @brief Get the Nullspace projector of the previous tasks
 	 *
 	 * @return Eigen::MatrixXd
 	 */
-	MatrixXd getPreviousTasksNullspace() const override { return _N_prec; }
+	MatrixXd getPreviousTasksNullspace() const override;
 
 	/**
 	 * @brief Get the nullspace of this and the previous tasks. Concretely, it
 	 * is the task nullspace multiplied by the nullspace of the previous tasks
 	 *
 	 */
-	MatrixXd getTaskAndPreviousNullspace() const override {
-		return _N * _N_prec;
-	}
+	MatrixXd getTaskAndPreviousNullspace() const override;
+
+	/**
+	 * @brief Get the basis representation of the nullspace of this and the
+	 * previous tasks
+	 *
+	 */
+	NullspaceBasis getTaskAndPreviousNullspaceBasis() const override;
+
+	/**
+	 * @brief Projects joint torques in the nullspace of this task only. Does
+	 * not form the dense nullspace when the task model was updated from a
+	 * nullspace basis
+	 *
+	 */
+	VectorXd projectTorquesInTaskNullspace(
+		const VectorXd& torques) const override;
 
 	/**
 	 * @brief Set gains from vectors. The vectors must be either all of size 1
@@ -311,6 +368,26 @@ public:
 
 	bool getInternalOtgEnabled() const { return _use_internal_otg_flag; }
 
+	/**
+	 * @brief      Switches the internal trajectory generation between the
+	 * position mode (default, tracks the goal position and velocity) and the
+	 * velocity streaming mode, where only the goal velocity is tracked and
+	 * the desired position is integrated from it. The velocity streaming mode
+	 * is cheaper when streaming velocity goals (jogging, teleoperation). The
+	 * switch does not reinitialize the task and the trajectory continues from
+	 * the current desired state.
+	 *
+	 * @param[in]  enable_velocity_streaming  true to stream velocities
+	 */
+	void enableInternalOtgVelocityStreaming(
+		const bool enable_velocity_streaming = true) {
+		_otg->enableVelocityStreaming(enable_velocity_streaming);
+	}
+
+	bool getInternalOtgVelocityStreamingEnabled() const {
+		return _otg->getVelocityStreamingEnabled();
+	}
+
 	const OTG_joints& getInternalOtg() const { return *_otg; }
 
 	/**
@@ -368,11 +445,42 @@ public:
 	//-----------------------------------------------
 
 private:
+	/**
+	 * @brief      Constructor used by clone, copies the configuration of the
+	 * prototype
+	 */
+	JointTask(std::shared_ptr<Sai2Model::Sai2Model>& robot,
+			  const JointTask& prototype);
+
 	/**
 	 * @brief      Initializes the task. Automatically called by the constructor
 	 */
 	void initialSetup();
 
+	/**
+	 * @brief      Initializes the sizes of the model matrices from the task
+	 * and robot dof
+	 */
+	void initializeModelMatrices();
+
+	/**
+	 * @brief      Engages or releases the emergency stop if it was requested
+	 * or released since the last cycle
+	 */
+	void applyEmergencyStopTransition();
+
+	/**
+	 * @brief      Computes the desired state of the cycle from the goal, the
+	 * internal otg or the brake trajectory
+	 */
+	void computeDesiredState();
+
+	/**
+	 * @brief      Computes the mass matrix used for the feedback terms from
+	 * the decoupling type. Called at the end of updateTaskModel
+	 */
+	void updateModifiedMassMatrix();
+
 	// The goal state of the task is set by the user
 	VectorXd _goal_position;
 	VectorXd _goal_velocity;
@@ -418,12 +526,20 @@ private:
 		_dynamic_decoupling_type;  // defaults to BOUNDED_INERTIA_ESTIMATES. See
 								   // the enum for more details
 
-	MatrixXd _joint_selection;	// selection matrix for the joint task, defaults
-								// to Identity
+	// selection matrix for the joint task, defaults to Identity. It does not
+	// change after construction and is shared by the cloned tasks
+	std::shared_ptr<const MatrixXd> _joint_selection;
 	MatrixXd _projected_jacobian;
 	MatrixXd _N;
 	MatrixXd _current_task_range;
 
+	// nullspace basis representation, used when the task model is updated
+	// from a NullspaceBasis instead of a dense N_prec
+	bool _use_nullspace_basis;
+	NullspaceBasis _N_prec_basis;
+	NullspaceBasis _task_and_previous_nullspace_basis;
+	MatrixXd _basis_task_jacobian;	// task jacobian restricted to N_prec_basis
+
 	bool _is_partial_joint_task;
 };
 
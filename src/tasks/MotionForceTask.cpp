@@ -13,6 +13,47 @@ using namespace Eigen;
 
 namespace Sai2Primitives {
 
+namespace {
+// tolerance on the singular values of the controlled directions, as in
+// Sai2Model::matrixRangeBasis. The gram matrix of the directions has the
+// squared singular values
+const double RANGE_TOLERANCE = 1e-6;
+
+// orthonormal basis (first rank columns) of the range of a 3x3 matrix, and
+// projector on it, computed with fixed size matrices (no allocation)
+Matrix3d rangeBasis(const Matrix3d& matrix, const double tolerance,
+					int& rank) {
+	JacobiSVD<Matrix3d> svd(matrix, ComputeFullU);
+	rank = 0;
+	while (rank < 3 && svd.singularValues()(rank) > tolerance) {
+		rank++;
+	}
+	return svd.matrixU();
+}
+
+Matrix3d projectorFromBasis(const Matrix3d& basis, const int rank) {
+	Matrix3d projector = Matrix3d::Zero();
+	for (int i = 0; i < rank; i++) {
+		projector += basis.col(i) * basis.col(i).transpose();
+	}
+	return projector;
+}
+
+Matrix3d rangeProjector(const Matrix3d& matrix, const double tolerance) {
+	int rank = 0;
+	const Matrix3d basis = rangeBasis(matrix, tolerance, rank);
+	return projectorFromBasis(basis, rank);
+}
+
+Matrix3d directionsGramMatrix(const std::vector<Vector3d>& directions) {
+	Matrix3d gram_matrix = Matrix3d::Zero();
+	for (const auto& direction : directions) {
+		gram_matrix += direction * direction.transpose();
+	}
+	return gram_matrix;
+}
+}  // namespace
+
 MotionForceTask::MotionForceTask(
 	std::shared_ptr<Sai2Model::Sai2Model>& robot, const string& link_name,
 	const Affine3d& compliant_frame, const std::string& task_name,
@@ -90,12 +131,13 @@ MotionForceTask::MotionForceTask(
 }
 
 void MotionForceTask::initialSetup() {
-
-	int dof = getConstRobotModel()->dof();
 	_T_control_to_sensor = Affine3d::Identity();
 
 	// POPC force
 	_POPC_force.reset(new POPCExplicitForceControl(getLoopTimestep()));
+	_kinematic_force_admittance = DefaultParameters::kinematic_force_admittance;
+	_kinematic_moment_admittance =
+		DefaultParameters::kinematic_moment_admittance;
 
 	// motion
 	_current_position = getConstRobotModel()->positionInWorld(
@@ -134,14 +176,7 @@ void MotionForceTask::initialSetup() {
 	setClosedLoopForceControl(DefaultParameters::closed_loop_force_control);
 	setClosedLoopMomentControl(DefaultParameters::closed_loop_moment_control);
 
-	// initialize matrices sizes
-	_jacobian.setZero(6, dof);
-	_projected_jacobian.setZero(6, dof);
-	_Lambda.setZero(6, 6);
-	_Lambda_modified.setZero(6, 6);
-	_Jbar.setZero(dof, 6);
-	_N.setZero(dof, dof);
-	_N_prec = MatrixXd::Identity(dof, dof);
+	initializeModelMatrices();
 
 	MatrixXd range_pos =
 		Sai2Model::matrixRangeBasis(_partial_task_projection.block<3, 3>(0, 0));
@@ -199,6 +234,169 @@ void MotionForceTask::initialSetup() {
 	reInitializeTask();	
 }
 
+MotionForceTask::MotionForceTask(std::shared_ptr<Sai2Model::Sai2Model>& robot,
+								 const MotionForceTask& prototype)
+	: TemplateTask(robot, prototype.getTaskName(),
+				   TaskType::MOTION_FORCE_TASK, prototype.getLoopTimestep()) {
+	_link_name = prototype._link_name;
+	_compliant_frame = prototype._compliant_frame;
+	_is_force_motion_parametrization_in_compliant_frame =
+		prototype._is_force_motion_parametrization_in_compliant_frame;
+	_T_control_to_sensor = prototype._T_control_to_sensor;
+
+	// controlled directions
+	_partial_task_projection = prototype._partial_task_projection;
+	_pos_range = prototype._pos_range;
+	_ori_range = prototype._ori_range;
+	_current_task_range = prototype._current_task_range;
+
+	// gains
+	_kp_pos = prototype._kp_pos;
+	_kv_pos = prototype._kv_pos;
+	_ki_pos = prototype._ki_pos;
+	_kp_ori = prototype._kp_ori;
+	_kv_ori = prototype._kv_ori;
+	_ki_ori = prototype._ki_ori;
+	_are_pos_gains_isotropic = prototype._are_pos_gains_isotropic;
+	_are_ori_gains_isotropic = prototype._are_ori_gains_isotropic;
+	_kp_force = prototype._kp_force;
+	_kv_force = prototype._kv_force;
+	_ki_force = prototype._ki_force;
+	_kp_moment = prototype._kp_moment;
+	_kv_moment = prototype._kv_moment;
+	_ki_moment = prototype._ki_moment;
+	_dynamic_decoupling_type = prototype._dynamic_decoupling_type;
+
+	// velocity saturation
+	_use_velocity_saturation_flag = prototype._use_velocity_saturation_flag;
+	_linear_saturation_velocity = prototype._linear_saturation_velocity;
+	_angular_saturation_velocity = prototype._angular_saturation_velocity;
+
+	// force and moment spaces
+	_force_space_dimension = prototype._force_space_dimension;
+	_moment_space_dimension = prototype._moment_space_dimension;
+	_force_or_motion_axis = prototype._force_or_motion_axis;
+	_moment_or_rotmotion_axis = prototype._moment_or_rotmotion_axis;
+	_closed_loop_force_control = prototype._closed_loop_force_control;
+	_closed_loop_moment_control = prototype._closed_loop_moment_control;
+	_kff_force = prototype._kff_force;
+	_kff_moment = prototype._kff_moment;
+	_max_force_control_feedback_output =
+		prototype._max_force_control_feedback_output;
+	_max_moment_control_feedback_output =
+		prototype._max_moment_control_feedback_output;
+	_kinematic_force_admittance = prototype._kinematic_force_admittance;
+	_kinematic_moment_admittance = prototype._kinematic_moment_admittance;
+
+	_POPC_force.reset(new POPCExplicitForceControl(getLoopTimestep()));
+	if (prototype._POPC_force->isEnabled()) {
+		_POPC_force->enable();
+	}
+
+	initializeModelMatrices();
+
+	// trajectory generation
+	_current_position = getConstRobotModel()->positionInWorld(
+		_link_name, _compliant_frame.translation());
+	_current_orientation = getConstRobotModel()->rotationInWorld(
+		_link_name, _compliant_frame.rotation());
+	_use_internal_otg_flag = prototype._use_internal_otg_flag;
+	_otg = make_unique<OTG_6dof_cartesian>(
+		*prototype._otg, _current_position, _current_orientation);
+
+	// singularity handler
+	_singularity_handler = std::make_unique<SingularityHandler>(
+		getConstRobotModel(), *prototype._singularity_handler);
+
+	reInitializeTask();
+}
+
+std::shared_ptr<MotionForceTask> MotionForceTask::clone(
+	std::shared_ptr<Sai2Model::Sai2Model>& robot) const {
+	if (robot->dof() != getConstRobotModel()->dof()) {
+		throw invalid_argument(
+			"robot dof not consistent with the prototype task in "
+			"MotionForceTask::clone\n");
+	}
+	return std::shared_ptr<MotionForceTask>(new MotionForceTask(robot, *this));
+}
+
+void MotionForceTask::initializeModelMatrices() {
+	const int dof = getConstRobotModel()->dof();
+	_jacobian.setZero(6, dof);
+	_projected_jacobian.setZero(6, dof);
+	_Lambda.setZero(6, 6);
+	_Lambda_modified.setZero(6, 6);
+	_Jbar.setZero(dof, 6);
+	_N.setZero(dof, dof);
+	_N_prec = MatrixXd::Identity(dof, dof);
+	_use_nullspace_basis = false;
+	_is_model_updated_from_basis = false;
+}
+
+void MotionForceTask::setControlledDirections(
+	const std::vector<Vector3d>& controlled_directions_translation,
+	const std::vector<Vector3d>& controlled_directions_rotation) {
+	int pos_range = 0, ori_range = 0;
+	const Matrix3d range_pos = rangeBasis(
+		directionsGramMatrix(controlled_directions_translation),
+		RANGE_TOLERANCE * RANGE_TOLERANCE, pos_range);
+	const Matrix3d range_ori =
+		rangeBasis(directionsGramMatrix(controlled_directions_rotation),
+				   RANGE_TOLERANCE * RANGE_TOLERANCE, ori_range);
+	if (pos_range + ori_range == 0) {
+		throw invalid_argument(
+			"controlled_directions_translation and "
+			"controlled_directions_rotation cannot both be empty in "
+			"MotionForceTask::setControlledDirections\n");
+	}
+	const Matrix3d pos_projector = projectorFromBasis(range_pos, pos_range);
+	const Matrix3d ori_projector = projectorFromBasis(range_ori, ori_range);
+
+	const Matrix3d previous_pos_projector = posSelectionProjector();
+	const Matrix3d previous_ori_projector = oriSelectionProjector();
+	if ((pos_projector - previous_pos_projector).norm() < RANGE_TOLERANCE &&
+		(ori_projector - previous_ori_projector).norm() < RANGE_TOLERANCE) {
+		return;
+	}
+
+	_partial_task_projection.block<3, 3>(0, 0) = pos_projector;
+	_partial_task_projection.block<3, 3>(3, 3) = ori_projector;
+	if (pos_range + ori_range != _pos_range + _ori_range) {
+		_singularity_handler->setTaskRank(pos_range + ori_range);
+	}
+	_pos_range = pos_range;
+	_ori_range = ori_range;
+	_current_task_range.setZero(6, _pos_range + _ori_range);
+	_current_task_range.block(0, 0, 3, _pos_range) =
+		range_pos.leftCols(_pos_range);
+	_current_task_range.block(3, _pos_range, 3, _ori_range) =
+		range_ori.leftCols(_ori_range);
+
+	// the integrators keep their components along the directions that stay
+	// controlled
+	_integrated_position_error = pos_projector * _integrated_position_error;
+	_integrated_force_error = pos_projector * _integrated_force_error;
+	_integrated_orientation_error =
+		ori_projector * _integrated_orientation_error;
+	_integrated_moment_error = ori_projector * _integrated_moment_error;
+
+	// the trajectory restarts from the current pose along the directions that
+	// become controlled
+	const Matrix3d added_pos_directions = rangeProjector(
+		pos_projector * (Matrix3d::Identity() - previous_pos_projector),
+		RANGE_TOLERANCE);
+	const Matrix3d added_ori_directions = rangeProjector(
+		ori_projector * (Matrix3d::Identity() - previous_ori_projector),
+		RANGE_TOLERANCE);
+	_current_position = getConstRobotModel()->positionInWorld(
+		_link_name, _compliant_frame.translation());
+	_current_orientation = getConstRobotModel()->rotationInWorld(
+		_link_name, _compliant_frame.rotation());
+	_otg->reInitializeDirections(added_pos_directions, _current_position,
+								 added_ori_directions, _current_orientation);
+}
+
 void MotionForceTask::reInitializeTask() {
 	int dof = getConstRobotModel()->dof();
 
@@ -254,6 +452,8 @@ void MotionForceTask::updateTaskModel(const MatrixXd& N_prec) {
 			"MotionForceTask::updateTaskModel\n");
 	}
 
+	_use_nullspace_basis = false;
+	_is_model_updated_from_basis = false;
 	_N_prec = N_prec;
 
 	_jacobian = _partial_task_projection *
@@ -266,12 +466,118 @@ void MotionForceTask::updateTaskModel(const MatrixXd& N_prec) {
 
 }
 
+void MotionForceTask::updateTaskModel(const NullspaceBasis& N_prec_basis) {
+	if (N_prec_basis.dof() != getConstRobotModel()->dof()) {
+		throw invalid_argument(
+			"N_prec basis size not consistent with robot dof in "
+			"MotionForceTask::updateTaskModel\n");
+	}
+	_jacobian = _partial_task_projection *
+				getConstRobotModel()->JWorldFrame(
+					_link_name, _compliant_frame.translation());
+	if (_singularity_handler->updateTaskModelFromBasis(_jacobian,
+													   N_prec_basis)) {
+		_is_model_updated_from_basis = true;
+		_N_prec_basis = N_prec_basis;
+		_projected_jacobian = _N_prec_basis.projectJacobian(_jacobian);
+	} else {
+		// close to singularities, the singularity handling works on the
+		// dense projectors
+		updateTaskModel(N_prec_basis.toProjector());
+	}
+	_use_nullspace_basis = true;
+	_task_and_previous_nullspace_basis =
+		_singularity_handler->restrictNullspaceBasis(N_prec_basis);
+}
+
+VectorXd MotionForceTask::projectTorquesInTaskNullspace(
+	const VectorXd& torques) const {
+	if (_is_model_updated_from_basis) {
+		return _singularity_handler->projectTorquesInNullspace(torques);
+	}
+	return TemplateTask::projectTorquesInTaskNullspace(torques);
+}
+
+NullspaceBasis MotionForceTask::getTaskAndPreviousNullspaceBasis() const {
+	if (_use_nullspace_basis) {
+		return _task_and_previous_nullspace_basis;
+	}
+	return TemplateTask::getTaskAndPreviousNullspaceBasis();
+}
+
+void MotionForceTask::applyEmergencyStopTransition() {
+	switch (pollEmergencyStop()) {
+		case ENGAGE_EMERGENCY_STOP:
+			// without trajectory generation, the brake trajectory starts from
+			// the robot state, and is only computed when the stop engages
+			if (!_use_internal_otg_flag) {
+				_otg->precomputeBrakeTrajectory(
+					_current_position, _current_orientation,
+					_current_linear_velocity, _current_angular_velocity);
+			}
+			_otg->brake();
+			break;
+		case RELEASE_EMERGENCY_STOP:
+			// hold the pose where the brake trajectory stopped
+			_otg->releaseBrake();
+			_goal_position = _otg->getNextPosition();
+			_goal_orientation = _otg->getNextOrientation();
+			_goal_linear_velocity.setZero();
+			_goal_angular_velocity.setZero();
+			_goal_linear_acceleration.setZero();
+			_goal_angular_acceleration.setZero();
+			break;
+		default:
+			break;
+	}
+}
+
+void MotionForceTask::computeDesiredState() {
+	// on emergency stops, follow the brake trajectory (braking again if the
+	// otg was reinitialized during the stop, which makes it hold its state)
+	if (isEmergencyStopEngaged()) {
+		_otg->brake();
+		_otg->update();
+		_desired_position = _otg->getNextPosition();
+		_desired_linear_velocity = _otg->getNextLinearVelocity();
+		_desired_linear_acceleration = _otg->getNextLinearAcceleration();
+		_desired_orientation = _otg->getNextOrientation();
+		_desired_angular_velocity = _otg->getNextAngularVelocity();
+		_desired_angular_acceleration = _otg->getNextAngularAcceleration();
+		return;
+	}
+
+	_desired_position = _goal_position;
+	_desired_orientation = _goal_orientation;
+	_desired_linear_velocity = _goal_linear_velocity;
+	_desired_angular_velocity = _goal_angular_velocity;
+	_desired_linear_acceleration = _goal_linear_acceleration;
+	_desired_angular_acceleration = _goal_angular_acceleration;
+
+	if (_use_internal_otg_flag) {
+		_otg->setGoalPositionAndLinearVelocity(_goal_position,
+											   _goal_linear_velocity);
+		_otg->setGoalOrientationAndAngularVelocity(_goal_orientation,
+												   _goal_angular_velocity);
+		_otg->update();
+
+		_desired_position = _otg->getNextPosition();
+		_desired_linear_velocity = _otg->getNextLinearVelocity();
+		_desired_linear_acceleration = _otg->getNextLinearAcceleration();
+		_desired_orientation = _otg->getNextOrientation();
+		_desired_angular_velocity = _otg->getNextAngularVelocity();
+		_desired_angular_acceleration = _otg->getNextAngularAcceleration();
+	}
+}
+
 VectorXd MotionForceTask::computeTorques() {
 	VectorXd task_joint_torques = VectorXd::Zero(getConstRobotModel()->dof());
 	_jacobian = _partial_task_projection *
 				getConstRobotModel()->JWorldFrame(
 					_link_name, _compliant_frame.translation());
-	_projected_jacobian = _jacobian * _N_prec;
+	_projected_jacobian = _is_model_updated_from_basis
+							  ? _N_prec_basis.projectJacobian(_jacobian)
+							  : _jacobian * _N_prec;
 
 	// update controller state
 	_current_position = getConstRobotModel()->positionInWorld(
@@ -287,10 +593,12 @@ VectorXd MotionForceTask::computeTorques() {
 	_current_angular_velocity =
 		_projected_jacobian.block(3, 0, 3, getConstRobotModel()->dof()) *
 		getConstRobotModel()->dq();
+	applyEmergencyStopTransition();
 
 	if (_pos_range + _ori_range == 0) {
 		// there is no controllable degree of freedom for the task, just return
 		// zero torques. should maybe print a warning here
+		recordEmergencyStopLatency();
 		return task_joint_torques;
 	}
 
@@ -376,27 +684,7 @@ VectorXd MotionForceTask::computeTorques() {
 
 	// motion related terms
 	// compute next state from trajectory generation
-	_desired_position = _goal_position;
-	_desired_orientation = _goal_orientation;
-	_desired_linear_velocity = _goal_linear_velocity;
-	_desired_angular_velocity = _goal_angular_velocity;
-	_desired_linear_acceleration = _goal_linear_acceleration;
-	_desired_angular_acceleration = _goal_angular_acceleration;
-
-	if (_use_internal_otg_flag) {
-		_otg->setGoalPositionAndLinearVelocity(_goal_position,
-											   _goal_linear_velocity);
-		_otg->setGoalOrientationAndAngularVelocity(_goal_orientation,
-												   _goal_angular_velocity);
-		_otg->update();
-
-		_desired_position = _otg->getNextPosition();
-		_desired_linear_velocity = _otg->getNextLinearVelocity();
-		_desired_linear_acceleration = _otg->getNextLinearAcceleration();
-		_desired_orientation = _otg->getNextOrientation();
-		_desired_angular_velocity = _otg->getNextAngularVelocity();
-		_desired_angular_acceleration = _otg->getNextAngularAcceleration();
-	}
+	computeDesiredState();
 
 	// linear motion
 	// update integrated error for I term
@@ -485,9 +773,98 @@ VectorXd MotionForceTask::computeTorques() {
 	// compute torque through singularity handler 
 	task_joint_torques = _singularity_handler->computeTorques(_unit_mass_force, force_moment_contribution + feedforward_force_moment);
 
+	recordEmergencyStopLatency();
 	return task_joint_torques;
 }
 
+void MotionForceTask::computeKinematicTaskQuantities(
+	MatrixXd& task_jacobian, VectorXd& desired_task_velocity) {
+	task_jacobian = _partial_task_projection *
+					getConstRobotModel()->JWorldFrame(
+						_link_name, _compliant_frame.translation());
+
+	// update controller state
+	_current_position = getConstRobotModel()->positionInWorld(
+		_link_name, _compliant_frame.translation());
+	_current_orientation = getConstRobotModel()->rotationInWorld(
+		_link_name, _compliant_frame.rotation());
+	_orientation_error =
+		Sai2Model::orientationError(_goal_orientation, _current_orientation);
+	const VectorXd current_velocity = task_jacobian * getConstRobotModel()->dq();
+	_current_linear_velocity = current_velocity.head<3>();
+	_current_angular_velocity = current_velocity.tail<3>();
+	applyEmergencyStopTransition();
+
+	Matrix3d sigma_force = sigmaForce();
+	Matrix3d sigma_moment = sigmaMoment();
+	Matrix3d sigma_position = sigmaPosition();
+	Matrix3d sigma_orientation = sigmaOrientation();
+
+	// force and moment spaces, admittance on the force error
+	Vector3d force_space_velocity = Vector3d::Zero();
+	Vector3d moment_space_velocity = Vector3d::Zero();
+	if (_closed_loop_force_control) {
+		force_space_velocity =
+			_kinematic_force_admittance * sigma_force *
+			(getGoalForce() - _sensed_force_control_world_frame);
+	}
+	if (_closed_loop_moment_control) {
+		moment_space_velocity =
+			_kinematic_moment_admittance * sigma_moment *
+			(getGoalMoment() - _sensed_moment_control_world_frame);
+	}
+
+	// motion space, compute next state from trajectory generation
+	computeDesiredState();
+
+	// pose feedback resolved at the velocity level
+	const Vector3d position_error =
+		sigma_position * (_current_position - _desired_position);
+	const Vector3d step_orientation_error =
+		sigma_orientation *
+		Sai2Model::orientationError(_desired_orientation, _current_orientation);
+	_integrated_position_error += position_error * getLoopTimestep();
+	_integrated_orientation_error += step_orientation_error * getLoopTimestep();
+
+	const Matrix3d kv_pos_inv = Sai2Model::computePseudoInverse(_kv_pos);
+	const Matrix3d kv_ori_inv = Sai2Model::computePseudoInverse(_kv_ori);
+	Vector3d linear_velocity =
+		sigma_position * _desired_linear_velocity -
+		_kp_pos * kv_pos_inv * position_error -
+		_ki_pos * kv_pos_inv * _integrated_position_error;
+	Vector3d angular_velocity =
+		sigma_orientation * _desired_angular_velocity -
+		_kp_ori * kv_ori_inv * step_orientation_error -
+		_ki_ori * kv_ori_inv * _integrated_orientation_error;
+	if (_use_velocity_saturation_flag) {
+		if (linear_velocity.norm() > _linear_saturation_velocity) {
+			linear_velocity *=
+				_linear_saturation_velocity / linear_velocity.norm();
+		}
+		if (angular_velocity.norm() > _angular_saturation_velocity) {
+			angular_velocity *=
+				_angular_saturation_velocity / angular_velocity.norm();
+		}
+	}
+
+	desired_task_velocity.resize(6);
+	desired_task_velocity.head<3>() = linear_velocity + force_space_velocity;
+	desired_task_velocity.tail<3>() = angular_velocity + moment_space_velocity;
+	desired_task_velocity = _partial_task_projection * desired_task_velocity;
+	recordEmergencyStopLatency();
+}
+
+void MotionForceTask::setKinematicForceAdmittance(
+	const double force_admittance, const double moment_admittance) {
+	if (force_admittance < 0 || moment_admittance < 0) {
+		throw invalid_argument(
+			"admittances cannot be negative in "
+			"MotionForceTask::setKinematicForceAdmittance\n");
+	}
+	_kinematic_force_admittance = force_admittance;
+	_kinematic_moment_admittance = moment_admittance;
+}
+
 void MotionForceTask::enableInternalOtgAccelerationLimited(
 	const double max_linear_velelocity, const double max_linear_acceleration,
 	const double max_angular_velocity, const double max_angular_acceleration) {
@@ -807,6 +1184,33 @@ void MotionForceTask::updateSensedForceAndMoment(
 		T_world_compliant_frame.rotation() * _sensed_moment_control_world_frame;
 }
 
+void MotionForceTask::updateSensedForceAndMomentFromObserver(
+	const MomentumObserver& observer) {
+	// the observer estimates the wrench applied by the environment on the
+	// robot at the control frame
+	const Vector6d external_wrench =
+		observer.computeExternalWrench(getConstRobotModel()->JWorldFrame(
+			_link_name, _compliant_frame.translation()));
+	_sensed_force_control_world_frame = -external_wrench.head<3>();
+	_sensed_moment_control_world_frame = -external_wrench.tail<3>();
+
+	// equivalent values in sensor frame
+	Affine3d T_world_link = getConstRobotModel()->transformInWorld(_link_name);
+	Affine3d T_world_compliant_frame = T_world_link * _compliant_frame;
+	const Vector3d force_control_frame =
+		T_world_compliant_frame.rotation().transpose() *
+		_sensed_force_control_world_frame;
+	const Vector3d moment_control_frame =
+		T_world_compliant_frame.rotation().transpose() *
+		_sensed_moment_control_world_frame;
+	_sensed_force_sensor_frame =
+		_T_control_to_sensor.rotation().transpose() * force_control_frame;
+	_sensed_moment_sensor_frame =
+		_T_control_to_sensor.rotation().transpose() *
+		(moment_control_frame -
+		 _T_control_to_sensor.translation().cross(force_control_frame));
+}
+
 bool MotionForceTask::parametrizeForceMotionSpaces(
 	const int force_space_dimension,
 	const Vector3d& force_or_motion_single_axis) {
@@ -18,6 +18,7 @@
 #ifndef SAI2_PRIMITIVES_MOTIONFORCETASK_TASK_H_
 #define SAI2_PRIMITIVES_MOTIONFORCETASK_TASK_H_
 
+#include <helper_modules/MomentumObserver.h>
 #include <helper_modules/OTG_6dof_cartesian.h>
 #include <helper_modules/POPCExplicitForceControl.h>
 #include <helper_modules/Sai2PrimitivesCommonDefinitions.h>
@@ -72,6 +73,8 @@ public:
 		static constexpr bool internal_otg_jerk_limited = false;
 		static constexpr double otg_max_linear_jerk = 10.0;
 		static constexpr double otg_max_angular_jerk = 10.0 * M_PI;
+		static constexpr double kinematic_force_admittance = 1e-3;
+		static constexpr double kinematic_moment_admittance = 1e-2;
 	};
 
 	//------------------------------------------------
@@ -109,6 +112,27 @@ public:
 		const bool is_force_motion_parametrization_in_compliant_frame = false,
 		const double loop_timestep = 0.001);
 
+	/**
+	 * @brief Creates a motion force task with the same configuration as this
+	 * one (control frame, controlled directions, gains, force and moment
+	 * spaces, force sensor frame, velocity saturation, internal otg and
+	 * singularity handling settings) for another robot model with the same
+	 * joints. The range of the controlled directions is copied instead of
+	 * being recomputed, and the joint limits used by the singularity handling
+	 * are shared with this task. The state of the new task is initialized
+	 * from its robot model, as in the constructor.
+	 *
+	 * @param robot The robot model of the new task
+	 * @return std::shared_ptr<MotionForceTask> the new task
+	 */
+	std::shared_ptr<MotionForceTask> clone(
+		std::shared_ptr<Sai2Model::Sai2Model>& robot) const;
+
+	std::shared_ptr<TemplateTask> cloneTask(
+		std::shared_ptr<Sai2Model::Sai2Model>& robot) const override {
+		return clone(robot);
+	}
+
 	//------------------------------------------------
 	// Getters Setters
 	//------------------------------------------------
@@ -190,14 +214,24 @@ public:
 	 *
 	 * @return const MatrixXd& Nullspace matrix
 	 */
-	MatrixXd getTaskNullspace() const override { return _N; }
+	MatrixXd getTaskNullspace() const override {
+		if (_is_model_updated_from_basis) {
+			return _singularity_handler->getNullspace();
+		}
+		return _N;
+	}
 
 	/**
 	 * @brief Get the Nullspace projector of the previous tasks
 	 *
 	 * @return Eigen::MatrixXd
 	 */
-	MatrixXd getPreviousTasksNullspace() const override { return _N_prec; }
+	MatrixXd getPreviousTasksNullspace() const override {
+		if (_is_model_updated_from_basis) {
+			return _N_prec_basis.toProjector();
+		}
+		return _N_prec;
+	}
 
 	/**
 	 * @brief Get the nullspace of this and the previous tasks. Concretely, it
@@ -205,9 +239,29 @@ public:
 	 *
 	 */
 	MatrixXd getTaskAndPreviousNullspace() const override {
+		if (_is_model_updated_from_basis) {
+			return _task_and_previous_nullspace_basis.toProjector();
+		}
 		return _N * _N_prec;
 	}
 
+	/**
+	 * @brief Get the basis representation of the nullspace of this and the
+	 * previous tasks. Computed directly from the previous tasks basis if the
+	 * task model was updated from a nullspace basis
+	 *
+	 */
+	NullspaceBasis getTaskAndPreviousNullspaceBasis() const override;
+
+	/**
+	 * @brief Projects joint torques in the nullspace of this task only. Does
+	 * not form the dense nullspace when the task model was updated from a
+	 * nullspace basis away from singularities
+	 *
+	 */
+	VectorXd projectTorquesInTaskNullspace(
+		const VectorXd& torques) const override;
+
 	void setGoalPosition(const Vector3d& goal_position) {
 		_goal_position = goal_position;
 	}
@@ -384,6 +438,15 @@ public:
 	 */
 	Vector3d getGoalMoment() const;
 
+	/**
+	 * @brief Get the goal force and moment as given to setGoalForce and
+	 * setGoalMoment, without the rotation to the robot world frame applied
+	 * when the force space parametrization is in the compliant frame
+	 *
+	 */
+	const Vector3d& getGoalForceSetpoint() const { return _goal_force; }
+	const Vector3d& getGoalMomentSetpoint() const { return _goal_moment; }
+
 	// internal otg functions
 	/**
 	 * @brief 	Enables the internal otg for position and orientation with
@@ -424,6 +487,25 @@ public:
 
 	bool getInternalOtgEnabled() const { return _use_internal_otg_flag; }
 
+	/**
+	 * @brief 	Switches the internal otg between the position mode (default,
+	 * tracks the goal position, orientation and velocities) and the velocity
+	 * streaming mode, where only the goal linear and angular velocities are
+	 * tracked and the desired pose is integrated from them. The velocity
+	 * streaming mode is cheaper when streaming velocity goals (jogging,
+	 * teleoperation). The switch does not reinitialize the task.
+	 *
+	 * @param enable_velocity_streaming
+	 */
+	void enableInternalOtgVelocityStreaming(
+		const bool enable_velocity_streaming = true) {
+		_otg->enableVelocityStreaming(enable_velocity_streaming);
+	}
+
+	bool getInternalOtgVelocityStreamingEnabled() const {
+		return _otg->getVelocityStreamingEnabled();
+	}
+
 	const OTG_6dof_cartesian& getInternalOtg() const { return *_otg; }
 
 	// Velocity saturation flag and saturation values
@@ -470,6 +552,17 @@ public:
 	 */
 	void updateTaskModel(const MatrixXd& N_prec) override;
 
+	/**
+	 * @brief      update the task model from a basis representation of the
+	 * nullspace of the higher priority tasks. The singularity handling still
+	 * works with the dense projector, but the nullspace of this task and the
+	 * previous ones is directly available as a basis for the next tasks
+	 *
+	 * @param      N_prec_basis  The nullspace basis of all the higher priority
+	 *                           tasks
+	 */
+	void updateTaskModel(const NullspaceBasis& N_prec_basis) override;
+
 	/**
 	 * @brief      Computes the torques associated with this task.
 	 * @details    Computes the torques taking into account the last model
@@ -543,6 +636,44 @@ public:
 	void updateSensedForceAndMoment(const Vector3d sensed_force_sensor_frame,
 									const Vector3d sensed_moment_sensor_frame);
 
+	/**
+	 * @brief      Computes the task jacobian (with the partial task projection)
+	 * and the desired task velocity for the kinematic resolution. In the
+	 * motion space, the desired velocity is the goal or internal otg velocity
+	 * plus the pose feedback kv^-1 * kp * error (same closed loop time
+	 * constant as in torque control). In the force space, it is an admittance
+	 * on the force error when closed loop force control is enabled, and zero
+	 * otherwise.
+	 *
+	 * @param      task_jacobian          The task jacobian (6 x dof)
+	 * @param      desired_task_velocity  The desired task velocity (linear
+	 *                                    first)
+	 */
+	void computeKinematicTaskQuantities(
+		MatrixXd& task_jacobian, VectorXd& desired_task_velocity) override;
+
+	/**
+	 * @brief      Sets the admittances used in the force and moment spaces for
+	 * the kinematic resolution, in (m/s)/N and (rad/s)/Nm
+	 */
+	void setKinematicForceAdmittance(const double force_admittance,
+									 const double moment_admittance);
+
+	/**
+	 * @brief      Updates the values of the sensed force and sensed moment
+	 *             from a momentum observer instead of a force sensor
+	 * @details    The external wrench estimated by the observer at the control
+	 * frame is used as the sensed force and moment (with the same convention
+	 * as the sensor values, the force that the robot applies to the
+	 * environment). The sensor frame values are updated accordingly. The
+	 * observer needs to be updated for the current cycle before calling this
+	 * function.
+	 *
+	 * @param[in]  observer  The momentum observer of the robot
+	 */
+	void updateSensedForceAndMomentFromObserver(
+		const MomentumObserver& observer);
+
 	/**
 	 * @brief Parametrizes the force space and motion space for translational
 	 * control The first argument is the dimension of the force space (between
@@ -654,6 +785,30 @@ public:
 		return _partial_task_projection.block<3, 3>(3, 3);
 	}
 
+	/**
+	 * @brief Changes the controlled translation and rotation directions of
+	 * the task at runtime, without rebuilding the task or the controller
+	 * (same arguments as the partial task constructor, three orthogonal
+	 * directions to control the whole translation or rotation). Does not
+	 * allocate: the buffers that depend on the number of controlled
+	 * directions are sized for the full task. The new directions are used from
+	 * the next task model update. Along the directions that become controlled,
+	 * the internal otg restarts at rest from the current pose and moves
+	 * towards the current goal, while the trajectory continues along the
+	 * directions that stay controlled. The integrators keep their components
+	 * along the directions that stay controlled, and the singularity
+	 * classification history is cleared if the number of controlled
+	 * directions changes.
+	 *
+	 * @param controlled_directions_translation directions spanning the
+	 * controlled translation space (can be empty)
+	 * @param controlled_directions_rotation directions spanning the controlled
+	 * rotation space (can be empty if the translation space is not)
+	 */
+	void setControlledDirections(
+		const std::vector<Vector3d>& controlled_directions_translation,
+		const std::vector<Vector3d>& controlled_directions_rotation);
+
 	// -------- singularity handling methods --------
 
 	/**
@@ -724,7 +879,25 @@ public:
 		_singularity_handler->setSingularityHandlingGains(kp_type_1, kv_type_1, kv_type_2);
 	}
 
+	/**
+	 * @brief Get the classification of the singular directions of the task at
+	 * the last task model update (empty if the task is not singular)
+	 *
+	 * @return const std::vector<SingularityType>& one type per singular direction
+	 */
+	const std::vector<SingularityType>& getSingularityTypes() const {
+		return _singularity_handler->getSingularityTypes();
+	}
+
 private:
+	/**
+	 * @brief Constructor used by clone, copies the configuration of the
+	 * prototype
+	 *
+	 */
+	MotionForceTask(std::shared_ptr<Sai2Model::Sai2Model>& robot,
+					const MotionForceTask& prototype);
+
 	/**
 	 * @brief Initial setup of the task, called in the constructor to avoid
 	 * duplicated code
@@ -732,6 +905,26 @@ private:
 	 */
 	void initialSetup();
 
+	/**
+	 * @brief Initializes the sizes of the model matrices from the robot dof
+	 *
+	 */
+	void initializeModelMatrices();
+
+	/**
+	 * @brief Engages or releases the emergency stop if it was requested or
+	 * released since the last cycle
+	 *
+	 */
+	void applyEmergencyStopTransition();
+
+	/**
+	 * @brief Computes the desired motion of the cycle from the goal, the
+	 * internal otg or the brake trajectory
+	 *
+	 */
+	void computeDesiredState();
+
 	// the goal state is the state the controller tries to reach. If OTG is on,
 	// the actual desired state at each timestep will be interpolated between
 	// the initial state and the goal state, while the goal state might not
@@ -789,6 +982,15 @@ private:
 	Eigen::VectorXd _task_force;
 	Eigen::MatrixXd _N_prec;
 
+	// nullspace basis representation, used when the task model is updated
+	// from a NullspaceBasis instead of a dense N_prec
+	bool _use_nullspace_basis;
+	NullspaceBasis _N_prec_basis;
+	NullspaceBasis _task_and_previous_nullspace_basis;
+	// true when the model was updated from the basis without forming the
+	// dense _N_prec and _N (away from singularities)
+	bool _is_model_updated_from_basis;
+
 	// internal variables, not to be touched by the user
 	string _link_name;
 	Affine3d _compliant_frame;	// in link_frame
@@ -827,6 +1029,10 @@ private:
 	double _max_force_control_feedback_output;
 	double _max_moment_control_feedback_output;
 
+	// admittances of the force and moment spaces in the kinematic resolution
+	double _kinematic_force_admittance;
+	double _kinematic_moment_admittance;
+
 	// POPC for closed loop force control
 	std::unique_ptr<POPCExplicitForceControl> _POPC_force;
 
@@ -848,7 +1054,9 @@ private:
 	MatrixXd _Jbar;
 	MatrixXd _N;
 
-	MatrixXd _current_task_range;
+	// sized for the full task so that the controlled directions can change
+	// without allocation
+	Matrix<double, 6, Dynamic, 0, 6, 6> _current_task_range;
 	int _pos_range, _ori_range;
 
 	Matrix<double, 6, 6> _partial_task_projection;
@@ -6,6 +6,9 @@
 
 #include "SingularityHandler.h"
 
+#include <algorithm>
+#include <stdexcept>
+
 // Default parameters 
 namespace {
     double S_ABS_TOL = 1e-3;
@@ -34,30 +37,30 @@ SingularityHandler::SingularityHandler(std::shared_ptr<Sai2Model::Sai2Model> rob
 {
     // initialize limits 
     _dof = _robot->dof();
-    _q_upper = VectorXd::Zero(_dof);
-    _q_lower = VectorXd::Zero(_dof);
-    _tau_upper = VectorXd::Zero(_dof);
-    _tau_lower = VectorXd::Zero(_dof);
-    _joint_midrange = VectorXd::Zero(_dof);
+    auto joint_limits = std::make_shared<SingularityHandlerJointLimits>();
+    joint_limits->q_upper = VectorXd::Zero(_dof);
+    joint_limits->q_lower = VectorXd::Zero(_dof);
+    joint_limits->tau_upper = VectorXd::Zero(_dof);
+    joint_limits->tau_lower = VectorXd::Zero(_dof);
+    joint_limits->joint_midrange = VectorXd::Zero(_dof);
     _type_2_torque_vector = VectorXd::Zero(_dof);
-    auto joint_limits = _robot->jointLimits();
-    for (int i = 0; i < joint_limits.size(); ++i) {
-        _q_upper(i) = joint_limits[i].position_upper;
-        _q_lower(i) = joint_limits[i].position_lower;
-        _joint_midrange(i) = 0.5 * (joint_limits[i].position_lower + joint_limits[i].position_upper);
-        _type_2_torque_vector(i) = _type_2_torque_ratio * joint_limits[i].effort;
-        _tau_upper(i) = joint_limits[i].effort;
-        _tau_lower(i) = - joint_limits[i].effort;
+    const auto& robot_joint_limits = _robot->jointLimits();
+    for (int i = 0; i < robot_joint_limits.size(); ++i) {
+        joint_limits->q_upper(i) = robot_joint_limits[i].position_upper;
+        joint_limits->q_lower(i) = robot_joint_limits[i].position_lower;
+        joint_limits->joint_midrange(i) = 0.5 * (robot_joint_limits[i].position_lower + robot_joint_limits[i].position_upper);
+        _type_2_torque_vector(i) = _type_2_torque_ratio * robot_joint_limits[i].effort;
+        joint_limits->tau_upper(i) = robot_joint_limits[i].effort;
+        joint_limits->tau_lower(i) = - robot_joint_limits[i].effort;
     }
+    _joint_limits = joint_limits;
 
     // initialize singularity handling variables 
     _singularity_types.resize(0);
-    _q_prior = _joint_midrange;
+    _q_prior = _joint_limits->joint_midrange;
     _dq_prior = VectorXd::Zero(_dof);
     setSingularityHandlingGains(KP_TYPE_1, KV_TYPE_1, KV_TYPE_2);
     setDynamicDecouplingType(BOUNDED_INERTIA_ESTIMATES);
-    _type_1_counter = 0;
-    _type_2_counter = 0;
     _type_2_direction = VectorXd::Ones(_dof);
     _enforce_type_1_strategy = false;
     _enforce_handling_strategy = true;
@@ -69,9 +72,76 @@ SingularityHandler::SingularityHandler(std::shared_ptr<Sai2Model::Sai2Model> rob
     _type_2_angle_threshold = TYPE_2_ANGLE_THRESHOLD;
     _perturb_step_size = PERTURB_STEP_SIZE;
     _buffer_size = BUFFER_SIZE;
+    allocateSingularityHistory();
+    _is_updated_from_basis = false;
+}
+
+SingularityHandler::SingularityHandler(std::shared_ptr<Sai2Model::Sai2Model> robot,
+                                       const SingularityHandler& prototype) :
+                                       _robot(robot),
+                                       _dynamic_decoupling_type(prototype._dynamic_decoupling_type),
+                                       _link_name(prototype._link_name),
+                                       _compliant_frame(prototype._compliant_frame),
+                                       _task_rank(prototype._task_rank),
+                                       _dof(prototype._dof),
+                                       _joint_limits(prototype._joint_limits),
+                                       _enforce_type_1_strategy(prototype._enforce_type_1_strategy),
+                                       _enforce_handling_strategy(prototype._enforce_handling_strategy),
+                                       _verbose(prototype._verbose),
+                                       _perturb_step_size(prototype._perturb_step_size),
+                                       _buffer_size(prototype._buffer_size),
+                                       _q_prior(prototype._q_prior),
+                                       _kp_type_1(prototype._kp_type_1),
+                                       _kv_type_1(prototype._kv_type_1),
+                                       _type_1_tol(prototype._type_1_tol),
+                                       _type_2_torque_ratio(prototype._type_2_torque_ratio),
+                                       _type_2_angle_threshold(prototype._type_2_angle_threshold),
+                                       _kv_type_2(prototype._kv_type_2),
+                                       _type_2_torque_vector(prototype._type_2_torque_vector),
+                                       _s_abs_tol(prototype._s_abs_tol),
+                                       _s_min(prototype._s_min),
+                                       _s_max(prototype._s_max)
+{
+    if (_robot->dof() != _dof) {
+        throw std::invalid_argument("robot dof not consistent with the prototype in SingularityHandler::SingularityHandler\n");
+    }
+
+    // the singularity history is not copied
+    _singularity_types.resize(0);
+    _dq_prior = VectorXd::Zero(_dof);
+    allocateSingularityHistory();
+    _type_2_direction = VectorXd::Ones(_dof);
+    _is_updated_from_basis = false;
+}
+
+void SingularityHandler::setTaskRank(const int task_rank) {
+    if (task_rank < 1 || task_rank > 6) {
+        throw std::invalid_argument("task rank should be between 1 and 6 in SingularityHandler::setTaskRank\n");
+    }
+    _task_rank = task_rank;
+    _singularity_types.resize(0);
+    clearSingularityHistory();
+}
+
+void SingularityHandler::allocateSingularityHistory() {
+    _singularity_history.assign(std::max(_buffer_size, 0), NO_SINGULARITY);
+    clearSingularityHistory();
+}
+
+void SingularityHandler::clearSingularityHistory() {
+    _singularity_history_start = 0;
+    _singularity_history_length = 0;
+    _type_1_counter = 0;
+    _type_2_counter = 0;
 }
 
 void SingularityHandler::updateTaskModel(const MatrixXd& projected_jacobian, const MatrixXd& N_prec) {
+    SAI2_TRACE_SCOPE("updateTaskModel", "SingularityHandler");
+    _is_updated_from_basis = false;
+
+    // single factorization of the mass matrix, all the operational space
+    // quantities below are derived from it
+    _M_llt.compute(_robot->M());
     
     // task range decomposition
     JacobiSVD<MatrixXd> J_svd(projected_jacobian, ComputeThinU | ComputeThinV);
@@ -92,9 +162,7 @@ void SingularityHandler::updateTaskModel(const MatrixXd& projected_jacobian, con
         _task_range_s = _svd_U.leftCols(_task_rank);
         _joint_task_range_s = _svd_V.leftCols(_task_rank);
         _projected_jacobian_s = _task_range_s.transpose() * projected_jacobian;
-        _Lambda_s = (_projected_jacobian_s *
-					_robot->MInv() * 
-					_projected_jacobian_s.transpose()).completeOrthogonalDecomposition().pseudoInverse();
+        _Lambda_s = lambdaInverse(_M_llt, _projected_jacobian_s).completeOrthogonalDecomposition().pseudoInverse();
     } else {
         for (int i = 1; i < _task_rank; ++i) {
             double inv_condition_number = _svd_s(i) / _svd_s(0);
@@ -106,17 +174,13 @@ void SingularityHandler::updateTaskModel(const MatrixXd& projected_jacobian, con
                 // non-singular task
                 _task_range_ns = _svd_U.leftCols(i);
                 _projected_jacobian_ns = _task_range_ns.transpose() * projected_jacobian;
-                Sai2Model::OpSpaceMatrices ns_matrices =
-                    _robot->operationalSpaceMatrices(_projected_jacobian_ns);
-                _Lambda_ns = ns_matrices.Lambda;
-                _Jbar_ns = ns_matrices.Jbar;
-                _N_ns = ns_matrices.N;
+                computeOpSpaceMatrices(_projected_jacobian_ns, _Lambda_ns, _Jbar_ns, _N_ns);
 
                 // singular task: task range only collects columns of U up to size task_rank - non-singular task rank
                 _task_range_s = _svd_U.block(0, i, _svd_U.rows(), _task_rank - i);  
                 _joint_task_range_s = _svd_V.block(0, i, _svd_V.rows(), _task_rank - i);
                 _projected_jacobian_s = _task_range_s.transpose() * projected_jacobian;  
-                _Lambda_s = (_projected_jacobian_s * _robot->MInv() * _projected_jacobian_s.transpose()).inverse();
+                _Lambda_s = lambdaInverse(_M_llt, _projected_jacobian_s).inverse();
                 break;
 
             } else if (i == _task_rank - 1) {
@@ -126,11 +190,7 @@ void SingularityHandler::updateTaskModel(const MatrixXd& projected_jacobian, con
                 // non-singular task
                 _task_range_ns = _svd_U.leftCols(_task_rank); 
                 _projected_jacobian_ns = _task_range_ns.transpose() * projected_jacobian;
-                Sai2Model::OpSpaceMatrices ns_matrices =
-                    _robot->operationalSpaceMatrices(_projected_jacobian_ns);
-                _Lambda_ns = ns_matrices.Lambda;
-                _Jbar_ns = ns_matrices.Jbar;
-                _N_ns = ns_matrices.N;
+                computeOpSpaceMatrices(_projected_jacobian_ns, _Lambda_ns, _Jbar_ns, _N_ns);
 
                 // placeholder singular task terms 
                 _task_range_s = MatrixXd::Zero(_task_rank, 1);
@@ -146,14 +206,16 @@ void SingularityHandler::updateTaskModel(const MatrixXd& projected_jacobian, con
         _N = _N_ns;  
         _Lambda_joint_s = MatrixXd::Zero(1, 1);  // placeholder
     } else if (_task_range_ns.norm() == 0) {
-        _N = N_prec;  // if task is fully singular, then pass through the task 
+        // if task is fully singular, then pass through the task: its own
+        // nullspace is the identity, so the torques of the higher priority
+        // tasks are not cancelled
+        _N = MatrixXd::Identity(_dof, _dof);
         _Lambda_joint_s = MatrixXd::Zero(1, 1);  // placeholder
     } else {
         _posture_projected_jacobian = _joint_task_range_s.transpose() * _N_ns * N_prec;
-        Sai2Model::OpSpaceMatrices op_space_matrices =
-            _robot->operationalSpaceMatrices(_posture_projected_jacobian);
-        _Lambda_joint_s = op_space_matrices.Lambda;
-        _N = op_space_matrices.N * _N_ns; 
+        MatrixXd Jbar_joint_s, N_joint_s;
+        computeOpSpaceMatrices(_posture_projected_jacobian, _Lambda_joint_s, Jbar_joint_s, N_joint_s);
+        _N = N_joint_s * _N_ns; 
     }
 
     switch (_dynamic_decoupling_type) {
@@ -172,43 +234,38 @@ void SingularityHandler::updateTaskModel(const MatrixXd& projected_jacobian, con
         }
 
         case BOUNDED_INERTIA_ESTIMATES: {
+            // the bounded mass matrix only needs its own factorization if
+            // one of the diagonal terms was actually saturated
             MatrixXd M_BIE = _robot->M();
+            bool is_M_saturated = false;
             for (int i = 0; i < _robot->dof(); i++) {
-                if (M_BIE(i, i) < 0.1) {
-                    M_BIE(i, i) = 0.1;
+                if (M_BIE(i, i) < BIE_SATURATION_VALUE) {
+                    M_BIE(i, i) = BIE_SATURATION_VALUE;
+                    is_M_saturated = true;
                 }
             }
-            MatrixXd M_inv_BIE = M_BIE.inverse();
+            if (is_M_saturated) {
+                _M_BIE_llt.compute(M_BIE);
+            }
+            const LLT<MatrixXd>& M_BIE_llt = is_M_saturated ? _M_BIE_llt : _M_llt;
 
             // non-singular lambda
             if (_task_range_ns.norm() != 0) {
-                MatrixXd Lambda_inv_BIE =
-                    _projected_jacobian_ns *
-                    M_inv_BIE * 
-                    _projected_jacobian_ns.transpose();
-                _Lambda_ns_modified = Lambda_inv_BIE.inverse();
+                _Lambda_ns_modified = lambdaInverse(M_BIE_llt, _projected_jacobian_ns).inverse();
             } else {
                 _Lambda_ns_modified = _Lambda_ns;
             }
 
             // singular lambda
             if (_task_range_s.norm() != 0) {
-                MatrixXd Lambda_inv_BIE =
-                    _projected_jacobian_s *
-                    M_inv_BIE * 
-                    _projected_jacobian_s.transpose();
-                _Lambda_s_modified = Lambda_inv_BIE.inverse();
+                _Lambda_s_modified = lambdaInverse(M_BIE_llt, _projected_jacobian_s).inverse();
             } else {
                 _Lambda_s_modified = _Lambda_s;
             }
 
             // joint strategy lambda 
             if (_task_range_s.norm() != 0) {
-                MatrixXd Lambda_inv_BIE = 
-                    _posture_projected_jacobian * 
-                    M_inv_BIE * 
-                    _posture_projected_jacobian.transpose();
-                _Lambda_joint_s_modified = Lambda_inv_BIE.inverse();
+                _Lambda_joint_s_modified = lambdaInverse(M_BIE_llt, _posture_projected_jacobian).inverse();
             } else {
                 _Lambda_joint_s_modified = _Lambda_joint_s;
             }
@@ -226,8 +283,127 @@ void SingularityHandler::updateTaskModel(const MatrixXd& projected_jacobian, con
     classifySingularity(_task_range_s, _joint_task_range_s);
 }
 
+bool SingularityHandler::updateTaskModelFromBasis(const MatrixXd& jacobian, const NullspaceBasis& N_prec_basis) {
+    SAI2_TRACE_SCOPE("updateTaskModelFromBasis", "SingularityHandler");
+    if (_task_rank < 2) {
+        // same classification as the dense path
+        return false;
+    }
+    if (_dynamic_decoupling_type == BOUNDED_INERTIA_ESTIMATES &&
+        _robot->M().diagonal().minCoeff() < BIE_SATURATION_VALUE) {
+        return false;
+    }
+
+    // the projected jacobian J N_prec = (J Z) Y^T has the same range and singular values as in the dense path
+    const MatrixXd restricted_jacobian = jacobian * N_prec_basis.basis();
+    const MatrixXd projected_jacobian = restricted_jacobian * N_prec_basis.massWeightedBasis().transpose();
+    JacobiSVD<MatrixXd> J_svd(projected_jacobian, ComputeThinU);
+    const VectorXd& s = J_svd.singularValues();
+    if (s(0) < _s_abs_tol || s(_task_rank - 1) / s(0) < _s_max) {
+        return false;
+    }
+    _svd_U = J_svd.matrixU();
+    _svd_s = s;
+    _is_updated_from_basis = true;
+    _N_prec_basis = N_prec_basis;
+
+    // fully non-singular task
+    _alpha = 1;
+    _task_range_ns = _svd_U.leftCols(_task_rank);
+    _basis_task_jacobian = _task_range_ns.transpose() * restricted_jacobian;
+    _projected_jacobian_ns = _basis_task_jacobian * N_prec_basis.massWeightedBasis().transpose();
+    const MatrixXd Lambda_inverse = _basis_task_jacobian * _basis_task_jacobian.transpose();
+    _Lambda_ns = Lambda_inverse.completeOrthogonalDecomposition().pseudoInverse();
+
+    // placeholder singular task terms
+    _task_range_s = MatrixXd::Zero(_task_rank, 1);
+    _joint_task_range_s = MatrixXd::Zero(_dof, 1);
+    _projected_jacobian_s = MatrixXd::Zero(_task_rank, _dof);
+    _Lambda_s = MatrixXd::Zero(_task_rank, _task_rank);
+    _Lambda_joint_s = MatrixXd::Zero(1, 1);
+
+    switch (_dynamic_decoupling_type) {
+        case IMPEDANCE: {
+            _Lambda_ns_modified.setIdentity(_task_rank, _task_rank);
+            _Lambda_s_modified.setIdentity(_task_rank, _task_rank);
+            _Lambda_joint_s_modified.setIdentity(1, 1);
+            break;
+        }
+
+        case BOUNDED_INERTIA_ESTIMATES: {
+            // the mass matrix is not saturated, so the bounded inertia is the task inertia
+            _Lambda_ns_modified = Lambda_inverse.inverse();
+            _Lambda_s_modified = _Lambda_s;
+            _Lambda_joint_s_modified = _Lambda_joint_s;
+            break;
+        }
+
+        default: {
+            _Lambda_ns_modified = _Lambda_ns;
+            _Lambda_s_modified = _Lambda_s;
+            _Lambda_joint_s_modified = _Lambda_joint_s;
+            break;
+        }
+    }
+
+    classifySingularity(_task_range_s, _joint_task_range_s);
+    return true;
+}
+
+MatrixXd SingularityHandler::getNullspace() const {
+    if (!_is_updated_from_basis) {
+        return _N;
+    }
+    // N = I - Jbar J with J = (U^T J Z) Y^T and Jbar = Z (U^T J Z)^T Lambda
+    return MatrixXd::Identity(_dof, _dof) -
+           _N_prec_basis.basis() * (_basis_task_jacobian.transpose() * _Lambda_ns * _basis_task_jacobian) *
+               _N_prec_basis.massWeightedBasis().transpose();
+}
+
+VectorXd SingularityHandler::projectTorquesInNullspace(const VectorXd& torques) const {
+    if (!_is_updated_from_basis) {
+        return _N.transpose() * torques;
+    }
+    // N^T tau = tau - J^T Jbar^T tau, computed without forming N
+    return torques - _N_prec_basis.massWeightedBasis() *
+                         (_basis_task_jacobian.transpose() *
+                          (_Lambda_ns * (_basis_task_jacobian * (_N_prec_basis.basis().transpose() * torques))));
+}
+
+NullspaceBasis SingularityHandler::restrictNullspaceBasis(const NullspaceBasis& N_prec_basis) const {
+    if (_task_range_ns.norm() == 0) {
+        return N_prec_basis;  // task is fully singular and passed through
+    }
+    NullspaceBasis N_ns_basis = N_prec_basis.restrictedTo(_projected_jacobian_ns);
+    if (_task_range_s.norm() == 0 || !_enforce_handling_strategy) {
+        return N_ns_basis;
+    }
+    // the joint strategy acts along the singular joint directions in the nullspace of the non-singular task
+    return N_ns_basis.restrictedTo(_joint_task_range_s.transpose());
+}
+
+MatrixXd SingularityHandler::lambdaInverse(const LLT<MatrixXd>& M_llt, const MatrixXd& task_jacobian) const {
+    // J M^-1 J^T = (L^-1 J^T)^T (L^-1 J^T) with M = L L^T
+    MatrixXd weighted_jacobian_transpose = M_llt.matrixL().solve(task_jacobian.transpose());
+    return weighted_jacobian_transpose.transpose() * weighted_jacobian_transpose;
+}
+
+void SingularityHandler::computeOpSpaceMatrices(const MatrixXd& task_jacobian,
+                                                MatrixXd& Lambda,
+                                                MatrixXd& Jbar,
+                                                MatrixXd& N) const {
+    // same quantities as Sai2Model::operationalSpaceMatrices, but computed from
+    // the mass matrix factorization instead of going back to the raw matrices
+    MatrixXd weighted_jacobian_transpose = _M_llt.matrixL().solve(task_jacobian.transpose());
+    Lambda = (weighted_jacobian_transpose.transpose() * weighted_jacobian_transpose)
+                 .completeOrthogonalDecomposition().pseudoInverse();
+    Jbar = _M_llt.matrixU().solve(weighted_jacobian_transpose * Lambda);
+    N = MatrixXd::Identity(_dof, _dof) - Jbar * task_jacobian;
+}
+
 void SingularityHandler::classifySingularity(const MatrixXd& singular_task_range,
                                              const MatrixXd& singular_joint_task_range) {
+    SAI2_TRACE_SCOPE("classifySingularity", "SingularityHandler");
     // memory of entering conditions 
     if (_singularity_types.size() == 0 || (_type_2_counter > _type_1_counter)) {
         _q_prior = _robot->q();
@@ -237,9 +413,7 @@ void SingularityHandler::classifySingularity(const MatrixXd& singular_task_range
     // if singular task range is empty, return no singularities 
     if (singular_task_range.norm() == 0) {
         _singularity_types.resize(0);
-        _singularity_history.clear();
-        _type_1_counter = 0;
-        _type_2_counter = 0;
+        clearSingularityHistory();
         return;
     }
 
@@ -272,25 +446,32 @@ void SingularityHandler::classifySingularity(const MatrixXd& singular_task_range
     }
 
     // add to buffer and counters (preference for handling type 1 over type 2 for multiple, simultaneous singularities)
+    if (_singularity_history.empty()) {
+        // buffer size of 0, nothing is remembered
+        return;
+    }
+    const int buffer_size = _singularity_history.size();
+    int index = (_singularity_history_start + _singularity_history_length) % buffer_size;
+    if (_singularity_history_length == buffer_size) {
+        // overwrite the oldest if the buffer is full
+        if (_singularity_history[index] == TYPE_1_SINGULARITY) {
+            _type_1_counter--;
+        } else if (_singularity_history[index] == TYPE_2_SINGULARITY) {
+            _type_2_counter--;
+        }
+        _singularity_history_start = (_singularity_history_start + 1) % buffer_size;
+    } else {
+        _singularity_history_length++;
+    }
     auto it = std::find(_singularity_types.begin(), _singularity_types.end(), TYPE_1_SINGULARITY);
     if (it != _singularity_types.end()) {
-        _singularity_history.push_back(TYPE_1_SINGULARITY);
+        _singularity_history[index] = TYPE_1_SINGULARITY;
         _type_1_counter++;
     } else {
-        _singularity_history.push_back(TYPE_2_SINGULARITY);
+        _singularity_history[index] = TYPE_2_SINGULARITY;
         _type_2_counter++;
     }
 
-    // pop oldest if greater than buffer size
-    if (_singularity_history.size() > _buffer_size) {
-        if (_singularity_history.front() == TYPE_1_SINGULARITY) {
-            _type_1_counter--;
-        } else if (_singularity_history.front() == TYPE_2_SINGULARITY) {
-            _type_2_counter--;
-        }
-        _singularity_history.pop_front();
-    }
-
 }
 
 VectorXd SingularityHandler::computeTorques(const VectorXd& unit_mass_force, const VectorXd& force_related_terms) {
@@ -331,9 +512,9 @@ VectorXd SingularityHandler::computeTorques(const VectorXd& unit_mass_force, con
             // the direction is reversed if the joint is approaching a joint limit 
             for (int i = 0; i < _joint_task_range_s.rows(); ++i) {
                 if (_joint_task_range_s(i, 0) != 0) {
-                    if (std::abs(_robot->q()(i) - _q_upper(i)) < _type_2_angle_threshold) {
+                    if (std::abs(_robot->q()(i) - _joint_limits->q_upper(i)) < _type_2_angle_threshold) {
                         _type_2_direction(i) = - 1;
-                    } else if (std::abs(_robot->q()(i) - _q_lower(i)) < _type_2_angle_threshold) {
+                    } else if (std::abs(_robot->q()(i) - _joint_limits->q_lower(i)) < _type_2_angle_threshold) {
                         _type_2_direction(i) = 1;
                     } 
                 }
@@ -353,10 +534,10 @@ VectorXd SingularityHandler::computeTorques(const VectorXd& unit_mass_force, con
         for (int i = 0; i < _dof; ++i) {
             if (isnan(_singular_task_torques(i))) {
                 _singular_task_torques(i) = 0;  
-            } else if (_singular_task_torques(i) > _tau_upper(i)) {
-                _singular_task_torques(i) = _tau_upper(i);
-            } else if (_singular_task_torques(i) < _tau_lower(i)) {
-                _singular_task_torques(i) = _tau_lower(i);
+            } else if (_singular_task_torques(i) > _joint_limits->tau_upper(i)) {
+                _singular_task_torques(i) = _joint_limits->tau_upper(i);
+            } else if (_singular_task_torques(i) < _joint_limits->tau_lower(i)) {
+                _singular_task_torques(i) = _joint_limits->tau_lower(i);
             }
         }
         return tau_ns + _alpha * _singular_task_torques + (1 - _alpha) * _joint_strategy_torques;
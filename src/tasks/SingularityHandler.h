@@ -13,10 +13,12 @@
 #ifndef SAI2_PRIMITIVES_SINGULARITY_HANDLER_
 #define SAI2_PRIMITIVES_SINGULARITY_HANDLER_
 
+#include <helper_modules/NullspaceBasis.h>
 #include <helper_modules/Sai2PrimitivesCommonDefinitions.h>
+#include <helper_modules/TraceRecorder.h>
 #include "Sai2Model.h"
 #include <Eigen/Dense>
-#include <queue>
+#include <vector>
 #include <memory>
 
 using namespace Eigen;
@@ -30,6 +32,14 @@ enum SingularityType {
 
 const std::vector<std::string> singularity_labels {"No Singularity", "Type 1 Singularity", "Type 2 Singularity"};               
 
+/**
+ * @brief Joint position and torque limits of the robot, computed once and
+ * shared (read only) by the singularity handlers cloned from a same prototype
+ */
+struct SingularityHandlerJointLimits {
+    VectorXd joint_midrange, q_upper, q_lower, tau_upper, tau_lower;
+};
+
 class SingularityHandler {
 public:
     /**
@@ -47,6 +57,16 @@ public:
                        const int& task_rank,
                        const bool& verbose = false);
 
+    /**
+     * @brief Construct a new Singularity Handler with the same settings as a prototype, for another
+     * robot model with the same joints. The joint limits are shared with the prototype.
+     * 
+     * @param robot robot model from motion force task
+     * @param prototype singularity handler to copy the settings from
+     */
+    SingularityHandler(std::shared_ptr<Sai2Model::Sai2Model> robot,
+                       const SingularityHandler& prototype);
+
     /**
      * @brief Updates the model quantities for the singularity handling task, and performs singularity classification
      * 
@@ -55,6 +75,20 @@ public:
      */
     void updateTaskModel(const MatrixXd& projected_jacobian, const MatrixXd& N_prec);
 
+    /**
+     * @brief Updates the model quantities from the nullspace basis of the preceding tasks without forming
+     * any dense projector. With Z^T M Z = I, the inverse of the task inertia is directly (J Z) (J Z)^T,
+     * so neither the mass matrix factorization nor the dense nullspace are needed. This only applies when
+     * the task is away from singularities: nothing is updated and false is returned if the task is singular
+     * or in the blending region, or if the bounded inertia estimates saturate the mass matrix, in which case
+     * updateTaskModel must be called with the dense projector.
+     * 
+     * @param jacobian Task jacobian (not projected) from motion force task
+     * @param N_prec_basis Nullspace basis of the preceding tasks
+     * @return true if the model was updated
+     */
+    bool updateTaskModelFromBasis(const MatrixXd& jacobian, const NullspaceBasis& N_prec_basis);
+
     /**
      * @brief Computes the torques from the singularity handling. If the projected jacobian isn't classified singular, then
      * the torque is computed as usual.
@@ -83,7 +117,42 @@ public:
      * 
      * @return MatrixXd nullspace 
      */
-    MatrixXd getNullspace() { return _N; };
+    MatrixXd getNullspace() const;
+
+    /**
+     * @brief Projects torques in the nullspace of the task (N^T torques), without forming N if the model
+     * was updated from a nullspace basis
+     * 
+     * @param torques joint torques
+     * @return VectorXd projected torques
+     */
+    VectorXd projectTorquesInNullspace(const VectorXd& torques) const;
+
+    /**
+     * @brief Set the rank of the task, when the directions controlled by the
+     * task change. Clears the singularity classification history.
+     * 
+     * @param task_rank number of controlled directions (1 to 6)
+     */
+    void setTaskRank(const int task_rank);
+
+    /**
+     * @brief Get the classification of the singular directions of the task at
+     * the last task model update (empty if the task is not singular)
+     * 
+     * @return const std::vector<SingularityType>& one type per singular direction
+     */
+    const std::vector<SingularityType>& getSingularityTypes() const { return _singularity_types; }
+
+    /**
+     * @brief Get the basis representation of the nullspace of the task and the preceding tasks,
+     * from the basis of the nullspace of the preceding tasks. Consistent with getNullspace() * N_prec.
+     * Must be called after updateTaskModel
+     * 
+     * @param N_prec_basis Nullspace basis of the preceding tasks
+     * @return NullspaceBasis nullspace basis of the task and preceding tasks 
+     */
+    NullspaceBasis restrictNullspaceBasis(const NullspaceBasis& N_prec_basis) const;
 
     /**
      * @brief Set the singularity bounds for torque blending based on the inverse of the condition number
@@ -170,10 +239,21 @@ public:
         _type_2_angle_threshold = type_2_angle_threshold;
         _perturb_step_size = perturb_step_size;
         _buffer_size = buffer_size;
+        allocateSingularityHistory();
     }
 
 private:
 
+    /**
+     * @brief Allocates the singularity history for the buffer size and clears it
+     */
+    void allocateSingularityHistory();
+
+    /**
+     * @brief Clears the singularity history and its counters, without freeing it
+     */
+    void clearSingularityHistory();
+
     /**
      * @brief Classifies the singularity based on a joint perturbation in the singular joint space 
      * 
@@ -183,6 +263,27 @@ private:
     void classifySingularity(const MatrixXd& singular_task_range, 
                              const MatrixXd& singular_joint_task_range);
 
+    /**
+     * @brief Computes the inverse of the task inertia J M^-1 J^T from a cholesky factorization of the mass matrix
+     * 
+     * @param M_llt Cholesky factorization of the (possibly bounded) mass matrix
+     * @param task_jacobian Task jacobian
+     * @return MatrixXd Inverse of the task inertia
+     */
+    MatrixXd lambdaInverse(const LLT<MatrixXd>& M_llt, const MatrixXd& task_jacobian) const;
+
+    /**
+     * @brief Computes the task inertia, dynamically consistent inverse and nullspace of a task jacobian
+     * from the cholesky factorization of the mass matrix computed once per model update
+     * 
+     * @param task_jacobian Task jacobian
+     * @param Lambda Task inertia
+     * @param Jbar Dynamically consistent inverse of the task jacobian
+     * @param N Nullspace of the task
+     */
+    void computeOpSpaceMatrices(const MatrixXd& task_jacobian, MatrixXd& Lambda,
+                                MatrixXd& Jbar, MatrixXd& N) const;
+
     // singularity setup
     std::shared_ptr<Sai2Model::Sai2Model> _robot;
     DynamicDecouplingType _dynamic_decoupling_type;
@@ -190,7 +291,7 @@ private:
     Affine3d _compliant_frame;
     int _task_rank;
     int _dof;
-    VectorXd _joint_midrange, _q_upper, _q_lower, _tau_upper, _tau_lower;
+    std::shared_ptr<const SingularityHandlerJointLimits> _joint_limits;
     bool _enforce_type_1_strategy;
     bool _enforce_handling_strategy;
     bool _verbose;
@@ -198,7 +299,10 @@ private:
     // singularity information
     std::vector<SingularityType> _singularity_types;
     double _perturb_step_size;
-    std::deque<SingularityType> _singularity_history;
+    // ring buffer of the last _buffer_size classifications, allocated for the
+    // buffer size so that the classification does not allocate
+    std::vector<SingularityType> _singularity_history;
+    int _singularity_history_start, _singularity_history_length;
     int _type_1_counter, _type_2_counter;
     int _buffer_size;
 
@@ -215,6 +319,7 @@ private:
     VectorXd _type_2_direction;
 
     // model quantities 
+    LLT<MatrixXd> _M_llt, _M_BIE_llt;
     MatrixXd _svd_U, _svd_V;
     VectorXd _svd_s;
     double _s_abs_tol;  
@@ -228,6 +333,12 @@ private:
     MatrixXd _Lambda_ns_modified, _Lambda_s_modified;
     MatrixXd _Lambda_joint_s, _Lambda_joint_s_modified;
 
+    // quantities of the update from a nullspace basis, where _N is not formed:
+    // the jacobian of the task restricted to the basis, (U^T J) Z
+    bool _is_updated_from_basis;
+    NullspaceBasis _N_prec_basis;
+    MatrixXd _basis_task_jacobian;
+
     // joint task quantities 
     MatrixXd _posture_projected_jacobian, _M_partial;
     
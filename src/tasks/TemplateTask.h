@@ -12,7 +12,14 @@
 #include <Sai2Model.h>
 
 #include <Eigen/Dense>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <stdexcept>
+
+#include "helper_modules/NullspaceBasis.h"
 
 namespace Sai2Primitives {
 
@@ -20,6 +27,7 @@ enum TaskType {
 	UNDEFINED,
 	JOINT_TASK,
 	MOTION_FORCE_TASK,
+	COLLISION_AVOIDANCE_TASK,
 };
 
 class TemplateTask {
@@ -41,6 +49,19 @@ public:
 	 */
 	virtual void updateTaskModel(const Eigen::MatrixXd& N_prec) = 0;
 
+	/**
+	 * @brief update the task model using a basis representation of the
+	 * nullspace of the higher priority tasks instead of the dense projector.
+	 * The default implementation converts the basis to a dense projector, tasks
+	 * can override it to work directly with the basis.
+	 *
+	 * @param N_prec_basis The nullspace basis of all the higher priority tasks.
+	 * If this is the highest priority task, use NullspaceBasis(M).
+	 */
+	virtual void updateTaskModel(const NullspaceBasis& N_prec_basis) {
+		updateTaskModel(N_prec_basis.toProjector());
+	}
+
 	/**
 	 * @brief Computes the joint torques associated with this control task.
 	 *
@@ -78,6 +99,122 @@ public:
 	 */
 	virtual Eigen::MatrixXd getTaskAndPreviousNullspace() const = 0;
 
+	/**
+	 * @brief Get the basis representation of the nullspace of this task and
+	 * the previous tasks. The default implementation decomposes the dense
+	 * projector, tasks can override it to compute the basis directly.
+	 *
+	 * @return NullspaceBasis
+	 */
+	virtual NullspaceBasis getTaskAndPreviousNullspaceBasis() const {
+		return NullspaceBasis::fromProjector(getTaskAndPreviousNullspace(),
+											 _robot->M());
+	}
+
+	/**
+	 * @brief Projects joint torques in the nullspace of this task only
+	 * (N^T * torques where N is the task nullspace)
+	 *
+	 * @param torques joint torques
+	 * @return Eigen::VectorXd projected torques
+	 */
+	virtual Eigen::VectorXd projectTorquesInTaskNullspace(
+		const Eigen::VectorXd& torques) const {
+		return getTaskNullspace().transpose() * torques;
+	}
+
+	/**
+	 * @brief Computes the quantities used to resolve the task kinematically,
+	 * for robots that take joint position or velocity commands. Called
+	 * instead of updateTaskModel and computeTorques in that mode, it steps the
+	 * task (internal otg, integrators) like computeTorques does and only uses
+	 * the robot kinematics. The default implementation throws, tasks that
+	 * support the kinematic resolution override it.
+	 *
+	 * @param task_jacobian The jacobian of the task (task dof x robot dof)
+	 * @param desired_task_velocity The desired velocity in task space
+	 */
+	virtual void computeKinematicTaskQuantities(
+		Eigen::MatrixXd& task_jacobian, Eigen::VectorXd& desired_task_velocity) {
+		throw std::runtime_error("Task " + _task_name +
+								 " does not support the kinematic resolution");
+	}
+
+	/**
+	 * @brief Creates a task with the same configuration as this one for
+	 * another robot model with the same joints, to build many identical
+	 * controllers from a configured prototype. The immutable parts of the
+	 * configuration are shared with this task, and the state of the new task
+	 * is initialized from its robot model. The default implementation throws,
+	 * tasks that support cloning override it.
+	 *
+	 * @param robot The robot model of the new task
+	 * @return std::shared_ptr<TemplateTask> the new task
+	 */
+	virtual std::shared_ptr<TemplateTask> cloneTask(
+		std::shared_ptr<Sai2Model::Sai2Model>& robot) const {
+		throw std::runtime_error("Task " + _task_name +
+								 " does not support cloning");
+	}
+
+	/**
+	 * @brief Requests an emergency stop of the task. Can be called from any
+	 * thread, it does not lock or allocate. At its next cycle, the task
+	 * switches to the brake trajectory precomputed by its internal otg, which
+	 * brings its desired motion to rest within the otg limits, and ignores its
+	 * goals until the stop is released. Tasks with no motion to brake keep
+	 * their behavior. Repeated requests keep the time of the first one.
+	 *
+	 * @param trigger_time time of the request, from which the latency of the
+	 * stop is measured
+	 */
+	void triggerEmergencyStop(const std::chrono::steady_clock::time_point
+								  trigger_time = std::chrono::steady_clock::now()) {
+		std::int64_t no_request = 0;
+		_emergency_stop_trigger_time.compare_exchange_strong(
+			no_request,
+			std::max<std::int64_t>(1, trigger_time.time_since_epoch().count()),
+			std::memory_order_acq_rel);
+	}
+
+	/**
+	 * @brief Releases the emergency stop. Can be called from any thread. At
+	 * its next cycle, the task leaves its brake trajectory and its goal is set
+	 * to its current desired state.
+	 */
+	void releaseEmergencyStop() {
+		_emergency_stop_trigger_time.store(0, std::memory_order_release);
+	}
+
+	bool isEmergencyStopRequested() const {
+		return _emergency_stop_trigger_time.load(std::memory_order_acquire) !=
+			   0;
+	}
+
+	/**
+	 * @brief Whether the task follows its brake trajectory, from the first
+	 * cycle after the request to the first cycle after the release
+	 */
+	bool isEmergencyStopEngaged() const {
+		return _emergency_stop_engaged.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * @brief Time between the request of the last emergency stop and the end
+	 * of the computation of the first braking torques of the task (s), the
+	 * maximum of that time over all the stops, and the number of stops where
+	 * it exceeded the loop timestep of the task
+	 */
+	double getLastEmergencyStopLatency() const {
+		return _last_emergency_stop_latency.load(std::memory_order_relaxed);
+	}
+	double getMaxEmergencyStopLatency() const {
+		return _max_emergency_stop_latency.load(std::memory_order_relaxed);
+	}
+	unsigned long getNumLateEmergencyStops() const {
+		return _num_late_emergency_stops.load(std::memory_order_relaxed);
+	}
+
 	/**
 	 * @brief gets a const reference to the internal robot model
 	 *
@@ -105,12 +242,78 @@ public:
 	 */
 	const std::string& getTaskName() const { return _task_name; }
 
+protected:
+	enum EmergencyStopTransition {
+		NO_EMERGENCY_STOP_TRANSITION,
+		ENGAGE_EMERGENCY_STOP,
+		RELEASE_EMERGENCY_STOP,
+	};
+
+	/**
+	 * @brief To be called by the tasks once per cycle, before computing their
+	 * desired state. Engages or releases the emergency stop when it was
+	 * requested or released since the last cycle.
+	 *
+	 * @return EmergencyStopTransition the transition to apply at this cycle
+	 */
+	EmergencyStopTransition pollEmergencyStop() {
+		const bool requested = isEmergencyStopRequested();
+		if (requested ==
+			_emergency_stop_engaged.load(std::memory_order_relaxed)) {
+			return NO_EMERGENCY_STOP_TRANSITION;
+		}
+		_emergency_stop_engaged.store(requested, std::memory_order_release);
+		_emergency_stop_latency_pending = requested;
+		return requested ? ENGAGE_EMERGENCY_STOP : RELEASE_EMERGENCY_STOP;
+	}
+
+	/**
+	 * @brief To be called by the tasks once their torques are computed.
+	 * Measures the latency of the emergency stop engaged at this cycle.
+	 */
+	void recordEmergencyStopLatency() {
+		if (!_emergency_stop_latency_pending) {
+			return;
+		}
+		_emergency_stop_latency_pending = false;
+		const std::int64_t trigger_time =
+			_emergency_stop_trigger_time.load(std::memory_order_acquire);
+		if (trigger_time == 0) {
+			return;
+		}
+		const double latency =
+			std::chrono::duration<double>(
+				std::chrono::steady_clock::duration(
+					std::chrono::steady_clock::now()
+						.time_since_epoch()
+						.count() -
+					trigger_time))
+				.count();
+		_last_emergency_stop_latency.store(latency, std::memory_order_relaxed);
+		if (latency > getMaxEmergencyStopLatency()) {
+			_max_emergency_stop_latency.store(latency,
+											  std::memory_order_relaxed);
+		}
+		if (latency > _loop_timestep) {
+			_num_late_emergency_stops.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
 private:
 	std::shared_ptr<Sai2Model::Sai2Model> _robot;
 	double _loop_timestep;
 
 	TaskType _task_type;
 	std::string _task_name;
+
+	// emergency stop. The trigger time (steady clock ticks) is 0 when no stop
+	// is requested
+	std::atomic<std::int64_t> _emergency_stop_trigger_time{0};
+	std::atomic<bool> _emergency_stop_engaged{false};
+	bool _emergency_stop_latency_pending = false;
+	std::atomic<double> _last_emergency_stop_latency{0.0};
+	std::atomic<double> _max_emergency_stop_latency{0.0};
+	std::atomic<unsigned long> _num_late_emergency_stops{0};
 };
 
 } /* namespace Sai2Primitives */